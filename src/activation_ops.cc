@@ -0,0 +1,391 @@
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include "kernel.h"
+#include "types.h"
+#include "log.h"
+#include "vmath.h"
+
+#include <omp.h>
+
+REGISTER_KERNEL("Gelu", "op_Gelu");
+REGISTER_KERNEL("GeluGrad", "op_GeluGrad");
+REGISTER_KERNEL("Swish", "op_Swish");
+REGISTER_KERNEL("SwishGrad", "op_SwishGrad");
+REGISTER_KERNEL("Relu6", "op_Relu6");
+REGISTER_KERNEL("Relu6Grad", "op_Relu6Grad");
+REGISTER_KERNEL("Elu", "op_Elu");
+REGISTER_KERNEL("EluGrad", "op_EluGrad");
+REGISTER_KERNEL("Softplus", "op_Softplus");
+REGISTER_KERNEL("SoftplusGrad", "op_SoftplusGrad");
+REGISTER_KERNEL("LeakyRelu", "op_LeakyRelu");
+REGISTER_KERNEL("LeakyReluGrad", "op_LeakyReluGrad");
+
+extern "C" {
+  int op_Gelu(const void* arg, size_t len);
+  int op_GeluGrad(const void* arg, size_t len);
+  int op_Swish(const void* arg, size_t len);
+  int op_SwishGrad(const void* arg, size_t len);
+  int op_Relu6(const void* arg, size_t len);
+  int op_Relu6Grad(const void* arg, size_t len);
+  int op_Elu(const void* arg, size_t len);
+  int op_EluGrad(const void* arg, size_t len);
+  int op_Softplus(const void* arg, size_t len);
+  int op_SoftplusGrad(const void* arg, size_t len);
+  int op_LeakyRelu(const void* arg, size_t len);
+  int op_LeakyReluGrad(const void* arg, size_t len);
+}
+
+//
+// Activations and their gradients
+//
+// The forward ops take the same arguments as unary_op in ops.cc (Tensor in,
+// Tensor out), the gradient ops take (Tensor gradients, Tensor x, Tensor
+// out) like the cwise gradient ops, where x is the forward input, or the
+// forward output for EluGrad as in TensorFlow. Ops with an attribute
+// (alpha of LeakyRelu and Elu, approximate of Gelu) take it as a double
+// appended to the arguments. Without it the TensorFlow default is used
+// (alpha 0.2 for LeakyRelu and 1 for Elu, exact Gelu).
+//
+// Every op is one pass over the data: the activation is a scalar function
+// applied in a plain loop which vectorizes, split among threads like
+// unary_op. exp and tanh go through the math tier of vmath.h, picked per
+// kernel with vmath_use_fast. erf (exact Gelu) and log1p (Softplus) have no
+// fast version and stay on libm.
+//
+
+namespace {
+
+struct _Tensor {
+  int dtype;
+  int data_format;
+  uint64_t addr;
+  int32_t dims;
+  int64_t nelems;
+  int64_t dim_size[8];
+};
+
+struct UnaryArgs {
+  _Tensor in;
+  _Tensor out;
+};
+
+struct _GradTensor {
+  int dtype;
+  uint64_t addr;
+  int32_t dims;
+  int64_t nelems;
+  int64_t dim_size[8];
+};
+
+struct GradArgs {
+  _GradTensor grad;
+  _GradTensor x;
+  _GradTensor out;
+};
+
+// Below this many elements the op runs on a single thread.
+#define ACTIVATION_PARALLEL_MIN 2048
+
+template <typename T, typename F>
+void activation_loop(int64_t n, F func)
+{
+#pragma omp parallel if (n >= ACTIVATION_PARALLEL_MIN)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = n / nthreads ;
+    int64_t remain    = n % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    if( myChunk > 0 )
+      func(chunkBegin, chunkBegin + myChunk) ;
+  }
+}
+
+template <typename Act, typename M, typename T>
+void activation_forward(uint64_t out, uint64_t in, int64_t n, T attr)
+{
+  T* po = reinterpret_cast<T*>(out) ;
+  const T* pi = reinterpret_cast<const T*>(in) ;
+  activation_loop<T>(n, [=](int64_t b, int64_t e) {
+    for (int64_t i = b; i < e; ++i)
+      po[i] = Act::template forward<M>(pi[i], attr) ;
+  }) ;
+}
+
+template <typename Act, typename M, typename T>
+void activation_backward(uint64_t gin, uint64_t grad, uint64_t x, int64_t n, T attr)
+{
+  T* pgi = reinterpret_cast<T*>(gin) ;
+  const T* pg = reinterpret_cast<const T*>(grad) ;
+  const T* px = reinterpret_cast<const T*>(x) ;
+  activation_loop<T>(n, [=](int64_t b, int64_t e) {
+    for (int64_t i = b; i < e; ++i)
+      pgi[i] = Act::template backward<M>(pg[i], px[i], attr) ;
+  }) ;
+}
+
+template <typename Act, typename T>
+void activation_forward(uint64_t out, uint64_t in, int64_t n, T attr, bool fast)
+{
+  if (fast)
+    activation_forward<Act, VMathFast, T>(out, in, n, attr) ;
+  else
+    activation_forward<Act, VMathAccurate, T>(out, in, n, attr) ;
+}
+
+template <typename Act, typename T>
+void activation_backward(uint64_t gin, uint64_t grad, uint64_t x, int64_t n, T attr, bool fast)
+{
+  if (fast)
+    activation_backward<Act, VMathFast, T>(gin, grad, x, n, attr) ;
+  else
+    activation_backward<Act, VMathAccurate, T>(gin, grad, x, n, attr) ;
+}
+
+template <typename Act>
+int activation_op(const void* args, size_t len, const char* name)
+{
+  LOG(2) << name << ": begin";
+
+  if (len != sizeof(UnaryArgs) && len != sizeof(UnaryArgs) + sizeof(double)) {
+    fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n",
+            name, sizeof(UnaryArgs), len);
+    return 1;
+  }
+  const UnaryArgs* p = reinterpret_cast<const UnaryArgs*>(args);
+  double attr = Act::default_attr() ;
+  if (len > sizeof(UnaryArgs))
+    memcpy(&attr, reinterpret_cast<const char*>(args) + sizeof(UnaryArgs), sizeof(double)) ;
+
+  const bool fast = vmath_use_fast(name + 3) ;   // kernel name without "op_"
+
+  int ret = 1;
+  if (p->in.dtype == p->out.dtype && p->in.nelems == p->out.nelems) {
+    if (p->in.dtype == DT_FLOAT) {
+      activation_forward<Act, float>(p->out.addr, p->in.addr, p->in.nelems, float(attr), fast) ;
+      ret = 0 ;
+    } else if (p->in.dtype == DT_DOUBLE) {
+      activation_forward<Act, double>(p->out.addr, p->in.addr, p->in.nelems, attr, fast) ;
+      ret = 0 ;
+    }
+  }
+
+  LOG(2) << name << ": end. ret=" << ret;
+  return ret;
+}
+
+template <typename Act>
+int activation_grad_op(const void* args, size_t len, const char* name)
+{
+  LOG(2) << name << ": begin";
+
+  if (len != sizeof(GradArgs) && len != sizeof(GradArgs) + sizeof(double)) {
+    fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n",
+            name, sizeof(GradArgs), len);
+    return 1;
+  }
+  const GradArgs* p = reinterpret_cast<const GradArgs*>(args);
+  double attr = Act::default_attr() ;
+  if (len > sizeof(GradArgs))
+    memcpy(&attr, reinterpret_cast<const char*>(args) + sizeof(GradArgs), sizeof(double)) ;
+
+  const bool fast = vmath_use_fast(name + 3) ;
+
+  int ret = 1;
+  const int dtype = p->grad.dtype ;
+  if (p->x.dtype == dtype && p->out.dtype == dtype
+      && p->x.nelems == p->grad.nelems && p->out.nelems == p->grad.nelems) {
+    if (dtype == DT_FLOAT) {
+      activation_backward<Act, float>(p->out.addr, p->grad.addr, p->x.addr,
+                                      p->grad.nelems, float(attr), fast) ;
+      ret = 0 ;
+    } else if (dtype == DT_DOUBLE) {
+      activation_backward<Act, double>(p->out.addr, p->grad.addr, p->x.addr,
+                                       p->grad.nelems, attr, fast) ;
+      ret = 0 ;
+    }
+  }
+
+  LOG(2) << name << ": end. ret=" << ret;
+  return ret;
+}
+
+//
+// Each activation is a struct of
+//   forward<M>(x, attr)       -> y
+//   backward<M>(dy, x, attr)  -> dx
+//   default_attr()
+// with M the math tier (VMathAccurate or VMathFast).
+//
+
+// 0.5 x (1 + erf(x / sqrt(2)))
+struct GeluExact {
+  static double default_attr() { return 0. ; }
+
+  template <typename M, typename T> static T forward(T x, T) {
+    return T(0.5) * x * (T(1.) + std::erf(x * T(0.7071067811865476))) ;
+  }
+
+  template <typename M, typename T> static T backward(T dy, T x, T) {
+    const T cdf = T(0.5) * (T(1.) + std::erf(x * T(0.7071067811865476))) ;
+    const T pdf = T(0.3989422804014327) * M::exp(T(-0.5) * x * x) ;
+    return dy * (cdf + x * pdf) ;
+  }
+};
+
+// 0.5 x (1 + tanh(sqrt(2/pi) (x + 0.044715 x^3)))
+struct GeluTanh {
+  static double default_attr() { return 1. ; }
+
+  template <typename M, typename T> static T forward(T x, T) {
+    const T u = T(0.7978845608028654) * (x + T(0.044715) * x * x * x) ;
+    return T(0.5) * x * (T(1.) + M::tanh(u)) ;
+  }
+
+  template <typename M, typename T> static T backward(T dy, T x, T) {
+    const T x2 = x * x ;
+    const T u = T(0.7978845608028654) * (x + T(0.044715) * x2 * x) ;
+    const T du = T(0.7978845608028654) * (T(1.) + T(3. * 0.044715) * x2) ;
+    const T t = M::tanh(u) ;
+    return dy * (T(0.5) * (T(1.) + t) + T(0.5) * x * (T(1.) - t * t) * du) ;
+  }
+};
+
+// Gelu takes approximate as its attribute. The two forms are separate
+// activations so that the element loop has no branch on it.
+inline bool gelu_approximate(const void* args, size_t len, size_t args_size)
+{
+  double attr = 0. ;
+  if (len == args_size + sizeof(double))
+    memcpy(&attr, reinterpret_cast<const char*>(args) + args_size, sizeof(double)) ;
+  return attr != 0. ;
+}
+
+// x * sigmoid(x)
+struct Swish {
+  static double default_attr() { return 0. ; }
+
+  template <typename M, typename T> static T forward(T x, T) {
+    return x * M::sigmoid(x) ;
+  }
+
+  template <typename M, typename T> static T backward(T dy, T x, T) {
+    const T s = M::sigmoid(x) ;
+    return dy * s * (T(1.) + x * (T(1.) - s)) ;
+  }
+};
+
+struct Relu6 {
+  static double default_attr() { return 0. ; }
+
+  template <typename M, typename T> static T forward(T x, T) {
+    const T y = x > T(0.) ? x : T(0.) ;
+    return y < T(6.) ? y : T(6.) ;
+  }
+
+  template <typename M, typename T> static T backward(T dy, T x, T) {
+    return (x > T(0.) && x < T(6.)) ? dy : T(0.) ;
+  }
+};
+
+// x > 0 ? x : alpha (exp(x) - 1). The gradient takes the forward output y,
+// where dy/dx = y + alpha for x <= 0.
+struct Elu {
+  static double default_attr() { return 1. ; }
+
+  template <typename M, typename T> static T forward(T x, T alpha) {
+    return x > T(0.) ? x : alpha * (M::exp(x) - T(1.)) ;
+  }
+
+  template <typename M, typename T> static T backward(T dy, T y, T alpha) {
+    return y > T(0.) ? dy : dy * (y + alpha) ;
+  }
+};
+
+// log(1 + exp(x)) = max(x, 0) + log1p(exp(-|x|)), which neither overflows
+// for large x nor loses the small values for very negative x
+struct Softplus {
+  static double default_attr() { return 0. ; }
+
+  template <typename M, typename T> static T forward(T x, T) {
+    const T ax = x > T(0.) ? x : -x ;
+    return (x > T(0.) ? x : T(0.)) + std::log1p(M::exp(-ax)) ;
+  }
+
+  template <typename M, typename T> static T backward(T dy, T x, T) {
+    return dy * M::sigmoid(x) ;
+  }
+};
+
+struct LeakyRelu {
+  static double default_attr() { return 0.2 ; }
+
+  template <typename M, typename T> static T forward(T x, T alpha) {
+    return x > T(0.) ? x : alpha * x ;
+  }
+
+  template <typename M, typename T> static T backward(T dy, T x, T alpha) {
+    return x > T(0.) ? dy : alpha * dy ;
+  }
+};
+
+} // namespace
+
+int op_Gelu(const void* args, size_t len)
+{
+  if (gelu_approximate(args, len, sizeof(UnaryArgs)))
+    return activation_op<GeluTanh>(args, len, "op_Gelu");
+  return activation_op<GeluExact>(args, len, "op_Gelu");
+}
+int op_GeluGrad(const void* args, size_t len)
+{
+  if (gelu_approximate(args, len, sizeof(GradArgs)))
+    return activation_grad_op<GeluTanh>(args, len, "op_GeluGrad");
+  return activation_grad_op<GeluExact>(args, len, "op_GeluGrad");
+}
+int op_Swish(const void* args, size_t len)
+{
+  return activation_op<Swish>(args, len, "op_Swish");
+}
+int op_SwishGrad(const void* args, size_t len)
+{
+  return activation_grad_op<Swish>(args, len, "op_SwishGrad");
+}
+int op_Relu6(const void* args, size_t len)
+{
+  return activation_op<Relu6>(args, len, "op_Relu6");
+}
+int op_Relu6Grad(const void* args, size_t len)
+{
+  return activation_grad_op<Relu6>(args, len, "op_Relu6Grad");
+}
+int op_Elu(const void* args, size_t len)
+{
+  return activation_op<Elu>(args, len, "op_Elu");
+}
+int op_EluGrad(const void* args, size_t len)
+{
+  return activation_grad_op<Elu>(args, len, "op_EluGrad");
+}
+int op_Softplus(const void* args, size_t len)
+{
+  return activation_op<Softplus>(args, len, "op_Softplus");
+}
+int op_SoftplusGrad(const void* args, size_t len)
+{
+  return activation_grad_op<Softplus>(args, len, "op_SoftplusGrad");
+}
+int op_LeakyRelu(const void* args, size_t len)
+{
+  return activation_op<LeakyRelu>(args, len, "op_LeakyRelu");
+}
+int op_LeakyReluGrad(const void* args, size_t len)
+{
+  return activation_grad_op<LeakyRelu>(args, len, "op_LeakyReluGrad");
+}
@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <cstdint>
 #include <cassert>
+#include <cstddef>
 #include <algorithm>
 #include "kernel.h"
 #include "types.h"
@@ -23,244 +24,173 @@ extern "C" {
   int op_ArgMin(const void* arg, size_t len);
 }
 
+// The host sends up to VE_ARGOP_MAX_HANDLE_DIM dims. Hosts that send a
+// fixed dim_size[VE_ARGOP_LEGACY_DIM] array are accepted as well.
+#define VE_ARGOP_MAX_HANDLE_DIM 8
+#define VE_ARGOP_LEGACY_DIM 4
 
-#define VE_ARGOP_MAX_HANDLE_DIM 4
-
 //
-// ArgMax
+// ArgMax / ArgMin
+//
+// The input is viewed as [outer, axis, inner] and the index of the first
+// max (min) along axis is written for each of the outer * inner positions.
+//
+//  - inner > 1: a strip of ARGOP_STRIP inner positions keeps its running
+//    best value and index, the loop over the strip vectorizes and the loop
+//    over axis runs outside of it.
+//  - inner == 1 and a long axis: each row is reduced in ARGOP_LANES
+//    independent lanes (lane l sees elements l, l + ARGOP_LANES, ...), which
+//    vectorizes, and the lanes are combined at the end.
+//  - inner == 1 and a short axis: a strip of rows is reduced together as
+//    in the inner > 1 case, with a strided access.
+//
+// The (outer, strip) or row units are split among threads.
 //
 
-namespace {
+#define ARGOP_STRIP 256
+#define ARGOP_LANES 256
 
-template <typename T, typename Index>
-int argmax_10(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
+// Below this many elements the op runs on a single thread.
+#define ARGOP_PARALLEL_MIN (16*1024)
 
-  Index idx = 0 ;
-  for(int64_t i=0; i<d0; i++) {
-    if( in[idx] < in[i] ) idx = i ;
-  }
-  out[0] = idx ;
-  return 0 ;
-}
+namespace {
 
+struct ArgMaxCmp {
+  template <typename T> static bool better(T a, T b) { return a > b ; }
+};
 
-template <typename T, typename Index>
-int argmax_20(const T* in, Index* out, const int64_t* dim_size) 
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-
-#pragma novector
-  for(int64_t j=0; j<d1; j++) {
-    Index idx = 0 ;
-#pragma vector
-    for(int64_t i=0; i<d0; i++) {
-      if( in[idx*d1+j] < in[i*d1+j] ) idx = i ;
-    }
-    out[j] = idx ;
-  }
-
-  return 0 ;
-}
+struct ArgMinCmp {
+  template <typename T> static bool better(T a, T b) { return a < b ; }
+};
 
-template <typename T, typename Index>
-int argmax_21(const T* in, Index* out, const int64_t* dim_size) 
+// positions [k0, k1) of in[axis][stride], stride is inner or axis
+template <typename Cmp, typename T, typename Index>
+void argop_strip(const T* in, Index* out, int64_t axis, int64_t step,
+                 int64_t stride, int64_t n)
 {
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
+  T best[ARGOP_STRIP] ;
+  Index idx[ARGOP_STRIP] ;
 
-  for(int64_t i=0; i<d0; i++) {
-    Index idx = 0 ;
-    for(int64_t j=0; j<d1; j++) {
-      if( in[idx] < in[j] ) idx = j ;
-    }
-    out[i] = idx ;
-    in+=d1 ;
+  for (int64_t k = 0; k < n; ++k) {
+    best[k] = in[k * stride] ;
+    idx[k] = 0 ;
   }
-
-  return 0 ;
-}
-
-template <typename T, typename Index>
-int argmax_30(const T* in, Index* out, const int64_t* dim_size) 
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-
-  for(int64_t j=0; j<d1; j++) {
-    for(int64_t k=0; k<d2; k++) {
-      Index idx = 0 ;
-#pragma vector
-      for(int64_t i=0; i<d0; i++) {
-        if( in[idx*d1*d2+j*d2+k] < in[i*d1*d2+j*d2+k] ) idx = i ;
+  for (int64_t a = 1; a < axis; ++a) {
+    const T* ia = in + a * step ;
+#pragma _NEC ivdep
+    for (int64_t k = 0; k < n; ++k) {
+      const T v = ia[k * stride] ;
+      if (Cmp::better(v, best[k])) {
+        best[k] = v ;
+        idx[k] = a ;
       }
-      out[j*d2+k] = idx ;
     }
   }
-
-  return 0 ;
+  for (int64_t k = 0; k < n; ++k)
+    out[k] = idx[k] ;
 }
 
-template <typename T, typename Index>
-int argmax_31(const T* in, Index* out, const int64_t* dim_size) 
+// one contiguous row of length axis
+template <typename Cmp, typename T, typename Index>
+Index argop_row(const T* in, int64_t axis)
 {
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-
-  for(int64_t i=0; i<d0; i++) {
-    for(int64_t k=0; k<d2; k++) {
-      Index idx = 0 ;
-#pragma vector
-      for(int64_t j=0; j<d1; j++) {
-        if( in[i*d1*d2+idx*d2+k] < in[i*d1*d2+j*d2+k] ) idx = j ;
-      }
-      out[i*d2+k] = idx ;
-    }
+  if (axis < 2 * ARGOP_LANES) {
+    int64_t idx = 0 ;
+    for (int64_t a = 1; a < axis; ++a)
+      if (Cmp::better(in[a], in[idx])) idx = a ;
+    return idx ;
   }
-  return 0 ;
-}
 
-template <typename T, typename Index>
-int argmax_32(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-
-  for(int64_t i=0; i<d0; i++) {
-    for(int64_t j=0; j<d1; j++) {
-      Index idx = 0 ;
-#pragma vector
-      for(int64_t k=0; k<d2; k++) {
-        if( in[idx] < in[k] ) idx = k ;
-      }
-      *out = idx ;
-      in+=d2 ;
-      out++ ;
-    }
+  T best[ARGOP_LANES] ;
+  int64_t idx[ARGOP_LANES] ;
+  for (int64_t l = 0; l < ARGOP_LANES; ++l) {
+    best[l] = in[l] ;
+    idx[l] = l ;
   }
-  return 0 ;
-}
 
-#if 0
-template <typename T, typename Index>
-int argmax_43(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-  const int64_t d3 = dim_size[3] ;
-  int64_t oi, oo, oo0, oo1;
-
-  for(int64_t i0=0; i0<d0; i0++) {
-    oo0 = i0*d1*d2 ;
-    for(int64_t i1=0; i1<d1; i1++) {
-      oo1 = oo0 + i1*d2 ;
-      for(int64_t i2=0; i2<d2; i2++) {
-        oo = oo1 + i2 ;
-        oi = oo*d3 ;
-        Index idx = 0 ;
-#pragma vector
-        for(int64_t i3=0; i3<d3; i3++) {
-          if( in[oi+idx] < in[oi+i3] ) idx = i3 ;
-        }
-        out[oo] = idx ;
+  const int64_t nfull = axis / ARGOP_LANES * ARGOP_LANES ;
+  for (int64_t a = ARGOP_LANES; a < nfull; a += ARGOP_LANES) {
+    const T* ia = in + a ;
+    for (int64_t l = 0; l < ARGOP_LANES; ++l) {
+      if (Cmp::better(ia[l], best[l])) {
+        best[l] = ia[l] ;
+        idx[l] = a + l ;
       }
     }
   }
-  return 0 ;
-}
-#else
-#define MAXSTRIP 10240
-#define MIN(a,b) ((a) < (b) ? (a) : (b))
-
-template <typename T, typename Index>
-int argmax_43(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-  const int64_t d3 = dim_size[3] ;
-  int64_t osize = d0*d1*d2 ;
-  T omax[MAXSTRIP];
-
-  LOG(2) << "argmax_43" << " begin";
-  for (int64_t i=0; i<osize; i+=MAXSTRIP) {
-    for (int64_t j=0; j<MIN(MAXSTRIP,osize-i); j++) {
-      omax[j] = in[(i+j)*d3] ;
-      out[i+j] = 0;
-    }
-    for(int64_t i3=1; i3<d3; i3++) {
-#pragma _NEC ivdep
-#pragma _NEC packed_vector
-      for (int64_t j=0; j<MIN(MAXSTRIP,osize-i); j++) {
-        if (omax[j] < in[(i+j)*d3+i3]) {
-          out[i+j] = i3 ;
-          omax[j] = in[(i+j)*d3+i3] ;
-        }
-      }
+  for (int64_t a = nfull; a < axis; ++a) {
+    const int64_t l = a - nfull ;
+    if (Cmp::better(in[a], best[l])) {
+      best[l] = in[a] ;
+      idx[l] = a ;
     }
   }
-  LOG(2) << "argmax_43" << " end";
-  return 0 ;
-}
-#undef MAXSTRIP
-#undef MIN
-#endif
 
+  // each lane holds its first best, ties between lanes go to the lower index
+  int64_t r = 0 ;
+  for (int64_t l = 1; l < ARGOP_LANES; ++l) {
+    if (Cmp::better(best[l], best[r])
+        || (!Cmp::better(best[r], best[l]) && idx[l] < idx[r]))
+      r = l ;
+  }
+  return idx[r] ;
+}
 
-template <typename T, typename Index>
-int argmax(uint64_t in_ptr, uint64_t out_ptr,
-           int64_t axis, int64_t input_dims, int64_t* dim_size)
+template <typename Cmp, typename T, typename Index>
+int argop(uint64_t in_ptr, uint64_t out_ptr,
+          int64_t axis, int64_t input_dims, const int64_t* dim_size)
 {
   const T* in = reinterpret_cast<const T*>(in_ptr);
   Index* out = reinterpret_cast<Index*>(out_ptr);
 
-  int ret = 1 ;
+  if (input_dims < 1 || input_dims > VE_ARGOP_MAX_HANDLE_DIM)
+    return 1 ;
+  if (axis < 0)
+    axis += input_dims ;
+  if (axis < 0 || axis >= input_dims)
+    return 1 ;
 
-  if( input_dims == 1 ) {
-    if( axis == 0 ) {
-      ret = argmax_10<T, Index>(in, out, dim_size) ;
-    }
-  }
-  else if( input_dims == 2 ) {
-    if( axis == 0 ) {
-      ret = argmax_20<T, Index>(in, out, dim_size) ;
-    }
-    else if( axis == 1 ) {
-      ret = argmax_21<T, Index>(in, out, dim_size) ;
-    }
-  }
-  else if( input_dims == 3 ) {
-    if( axis == 0 ) {
-      ret = argmax_30<T, Index>(in, out, dim_size) ;
-    }
-    else if( axis == 1 ) {
-      ret = argmax_31<T, Index>(in, out, dim_size) ;
-    }
-    else if( axis == 2 ) {
-      ret = argmax_32<T, Index>(in, out, dim_size) ;
+  int64_t outer = 1, inner = 1 ;
+  for (int64_t d = 0; d < axis; ++d) outer *= dim_size[d] ;
+  for (int64_t d = axis + 1; d < input_dims; ++d) inner *= dim_size[d] ;
+  const int64_t n = dim_size[axis] ;
+
+  if (outer * inner == 0)
+    return 0 ;
+  if (n <= 0)
+    return 1 ;
+
+  const bool parallel = outer * n * inner >= ARGOP_PARALLEL_MIN ;
+
+  if (inner > 1) {
+    const int64_t nstrip = (inner + ARGOP_STRIP - 1) / ARGOP_STRIP ;
+#pragma omp parallel for if (parallel)
+    for (int64_t u = 0; u < outer * nstrip; ++u) {
+      const int64_t o = u / nstrip ;
+      const int64_t k0 = (u % nstrip) * ARGOP_STRIP ;
+      argop_strip<Cmp>(in + o * n * inner + k0, out + o * inner + k0,
+                       n, inner, 1, std::min<int64_t>(ARGOP_STRIP, inner - k0)) ;
     }
-  }
-  else if( input_dims == 4 ) {
-    if( axis == 3 ) {
-      ret = argmax_43<T, Index>(in, out, dim_size) ;
+  } else if (n >= ARGOP_LANES || outer == 1) {
+#pragma omp parallel for if (parallel)
+    for (int64_t o = 0; o < outer; ++o)
+      out[o] = argop_row<Cmp, T, Index>(in + o * n, n) ;
+  } else {
+    const int64_t nstrip = (outer + ARGOP_STRIP - 1) / ARGOP_STRIP ;
+#pragma omp parallel for if (parallel)
+    for (int64_t u = 0; u < nstrip; ++u) {
+      const int64_t o0 = u * ARGOP_STRIP ;
+      argop_strip<Cmp>(in + o0 * n, out + o0, n, 1, n,
+                       std::min<int64_t>(ARGOP_STRIP, outer - o0)) ;
     }
-    else
-      ret = 1 ;
   }
-  return ret ;
-}
+
+  return 0 ;
 }
 
-int op_ArgMax(const void* args, size_t len)
+template <typename Cmp>
+int argop_kernel(const void* args, size_t len, const char* name)
 {
-  LOG(2) << __FUNCTION__ << " begin";
-
   struct Args {
     int dtype, idxtype ;
     int64_t axis ;
@@ -269,311 +199,56 @@ int op_ArgMax(const void* args, size_t len)
     int64_t dim_size[VE_ARGOP_MAX_HANDLE_DIM] ;
   } const* p;
 
-  CHECK_ARG_LEN(len, sizeof(Args));
+  const size_t header = offsetof(Args, dim_size) ;
+  if (len != sizeof(Args) && len != header + sizeof(int64_t) * VE_ARGOP_LEGACY_DIM) {
+    fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n",
+            name, sizeof(Args), len);
+    return 1;
+  }
   p = reinterpret_cast<const Args*>(args);
 
+  if (p->input_dims > static_cast<int64_t>((len - header) / sizeof(int64_t)))
+    return 1 ;
+
   int ret = 1;
 
   if (p->dtype == DT_FLOAT) {
     if ( p->idxtype == DT_INT32 ) {
-      ret = argmax<float, int32_t> (p->in_ptr, p->out_ptr,
-                                    p->axis, p->input_dims, 
-                                    (int64_t*) p->dim_size) ;
+      ret = argop<Cmp, float, int32_t> (p->in_ptr, p->out_ptr,
+                                        p->axis, p->input_dims, p->dim_size) ;
     }
     else if ( p->idxtype == DT_INT64 ) {
-      ret = argmax<float, int64_t> (p->in_ptr, p->out_ptr,
-                                    p->axis, p->input_dims, 
-                                    (int64_t*) p->dim_size) ;
+      ret = argop<Cmp, float, int64_t> (p->in_ptr, p->out_ptr,
+                                        p->axis, p->input_dims, p->dim_size) ;
     }
   }
   else if (p->dtype == DT_DOUBLE) {
     if ( p->idxtype == DT_INT32 ) {
-      ret = argmax<double, int32_t>(p->in_ptr, p->out_ptr,
-                                    p->axis, p->input_dims, 
-                                    (int64_t*) p->dim_size) ;
+      ret = argop<Cmp, double, int32_t>(p->in_ptr, p->out_ptr,
+                                        p->axis, p->input_dims, p->dim_size) ;
     }
     else if ( p->idxtype == DT_INT64 ) {
-      ret = argmax<double, int64_t>(p->in_ptr, p->out_ptr,
-                                    p->axis, p->input_dims, 
-                                    (int64_t*) p->dim_size) ;
+      ret = argop<Cmp, double, int64_t>(p->in_ptr, p->out_ptr,
+                                        p->axis, p->input_dims, p->dim_size) ;
     }
   }
 
-  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
   return ret;
 }
-
-//
-// ArgMin
-//
-
-namespace {
-
-template <typename T, typename Index>
-int argmin_10(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-
-  Index idx = 0 ;
-  for(int64_t i=0; i<d0; i++) {
-    if( in[idx] > in[i] ) idx = i ;
-  }
-  out[0] = idx ;
-  return 0 ;
-}
-
-
-template <typename T, typename Index>
-int argmin_20(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-
-#pragma novector
-  for(int64_t j=0; j<d1; j++) {
-    Index idx = 0 ;
-#pragma vector
-    for(int64_t i=0; i<d0; i++) {
-      if( in[idx*d1+j] > in[i*d1+j] ) idx = i ;
-    }
-    out[j] = idx ;
-  }
-
-  return 0 ;
-}
-
-template <typename T, typename Index>
-int argmin_21(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-
-  for(int64_t i=0; i<d0; i++) {
-    Index idx = 0 ;
-    for(int64_t j=0; j<d1; j++) {
-      if( in[idx] > in[j] ) idx = j ;
-    }
-    out[i] = idx ;
-    in+=d1 ;
-  }
-
-  return 0 ;
-}
-
-template <typename T, typename Index>
-int argmin_30(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-
-  for(int64_t j=0; j<d1; j++) {
-    for(int64_t k=0; k<d2; k++) {
-      Index idx = 0 ;
-#pragma vector
-      for(int64_t i=0; i<d0; i++) {
-        if( in[idx*d1*d2+j*d2+k] > in[i*d1*d2+j*d2+k] ) idx = i ;
-      }
-      out[j*d2+k] = idx ;
-    }
-  }
-
-  return 0 ;
 }
 
-template <typename T, typename Index>
-int argmin_31(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-
-  for(int64_t i=0; i<d0; i++) {
-    for(int64_t k=0; k<d2; k++) {
-      Index idx = 0 ;
-#pragma vector
-      for(int64_t j=0; j<d1; j++) {
-        if( in[i*d1*d2+idx*d2+k] > in[i*d1*d2+j*d2+k] ) idx = j ;
-      }
-      out[i*d2+k] = idx ;
-    }
-  }
-  return 0 ;
-}
-
-template <typename T, typename Index>
-int argmin_32(const T* in, Index* out, const int64_t* dim_size) 
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-
-  for(int64_t i=0; i<d0; i++) {
-    for(int64_t j=0; j<d1; j++) {
-      Index idx = 0 ;
-#pragma vector
-      for(int64_t k=0; k<d2; k++) {
-        if( in[idx] > in[k] ) idx = k ;
-      }
-      *out = idx ;
-      in+=d2 ;
-      out++ ;
-    }
-  }
-  return 0 ;
-}
-
-#if 0
-template <typename T, typename Index>
-int argmin_43(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-  const int64_t d3 = dim_size[3] ;
-  int64_t oi, oo, oo0, oo1;
-
-  for(int64_t i0=0; i0<d0; i0++) {
-    oo0 = i0*d1*d2 ;
-    for(int64_t i1=0; i1<d1; i1++) {
-      oo1 = oo0 + i1*d2 ;
-      for(int64_t i2=0; i2<d2; i2++) {
-        oo = oo1 + i2 ;
-        oi = oo * d3 ;
-        Index idx = 0 ;
-#pragma vector
-        for(int64_t i3=0; i3<d3; i3++) {
-          if( in[oi+idx] > in[oi+i3] ) idx = i3 ;
-        }
-        out[oo] = idx ;
-      }
-    }
-  }
-  return 0 ;
-}
-#else
-#define MAXSTRIP 10240
-#define MIN(a,b) ((a) < (b) ? (a) : (b))
-
-template <typename T, typename Index>
-int argmin_43(const T* in, Index* out, const int64_t* dim_size)
-{
-  const int64_t d0 = dim_size[0] ;
-  const int64_t d1 = dim_size[1] ;
-  const int64_t d2 = dim_size[2] ;
-  const int64_t d3 = dim_size[3] ;
-  int64_t osize = d0*d1*d2 ;
-  T omax[MAXSTRIP];
-
-  for (int64_t i=0; i<osize; i+=MAXSTRIP) {
-    for (int64_t j=0; j<MIN(MAXSTRIP,osize-i); j++) {
-      omax[j] = in[(i+j)*d3] ;
-      out[i+j] = 0;
-    }
-    for(int64_t i3=1; i3<d3; i3++) {
-#pragma _NEC ivdep
-#pragma _NEC packed_vector
-      for (int64_t j=0; j<MIN(MAXSTRIP,osize-i); j++) {
-        if (omax[j] > in[(i+j)*d3+i3]) {
-          out[i+j] = i3 ;
-          omax[j] = in[(i+j)*d3+i3] ;
-        }
-      }
-    }
-  }
-  return 0 ;
-}
-#undef MAXSTRIP
-#endif
-
-template <typename T, typename Index>
-int argmin(uint64_t in_ptr, uint64_t out_ptr,
-           int64_t axis, int64_t input_dims, int64_t* dim_size)
+int op_ArgMax(const void* args, size_t len)
 {
-  const T* in = reinterpret_cast<const T*>(in_ptr);
-  Index* out = reinterpret_cast<Index*>(out_ptr);
-
-  int ret = 1 ;
-
-  if( input_dims == 1 ) {
-    if( axis == 0 ) {
-      ret = argmin_10<T, Index>(in, out, dim_size) ;
-    }
-  }
-  else if( input_dims == 2 ) {
-    if( axis == 0 ) {
-      ret = argmin_20<T, Index>(in, out, dim_size) ;
-    }
-    else if( axis == 1 ) {
-      ret = argmin_21<T, Index>(in, out, dim_size) ;
-    }
-  }
-  else if( input_dims == 3 ) {
-    if( axis == 0 ) {
-      ret = argmin_30<T, Index>(in, out, dim_size) ;
-    }
-    else if( axis == 1 ) {
-      ret = argmin_31<T, Index>(in, out, dim_size) ;
-    }
-    else if( axis == 2 ) {
-      ret = argmin_32<T, Index>(in, out, dim_size) ;
-    }
-  }
-  else if( input_dims == 4 ) {
-    if( axis == 3 ) {
-      ret = argmin_43<T, Index>(in, out, dim_size) ;
-    }
-    else
-      ret = 1 ;
-  }
-  return ret ;
-}
+  LOG(2) << __FUNCTION__ << " begin";
+  int ret = argop_kernel<ArgMaxCmp>(args, len, __FUNCTION__) ;
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
 }
 
 int op_ArgMin(const void* args, size_t len)
 {
   LOG(2) << __FUNCTION__ << " begin";
-
-  struct Args {
-    int dtype, idxtype ;
-    int64_t axis ;
-    uint64_t in_ptr, out_ptr ;
-    int64_t input_dims ;
-    int64_t dim_size[VE_ARGOP_MAX_HANDLE_DIM] ;
-  } const* p;
-
-  CHECK_ARG_LEN(len, sizeof(Args));
-  p = reinterpret_cast<const Args*>(args);
-
-  int ret = 1;
-
-  if (p->dtype == DT_FLOAT) {
-    if ( p->idxtype == DT_INT32 ) {
-      ret = argmin<float, int32_t> (p->in_ptr, p->out_ptr,
-                                    p->axis, p->input_dims, 
-                                    (int64_t*) p->dim_size) ;
-    }
-    else if ( p->idxtype == DT_INT64 ) {
-      ret = argmin<float, int64_t> (p->in_ptr, p->out_ptr,
-                                    p->axis, p->input_dims, 
-                                    (int64_t*) p->dim_size) ;
-    }
-  }
-  else if (p->dtype == DT_DOUBLE) {
-    if ( p->idxtype == DT_INT32 ) {
-      ret = argmin<double, int32_t>(p->in_ptr, p->out_ptr,
-                                    p->axis, p->input_dims, 
-                                    (int64_t*) p->dim_size) ;
-    }
-    else if ( p->idxtype == DT_INT64 ) {
-      ret = argmin<double, int64_t>(p->in_ptr, p->out_ptr,
-                                    p->axis, p->input_dims, 
-                                    (int64_t*) p->dim_size) ;
-    }
-  }
-
+  int ret = argop_kernel<ArgMinCmp>(args, len, __FUNCTION__) ;
   LOG(2) << __FUNCTION__ << " end. ret=" << ret;
   return ret;
 }
-
-
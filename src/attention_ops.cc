@@ -0,0 +1,435 @@
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include "kernel.h"
+#include "types.h"
+#include "log.h"
+#include "vmath.h"
+
+#include <omp.h>
+
+#define ADD_
+#include <cblas_f77.h>
+#undef ADD_
+
+REGISTER_KERNEL("FusedAttention", "op_FusedAttention");
+REGISTER_KERNEL("FusedAttentionGrad", "op_FusedAttentionGrad");
+
+#define CHECK_ARG_LEN(l0, l1) \
+  if ((l0) != (l1)) { \
+      fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n", (l1), (l0)); \
+      return 1; \
+  }
+
+extern "C" {
+  int op_FusedAttention(const void* arg, size_t len);
+  int op_FusedAttentionGrad(const void* arg, size_t len);
+}
+
+//
+// FusedAttention / FusedAttentionGrad
+//
+//   out = softmax(scale * q k^T + mask) v
+//
+// q is [batch, heads, q_len, head_dim], k is [batch, heads, kv_len, head_dim],
+// v is [batch, heads, kv_len, value_dim] and out is [batch, heads, q_len,
+// value_dim]. The additive mask is optional (mask == 0). It is read as
+// mask[b * mask_batch_stride + h * mask_head_stride + i * mask_query_stride
+// + j], so a stride of 0 broadcasts it over batch, heads or queries. A key
+// padding mask [batch, 1, 1, kv_len] has mask_batch_stride kv_len and the
+// other strides 0. With causal set, query i only sees keys
+// j <= i + kv_len - q_len.
+//
+// The forward op works on blocks of ATTENTION_BLOCK queries. Each thread
+// holds the scores of one block, [ATTENTION_BLOCK, kv_len], computes them
+// with sgemm_, applies the softmax in place and multiplies by v. The full
+// [q_len, kv_len] score matrix is never stored. The forward op also writes
+// lse = log(sum(exp(scores))) per query row ([batch, heads, q_len]), which
+// lets the backward op recompute the probabilities from the scores alone.
+//
+// The backward op recomputes the scores twice: per block of queries for dq,
+// and per block of keys (transposed) for dk and dv. Every output element is
+// then written by exactly one thread, so no atomics or per-thread
+// accumulators are needed and the result does not depend on the number of
+// threads.
+//
+// Only float is supported, as the tiles use sgemm_. exp and log of the
+// softmax go through the math tier of vmath.h (vmath_use_fast).
+//
+
+#define ATTENTION_BLOCK 128
+
+namespace {
+
+struct AttentionShape {
+  int64_t batch, heads, q_len, kv_len, head_dim, value_dim ;
+  int64_t mask_batch_stride, mask_head_stride, mask_query_stride ;
+  int causal ;
+  float scale ;
+} ;
+
+// C[M x N] = alpha * op(A) op(B) + beta * C, all row-major
+inline void gemm_rm(char transa, char transb, int M, int N, int K,
+                    float alpha, const float* A, int lda,
+                    const float* B, int ldb,
+                    float beta, float* C, int ldc)
+{
+  // row-major C = A B is column-major C^T = B^T A^T
+  sgemm_(&transb, &transa, &N, &M, &K, &alpha, B, &ldb, A, &lda, &beta, C, &ldc) ;
+}
+
+// Adds the mask and the causal limit to scores s[nq, kv_len] of queries
+// [q0, q0 + nq) of head (b, h).
+void apply_mask(const AttentionShape& a, const float* mask, int64_t b, int64_t h,
+                int64_t q0, int64_t nq, float* s)
+{
+  const int64_t kv_len = a.kv_len ;
+  if (mask) {
+    const float* m = mask + b * a.mask_batch_stride + h * a.mask_head_stride
+                     + q0 * a.mask_query_stride ;
+    for (int64_t i = 0; i < nq; ++i) {
+      const float* mi = m + i * a.mask_query_stride ;
+      float* si = s + i * kv_len ;
+      for (int64_t j = 0; j < kv_len; ++j)
+        si[j] += mi[j] ;
+    }
+  }
+  if (a.causal) {
+    const float ninf = -std::numeric_limits<float>::infinity() ;
+    for (int64_t i = 0; i < nq; ++i) {
+      const int64_t jmax = q0 + i + kv_len - a.q_len ;   // last visible key
+      for (int64_t j = std::max<int64_t>(jmax + 1, 0); j < kv_len; ++j)
+        s[i * kv_len + j] = ninf ;
+    }
+  }
+}
+
+// Same for transposed scores st[nk, q_len] of keys [k0, k0 + nk).
+void apply_mask_t(const AttentionShape& a, const float* mask, int64_t b, int64_t h,
+                  int64_t k0, int64_t nk, float* st)
+{
+  const int64_t q_len = a.q_len ;
+  const int64_t kv_len = a.kv_len ;
+  if (mask) {
+    const int64_t qs = a.mask_query_stride ;
+    const float* m = mask + b * a.mask_batch_stride + h * a.mask_head_stride + k0 ;
+    for (int64_t j = 0; j < nk; ++j)
+      for (int64_t i = 0; i < q_len; ++i)
+        st[j * q_len + i] += m[i * qs + j] ;
+  }
+  if (a.causal) {
+    const float ninf = -std::numeric_limits<float>::infinity() ;
+    for (int64_t j = 0; j < nk; ++j) {
+      // query i sees key k0+j if i >= k0 + j - (kv_len - q_len)
+      const int64_t imin = std::min<int64_t>(std::max<int64_t>(k0 + j - (kv_len - q_len), 0), q_len) ;
+      for (int64_t i = 0; i < imin; ++i)
+        st[j * q_len + i] = ninf ;
+    }
+  }
+}
+
+// exp(s - lse), 0 for rows where every key is masked
+template <typename M>
+inline float attention_prob(float s, float lse)
+{
+  return lse == -std::numeric_limits<float>::infinity() ? 0.f : M::exp(s - lse) ;
+}
+
+template <typename M>
+int attention_forward(const AttentionShape& a,
+                      const float* q, const float* k, const float* v,
+                      const float* mask, float* out, float* lse)
+{
+  const int64_t nqblk = (a.q_len + ATTENTION_BLOCK - 1) / ATTENTION_BLOCK ;
+  const int64_t nunits = a.batch * a.heads * nqblk ;
+  const int64_t D = a.head_dim, Dv = a.value_dim, Tq = a.q_len, Tk = a.kv_len ;
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = nunits / nthreads ;
+    int64_t remain    = nunits % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    std::vector<float> s(myChunk > 0 ? ATTENTION_BLOCK * Tk : 0) ;
+
+    for (int64_t u = chunkBegin; u < chunkBegin + myChunk; ++u) {
+      const int64_t bh = u / nqblk ;
+      const int64_t b  = bh / a.heads ;
+      const int64_t h  = bh % a.heads ;
+      const int64_t q0 = (u % nqblk) * ATTENTION_BLOCK ;
+      const int64_t nq = std::min<int64_t>(ATTENTION_BLOCK, Tq - q0) ;
+
+      const float* qb = q + (bh * Tq + q0) * D ;
+      const float* kb = k + bh * Tk * D ;
+      const float* vb = v + bh * Tk * Dv ;
+      float* ob = out + (bh * Tq + q0) * Dv ;
+      float* lb = lse + bh * Tq + q0 ;
+
+      // s = scale * q k^T + mask
+      gemm_rm('N', 'T', nq, Tk, D, a.scale, qb, D, kb, D, 0.f, s.data(), Tk) ;
+      apply_mask(a, mask, b, h, q0, nq, s.data()) ;
+
+      // softmax of each row, in place
+      for (int64_t i = 0; i < nq; ++i) {
+        float* si = s.data() + i * Tk ;
+        float m = -std::numeric_limits<float>::infinity() ;
+        for (int64_t j = 0; j < Tk; ++j)
+          m = si[j] > m ? si[j] : m ;
+        if (m == -std::numeric_limits<float>::infinity()) {
+          for (int64_t j = 0; j < Tk; ++j) si[j] = 0.f ;
+          lb[i] = m ;
+          continue ;
+        }
+        float sum = 0.f ;
+        for (int64_t j = 0; j < Tk; ++j) {
+          const float e = M::exp(si[j] - m) ;
+          si[j] = e ;
+          sum += e ;
+        }
+        const float inv = 1.f / sum ;
+        for (int64_t j = 0; j < Tk; ++j)
+          si[j] *= inv ;
+        lb[i] = m + M::log(sum) ;
+      }
+
+      // out = p v
+      gemm_rm('N', 'N', nq, Dv, Tk, 1.f, s.data(), Tk, vb, Dv, 0.f, ob, Dv) ;
+    }
+  }
+
+  return 0 ;
+}
+
+template <typename M>
+int attention_backward(const AttentionShape& a,
+                       const float* q, const float* k, const float* v,
+                       const float* mask, const float* out, const float* lse,
+                       const float* dout, float* dq, float* dk, float* dv)
+{
+  const int64_t D = a.head_dim, Dv = a.value_dim, Tq = a.q_len, Tk = a.kv_len ;
+  const int64_t nbh = a.batch * a.heads ;
+  const int64_t nqblk = (Tq + ATTENTION_BLOCK - 1) / ATTENTION_BLOCK ;
+  const int64_t nkblk = (Tk + ATTENTION_BLOCK - 1) / ATTENTION_BLOCK ;
+  const int64_t nqunits = nbh * nqblk ;
+  const int64_t nkunits = nbh * nkblk ;
+
+  // delta = rowsum(dout * out), the dot product of dp and p of each row
+  std::vector<float> delta(nbh * Tq) ;
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+#pragma omp for
+    for (int64_t r = 0; r < nbh * Tq; ++r) {
+      float d = 0.f ;
+      for (int64_t c = 0; c < Dv; ++c)
+        d += dout[r * Dv + c] * out[r * Dv + c] ;
+      delta[r] = d ;
+    }
+
+    // dq, per block of queries
+    {
+      int64_t chunkSize = nqunits / nthreads ;
+      int64_t remain    = nqunits % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      std::vector<float> p(myChunk > 0 ? ATTENTION_BLOCK * Tk : 0) ;
+      std::vector<float> dp(myChunk > 0 ? ATTENTION_BLOCK * Tk : 0) ;
+
+      for (int64_t u = chunkBegin; u < chunkBegin + myChunk; ++u) {
+        const int64_t bh = u / nqblk ;
+        const int64_t q0 = (u % nqblk) * ATTENTION_BLOCK ;
+        const int64_t nq = std::min<int64_t>(ATTENTION_BLOCK, Tq - q0) ;
+
+        const float* qb = q + (bh * Tq + q0) * D ;
+        const float* kb = k + bh * Tk * D ;
+        const float* vb = v + bh * Tk * Dv ;
+        const float* dob = dout + (bh * Tq + q0) * Dv ;
+        const float* lb = lse + bh * Tq + q0 ;
+        const float* db = delta.data() + bh * Tq + q0 ;
+
+        gemm_rm('N', 'T', nq, Tk, D, a.scale, qb, D, kb, D, 0.f, p.data(), Tk) ;
+        apply_mask(a, mask, bh / a.heads, bh % a.heads, q0, nq, p.data()) ;
+
+        // dp = dout v^T
+        gemm_rm('N', 'T', nq, Tk, Dv, 1.f, dob, Dv, vb, Dv, 0.f, dp.data(), Tk) ;
+
+        // ds = p * (dp - delta), stored in dp
+        for (int64_t i = 0; i < nq; ++i) {
+          const float l = lb[i] ;
+          const float d = db[i] ;
+          float* pi = p.data() + i * Tk ;
+          float* dpi = dp.data() + i * Tk ;
+          for (int64_t j = 0; j < Tk; ++j)
+            dpi[j] = attention_prob<M>(pi[j], l) * (dpi[j] - d) ;
+        }
+
+        // dq = scale * ds k
+        gemm_rm('N', 'N', nq, D, Tk, a.scale, dp.data(), Tk, kb, D,
+                0.f, dq + (bh * Tq + q0) * D, D) ;
+      }
+    }
+
+    // dk and dv, per block of keys
+    {
+      int64_t chunkSize = nkunits / nthreads ;
+      int64_t remain    = nkunits % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      std::vector<float> pt(myChunk > 0 ? ATTENTION_BLOCK * Tq : 0) ;
+      std::vector<float> dpt(myChunk > 0 ? ATTENTION_BLOCK * Tq : 0) ;
+
+      for (int64_t u = chunkBegin; u < chunkBegin + myChunk; ++u) {
+        const int64_t bh = u / nkblk ;
+        const int64_t k0 = (u % nkblk) * ATTENTION_BLOCK ;
+        const int64_t nk = std::min<int64_t>(ATTENTION_BLOCK, Tk - k0) ;
+
+        const float* qb = q + bh * Tq * D ;
+        const float* kb = k + (bh * Tk + k0) * D ;
+        const float* vb = v + (bh * Tk + k0) * Dv ;
+        const float* dob = dout + bh * Tq * Dv ;
+        const float* lb = lse + bh * Tq ;
+        const float* db = delta.data() + bh * Tq ;
+
+        // p^T = exp(scale * k q^T + mask^T - lse)
+        gemm_rm('N', 'T', nk, Tq, D, a.scale, kb, D, qb, D, 0.f, pt.data(), Tq) ;
+        apply_mask_t(a, mask, bh / a.heads, bh % a.heads, k0, nk, pt.data()) ;
+        for (int64_t j = 0; j < nk; ++j) {
+          float* ptj = pt.data() + j * Tq ;
+          for (int64_t i = 0; i < Tq; ++i)
+            ptj[i] = attention_prob<M>(ptj[i], lb[i]) ;
+        }
+
+        // dv = p^T dout
+        gemm_rm('N', 'N', nk, Dv, Tq, 1.f, pt.data(), Tq, dob, Dv,
+                0.f, dv + (bh * Tk + k0) * Dv, Dv) ;
+
+        // dp^T = v dout^T, ds^T = p^T * (dp^T - delta)
+        gemm_rm('N', 'T', nk, Tq, Dv, 1.f, vb, Dv, dob, Dv, 0.f, dpt.data(), Tq) ;
+        for (int64_t j = 0; j < nk; ++j) {
+          const float* ptj = pt.data() + j * Tq ;
+          float* dptj = dpt.data() + j * Tq ;
+          for (int64_t i = 0; i < Tq; ++i)
+            dptj[i] = ptj[i] * (dptj[i] - db[i]) ;
+        }
+
+        // dk = scale * ds^T q
+        gemm_rm('N', 'N', nk, D, Tq, a.scale, dpt.data(), Tq, qb, D,
+                0.f, dk + (bh * Tk + k0) * D, D) ;
+      }
+    }
+  }
+
+  return 0 ;
+}
+
+} // namespace
+
+int op_FusedAttention(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype, causal;
+    int64_t batch, heads, q_len, kv_len, head_dim, value_dim;
+    int64_t mask_batch_stride, mask_head_stride, mask_query_stride;
+    double scale;
+    uint64_t q_ptr, k_ptr, v_ptr, mask_ptr;
+    uint64_t out_ptr, lse_ptr;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  LOG(3) << __FUNCTION__ << " batch=" << p->batch << " heads=" << p->heads
+    << " q_len=" << p->q_len << " kv_len=" << p->kv_len
+    << " head_dim=" << p->head_dim << " value_dim=" << p->value_dim
+    << " causal=" << p->causal;
+
+  int ret = 1;
+
+  if (p->dtype == DT_FLOAT) {
+    AttentionShape a = { p->batch, p->heads, p->q_len, p->kv_len,
+                         p->head_dim, p->value_dim,
+                         p->mask_batch_stride, p->mask_head_stride,
+                         p->mask_query_stride,
+                         p->causal, static_cast<float>(p->scale) } ;
+    const float* q = reinterpret_cast<const float*>(p->q_ptr) ;
+    const float* k = reinterpret_cast<const float*>(p->k_ptr) ;
+    const float* v = reinterpret_cast<const float*>(p->v_ptr) ;
+    const float* mask = reinterpret_cast<const float*>(p->mask_ptr) ;
+    float* out = reinterpret_cast<float*>(p->out_ptr) ;
+    float* lse = reinterpret_cast<float*>(p->lse_ptr) ;
+    if (vmath_use_fast("FusedAttention"))
+      ret = attention_forward<VMathFast>(a, q, k, v, mask, out, lse) ;
+    else
+      ret = attention_forward<VMathAccurate>(a, q, k, v, mask, out, lse) ;
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
+int op_FusedAttentionGrad(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype, causal;
+    int64_t batch, heads, q_len, kv_len, head_dim, value_dim;
+    int64_t mask_batch_stride, mask_head_stride, mask_query_stride;
+    double scale;
+    uint64_t q_ptr, k_ptr, v_ptr, mask_ptr;
+    uint64_t out_ptr, lse_ptr, dout_ptr;
+    uint64_t dq_ptr, dk_ptr, dv_ptr;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  LOG(3) << __FUNCTION__ << " batch=" << p->batch << " heads=" << p->heads
+    << " q_len=" << p->q_len << " kv_len=" << p->kv_len
+    << " head_dim=" << p->head_dim << " value_dim=" << p->value_dim
+    << " causal=" << p->causal;
+
+  int ret = 1;
+
+  if (p->dtype == DT_FLOAT) {
+    AttentionShape a = { p->batch, p->heads, p->q_len, p->kv_len,
+                         p->head_dim, p->value_dim,
+                         p->mask_batch_stride, p->mask_head_stride,
+                         p->mask_query_stride,
+                         p->causal, static_cast<float>(p->scale) } ;
+    const float* q = reinterpret_cast<const float*>(p->q_ptr) ;
+    const float* k = reinterpret_cast<const float*>(p->k_ptr) ;
+    const float* v = reinterpret_cast<const float*>(p->v_ptr) ;
+    const float* mask = reinterpret_cast<const float*>(p->mask_ptr) ;
+    const float* out = reinterpret_cast<const float*>(p->out_ptr) ;
+    const float* lse = reinterpret_cast<const float*>(p->lse_ptr) ;
+    const float* dout = reinterpret_cast<const float*>(p->dout_ptr) ;
+    float* dq = reinterpret_cast<float*>(p->dq_ptr) ;
+    float* dk = reinterpret_cast<float*>(p->dk_ptr) ;
+    float* dv = reinterpret_cast<float*>(p->dv_ptr) ;
+    if (vmath_use_fast("FusedAttentionGrad"))
+      ret = attention_backward<VMathFast>(a, q, k, v, mask, out, lse, dout, dq, dk, dv) ;
+    else
+      ret = attention_backward<VMathAccurate>(a, q, k, v, mask, out, lse, dout, dq, dk, dv) ;
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
@@ -5,6 +5,10 @@
 #include "log.h"
 #include <sstream>
 #include <vector>
+#include <cmath>
+#include <type_traits>
+#include "broadcast.h"
+#include "float16.h"
 
 #define LIBVETF_INTRINSIC
 
@@ -37,6 +41,19 @@ REGISTER_KERNEL("Equal", "op_Equal");
 REGISTER_KERNEL("NotEqual", "op_NotEqual");
 REGISTER_KERNEL("LessEqual", "op_LessEqual");
 REGISTER_KERNEL("GreaterEqual", "op_GreaterEqual");
+REGISTER_KERNEL("Less", "op_Less");
+REGISTER_KERNEL("Greater", "op_Greater");
+REGISTER_KERNEL("LogicalAnd", "op_LogicalAnd");
+REGISTER_KERNEL("LogicalOr", "op_LogicalOr");
+REGISTER_KERNEL("FloorDiv", "op_FloorDiv");
+REGISTER_KERNEL("FloorMod", "op_FloorMod");
+REGISTER_KERNEL("TruncateDiv", "op_TruncateDiv");
+REGISTER_KERNEL("Mod", "op_Mod");
+REGISTER_KERNEL("BitwiseAnd", "op_BitwiseAnd");
+REGISTER_KERNEL("BitwiseOr", "op_BitwiseOr");
+REGISTER_KERNEL("BitwiseXor", "op_BitwiseXor");
+REGISTER_KERNEL("LeftShift", "op_LeftShift");
+REGISTER_KERNEL("RightShift", "op_RightShift");
 
 extern "C" {
   int op_Add(const void* arg, size_t len);
@@ -53,6 +70,19 @@ extern "C" {
   int op_NotEqual(const void* arg, size_t len);
   int op_LessEqual(const void* arg, size_t len);
   int op_GreaterEqual(const void* arg, size_t len);
+  int op_Less(const void* arg, size_t len);
+  int op_Greater(const void* arg, size_t len);
+  int op_LogicalAnd(const void* arg, size_t len);
+  int op_LogicalOr(const void* arg, size_t len);
+  int op_FloorDiv(const void* arg, size_t len);
+  int op_FloorMod(const void* arg, size_t len);
+  int op_TruncateDiv(const void* arg, size_t len);
+  int op_Mod(const void* arg, size_t len);
+  int op_BitwiseAnd(const void* arg, size_t len);
+  int op_BitwiseOr(const void* arg, size_t len);
+  int op_BitwiseXor(const void* arg, size_t len);
+  int op_LeftShift(const void* arg, size_t len);
+  int op_RightShift(const void* arg, size_t len);
 }
 
 namespace {
@@ -1027,143 +1057,108 @@ int op_mul(const BinaryOpArgs& args) {
   return 1;
 }
 
-// Equal
-
-template <typename T>
-int equal_n1(uint64_t out, uint64_t in0, uint64_t in1, size_t n)
-{
-  bool* po = reinterpret_cast<bool*>(out);
-  const T* pi0 = reinterpret_cast<const T*>(in0);
-  T i1 = *reinterpret_cast<const T*>(in1);
-
-  for (size_t i = 0; i < n; ++i) {
-    po[i] = (pi0[i] == i1);
-  }
-  return 0;
-}
-
-template <typename T>
-int equal_nn(uint64_t out, uint64_t in0, uint64_t in1, size_t n)
-{
-  bool* po = reinterpret_cast<bool*>(out);
-  const T* pi0 = reinterpret_cast<const T*>(in0);
-  const T* pi1 = reinterpret_cast<const T*>(in1);
-
-  for (size_t i = 0; i < n; ++i) {
-    po[i] = (pi0[i] == pi1[i]);
-  }
-  return 0;
+// Comparison and logical ops
+//
+// Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual for every numeric
+// dtype (and bool for Equal and NotEqual), LogicalAnd and LogicalOr, all
+// with a bool output and full broadcasting (see broadcast.h). half and
+// bfloat16 are compared as float (float16.h), so -0.0 equals 0.0 and NaN
+// compares false.
+
+struct EqualOp        { template <typename T> bool operator()(T a, T b) const { return a == b ; } };
+struct NotEqualOp     { template <typename T> bool operator()(T a, T b) const { return a != b ; } };
+struct LessOp         { template <typename T> bool operator()(T a, T b) const { return a <  b ; } };
+struct LessEqualOp    { template <typename T> bool operator()(T a, T b) const { return a <= b ; } };
+struct GreaterOp      { template <typename T> bool operator()(T a, T b) const { return a >  b ; } };
+struct GreaterEqualOp { template <typename T> bool operator()(T a, T b) const { return a >= b ; } };
+struct LogicalAndOp   { bool operator()(bool a, bool b) const { return a && b ; } };
+struct LogicalOrOp    { bool operator()(bool a, bool b) const { return a || b ; } };
+
+// out = op(in0, in1) with in0 and in1 broadcast to out
+template <typename Tout, typename Tin, typename F>
+int broadcast_op(const BinaryOpArgs& args, F op)
+{
+  const int dims[2] = { args.in0.dims, args.in1.dims } ;
+  const int64_t* dim_size[2] = { args.in0.dim_size, args.in1.dim_size } ;
+
+  Broadcast b ;
+  if (!broadcast_init(b, args.out.dims, args.out.dim_size, 2, dims, dim_size)) {
+    LOG(2) << __FUNCTION__ << " shapes do not broadcast.";
+    return 1 ;
+  }
+
+  broadcast_binary(reinterpret_cast<Tout*>(args.out.addr),
+                   reinterpret_cast<const Tin*>(args.in0.addr),
+                   reinterpret_cast<const Tin*>(args.in1.addr),
+                   b, op) ;
+  return 0 ;
+}
+
+template <typename F>
+int compare_op(const BinaryOpArgs& args, F op, bool with_bool = false)
+{
+  if (args.out.dtype != DT_BOOL || args.in0.dtype != args.in1.dtype)
+    return 1 ;
+
+  switch (args.in0.dtype) {
+    case DT_FLOAT:  return broadcast_op<bool, float>   (args, op) ;
+    case DT_DOUBLE: return broadcast_op<bool, double>  (args, op) ;
+    case DT_INT8:   return broadcast_op<bool, int8_t>  (args, op) ;
+    case DT_INT16:  return broadcast_op<bool, int16_t> (args, op) ;
+    case DT_INT32:  return broadcast_op<bool, int32_t> (args, op) ;
+    case DT_INT64:  return broadcast_op<bool, int64_t> (args, op) ;
+    case DT_UINT8:  return broadcast_op<bool, uint8_t> (args, op) ;
+    case DT_UINT16: return broadcast_op<bool, uint16_t>(args, op) ;
+    case DT_UINT32: return broadcast_op<bool, uint32_t>(args, op) ;
+    case DT_UINT64: return broadcast_op<bool, uint64_t>(args, op) ;
+    case DT_HALF:
+      return broadcast_op<bool, uint16_t>(args, [op](uint16_t a, uint16_t b) {
+          return op(half_to_float(a), half_to_float(b)) ; }) ;
+    case DT_BFLOAT16:
+      return broadcast_op<bool, uint16_t>(args, [op](uint16_t a, uint16_t b) {
+          return op(bf16_to_float(a), bf16_to_float(b)) ; }) ;
+    case DT_BOOL:
+      if (with_bool)
+        return broadcast_op<bool, bool>(args, op) ;
+      break ;
+  }
+  return 1 ;
+}
+
+template <typename F>
+int logical_op(const BinaryOpArgs& args, F op)
+{
+  if (!CheckTypesAll(args, DT_BOOL))
+    return 1 ;
+  return broadcast_op<bool, bool>(args, op) ;
 }
 
 int op_equal(const BinaryOpArgs& args) {
-  if (CheckTypes(args, DT_FLOAT, DT_FLOAT, DT_BOOL)) {
-    if (args.in1.nelems == 1) {
-      return equal_n1<float>(args.out.addr, args.in0.addr, args.in1.addr,
-                             args.in0.nelems);
-    }
-    else if( args.in0.nelems == args.in1.nelems ) {
-      return equal_nn<float>(args.out.addr, args.in0.addr, args.in1.addr,
-                              args.in0.nelems);
-    }
-  }
-  else if (CheckTypes(args, DT_DOUBLE, DT_DOUBLE, DT_BOOL)) {
-    if (args.in1.nelems == 1) {
-      return equal_n1<double>(args.out.addr, args.in0.addr, args.in1.addr,
-                              args.in0.nelems);
-    }
-    else if( args.in0.nelems == args.in1.nelems ) {
-      return equal_nn<double>(args.out.addr, args.in0.addr, args.in1.addr,
-                              args.in0.nelems);
-    }
-  }
-  else if (CheckTypes(args, DT_INT64, DT_INT64, DT_BOOL)) {
-    if (args.in1.nelems == 1) {
-      return equal_n1<int64_t>(args.out.addr, args.in0.addr, args.in1.addr,
-                              args.in0.nelems);
-    }
-    else if( args.in0.nelems == args.in1.nelems ) {
-      return equal_nn<int64_t>(args.out.addr, args.in0.addr, args.in1.addr,
-                              args.in0.nelems);
-    }
-  }
-  
-  return 1;
+  return compare_op(args, EqualOp(), true) ;
 }
 
-// NotEqual
-
-template <typename T>
-int notEqual_n1(uint64_t out, uint64_t in0, uint64_t in1, size_t n)
-{
-  bool* po = reinterpret_cast<bool*>(out);
-  const T* pi0 = reinterpret_cast<const T*>(in0);
-  T i1 = *reinterpret_cast<const T*>(in1);
-
-  for (size_t i = 0; i < n; ++i) {
-    po[i] = (pi0[i] != i1);
-  }
-  return 0;
+int op_notEqual(const BinaryOpArgs& args) {
+  return compare_op(args, NotEqualOp(), true) ;
 }
 
-template <typename T>
-int notEqual_nn(uint64_t out, uint64_t in0, uint64_t in1, size_t n)
-{
-  bool* po = reinterpret_cast<bool*>(out);
-  const T* pi0 = reinterpret_cast<const T*>(in0);
-  const T* pi1 = reinterpret_cast<const T*>(in1);
-
-  for (size_t i = 0; i < n; ++i) {
-    po[i] = (pi0[i] != pi1[i]);
-  }
-  return 0;
+int op_less(const BinaryOpArgs& args) {
+  return compare_op(args, LessOp()) ;
 }
 
-int op_notEqual(const BinaryOpArgs& args) {
-  if (CheckTypes(args, DT_FLOAT, DT_FLOAT, DT_BOOL)) {
-    if (args.in1.nelems == 1) {
-      return notEqual_n1<float>(args.out.addr, args.in0.addr, args.in1.addr,
-                             args.in0.nelems);
-    }
-    else if( args.in0.nelems == args.in1.nelems ) {
-      return notEqual_nn<float>(args.out.addr, args.in0.addr, args.in1.addr,
-                              args.in0.nelems);
-    }
-    else if (args.in0.nelems == 1 ) {
-      return notEqual_n1<float>(args.out.addr, args.in1.addr, args.in0.addr,
-                             args.in1.nelems);
-    }
-    else {
-      LOG(2) << __FUNCTION__ << " parameter combination not supported on VE.";
-      return 1;
-    }
-  }
-  
-  return 1;
+int op_lessEqual(const BinaryOpArgs& args) {
+  return compare_op(args, LessEqualOp()) ;
 }
 
-// LessEqual
-
-template <typename T>
-int lessEqual_n1(uint64_t out, uint64_t in0, uint64_t in1, size_t n)
-{
-  bool* po = reinterpret_cast<bool*>(out);
-  const T* pi0 = reinterpret_cast<const T*>(in0);
-  T i1 = *reinterpret_cast<const T*>(in1);
+int op_greater(const BinaryOpArgs& args) {
+  return compare_op(args, GreaterOp()) ;
+}
 
-  for (size_t i = 0; i < n; ++i) {
-    po[i] = pi0[i] <= i1;
-  }
-  return 0;
+int op_logicalAnd(const BinaryOpArgs& args) {
+  return logical_op(args, LogicalAndOp()) ;
 }
 
-int op_lessEqual(const BinaryOpArgs& args) {
-  if (CheckTypes(args, DT_FLOAT, DT_FLOAT, DT_BOOL)) {
-    if (args.in1.nelems == 1) {
-      return lessEqual_n1<float>(args.out.addr, args.in0.addr, args.in1.addr,
-                                 args.in0.nelems);
-    }
-  }
-  return 1;
+int op_logicalOr(const BinaryOpArgs& args) {
+  return logical_op(args, LogicalOrOp()) ;
 }
 
 // Div
@@ -1726,12 +1721,193 @@ int greaterEqual_n1(uint64_t out, uint64_t in0, uint64_t in1, size_t n)
 
 int op_greaterEqual(const BinaryOpArgs& args) {
   if (CheckTypes(args, DT_FLOAT, DT_FLOAT, DT_BOOL)) {
-    if (args.in1.nelems == 1) {
+    if (args.in1.nelems == 1 && args.in0.nelems == args.out.nelems) {
       return greaterEqual_n1<float>(args.out.addr, args.in0.addr, args.in1.addr,
                                     args.in0.nelems);
     }
   }
-  return 1;
+  return compare_op(args, GreaterEqualOp()) ;
+}
+
+// Integer and rounding ops
+//
+// FloorDiv, FloorMod, TruncateDiv and Mod for the integer dtypes (FloorDiv,
+// FloorMod and Mod for float and double as well), BitwiseAnd, BitwiseOr,
+// BitwiseXor, LeftShift and RightShift for the integer dtypes, all with
+// broadcasting.
+//
+// The ops are branch free so that the row loops vectorize. Integer division
+// by zero is an error in TensorFlow, so a zero divisor returns 1 and the op
+// runs on the host, which reports it. The most negative value divided by
+// -1 wraps around. Shift amounts are clamped to [0, bits - 1] like
+// TensorFlow does.
+
+template <typename T, bool Signed = std::is_signed<T>::value>
+struct IntDiv {
+  // a / b rounded toward zero
+  static T trunc(T a, T b) {
+    typedef typename std::make_unsigned<T>::type U ;
+    const T q = a / (b == T(-1) ? T(1) : b) ;
+    return b == T(-1) ? static_cast<T>(U(0) - static_cast<U>(a)) : q ;
+  }
+  // a / b rounded toward minus infinity
+  static T floor(T a, T b) {
+    const T q = trunc(a, b) ;
+    const T r = rem(a, b) ;    // not a - q * b, which overflows for INT_MIN / -1
+    return q - ((r != 0 && ((r < 0) != (b < 0))) ? 1 : 0) ;
+  }
+  static T rem(T a, T b) {
+    return b == T(-1) ? T(0) : a % b ;
+  }
+  // remainder with the sign of b
+  static T floor_rem(T a, T b) {
+    const T r = rem(a, b) ;
+    return r + ((r != 0 && ((r < 0) != (b < 0))) ? b : T(0)) ;
+  }
+};
+
+template <typename T>
+struct IntDiv<T, false> {
+  static T trunc(T a, T b) { return a / b ; }
+  static T floor(T a, T b) { return a / b ; }
+  static T rem(T a, T b) { return a % b ; }
+  static T floor_rem(T a, T b) { return a % b ; }
+};
+
+struct FloorDivOp {
+  template <typename T> T operator()(T a, T b) const { return IntDiv<T>::floor(a, b) ; }
+  float operator()(float a, float b) const { return std::floor(a / b) ; }
+  double operator()(double a, double b) const { return std::floor(a / b) ; }
+};
+
+struct FloorModOp {
+  template <typename T> T operator()(T a, T b) const { return IntDiv<T>::floor_rem(a, b) ; }
+  template <typename T> static T fp(T a, T b) {
+    const T r = std::fmod(a, b) ;
+    return (r != 0 && ((r < 0) != (b < 0))) ? r + b : r ;
+  }
+  float operator()(float a, float b) const { return fp(a, b) ; }
+  double operator()(double a, double b) const { return fp(a, b) ; }
+};
+
+struct TruncateDivOp {
+  template <typename T> T operator()(T a, T b) const { return IntDiv<T>::trunc(a, b) ; }
+};
+
+struct ModOp {
+  template <typename T> T operator()(T a, T b) const { return IntDiv<T>::rem(a, b) ; }
+  float operator()(float a, float b) const { return std::fmod(a, b) ; }
+  double operator()(double a, double b) const { return std::fmod(a, b) ; }
+};
+
+struct BitwiseAndOp { template <typename T> T operator()(T a, T b) const { return a & b ; } };
+struct BitwiseOrOp  { template <typename T> T operator()(T a, T b) const { return a | b ; } };
+struct BitwiseXorOp { template <typename T> T operator()(T a, T b) const { return a ^ b ; } };
+
+template <typename T>
+inline T clamp_shift(T b)
+{
+  const T bits = static_cast<T>(8 * sizeof(T) - 1) ;
+  return b < T(0) ? T(0) : b > bits ? bits : b ;
+}
+
+struct LeftShiftOp {
+  template <typename T> T operator()(T a, T b) const {
+    typedef typename std::make_unsigned<T>::type U ;
+    return static_cast<T>(static_cast<U>(a) << clamp_shift(b)) ;
+  }
+};
+
+struct RightShiftOp {
+  template <typename T> T operator()(T a, T b) const { return a >> clamp_shift(b) ; }
+};
+
+template <typename T>
+bool has_zero(const _Tensor& t)
+{
+  const T* p = reinterpret_cast<const T*>(t.addr) ;
+  const int64_t n = t.nelems ;
+  int64_t nzero = 0 ;
+#pragma omp parallel for reduction(+:nzero) if (n >= BROADCAST_PARALLEL_MIN)
+  for (int64_t i = 0; i < n; ++i)
+    nzero += p[i] == T(0) ? 1 : 0 ;
+  return nzero > 0 ;
+}
+
+template <typename T, typename F>
+int int_binary_op(const BinaryOpArgs& args, F op, bool division)
+{
+  if (division && has_zero<T>(args.in1)) {
+    LOG(2) << __FUNCTION__ << " integer division by zero.";
+    return 1 ;
+  }
+  return broadcast_op<T, T>(args, op) ;
+}
+
+template <typename F>
+int integer_op(const BinaryOpArgs& args, F op, bool division)
+{
+  if (!CheckTypesAll(args, args.out.dtype))
+    return 1 ;
+
+  switch (args.out.dtype) {
+    case DT_INT8:   return int_binary_op<int8_t>  (args, op, division) ;
+    case DT_INT16:  return int_binary_op<int16_t> (args, op, division) ;
+    case DT_INT32:  return int_binary_op<int32_t> (args, op, division) ;
+    case DT_INT64:  return int_binary_op<int64_t> (args, op, division) ;
+    case DT_UINT8:  return int_binary_op<uint8_t> (args, op, division) ;
+    case DT_UINT16: return int_binary_op<uint16_t>(args, op, division) ;
+    case DT_UINT32: return int_binary_op<uint32_t>(args, op, division) ;
+    case DT_UINT64: return int_binary_op<uint64_t>(args, op, division) ;
+  }
+  return 1 ;
+}
+
+// integer division ops that have a float version too
+template <typename F>
+int division_op(const BinaryOpArgs& args, F op)
+{
+  if (CheckTypesAll(args, DT_FLOAT))
+    return broadcast_op<float, float>(args, op) ;
+  if (CheckTypesAll(args, DT_DOUBLE))
+    return broadcast_op<double, double>(args, op) ;
+  return integer_op(args, op, true) ;
+}
+
+int op_floorDiv(const BinaryOpArgs& args) {
+  return division_op(args, FloorDivOp()) ;
+}
+
+int op_floorMod(const BinaryOpArgs& args) {
+  return division_op(args, FloorModOp()) ;
+}
+
+int op_truncateDiv(const BinaryOpArgs& args) {
+  return integer_op(args, TruncateDivOp(), true) ;
+}
+
+int op_mod(const BinaryOpArgs& args) {
+  return division_op(args, ModOp()) ;
+}
+
+int op_bitwiseAnd(const BinaryOpArgs& args) {
+  return integer_op(args, BitwiseAndOp(), false) ;
+}
+
+int op_bitwiseOr(const BinaryOpArgs& args) {
+  return integer_op(args, BitwiseOrOp(), false) ;
+}
+
+int op_bitwiseXor(const BinaryOpArgs& args) {
+  return integer_op(args, BitwiseXorOp(), false) ;
+}
+
+int op_leftShift(const BinaryOpArgs& args) {
+  return integer_op(args, LeftShiftOp(), false) ;
+}
+
+int op_rightShift(const BinaryOpArgs& args) {
+  return integer_op(args, RightShiftOp(), false) ;
 }
 
 } // namespace
@@ -1803,3 +1979,68 @@ int op_GreaterEqual(const void* args, size_t len)
 {
   return op_Binary(args, len, op_greaterEqual, "op_GreaterEqual");
 }
+
+int op_Less(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_less, "op_Less");
+}
+
+int op_Greater(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_greater, "op_Greater");
+}
+
+int op_LogicalAnd(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_logicalAnd, "op_LogicalAnd");
+}
+
+int op_LogicalOr(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_logicalOr, "op_LogicalOr");
+}
+
+int op_FloorDiv(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_floorDiv, "op_FloorDiv");
+}
+
+int op_FloorMod(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_floorMod, "op_FloorMod");
+}
+
+int op_TruncateDiv(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_truncateDiv, "op_TruncateDiv");
+}
+
+int op_Mod(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_mod, "op_Mod");
+}
+
+int op_BitwiseAnd(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_bitwiseAnd, "op_BitwiseAnd");
+}
+
+int op_BitwiseOr(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_bitwiseOr, "op_BitwiseOr");
+}
+
+int op_BitwiseXor(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_bitwiseXor, "op_BitwiseXor");
+}
+
+int op_LeftShift(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_leftShift, "op_LeftShift");
+}
+
+int op_RightShift(const void* args, size_t len)
+{
+  return op_Binary(args, len, op_rightShift, "op_RightShift");
+}
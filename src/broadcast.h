@@ -0,0 +1,168 @@
+#ifndef BROADCAST_H_
+#define BROADCAST_H_
+
+#include <cstdint>
+#include <omp.h>
+
+//
+// Broadcast iterator of the elementwise ops with several inputs (binary
+// ops, comparisons, logical ops, SelectV2).
+//
+// Inputs are broadcast to the output shape with the numpy rules: shapes are
+// aligned at the innermost dim and a dim of size 1 (or a missing dim) is
+// repeated. broadcast_init gives every input a stride per output dim, 0 for
+// a repeated dim, drops dims of size 1 and merges neighbouring dims that all
+// inputs walk through the same way. An elementwise op with equal shapes, or
+// with a scalar input, ends up as one dim.
+//
+// broadcast_for_each splits the rows of the innermost dim among threads and
+// calls row(out_offset, in_offset, len) for each. The innermost stride of an
+// input, 0 or 1, is in stride[k][ndims - 1], so the row loop has no index
+// arithmetic and vectorizes.
+//
+
+#define BROADCAST_MAX_DIMS 8
+#define BROADCAST_MAX_INPUTS 3
+
+// Below this many output elements the op runs on a single thread.
+#define BROADCAST_PARALLEL_MIN (64*1024)
+
+struct Broadcast {
+  int ndims ;
+  int ninputs ;
+  int64_t nelems ;
+  int64_t shape[BROADCAST_MAX_DIMS] ;
+  int64_t stride[BROADCAST_MAX_INPUTS][BROADCAST_MAX_DIMS] ;
+};
+
+// Returns false when an input does not broadcast to the output shape.
+inline bool broadcast_init(Broadcast& b, int out_dims, const int64_t* out_size,
+                           int ninputs, const int* in_dims,
+                           const int64_t* const* in_size)
+{
+  if (out_dims > BROADCAST_MAX_DIMS || ninputs > BROADCAST_MAX_INPUTS)
+    return false ;
+
+  int64_t shape[BROADCAST_MAX_DIMS] ;
+  int64_t stride[BROADCAST_MAX_INPUTS][BROADCAST_MAX_DIMS] ;
+
+  b.nelems = 1 ;
+  for (int d = 0; d < out_dims; ++d) {
+    shape[d] = out_size[d] ;
+    b.nelems *= out_size[d] ;
+  }
+
+  for (int k = 0; k < ninputs; ++k) {
+    if (in_dims[k] > out_dims)
+      return false ;
+    int64_t s = 1 ;
+    for (int d = out_dims - 1; d >= 0; --d) {
+      const int dk = d - (out_dims - in_dims[k]) ;
+      const int64_t n = dk >= 0 ? in_size[k][dk] : 1 ;
+      if (n == shape[d]) {
+        stride[k][d] = s ;
+        s *= n ;
+      } else if (n == 1) {
+        stride[k][d] = 0 ;
+      } else {
+        return false ;
+      }
+    }
+  }
+
+  // drop dims of size 1, merge dim d into the dim kept before it when every
+  // input either walks both contiguously or repeats both
+  b.ninputs = ninputs ;
+  b.ndims = 0 ;
+  for (int d = 0; d < out_dims; ++d) {
+    if (shape[d] == 1)
+      continue ;
+    bool merge = b.ndims > 0 ;
+    for (int k = 0; merge && k < ninputs; ++k) {
+      const int64_t outer = b.stride[k][b.ndims - 1] ;
+      merge = outer == stride[k][d] * shape[d] ;
+    }
+    if (merge) {
+      const int e = b.ndims - 1 ;
+      b.shape[e] *= shape[d] ;
+      for (int k = 0; k < ninputs; ++k)
+        b.stride[k][e] = stride[k][d] ;
+    } else {
+      const int e = b.ndims++ ;
+      b.shape[e] = shape[d] ;
+      for (int k = 0; k < ninputs; ++k)
+        b.stride[k][e] = stride[k][d] ;
+    }
+  }
+  if (b.ndims == 0) {
+    b.ndims = 1 ;
+    b.shape[0] = 1 ;
+    for (int k = 0; k < ninputs; ++k)
+      b.stride[k][0] = 0 ;
+  }
+
+  return true ;
+}
+
+template <typename F>
+void broadcast_for_each(const Broadcast& b, F row)
+{
+  if (b.nelems == 0)
+    return ;
+
+  const int ndims = b.ndims ;
+  const int64_t len = b.shape[ndims - 1] ;
+  const int64_t nrows = b.nelems / len ;
+
+#pragma omp parallel for if (b.nelems >= BROADCAST_PARALLEL_MIN)
+  for (int64_t r = 0; r < nrows; ++r) {
+    int64_t off[BROADCAST_MAX_INPUTS] = {0} ;
+    int64_t t = r ;
+    for (int d = ndims - 2; d >= 0; --d) {
+      const int64_t i = t % b.shape[d] ;
+      t /= b.shape[d] ;
+      for (int k = 0; k < b.ninputs; ++k)
+        off[k] += i * b.stride[k][d] ;
+    }
+    row(r * len, off, len) ;
+  }
+}
+
+// out[i] = op(in0[i], in1[i]) over a row, with input strides 0 or 1
+template <typename Tout, typename Tin0, typename Tin1, typename F>
+inline void broadcast_row2(Tout* out, const Tin0* in0, int64_t s0,
+                           const Tin1* in1, int64_t s1, int64_t n, F op)
+{
+  if (s0 && s1) {
+    for (int64_t i = 0; i < n; ++i)
+      out[i] = op(in0[i], in1[i]) ;
+  } else if (s0) {
+    const Tin1 v1 = in1[0] ;
+    for (int64_t i = 0; i < n; ++i)
+      out[i] = op(in0[i], v1) ;
+  } else if (s1) {
+    const Tin0 v0 = in0[0] ;
+    for (int64_t i = 0; i < n; ++i)
+      out[i] = op(v0, in1[i]) ;
+  } else {
+    const Tout v = op(in0[0], in1[0]) ;
+    for (int64_t i = 0; i < n; ++i)
+      out[i] = v ;
+  }
+}
+
+// out = op(in0, in1) with in0 and in1 broadcast to out
+template <typename Tout, typename Tin0, typename Tin1, typename F>
+void broadcast_binary(Tout* out, const Tin0* in0, const Tin1* in1,
+                      const Broadcast& b, F op)
+{
+  const int e = b.ndims - 1 ;
+  const int64_t s0 = b.stride[0][e] ;
+  const int64_t s1 = b.stride[1][e] ;
+
+  broadcast_for_each(b, [=](int64_t o, const int64_t* off, int64_t n) {
+    broadcast_row2(out + o, in0 + off[0], s0, in1 + off[1], s1, n, op) ;
+  }) ;
+}
+
+#endif // BROADCAST_H_
@@ -8,6 +8,8 @@
 #include <vednn.h>
 
 #include "kernel.h"
+#include "types.h"
+#include "grouped_conv2d.h"
 
 REGISTER_KERNEL("Conv2D", "conv2d");
 
@@ -65,6 +67,17 @@ int conv2d(const void* arg, size_t len)
             p.col_padding,   p.row_padding);
 #endif
      
+    // grouped convolution: the filter sees only a part of the input channels
+    if( p.in_param.c != p.filter_param.c ) {
+      GroupedConv g ;
+      if( ! grouped_conv_param(g, p.in_param, p.filter_param, p.out_param,
+                               p.row_stride, p.col_stride,
+                               p.row_dilation, p.col_dilation,
+                               p.row_padding, p.col_padding, p.data_format) )
+        return 1 ;
+      return grouped_conv2d(g, p.data_type, p.in, p.filter, p.out) ;
+    }
+
     float * transformed_filter = NULL ;
     if( p.filter_param.n > 1 || p.filter_param.c > 1 ) {
       const int N = p.filter_param.n ;
@@ -8,6 +8,8 @@
 #include <vednn.h>
 
 #include "kernel.h"
+#include "types.h"
+#include "grouped_conv2d.h"
 
 REGISTER_KERNEL("Conv2DBackpropFilter", "conv2d_backprop_filter");
 
@@ -66,6 +68,17 @@ int conv2d_backprop_filter(const void* arg, size_t len)
 #endif
 
 
+    // grouped convolution: the filter sees only a part of the input channels
+    if( p.in_param.c != p.filter_bp_param.c ) {
+      GroupedConv g ;
+      if( ! grouped_conv_param(g, p.in_param, p.filter_bp_param, p.out_bp_param,
+                               p.row_stride, p.col_stride,
+                               p.row_dilation, p.col_dilation,
+                               p.row_padding, p.col_padding, p.data_format) )
+        return 1 ;
+      return grouped_conv2d_backprop_filter(g, p.data_type, p.in, p.out_bp, p.filter_bp) ;
+    }
+
     const int N = p.filter_bp_param.n ;
     const int C = p.filter_bp_param.c ;
     const int H = p.filter_bp_param.h ;
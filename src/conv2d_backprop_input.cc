@@ -8,6 +8,8 @@
 #include <vednn.h>
 
 #include "kernel.h"
+#include "types.h"
+#include "grouped_conv2d.h"
 
 REGISTER_KERNEL("Conv2DBackpropInput", "conv2d_backprop_input");
 
@@ -65,6 +67,17 @@ int conv2d_backprop_input(const void* arg, size_t len)
             p.col_padding,  p.row_padding);
 #endif
 
+    // grouped convolution: the filter sees only a part of the input channels
+    if( p.in_bp_param.c != p.filter_param.c ) {
+      GroupedConv g ;
+      if( ! grouped_conv_param(g, p.in_bp_param, p.filter_param, p.out_bp_param,
+                               p.row_stride, p.col_stride,
+                               p.row_dilation, p.col_dilation,
+                               p.row_padding, p.col_padding, p.data_format) )
+        return 1 ;
+      return grouped_conv2d_backprop_input(g, p.data_type, p.out_bp, p.filter, p.in_bp) ;
+    }
+
     const int N = p.filter_param.n ;
     const int C = p.filter_param.c ;
     const int H = p.filter_param.h ;
@@ -0,0 +1,181 @@
+#include <cstdio>
+#include <cstdint>
+
+#include "kernel.h"
+#include "types.h"
+#include "log.h"
+#include "grouped_conv2d.h"
+
+REGISTER_KERNEL("DepthwiseConv2dNative", "depthwise_conv2d");
+REGISTER_KERNEL("DepthwiseConv2dNativeBackpropInput", "depthwise_conv2d_backprop_input");
+REGISTER_KERNEL("DepthwiseConv2dNativeBackpropFilter", "depthwise_conv2d_backprop_filter");
+
+#define CHECK_ARG_LEN(l0, l1) \
+  if ((l0) != (l1)) { \
+      fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n", (l1), (l0)); \
+      return 1; \
+  }
+
+extern "C" {
+    int depthwise_conv2d(const void* arg, size_t len);
+    int depthwise_conv2d_backprop_input(const void* arg, size_t len);
+    int depthwise_conv2d_backprop_filter(const void* arg, size_t len);
+}
+
+//
+// DepthwiseConv2dNative and its backprops
+//
+// The arguments are those of Conv2D and its backprops, with the filter
+// [h, w, c, n] being [kh, kw, in channels, channel multiplier] and
+// data_format FORMAT_NCHW or FORMAT_NHWC. A depthwise convolution is run as
+// a grouped convolution with one group per input channel (grouped_conv2d.h).
+//
+
+namespace {
+
+struct TensorParam {
+    int w,h,c,n ;
+} ;
+
+// the depthwise filter as a grouped filter with one input channel per group
+bool depthwise_param(GroupedConv& g,
+                     const TensorParam& in, const TensorParam& filter,
+                     const TensorParam& out,
+                     int row_stride, int col_stride,
+                     int row_dilation, int col_dilation,
+                     int row_padding, int col_padding, int data_format)
+{
+  if (filter.c != in.c || out.c != in.c * filter.n)
+    return false ;
+
+  TensorParam grouped = filter ;
+  grouped.c = 1 ;
+  grouped.n = out.c ;
+  return grouped_conv_param(g, in, grouped, out, row_stride, col_stride,
+                            row_dilation, col_dilation,
+                            row_padding, col_padding, data_format) ;
+}
+
+} // namespace
+
+int depthwise_conv2d(const void* arg, size_t len)
+{
+    LOG(2) << __FUNCTION__ << " begin";
+
+    struct ConvParam {
+        uint64_t in;
+        uint64_t filter;
+        uint64_t out;
+        TensorParam in_param;
+        TensorParam filter_param;
+        TensorParam out_param;
+
+        int row_stride;
+        int col_stride;
+        int row_dilation;
+        int col_dilation;
+        int row_padding;
+        int col_padding;
+
+        int data_format;
+        int data_type;
+    } const* p;
+
+    CHECK_ARG_LEN(len, sizeof(ConvParam));
+    p = reinterpret_cast<const ConvParam*>(arg);
+
+    int ret = 1;
+
+    GroupedConv g ;
+    if (depthwise_param(g, p->in_param, p->filter_param, p->out_param,
+                        p->row_stride, p->col_stride,
+                        p->row_dilation, p->col_dilation,
+                        p->row_padding, p->col_padding, p->data_format)) {
+        ret = grouped_conv2d(g, p->data_type, p->in, p->filter, p->out) ;
+    }
+
+    LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+    return ret;
+}
+
+int depthwise_conv2d_backprop_input(const void* arg, size_t len)
+{
+    LOG(2) << __FUNCTION__ << " begin";
+
+    struct ConvParam {
+        uint64_t out_bp;
+        uint64_t filter;
+        uint64_t in_bp;
+        TensorParam out_bp_param;
+        TensorParam filter_param;
+        TensorParam in_bp_param;
+
+        int row_stride;
+        int col_stride;
+        int row_dilation;
+        int col_dilation;
+        int row_padding;
+        int col_padding;
+
+        int data_format;
+        int data_type;
+    } const* p;
+
+    CHECK_ARG_LEN(len, sizeof(ConvParam));
+    p = reinterpret_cast<const ConvParam*>(arg);
+
+    int ret = 1;
+
+    GroupedConv g ;
+    if (depthwise_param(g, p->in_bp_param, p->filter_param, p->out_bp_param,
+                        p->row_stride, p->col_stride,
+                        p->row_dilation, p->col_dilation,
+                        p->row_padding, p->col_padding, p->data_format)) {
+        ret = grouped_conv2d_backprop_input(g, p->data_type, p->out_bp,
+                                            p->filter, p->in_bp) ;
+    }
+
+    LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+    return ret;
+}
+
+int depthwise_conv2d_backprop_filter(const void* arg, size_t len)
+{
+    LOG(2) << __FUNCTION__ << " begin";
+
+    struct ConvParam {
+        uint64_t out_bp;
+        uint64_t in;
+        uint64_t filter_bp;
+        TensorParam out_bp_param;
+        TensorParam in_param;
+        TensorParam filter_bp_param;
+
+        int row_stride;
+        int col_stride;
+        int row_dilation;
+        int col_dilation;
+        int row_padding;
+        int col_padding;
+
+        int data_format;
+        int data_type;
+    } const* p;
+
+    CHECK_ARG_LEN(len, sizeof(ConvParam));
+    p = reinterpret_cast<const ConvParam*>(arg);
+
+    int ret = 1;
+
+    GroupedConv g ;
+    if (depthwise_param(g, p->in_param, p->filter_bp_param, p->out_bp_param,
+                        p->row_stride, p->col_stride,
+                        p->row_dilation, p->col_dilation,
+                        p->row_padding, p->col_padding, p->data_format)) {
+        ret = grouped_conv2d_backprop_filter(g, p->data_type, p->in,
+                                             p->out_bp, p->filter_bp) ;
+    }
+
+    LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+    return ret;
+}
@@ -0,0 +1,82 @@
+#ifndef FILL_FUNCTOR_H_
+#define FILL_FUNCTOR_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <omp.h>
+
+//
+// Parallel fill used by Fill, ZerosLike and kernels that initialize their
+// output (e.g. UnsortedSegmentSum).
+//
+// The buffer is split into one contiguous chunk per thread and each chunk is
+// written with a plain store loop, which the compiler vectorizes. Buffers
+// smaller than FILL_PARALLEL_MIN bytes are filled by the calling thread.
+//
+
+#define FILL_PARALLEL_MIN (64*1024)
+
+template <typename T>
+void fill_parallel(T* out, size_t n, T value)
+{
+#pragma omp parallel if (n * sizeof(T) >= FILL_PARALLEL_MIN)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = n / nthreads ;
+    int64_t remain    = n % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    T* o = out + chunkBegin ;
+    for (int64_t i = 0; i < myChunk; ++i)
+      o[i] = value ;
+  }
+}
+
+// Fills n elements of elem_size bytes with the bit pattern at value. Works
+// for every dtype, as only the element size matters. Returns 1 for element
+// sizes it does not handle.
+inline int fill_bytes(void* out, size_t n, const void* value, size_t elem_size)
+{
+  switch (elem_size) {
+    case 1: { uint8_t  v; memcpy(&v, value, 1); fill_parallel(reinterpret_cast<uint8_t*>(out),  n, v); return 0; }
+    case 2: { uint16_t v; memcpy(&v, value, 2); fill_parallel(reinterpret_cast<uint16_t*>(out), n, v); return 0; }
+    case 4: { uint32_t v; memcpy(&v, value, 4); fill_parallel(reinterpret_cast<uint32_t*>(out), n, v); return 0; }
+    case 8: { uint64_t v; memcpy(&v, value, 8); fill_parallel(reinterpret_cast<uint64_t*>(out), n, v); return 0; }
+    case 16: {
+      // complex128: two 8-byte words repeating
+      uint64_t v[2]; memcpy(v, value, 16);
+      if (v[0] == v[1]) {
+        fill_parallel(reinterpret_cast<uint64_t*>(out), 2 * n, v[0]);
+      } else {
+        uint64_t* o = reinterpret_cast<uint64_t*>(out);
+#pragma omp parallel for if (n * 16 >= FILL_PARALLEL_MIN)
+        for (size_t i = 0; i < n; ++i) { o[2*i] = v[0]; o[2*i+1] = v[1]; }
+      }
+      return 0;
+    }
+    default:
+      return 1;
+  }
+}
+
+// All zero bits are zero for every numeric dtype.
+inline void fill_zero(void* out, size_t nbytes)
+{
+  uint8_t* o = reinterpret_cast<uint8_t*>(out);
+  const size_t head = (8 - (reinterpret_cast<uintptr_t>(o) & 7)) & 7;
+  if (nbytes < head + 8) {
+    memset(o, 0, nbytes);
+    return;
+  }
+  memset(o, 0, head);
+  const size_t nwords = (nbytes - head) / 8;
+  fill_parallel(reinterpret_cast<uint64_t*>(o + head), nwords, uint64_t(0));
+  memset(o + head + nwords * 8, 0, nbytes - head - nwords * 8);
+}
+
+#endif // FILL_FUNCTOR_H_
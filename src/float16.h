@@ -0,0 +1,65 @@
+#ifndef FLOAT16_H_
+#define FLOAT16_H_
+
+#include <cstdint>
+#include <cstring>
+
+//
+// 16-bit floating point types stored as raw bits, and conversions to and
+// from float with round-to-nearest-even. The conversions are branch-free
+// except for selects, so loops over them vectorize.
+//
+
+struct bfloat16_t { uint16_t v; };   // DT_BFLOAT16
+struct half_t     { uint16_t v; };   // DT_HALF (IEEE binary16)
+
+inline uint32_t float_as_bits(float f) { uint32_t u; memcpy(&u, &f, 4); return u; }
+inline float bits_as_float(uint32_t u) { float f; memcpy(&f, &u, 4); return f; }
+
+inline float bf16_to_float(uint16_t h)
+{
+  return bits_as_float(static_cast<uint32_t>(h) << 16) ;
+}
+
+inline uint16_t float_to_bf16(float f)
+{
+  const uint32_t u = float_as_bits(f) ;
+  const bool is_nan = (u & 0x7fffffff) > 0x7f800000 ;
+  const uint32_t rounded = u + 0x7fff + ((u >> 16) & 1) ;
+  return is_nan ? static_cast<uint16_t>((u >> 16) | 0x40)    // keep it quiet NaN
+                : static_cast<uint16_t>(rounded >> 16) ;
+}
+
+inline float half_to_float(uint16_t h)
+{
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16 ;
+  const uint32_t exp  = (h >> 10) & 0x1f ;
+  const uint32_t mant = h & 0x3ff ;
+
+  const uint32_t normal   = ((exp + 112) << 23) | (mant << 13) ;
+  const uint32_t infnan   = 0x7f800000 | (mant << 13) ;
+  const uint32_t subnorm  = float_as_bits(static_cast<float>(mant) * 5.9604644775390625e-8f) ; // mant * 2^-24
+
+  const uint32_t u = exp == 0x1f ? infnan : exp == 0 ? subnorm : normal ;
+  return bits_as_float(sign | u) ;
+}
+
+inline uint16_t float_to_half(float f)
+{
+  uint32_t u = float_as_bits(f) ;
+  const uint32_t sign = (u >> 16) & 0x8000 ;
+  u &= 0x7fffffff ;
+
+  // >= 2^16: inf, or quiet NaN
+  const uint32_t infnan = u > 0x7f800000 ? 0x7e00 : 0x7c00 ;
+  // < 2^-14: half subnormal. Adding 0.5f aligns the mantissa so that the
+  // float adder does the rounding.
+  const uint32_t subnorm = float_as_bits(bits_as_float(u) + 0.5f) - 0x3f000000 ;
+  // normal: rebias the exponent and round the 13 dropped mantissa bits.
+  const uint32_t normal = (u + 0xc8000fff + ((u >> 13) & 1)) >> 13 ;
+
+  const uint32_t h = u >= 0x47800000 ? infnan : u < 0x38800000 ? subnorm : normal ;
+  return static_cast<uint16_t>(sign | h) ;
+}
+
+#endif // FLOAT16_H_
@@ -1,6 +1,7 @@
 #include <cstdio>
 #include <cstdint>
 #include <cstdint>
+#include <cstring>
 #include <cassert>
 #include <algorithm>
 #include "kernel.h"
@@ -10,6 +11,7 @@
 #include <omp.h>
 
 REGISTER_KERNEL("Gather", "op_Gather");
+REGISTER_KERNEL("GatherV2", "op_GatherV2");
 
 #define CHECK_ARG_LEN(l0, l1) \
   if ((l0) != (l1)) { \
@@ -19,32 +21,155 @@ REGISTER_KERNEL("Gather", "op_Gather");
 
 extern "C" {
   int op_Gather(const void* arg, size_t len);
+  int op_GatherV2(const void* arg, size_t len);
 }
 
 
 //
 // Gather
 //
+// params are viewed as [batch_size, outer_size, gather_dim_size, inner_size]
+// and indices as [batch_size, nindex]. The result has the shape
+// [batch_size, outer_size, nindex, inner_size]. This covers TF's axis and
+// batch_dims: batch_size is the product of the leading batch_dims dimensions
+// of params, outer_size the product of the dimensions between batch_dims and
+// axis.
+//
+
+// Rows with at least this many elements are copied as contiguous blocks.
+// Narrower rows are gathered element by element with the index loop
+// vectorized (VE vector length is 256).
+#define GATHER_BLOCK_COPY_MIN 256
 
 namespace {
 
 template <typename T, typename Index>
-int gather(int64_t outer_size, int64_t inner_size, int64_t nindex,
+void gather_rows_narrow(const T* src, const Index* idx, T* dst,
+                        int64_t nindex, int64_t inner_size,
+                        int64_t gather_dim_size, int64_t outer_size,
+                        int64_t rowBegin, int64_t rowEnd)
+{
+  // rows [rowBegin, rowEnd) in the flattened (batch, outer, index) space.
+  int64_t r = rowBegin ;
+  while (r < rowEnd) {
+    const int64_t bo = r / nindex ;             // (batch, outer) slab
+    const int64_t b  = bo / outer_size ;
+    const int64_t i0 = r % nindex ;
+    const int64_t i1 = std::min(nindex, i0 + (rowEnd - r)) ;
+
+    const T*     s  = src + bo * gather_dim_size * inner_size ;
+    const Index* ix = idx + b * nindex ;
+    T*           d  = dst + bo * nindex * inner_size ;
+
+#pragma _NEC novector
+    for (int64_t j = 0; j < inner_size; j++) {
+#pragma _NEC ivdep
+      for (int64_t i = i0; i < i1; i++) {
+        d[i * inner_size + j] = s[ix[i] * inner_size + j] ;
+      }
+    }
+    r += i1 - i0 ;
+  }
+}
+
+template <typename T, typename Index>
+int gather(int64_t batch_size, int64_t outer_size, int64_t gather_dim_size,
+           int64_t inner_size, int64_t nindex,
            uint64_t src_ptr, uint64_t idx_ptr, uint64_t dst_ptr) 
 {
   const T* src = reinterpret_cast<const T*>(src_ptr);
   const Index* idx = reinterpret_cast<const Index*>(idx_ptr);
   T* dst = reinterpret_cast<T*>(dst_ptr);
 
-  for(int64_t i=0; i<nindex; i++) {
-    const int64_t k = idx[i] ;
-    for(int64_t j=0; j<inner_size; j++) {
-      dst[i*inner_size+j] = src[k*inner_size+j] ;
+  // gather_dim_size is 0 when the caller does not know it (op_Gather).
+  if (gather_dim_size > 0) {
+    int bad = 0 ;
+#pragma omp parallel for reduction(|:bad)
+    for (int64_t i = 0; i < batch_size * nindex; i++) {
+      bad |= (idx[i] < 0 || idx[i] >= gather_dim_size) ? 1 : 0 ;
+    }
+    if (bad) {
+      LOG(2) << __FUNCTION__ << ": index out of range [0, " << gather_dim_size << ")";
+      return 1 ;
+    }
+  }
+
+  const int64_t nrows = batch_size * outer_size * nindex ;
+
+  if (inner_size >= GATHER_BLOCK_COPY_MIN) {
+#pragma omp parallel for
+    for (int64_t r = 0; r < nrows; r++) {
+      const int64_t bo = r / nindex ;
+      const int64_t b  = bo / outer_size ;
+      const int64_t k  = idx[b * nindex + r % nindex] ;
+      memcpy(dst + r * inner_size,
+             src + (bo * gather_dim_size + k) * inner_size,
+             sizeof(T) * inner_size) ;
+    }
+  }
+  else {
+#pragma omp parallel
+    {
+      int64_t nthreads = omp_get_num_threads() ;
+      int64_t threadid = omp_get_thread_num() ;
+
+      int64_t chunkSize = nrows / nthreads ;
+      int64_t remain    = nrows % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      if( myChunk > 0 ) {
+        gather_rows_narrow<T, Index>(src, idx, dst, nindex, inner_size,
+                                     gather_dim_size, outer_size,
+                                     chunkBegin, chunkBegin + myChunk) ;
+      }
     }
   }
 
   return 0 ;
 }
+
+template <typename T>
+int gather_handle(int idxtype,
+                  int64_t batch_size, int64_t outer_size, int64_t gather_dim_size,
+                  int64_t inner_size, int64_t nindex,
+                  uint64_t src_ptr, uint64_t idx_ptr, uint64_t dst_ptr)
+{
+  if (idxtype == DT_INT32) {
+    return gather<T, int32_t>(batch_size, outer_size, gather_dim_size,
+                              inner_size, nindex, src_ptr, idx_ptr, dst_ptr) ;
+  }
+  else if (idxtype == DT_INT64) {
+    return gather<T, int64_t>(batch_size, outer_size, gather_dim_size,
+                              inner_size, nindex, src_ptr, idx_ptr, dst_ptr) ;
+  }
+  return 1 ;
+}
+
+int gather_dispatch(int dtype, int idxtype,
+                    int64_t batch_size, int64_t outer_size, int64_t gather_dim_size,
+                    int64_t inner_size, int64_t nindex,
+                    uint64_t src_ptr, uint64_t idx_ptr, uint64_t dst_ptr)
+{
+  switch (dtype) {
+  case DT_FLOAT :
+    return gather_handle<float>(idxtype, batch_size, outer_size, gather_dim_size,
+                                inner_size, nindex, src_ptr, idx_ptr, dst_ptr) ;
+  case DT_DOUBLE :
+    return gather_handle<double>(idxtype, batch_size, outer_size, gather_dim_size,
+                                 inner_size, nindex, src_ptr, idx_ptr, dst_ptr) ;
+  case DT_INT32 :
+    return gather_handle<int32_t>(idxtype, batch_size, outer_size, gather_dim_size,
+                                  inner_size, nindex, src_ptr, idx_ptr, dst_ptr) ;
+  case DT_INT64 :
+    return gather_handle<int64_t>(idxtype, batch_size, outer_size, gather_dim_size,
+                                  inner_size, nindex, src_ptr, idx_ptr, dst_ptr) ;
+  default :
+    break ;
+  }
+  return 1 ;
+}
 }
 
 int op_Gather(const void* args, size_t len)
@@ -62,30 +187,43 @@ int op_Gather(const void* args, size_t len)
   CHECK_ARG_LEN(len, sizeof(Args));
   p = reinterpret_cast<const Args*>(args);
 
-  int ret = 1;
-
-  if (p->dtype == DT_FLOAT) {
-    if ( p->idxtype == DT_INT32 ) {
-      ret = gather<float, int32_t> (p->outer_size, p->inner_size, p->nindex,
-                                    p->src_ptr, p->idx_ptr, p->dst_ptr) ;
-    }
-    else if ( p->idxtype == DT_INT64 ) {
-      ret = gather<float, int64_t> (p->outer_size, p->inner_size, p->nindex,
-                                    p->src_ptr, p->idx_ptr, p->dst_ptr) ;
-    }
-  }
-  else if (p->dtype == DT_DOUBLE) {
-    if ( p->idxtype == DT_INT32 ) {
-      ret = gather<double, int32_t> (p->outer_size, p->inner_size, p->nindex,
-                                     p->src_ptr, p->idx_ptr, p->dst_ptr) ;
-    }
-    else if ( p->idxtype == DT_INT64 ) {
-      ret = gather<double, int64_t> (p->outer_size, p->inner_size, p->nindex,
-                                     p->src_ptr, p->idx_ptr, p->dst_ptr) ;
-    }
-  }
+  // Gather along the first dimension of params.
+  int ret = gather_dispatch(p->dtype, p->idxtype, 1, 1, 0,
+                            p->inner_size, p->nindex,
+                            p->src_ptr, p->idx_ptr, p->dst_ptr) ;
 
   LOG(2) << __FUNCTION__ << " end. ret=" << ret;
   return ret;
 }
 
+int op_GatherV2(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype, idxtype;
+    int64_t batch_size ;
+    int64_t outer_size ;
+    int64_t gather_dim_size ;
+    int64_t inner_size ;
+    int64_t nindex ;
+    uint64_t src_ptr, idx_ptr, dst_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  LOG(3) << __FUNCTION__ << ": batch_size=" << p->batch_size
+    << " outer_size=" << p->outer_size
+    << " gather_dim_size=" << p->gather_dim_size
+    << " inner_size=" << p->inner_size
+    << " nindex=" << p->nindex;
+
+  int ret = gather_dispatch(p->dtype, p->idxtype,
+                            p->batch_size, p->outer_size, p->gather_dim_size,
+                            p->inner_size, p->nindex,
+                            p->src_ptr, p->idx_ptr, p->dst_ptr) ;
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
@@ -0,0 +1,461 @@
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include "types.h"
+#include "log.h"
+#include "grouped_conv2d.h"
+
+#include <omp.h>
+
+//
+// Direct grouped convolution (see grouped_conv2d.h).
+//
+// With the padding before pad and the stride s, input position
+// i = o * s + k * d - pad belongs to output position o and tap k. The
+// output positions whose input is inside [0, n) for a tap are computed once
+// per tap by conv_range, so that the loops over them have no bounds checks.
+//
+// Parallelization:
+//
+//   forward          NCHW: (n, out channel, out row)  NHWC: out pixels
+//   backprop input   NCHW: (n, in channel) planes     NHWC: in pixels
+//   backprop filter  NCHW: filter elements            NHWC: out rows, with
+//                                                     a partial filter per
+//                                                     thread
+//
+// Every thread writes its own part of the output, so there are no atomics.
+//
+
+// Below this many multiply-adds the kernels run on a single thread.
+#define GROUPED_CONV_PARALLEL_MIN (64*1024)
+
+namespace {
+
+// output positions [lo, hi) whose input o * s + off is in [0, n)
+inline void conv_range(int64_t off, int64_t s, int64_t n, int64_t nout,
+                       int64_t& lo, int64_t& hi)
+{
+  lo = off < 0 ? (-off + s - 1) / s : 0 ;
+  const int64_t last = n - 1 - off ;
+  hi = last < 0 ? 0 : std::min<int64_t>(nout, last / s + 1) ;
+  if (hi < lo)
+    hi = lo ;
+}
+
+inline int64_t conv_work(const GroupedConv& g)
+{
+  return static_cast<int64_t>(g.batch) * g.out_c * g.out_h * g.out_w
+         * (g.in_c / g.group) * g.kh * g.kw ;
+}
+
+//
+// Forward
+//
+
+template <typename T>
+void forward_nchw(const GroupedConv& g, const T* in, const T* filter, T* out)
+{
+  const int64_t C = g.in_c, IH = g.in_h, IW = g.in_w ;
+  const int64_t OC = g.out_c, OH = g.out_h, OW = g.out_w ;
+  const int64_t KH = g.kh, KW = g.kw ;
+  const int64_t Cg = C / g.group, Og = OC / g.group ;
+  const int64_t sh = g.row_stride, sw = g.col_stride ;
+
+#pragma omp parallel if (conv_work(g) >= GROUPED_CONV_PARALLEL_MIN)
+  {
+    std::vector<T> acc(OW) ;
+
+#pragma omp for
+    for (int64_t u = 0; u < g.batch * OC * OH; ++u) {
+      const int64_t n = u / (OC * OH) ;
+      const int64_t o = (u / OH) % OC ;
+      const int64_t oh = u % OH ;
+      const int64_t c0 = (o / Og) * Cg ;
+
+      for (int64_t ow = 0; ow < OW; ++ow)
+        acc[ow] = T(0) ;
+
+      for (int64_t kh = 0; kh < KH; ++kh) {
+        const int64_t ih = oh * sh + kh * g.row_dilation - g.pad_h ;
+        if (ih < 0 || ih >= IH)
+          continue ;
+        for (int64_t kw = 0; kw < KW; ++kw) {
+          const int64_t off = kw * g.col_dilation - g.pad_w ;
+          int64_t lo, hi ;
+          conv_range(off, sw, IW, OW, lo, hi) ;
+          for (int64_t ci = 0; ci < Cg; ++ci) {
+            const T* irow = in + ((n * C + c0 + ci) * IH + ih) * IW ;
+            const T f = filter[((kh * KW + kw) * Cg + ci) * OC + o] ;
+            for (int64_t ow = lo; ow < hi; ++ow)
+              acc[ow] += irow[ow * sw + off] * f ;
+          }
+        }
+      }
+
+      T* orow = out + u * OW ;
+      for (int64_t ow = 0; ow < OW; ++ow)
+        orow[ow] = acc[ow] ;
+    }
+  }
+}
+
+template <typename T>
+void forward_nhwc(const GroupedConv& g, const T* in, const T* filter, T* out)
+{
+  const int64_t C = g.in_c, IH = g.in_h, IW = g.in_w ;
+  const int64_t OC = g.out_c, OH = g.out_h, OW = g.out_w ;
+  const int64_t KH = g.kh, KW = g.kw ;
+  const int64_t Cg = C / g.group, Og = OC / g.group ;
+
+#pragma omp parallel if (conv_work(g) >= GROUPED_CONV_PARALLEL_MIN)
+  {
+    // first input channel of the group of output channel o
+    std::vector<int64_t> ibase(OC) ;
+    for (int64_t o = 0; o < OC; ++o)
+      ibase[o] = (o / Og) * Cg ;
+    std::vector<T> acc(OC) ;
+
+#pragma omp for
+    for (int64_t u = 0; u < g.batch * OH * OW; ++u) {
+      const int64_t n = u / (OH * OW) ;
+      const int64_t oh = (u / OW) % OH ;
+      const int64_t ow = u % OW ;
+
+      for (int64_t o = 0; o < OC; ++o)
+        acc[o] = T(0) ;
+
+      for (int64_t kh = 0; kh < KH; ++kh) {
+        const int64_t ih = oh * g.row_stride + kh * g.row_dilation - g.pad_h ;
+        if (ih < 0 || ih >= IH)
+          continue ;
+        for (int64_t kw = 0; kw < KW; ++kw) {
+          const int64_t iw = ow * g.col_stride + kw * g.col_dilation - g.pad_w ;
+          if (iw < 0 || iw >= IW)
+            continue ;
+          const T* ipix = in + ((n * IH + ih) * IW + iw) * C ;
+          const T* fk = filter + (kh * KW + kw) * Cg * OC ;
+          if (Cg == 1 && Og == 1) {
+            for (int64_t o = 0; o < OC; ++o)
+              acc[o] += ipix[o] * fk[o] ;
+          } else {
+            for (int64_t ci = 0; ci < Cg; ++ci) {
+              const T* frow = fk + ci * OC ;
+              for (int64_t o = 0; o < OC; ++o)
+                acc[o] += ipix[ibase[o] + ci] * frow[o] ;
+            }
+          }
+        }
+      }
+
+      T* opix = out + u * OC ;
+      for (int64_t o = 0; o < OC; ++o)
+        opix[o] = acc[o] ;
+    }
+  }
+}
+
+//
+// Backprop input
+//
+
+template <typename T>
+void backprop_input_nchw(const GroupedConv& g, const T* out_bp, const T* filter, T* in_bp)
+{
+  const int64_t C = g.in_c, IH = g.in_h, IW = g.in_w ;
+  const int64_t OC = g.out_c, OH = g.out_h, OW = g.out_w ;
+  const int64_t KH = g.kh, KW = g.kw ;
+  const int64_t Cg = C / g.group, Og = OC / g.group ;
+  const int64_t sw = g.col_stride ;
+
+#pragma omp parallel for if (conv_work(g) >= GROUPED_CONV_PARALLEL_MIN)
+  for (int64_t u = 0; u < g.batch * C; ++u) {
+    const int64_t n = u / C ;
+    const int64_t c = u % C ;
+    const int64_t ci = c % Cg ;
+    const int64_t o0 = (c / Cg) * Og ;
+
+    T* plane = in_bp + u * IH * IW ;
+    for (int64_t i = 0; i < IH * IW; ++i)
+      plane[i] = T(0) ;
+
+    for (int64_t o = o0; o < o0 + Og; ++o) {
+      for (int64_t oh = 0; oh < OH; ++oh) {
+        const T* orow = out_bp + ((n * OC + o) * OH + oh) * OW ;
+        for (int64_t kh = 0; kh < KH; ++kh) {
+          const int64_t ih = oh * g.row_stride + kh * g.row_dilation - g.pad_h ;
+          if (ih < 0 || ih >= IH)
+            continue ;
+          for (int64_t kw = 0; kw < KW; ++kw) {
+            const int64_t off = kw * g.col_dilation - g.pad_w ;
+            int64_t lo, hi ;
+            conv_range(off, sw, IW, OW, lo, hi) ;
+            const T f = filter[((kh * KW + kw) * Cg + ci) * OC + o] ;
+            T* irow = plane + ih * IW ;
+#pragma _NEC ivdep
+            for (int64_t ow = lo; ow < hi; ++ow)
+              irow[ow * sw + off] += orow[ow] * f ;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+void backprop_input_nhwc(const GroupedConv& g, const T* out_bp, const T* filter, T* in_bp)
+{
+  const int64_t C = g.in_c, IH = g.in_h, IW = g.in_w ;
+  const int64_t OC = g.out_c, OH = g.out_h, OW = g.out_w ;
+  const int64_t KH = g.kh, KW = g.kw ;
+  const int64_t Cg = C / g.group, Og = OC / g.group ;
+  const int64_t sh = g.row_stride, sw = g.col_stride ;
+
+#pragma omp parallel if (conv_work(g) >= GROUPED_CONV_PARALLEL_MIN)
+  {
+    // first output channel of input channel c's group, and the filter
+    // offset of (c, that channel)
+    std::vector<int64_t> obase(C), fbase(C) ;
+    for (int64_t c = 0; c < C; ++c) {
+      obase[c] = (c / Cg) * Og ;
+      fbase[c] = (c % Cg) * OC + obase[c] ;
+    }
+    std::vector<T> acc(C) ;
+
+#pragma omp for
+    for (int64_t u = 0; u < g.batch * IH * IW; ++u) {
+      const int64_t n = u / (IH * IW) ;
+      const int64_t ih = (u / IW) % IH ;
+      const int64_t iw = u % IW ;
+
+      for (int64_t c = 0; c < C; ++c)
+        acc[c] = T(0) ;
+
+      for (int64_t kh = 0; kh < KH; ++kh) {
+        const int64_t th = ih + g.pad_h - kh * g.row_dilation ;
+        if (th < 0 || th % sh != 0 || th / sh >= OH)
+          continue ;
+        const int64_t oh = th / sh ;
+        for (int64_t kw = 0; kw < KW; ++kw) {
+          const int64_t tw = iw + g.pad_w - kw * g.col_dilation ;
+          if (tw < 0 || tw % sw != 0 || tw / sw >= OW)
+            continue ;
+          const int64_t ow = tw / sw ;
+          const T* opix = out_bp + ((n * OH + oh) * OW + ow) * OC ;
+          const T* fk = filter + (kh * KW + kw) * Cg * OC ;
+          if (Cg == 1 && Og == 1) {
+            for (int64_t c = 0; c < C; ++c)
+              acc[c] += opix[c] * fk[c] ;
+          } else {
+            for (int64_t j = 0; j < Og; ++j) {
+              for (int64_t c = 0; c < C; ++c)
+                acc[c] += opix[obase[c] + j] * fk[fbase[c] + j] ;
+            }
+          }
+        }
+      }
+
+      T* ipix = in_bp + u * C ;
+      for (int64_t c = 0; c < C; ++c)
+        ipix[c] = acc[c] ;
+    }
+  }
+}
+
+//
+// Backprop filter
+//
+
+template <typename T>
+void backprop_filter_nchw(const GroupedConv& g, const T* in, const T* out_bp, T* filter_bp)
+{
+  const int64_t C = g.in_c, IH = g.in_h, IW = g.in_w ;
+  const int64_t OC = g.out_c, OH = g.out_h, OW = g.out_w ;
+  const int64_t KH = g.kh, KW = g.kw ;
+  const int64_t Cg = C / g.group, Og = OC / g.group ;
+  const int64_t sw = g.col_stride ;
+
+  // one filter element per iteration, in the filter layout
+#pragma omp parallel for if (conv_work(g) >= GROUPED_CONV_PARALLEL_MIN)
+  for (int64_t u = 0; u < KH * KW * Cg * OC; ++u) {
+    const int64_t o = u % OC ;
+    const int64_t ci = (u / OC) % Cg ;
+    const int64_t kw = (u / (OC * Cg)) % KW ;
+    const int64_t kh = u / (OC * Cg * KW) ;
+    const int64_t c = (o / Og) * Cg + ci ;
+
+    const int64_t off = kw * g.col_dilation - g.pad_w ;
+    int64_t lo, hi ;
+    conv_range(off, sw, IW, OW, lo, hi) ;
+
+    T sum = T(0) ;
+    for (int64_t n = 0; n < g.batch; ++n) {
+      for (int64_t oh = 0; oh < OH; ++oh) {
+        const int64_t ih = oh * g.row_stride + kh * g.row_dilation - g.pad_h ;
+        if (ih < 0 || ih >= IH)
+          continue ;
+        const T* orow = out_bp + ((n * OC + o) * OH + oh) * OW ;
+        const T* irow = in + ((n * C + c) * IH + ih) * IW ;
+        for (int64_t ow = lo; ow < hi; ++ow)
+          sum += orow[ow] * irow[ow * sw + off] ;
+      }
+    }
+    filter_bp[u] = sum ;
+  }
+}
+
+template <typename T>
+void backprop_filter_nhwc(const GroupedConv& g, const T* in, const T* out_bp, T* filter_bp)
+{
+  const int64_t C = g.in_c, IH = g.in_h, IW = g.in_w ;
+  const int64_t OC = g.out_c, OH = g.out_h, OW = g.out_w ;
+  const int64_t KH = g.kh, KW = g.kw ;
+  const int64_t Cg = C / g.group, Og = OC / g.group ;
+  const int64_t fsize = KH * KW * Cg * OC ;
+
+  const bool parallel = conv_work(g) >= GROUPED_CONV_PARALLEL_MIN ;
+  const int nthreads_max = parallel ? omp_get_max_threads() : 1 ;
+  std::vector<T> part(nthreads_max * fsize) ;
+
+#pragma omp parallel if (parallel)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    std::vector<int64_t> ibase(OC) ;
+    for (int64_t o = 0; o < OC; ++o)
+      ibase[o] = (o / Og) * Cg ;
+
+    T* mine = part.data() + threadid * fsize ;
+    for (int64_t i = 0; i < fsize; ++i)
+      mine[i] = T(0) ;
+
+#pragma omp for
+    for (int64_t u = 0; u < g.batch * OH; ++u) {
+      const int64_t n = u / OH ;
+      const int64_t oh = u % OH ;
+      for (int64_t kh = 0; kh < KH; ++kh) {
+        const int64_t ih = oh * g.row_stride + kh * g.row_dilation - g.pad_h ;
+        if (ih < 0 || ih >= IH)
+          continue ;
+        for (int64_t ow = 0; ow < OW; ++ow) {
+          const T* opix = out_bp + (u * OW + ow) * OC ;
+          for (int64_t kw = 0; kw < KW; ++kw) {
+            const int64_t iw = ow * g.col_stride + kw * g.col_dilation - g.pad_w ;
+            if (iw < 0 || iw >= IW)
+              continue ;
+            const T* ipix = in + ((n * IH + ih) * IW + iw) * C ;
+            T* pk = mine + (kh * KW + kw) * Cg * OC ;
+            if (Cg == 1 && Og == 1) {
+              for (int64_t o = 0; o < OC; ++o)
+                pk[o] += ipix[o] * opix[o] ;
+            } else {
+              for (int64_t ci = 0; ci < Cg; ++ci) {
+                T* prow = pk + ci * OC ;
+                for (int64_t o = 0; o < OC; ++o)
+                  prow[o] += ipix[ibase[o] + ci] * opix[o] ;
+              }
+            }
+          }
+        }
+      }
+    }
+
+    // implicit barrier of omp for, then the partials are summed
+#pragma omp for
+    for (int64_t i = 0; i < fsize; ++i) {
+      T s = T(0) ;
+      for (int64_t t = 0; t < nthreads; ++t)
+        s += part[t * fsize + i] ;
+      filter_bp[i] = s ;
+    }
+  }
+}
+
+bool check_param(const GroupedConv& g)
+{
+  return g.group > 0 && g.in_c % g.group == 0 && g.out_c % g.group == 0
+    && g.row_stride > 0 && g.col_stride > 0
+    && g.row_dilation > 0 && g.col_dilation > 0
+    && (g.data_format == FORMAT_NCHW || g.data_format == FORMAT_NHWC) ;
+}
+
+} // namespace
+
+int grouped_conv2d(const GroupedConv& g, int dtype,
+                   uint64_t in, uint64_t filter, uint64_t out)
+{
+  LOG(3) << __FUNCTION__ << " group=" << g.group << " in_c=" << g.in_c
+         << " out_c=" << g.out_c << " data_format=" << g.data_format ;
+
+  if (!check_param(g))
+    return 1 ;
+
+  const bool nchw = g.data_format == FORMAT_NCHW ;
+  if (dtype == DT_FLOAT) {
+    const float* pi = reinterpret_cast<const float*>(in) ;
+    const float* pf = reinterpret_cast<const float*>(filter) ;
+    float* po = reinterpret_cast<float*>(out) ;
+    if (nchw) forward_nchw(g, pi, pf, po) ; else forward_nhwc(g, pi, pf, po) ;
+    return 0 ;
+  } else if (dtype == DT_DOUBLE) {
+    const double* pi = reinterpret_cast<const double*>(in) ;
+    const double* pf = reinterpret_cast<const double*>(filter) ;
+    double* po = reinterpret_cast<double*>(out) ;
+    if (nchw) forward_nchw(g, pi, pf, po) ; else forward_nhwc(g, pi, pf, po) ;
+    return 0 ;
+  }
+  return 1 ;
+}
+
+int grouped_conv2d_backprop_input(const GroupedConv& g, int dtype,
+                                  uint64_t out_bp, uint64_t filter, uint64_t in_bp)
+{
+  LOG(3) << __FUNCTION__ << " group=" << g.group << " in_c=" << g.in_c
+         << " out_c=" << g.out_c << " data_format=" << g.data_format ;
+
+  if (!check_param(g))
+    return 1 ;
+
+  const bool nchw = g.data_format == FORMAT_NCHW ;
+  if (dtype == DT_FLOAT) {
+    const float* po = reinterpret_cast<const float*>(out_bp) ;
+    const float* pf = reinterpret_cast<const float*>(filter) ;
+    float* pi = reinterpret_cast<float*>(in_bp) ;
+    if (nchw) backprop_input_nchw(g, po, pf, pi) ; else backprop_input_nhwc(g, po, pf, pi) ;
+    return 0 ;
+  } else if (dtype == DT_DOUBLE) {
+    const double* po = reinterpret_cast<const double*>(out_bp) ;
+    const double* pf = reinterpret_cast<const double*>(filter) ;
+    double* pi = reinterpret_cast<double*>(in_bp) ;
+    if (nchw) backprop_input_nchw(g, po, pf, pi) ; else backprop_input_nhwc(g, po, pf, pi) ;
+    return 0 ;
+  }
+  return 1 ;
+}
+
+int grouped_conv2d_backprop_filter(const GroupedConv& g, int dtype,
+                                   uint64_t in, uint64_t out_bp, uint64_t filter_bp)
+{
+  LOG(3) << __FUNCTION__ << " group=" << g.group << " in_c=" << g.in_c
+         << " out_c=" << g.out_c << " data_format=" << g.data_format ;
+
+  if (!check_param(g))
+    return 1 ;
+
+  const bool nchw = g.data_format == FORMAT_NCHW ;
+  if (dtype == DT_FLOAT) {
+    const float* pi = reinterpret_cast<const float*>(in) ;
+    const float* po = reinterpret_cast<const float*>(out_bp) ;
+    float* pf = reinterpret_cast<float*>(filter_bp) ;
+    if (nchw) backprop_filter_nchw(g, pi, po, pf) ; else backprop_filter_nhwc(g, pi, po, pf) ;
+    return 0 ;
+  } else if (dtype == DT_DOUBLE) {
+    const double* pi = reinterpret_cast<const double*>(in) ;
+    const double* po = reinterpret_cast<const double*>(out_bp) ;
+    double* pf = reinterpret_cast<double*>(filter_bp) ;
+    if (nchw) backprop_filter_nchw(g, pi, po, pf) ; else backprop_filter_nhwc(g, pi, po, pf) ;
+    return 0 ;
+  }
+  return 1 ;
+}
@@ -0,0 +1,73 @@
+#ifndef GROUPED_CONV2D_H_
+#define GROUPED_CONV2D_H_
+
+#include <cstdint>
+#include "types.h"
+
+//
+// Direct grouped 2D convolution, forward and both backprops.
+//
+// The input channels are split into group groups of in_c / group channels,
+// and the output channels into group groups of out_c / group channels.
+// Output group g only sees input group g. The filter is in the TensorFlow
+// layout [kh, kw, in_c / group, out_c]. A depthwise convolution with
+// multiplier M is the case group = in_c, out_c = in_c * M, and its filter
+// [kh, kw, in_c, M] has the same layout.
+//
+// Tensors are NCHW or NHWC (data_format). NCHW loops vectorize over the
+// output width, NHWC loops over the channels.
+//
+// Used by the Depthwise kernels and by Conv2D and its backprops when the
+// filter has fewer input channels than the input (grouped Conv2D), which
+// vednn is not called for.
+//
+
+struct GroupedConv {
+  int batch ;
+  int in_c, in_h, in_w ;
+  int out_c, out_h, out_w ;
+  int kh, kw ;
+  int group ;
+  int row_stride, col_stride ;
+  int row_dilation, col_dilation ;
+  int pad_h, pad_w ;              // padding before the first row, column
+  int data_format ;
+};
+
+// Fills a GroupedConv from the TensorParam {w, h, c, n} of the input, filter
+// and output, with filter.c input channels per group and the total padding
+// of the Conv kernels. Returns false when the channels do not split into
+// groups.
+template <typename TensorParam>
+bool grouped_conv_param(GroupedConv& g,
+                        const TensorParam& in, const TensorParam& filter,
+                        const TensorParam& out,
+                        int row_stride, int col_stride,
+                        int row_dilation, int col_dilation,
+                        int row_padding, int col_padding, int data_format)
+{
+  if (filter.c <= 0 || in.c % filter.c != 0)
+    return false ;
+
+  g.batch = in.n ;
+  g.in_c = in.c ; g.in_h = in.h ; g.in_w = in.w ;
+  g.out_c = out.c ; g.out_h = out.h ; g.out_w = out.w ;
+  g.kh = filter.h ; g.kw = filter.w ;
+  g.group = in.c / filter.c ;
+  g.row_stride = row_stride ; g.col_stride = col_stride ;
+  g.row_dilation = row_dilation ; g.col_dilation = col_dilation ;
+  g.pad_h = row_padding / 2 ; g.pad_w = col_padding / 2 ;
+  g.data_format = data_format ;
+
+  return out.c % g.group == 0 && out.n == in.n ;
+}
+
+// These return 0 on success and 1 for an unsupported dtype or layout.
+int grouped_conv2d(const GroupedConv& g, int dtype,
+                   uint64_t in, uint64_t filter, uint64_t out) ;
+int grouped_conv2d_backprop_input(const GroupedConv& g, int dtype,
+                                  uint64_t out_bp, uint64_t filter, uint64_t in_bp) ;
+int grouped_conv2d_backprop_filter(const GroupedConv& g, int dtype,
+                                   uint64_t in, uint64_t out_bp, uint64_t filter_bp) ;
+
+#endif // GROUPED_CONV2D_H_
@@ -0,0 +1,741 @@
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "types.h"
+#include <sstream>
+#include "ve_ops_common.h"
+
+#include <omp.h>
+
+//
+// FusedBatchNorm, FusedBatchNormGrad, LayerNorm, LayerNormGrad
+//
+// Mean and variance come from one pass over the input. The per-thread
+// partial results (count, mean, sum of squared deviations) are merged with
+// the pairwise update of Chan et al., which is as accurate as Welford's
+// algorithm but lets every thread work on its own part of the data. Forward
+// and backward then need one more pass over the data each.
+//
+
+namespace {
+
+// Within a contiguous run, values are processed in blocks of this many
+// elements: block mean first, then squared deviations from it while the
+// block is still in cache. Both loops vectorize.
+#define MOMENTS_BLOCK 1024
+
+template <typename T>
+struct Moments {
+  int64_t n ;
+  T mean ;
+  T m2 ;      // sum of squared deviations from mean
+} ;
+
+template <typename T>
+inline void moments_merge(Moments<T>& a, const Moments<T>& b)
+{
+  if (b.n == 0)
+    return ;
+  if (a.n == 0) {
+    a = b ;
+    return ;
+  }
+  const int64_t n = a.n + b.n ;
+  const T d = b.mean - a.mean ;
+  a.mean += d * (T(b.n) / T(n)) ;
+  a.m2 += b.m2 + d * d * (T(a.n) * T(b.n) / T(n)) ;
+  a.n = n ;
+}
+
+// moments of x[0, n), merged into m
+template <typename T>
+void moments_accumulate(Moments<T>& m, const T* x, int64_t n)
+{
+  for (int64_t b = 0; b < n; b += MOMENTS_BLOCK) {
+    const int64_t len = std::min<int64_t>(MOMENTS_BLOCK, n - b) ;
+    const T* xb = x + b ;
+
+    T s = T(0.) ;
+    for (int64_t i = 0; i < len; ++i)
+      s += xb[i] ;
+    const T mean = s / T(len) ;
+
+    T m2 = T(0.) ;
+    for (int64_t i = 0; i < len; ++i) {
+      const T d = xb[i] - mean ;
+      m2 += d * d ;
+    }
+
+    Moments<T> blk = { len, mean, m2 } ;
+    moments_merge(m, blk) ;
+  }
+}
+
+//
+// The batch norm input is viewed as [outer, C, inner]: NHWC is
+// [N*H*W, C, 1] and NCHW is [N, C, H*W].
+//
+
+struct BNShape {
+  int64_t outer, C, inner ;
+} ;
+
+inline int get_bn_shape(const Tensor* x, int64_t data_format, BNShape& s)
+{
+  if (x->dims != 4)
+    return 1 ;
+  if (data_format == FORMAT_NHWC) {
+    s.outer = x->dim_size[0] * x->dim_size[1] * x->dim_size[2] ;
+    s.C     = x->dim_size[3] ;
+    s.inner = 1 ;
+  } else if (data_format == FORMAT_NCHW) {
+    s.outer = x->dim_size[0] ;
+    s.C     = x->dim_size[1] ;
+    s.inner = x->dim_size[2] * x->dim_size[3] ;
+  } else {
+    return 1 ;
+  }
+  return 0 ;
+}
+
+// Per-channel moments of x. Each thread collects moments for every channel
+// over its share of the data in part[threadid * C + c], then the threads'
+// results are merged per channel.
+template <typename T>
+void channel_moments(const T* x, const BNShape& s, Moments<T>* out)
+{
+  const int64_t C = s.C ;
+  const int nthreads_max = omp_get_max_threads() ;
+  std::vector<Moments<T> > part(nthreads_max * C) ;
+  for (size_t i = 0; i < part.size(); ++i) {
+    part[i].n = 0 ; part[i].mean = T(0.) ; part[i].m2 = T(0.) ;
+  }
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+    Moments<T>* my = part.data() + threadid * C ;
+
+    if (s.inner == 1) {
+      // NHWC: rows of C channels. Welford update vectorized over channels.
+      int64_t chunkSize = s.outer / nthreads ;
+      int64_t remain    = s.outer % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      if (myChunk > 0) {
+        std::vector<T> mean(C, T(0.)), m2(C, T(0.)) ;
+        for (int64_t r = 0; r < myChunk; ++r) {
+          const T* xr = x + (chunkBegin + r) * C ;
+          const T rk = T(1.) / T(r + 1) ;
+          for (int64_t c = 0; c < C; ++c) {
+            const T d = xr[c] - mean[c] ;
+            mean[c] += d * rk ;
+            m2[c] += d * (xr[c] - mean[c]) ;
+          }
+        }
+        for (int64_t c = 0; c < C; ++c) {
+          my[c].n = myChunk ; my[c].mean = mean[c] ; my[c].m2 = m2[c] ;
+        }
+      }
+    } else {
+      // NCHW: planes of H*W
+      const int64_t nplanes = s.outer * C ;
+      int64_t chunkSize = nplanes / nthreads ;
+      int64_t remain    = nplanes % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      for (int64_t p = chunkBegin; p < chunkBegin + myChunk; ++p)
+        moments_accumulate(my[p % C], x + p * s.inner, s.inner) ;
+    }
+  }
+
+#pragma omp parallel for
+  for (int64_t c = 0; c < C; ++c) {
+    Moments<T> m = part[c] ;
+    for (int t = 1; t < nthreads_max; ++t)
+      moments_merge(m, part[t * C + c]) ;
+    out[c] = m ;
+  }
+}
+
+// y = (x - m[c]) * a[c] + b[c]
+template <typename T>
+void channel_affine(const T* x, T* y, const BNShape& s,
+                    const T* m, const T* a, const T* b)
+{
+  const int64_t C = s.C ;
+  if (s.inner == 1) {
+#pragma omp parallel for
+    for (int64_t r = 0; r < s.outer; ++r) {
+      const T* xr = x + r * C ;
+      T* yr = y + r * C ;
+      for (int64_t c = 0; c < C; ++c)
+        yr[c] = (xr[c] - m[c]) * a[c] + b[c] ;
+    }
+  } else {
+#pragma omp parallel for
+    for (int64_t p = 0; p < s.outer * C; ++p) {
+      const T mp = m[p % C] ;
+      const T ap = a[p % C] ;
+      const T bp = b[p % C] ;
+      const T* xp = x + p * s.inner ;
+      T* yp = y + p * s.inner ;
+      for (int64_t i = 0; i < s.inner; ++i)
+        yp[i] = (xp[i] - mp) * ap + bp ;
+    }
+  }
+}
+
+template <typename T>
+int fused_batch_norm(const T* x, const T* scale, const T* offset,
+                     const T* est_mean, const T* est_var,
+                     T* y, T* batch_mean, T* batch_var,
+                     T* saved_mean, T* saved_var,
+                     const BNShape& s, T epsilon, T exp_avg_factor,
+                     bool is_training)
+{
+  const int64_t C = s.C ;
+  std::vector<T> mean(C), var(C), a(C) ;
+
+  if (is_training) {
+    std::vector<Moments<T> > m(C) ;
+    channel_moments(x, s, m.data()) ;
+
+    const int64_t n = s.outer * s.inner ;
+    const T bessel = n > 1 ? T(n) / T(n - 1) : T(1.) ;
+    for (int64_t c = 0; c < C; ++c) {
+      mean[c] = m[c].mean ;
+      var[c]  = m[c].m2 / T(n) ;
+    }
+    for (int64_t c = 0; c < C; ++c) {
+      const T old_mean = est_mean ? est_mean[c] : T(0.) ;
+      const T old_var  = est_var  ? est_var[c]  : T(0.) ;
+      batch_mean[c] = (T(1.) - exp_avg_factor) * old_mean + exp_avg_factor * mean[c] ;
+      batch_var[c]  = (T(1.) - exp_avg_factor) * old_var  + exp_avg_factor * var[c] * bessel ;
+      saved_mean[c] = mean[c] ;
+      saved_var[c]  = var[c] ;
+    }
+  } else {
+    for (int64_t c = 0; c < C; ++c) {
+      mean[c] = est_mean[c] ;
+      var[c]  = est_var[c] ;
+    }
+    for (int64_t c = 0; c < C; ++c) {
+      batch_mean[c] = mean[c] ;
+      batch_var[c]  = var[c] ;
+      saved_mean[c] = mean[c] ;
+      saved_var[c]  = var[c] ;
+    }
+  }
+
+  for (int64_t c = 0; c < C; ++c)
+    a[c] = scale[c] / std::sqrt(var[c] + epsilon) ;
+  channel_affine(x, y, s, mean.data(), a.data(), offset) ;
+
+  return 0 ;
+}
+
+// Per-channel sums of dy and dy * (x - mean[c]), collected per thread and
+// then added up per channel.
+template <typename T>
+void channel_grad_sums(const T* dy, const T* x, const T* mean, const BNShape& s,
+                       T* sum_dy, T* sum_dy_xc)
+{
+  const int64_t C = s.C ;
+  const int nthreads_max = omp_get_max_threads() ;
+  std::vector<T> part(2 * nthreads_max * C, T(0.)) ;
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+    T* my_dy   = part.data() + 2 * threadid * C ;
+    T* my_dyxc = my_dy + C ;
+
+    if (s.inner == 1) {
+      int64_t chunkSize = s.outer / nthreads ;
+      int64_t remain    = s.outer % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      for (int64_t r = chunkBegin; r < chunkBegin + myChunk; ++r) {
+        const T* dyr = dy + r * C ;
+        const T* xr = x + r * C ;
+        for (int64_t c = 0; c < C; ++c) {
+          my_dy[c]   += dyr[c] ;
+          my_dyxc[c] += dyr[c] * (xr[c] - mean[c]) ;
+        }
+      }
+    } else {
+      const int64_t nplanes = s.outer * C ;
+      int64_t chunkSize = nplanes / nthreads ;
+      int64_t remain    = nplanes % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      for (int64_t p = chunkBegin; p < chunkBegin + myChunk; ++p) {
+        const int64_t c = p % C ;
+        const T mc = mean[c] ;
+        const T* dyp = dy + p * s.inner ;
+        const T* xp = x + p * s.inner ;
+        T sdy = T(0.), sdyxc = T(0.) ;
+        for (int64_t i = 0; i < s.inner; ++i) {
+          sdy   += dyp[i] ;
+          sdyxc += dyp[i] * (xp[i] - mc) ;
+        }
+        my_dy[c]   += sdy ;
+        my_dyxc[c] += sdyxc ;
+      }
+    }
+  }
+
+  for (int64_t c = 0; c < C; ++c) {
+    T sdy = T(0.), sdyxc = T(0.) ;
+    for (int t = 0; t < nthreads_max; ++t) {
+      sdy   += part[2 * t * C + c] ;
+      sdyxc += part[2 * t * C + C + c] ;
+    }
+    sum_dy[c] = sdy ;
+    sum_dy_xc[c] = sdyxc ;
+  }
+}
+
+//
+// training:  dx = scale * rstd * (dy - mean(dy) - xhat * mean(dy * xhat))
+// inference: dx = scale * rstd * dy
+//
+// Both are dx = dy * a[c] + (x - mean[c]) * b[c] + k[c]. x is centered
+// before the multiply, as x * b + k would cancel badly for large means.
+//
+template <typename T>
+int fused_batch_norm_grad(const T* dy, const T* x, const T* scale,
+                          const T* mean, const T* var,
+                          T* dx, T* dscale, T* doffset,
+                          const BNShape& s, T epsilon, bool is_training)
+{
+  const int64_t C = s.C ;
+  std::vector<T> sum_dy(C), sum_dy_xc(C), a(C), b(C), k(C) ;
+
+  channel_grad_sums(dy, x, mean, s, sum_dy.data(), sum_dy_xc.data()) ;
+
+  const T n = T(s.outer * s.inner) ;
+  for (int64_t c = 0; c < C; ++c) {
+    const T rstd = T(1.) / std::sqrt(var[c] + epsilon) ;
+    doffset[c] = sum_dy[c] ;
+    dscale[c]  = sum_dy_xc[c] * rstd ;
+
+    a[c] = scale[c] * rstd ;
+    if (is_training) {
+      // mean(dy * xhat) = sum_dy_xc * rstd / n
+      b[c] = -a[c] * sum_dy_xc[c] * rstd * rstd / n ;
+      k[c] = -a[c] * sum_dy[c] / n ;
+    } else {
+      b[c] = T(0.) ;
+      k[c] = T(0.) ;
+    }
+  }
+
+  if (s.inner == 1) {
+#pragma omp parallel for
+    for (int64_t r = 0; r < s.outer; ++r) {
+      const T* dyr = dy + r * C ;
+      const T* xr = x + r * C ;
+      T* dxr = dx + r * C ;
+      for (int64_t c = 0; c < C; ++c)
+        dxr[c] = dyr[c] * a[c] + (xr[c] - mean[c]) * b[c] + k[c] ;
+    }
+  } else {
+#pragma omp parallel for
+    for (int64_t p = 0; p < s.outer * C; ++p) {
+      const int64_t c = p % C ;
+      const T ac = a[c], bc = b[c], kc = k[c], mc = mean[c] ;
+      const T* dyp = dy + p * s.inner ;
+      const T* xp = x + p * s.inner ;
+      T* dxp = dx + p * s.inner ;
+      for (int64_t i = 0; i < s.inner; ++i)
+        dxp[i] = dyp[i] * ac + (xp[i] - mc) * bc + kc ;
+    }
+  }
+
+  return 0 ;
+}
+
+//
+// FusedBatchNorm
+//
+// Tensor x, scale, offset, mean, variance, y, batch_mean, batch_variance,
+// saved_mean, saved_variance, double epsilon, double exponential_avg_factor,
+// int64 data_format, int64 is_training
+//
+// As in TensorFlow, batch_variance is the unbiased estimate (blended into
+// the running variance unless exponential_avg_factor is 1) and
+// saved_variance the biased one, which FusedBatchNormGrad expects. In
+// training mode mean and variance may be empty when the factor is 1.
+//
+
+int op_fused_batch_norm(const VEOpArgs& args)
+{
+  if (args.nVariables() != 14)
+    return 1;
+
+  const Tensor* x          = args.arg<Tensor>(0);
+  const Tensor* scale      = args.arg<Tensor>(1);
+  const Tensor* offset     = args.arg<Tensor>(2);
+  const Tensor* mean       = args.arg<Tensor>(3);
+  const Tensor* variance   = args.arg<Tensor>(4);
+  const Tensor* y          = args.arg<Tensor>(5);
+  const Tensor* batch_mean = args.arg<Tensor>(6);
+  const Tensor* batch_var  = args.arg<Tensor>(7);
+  const Tensor* saved_mean = args.arg<Tensor>(8);
+  const Tensor* saved_var  = args.arg<Tensor>(9);
+  const double epsilon        = *args.arg<double>(10) ;
+  const double exp_avg_factor = *args.arg<double>(11) ;
+  const int64_t data_format   = *args.arg<int64_t>(12) ;
+  const int64_t is_training   = *args.arg<int64_t>(13) ;
+
+  LOG(3) << __FUNCTION__ << ": x=" << x->to_s()
+    << " epsilon=" << epsilon << " data_format=" << data_format
+    << " is_training=" << is_training;
+
+  BNShape s ;
+  if (get_bn_shape(x, data_format, s))
+    return 1 ;
+  if (s.outer * s.inner == 0)
+    return 1 ;
+  if (y->dtype != x->dtype || y->nelems != x->nelems)
+    return 1 ;
+  if (scale->nelems != s.C || offset->nelems != s.C
+      || batch_mean->nelems != s.C || batch_var->nelems != s.C
+      || saved_mean->nelems != s.C || saved_var->nelems != s.C)
+    return 1 ;
+
+  const bool have_est = mean->nelems == s.C && variance->nelems == s.C ;
+  if (!have_est && (!is_training || exp_avg_factor != 1.0))
+    return 1 ;
+
+  int ret = 1 ;
+#define FUSED_BATCH_NORM(T) \
+  ret = fused_batch_norm<T>( \
+          reinterpret_cast<const T*>(x->addr), \
+          reinterpret_cast<const T*>(scale->addr), \
+          reinterpret_cast<const T*>(offset->addr), \
+          have_est ? reinterpret_cast<const T*>(mean->addr) : NULL, \
+          have_est ? reinterpret_cast<const T*>(variance->addr) : NULL, \
+          reinterpret_cast<T*>(y->addr), \
+          reinterpret_cast<T*>(batch_mean->addr), \
+          reinterpret_cast<T*>(batch_var->addr), \
+          reinterpret_cast<T*>(saved_mean->addr), \
+          reinterpret_cast<T*>(saved_var->addr), \
+          s, T(epsilon), T(exp_avg_factor), is_training != 0)
+
+  if (x->dtype == DT_FLOAT) {
+    FUSED_BATCH_NORM(float) ;
+  } else if (x->dtype == DT_DOUBLE) {
+    FUSED_BATCH_NORM(double) ;
+  }
+#undef FUSED_BATCH_NORM
+
+  return ret ;
+}
+
+//
+// FusedBatchNormGrad
+//
+// Tensor dy, x, scale, saved_mean, saved_variance, dx, dscale, doffset,
+// double epsilon, int64 data_format, int64 is_training
+//
+
+int op_fused_batch_norm_grad(const VEOpArgs& args)
+{
+  if (args.nVariables() != 11)
+    return 1;
+
+  const Tensor* dy         = args.arg<Tensor>(0);
+  const Tensor* x          = args.arg<Tensor>(1);
+  const Tensor* scale      = args.arg<Tensor>(2);
+  const Tensor* saved_mean = args.arg<Tensor>(3);
+  const Tensor* saved_var  = args.arg<Tensor>(4);
+  const Tensor* dx         = args.arg<Tensor>(5);
+  const Tensor* dscale     = args.arg<Tensor>(6);
+  const Tensor* doffset    = args.arg<Tensor>(7);
+  const double epsilon      = *args.arg<double>(8) ;
+  const int64_t data_format = *args.arg<int64_t>(9) ;
+  const int64_t is_training = *args.arg<int64_t>(10) ;
+
+  LOG(3) << __FUNCTION__ << ": x=" << x->to_s()
+    << " epsilon=" << epsilon << " data_format=" << data_format
+    << " is_training=" << is_training;
+
+  BNShape s ;
+  if (get_bn_shape(x, data_format, s))
+    return 1 ;
+  if (s.outer * s.inner == 0)
+    return 1 ;
+  if (dy->dtype != x->dtype || dx->dtype != x->dtype
+      || dy->nelems != x->nelems || dx->nelems != x->nelems)
+    return 1 ;
+  if (scale->nelems != s.C || saved_mean->nelems != s.C || saved_var->nelems != s.C
+      || dscale->nelems != s.C || doffset->nelems != s.C)
+    return 1 ;
+
+  int ret = 1 ;
+#define FUSED_BATCH_NORM_GRAD(T) \
+  ret = fused_batch_norm_grad<T>( \
+          reinterpret_cast<const T*>(dy->addr), \
+          reinterpret_cast<const T*>(x->addr), \
+          reinterpret_cast<const T*>(scale->addr), \
+          reinterpret_cast<const T*>(saved_mean->addr), \
+          reinterpret_cast<const T*>(saved_var->addr), \
+          reinterpret_cast<T*>(dx->addr), \
+          reinterpret_cast<T*>(dscale->addr), \
+          reinterpret_cast<T*>(doffset->addr), \
+          s, T(epsilon), is_training != 0)
+
+  if (x->dtype == DT_FLOAT) {
+    FUSED_BATCH_NORM_GRAD(float) ;
+  } else if (x->dtype == DT_DOUBLE) {
+    FUSED_BATCH_NORM_GRAD(double) ;
+  }
+#undef FUSED_BATCH_NORM_GRAD
+
+  return ret ;
+}
+
+//
+// LayerNorm / LayerNormGrad
+//
+// x is viewed as [rows, cols], where cols is the product of the dims from
+// begin_norm_axis on, and every row is normalized on its own:
+//
+//   y = (x - mean) * rstd * gamma + beta,   rstd = 1 / sqrt(var + epsilon)
+//
+// The forward op saves mean and rstd ([rows]) for the backward op. Rows are
+// split among threads. dgamma and dbeta are column sums over all rows,
+// collected per thread and then added up.
+//
+
+template <typename T>
+int layer_norm(const T* x, const T* gamma, const T* beta,
+               T* y, T* mean, T* rstd,
+               int64_t rows, int64_t cols, T epsilon)
+{
+#pragma omp parallel for
+  for (int64_t r = 0; r < rows; ++r) {
+    const T* xr = x + r * cols ;
+    T* yr = y + r * cols ;
+
+    Moments<T> m = { 0, T(0.), T(0.) } ;
+    moments_accumulate(m, xr, cols) ;
+
+    const T mu = m.mean ;
+    const T rs = T(1.) / std::sqrt(m.m2 / T(cols) + epsilon) ;
+    for (int64_t c = 0; c < cols; ++c)
+      yr[c] = (xr[c] - mu) * rs * gamma[c] + beta[c] ;
+
+    mean[r] = mu ;
+    rstd[r] = rs ;
+  }
+  return 0 ;
+}
+
+//
+// dx = rstd * (g - mean(g) - xhat * mean(g * xhat)),   g = dy * gamma
+//
+template <typename T>
+int layer_norm_grad(const T* dy, const T* x, const T* gamma,
+                    const T* mean, const T* rstd,
+                    T* dx, T* dgamma, T* dbeta,
+                    int64_t rows, int64_t cols)
+{
+  const int nthreads_max = omp_get_max_threads() ;
+  std::vector<T> part(2 * nthreads_max * cols, T(0.)) ;
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+    T* my_dgamma = part.data() + 2 * threadid * cols ;
+    T* my_dbeta  = my_dgamma + cols ;
+
+    int64_t chunkSize = rows / nthreads ;
+    int64_t remain    = rows % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    for (int64_t r = chunkBegin; r < chunkBegin + myChunk; ++r) {
+      const T* dyr = dy + r * cols ;
+      const T* xr = x + r * cols ;
+      T* dxr = dx + r * cols ;
+      const T mu = mean[r] ;
+      const T rs = rstd[r] ;
+
+      T sum_g = T(0.), sum_gx = T(0.) ;
+      for (int64_t c = 0; c < cols; ++c) {
+        const T xhat = (xr[c] - mu) * rs ;
+        const T g = dyr[c] * gamma[c] ;
+        sum_g  += g ;
+        sum_gx += g * xhat ;
+        my_dgamma[c] += dyr[c] * xhat ;
+        my_dbeta[c]  += dyr[c] ;
+      }
+
+      const T mean_g  = sum_g / T(cols) ;
+      const T mean_gx = sum_gx / T(cols) ;
+      for (int64_t c = 0; c < cols; ++c) {
+        const T xhat = (xr[c] - mu) * rs ;
+        dxr[c] = rs * (dyr[c] * gamma[c] - mean_g - xhat * mean_gx) ;
+      }
+    }
+  }
+
+#pragma omp parallel for
+  for (int64_t c = 0; c < cols; ++c) {
+    T dg = T(0.), db = T(0.) ;
+    for (int t = 0; t < nthreads_max; ++t) {
+      dg += part[2 * t * cols + c] ;
+      db += part[2 * t * cols + cols + c] ;
+    }
+    dgamma[c] = dg ;
+    dbeta[c] = db ;
+  }
+
+  return 0 ;
+}
+
+inline int get_layer_norm_shape(const Tensor* x, int64_t begin_norm_axis,
+                                int64_t& rows, int64_t& cols)
+{
+  if (begin_norm_axis < 0)
+    begin_norm_axis += x->dims ;
+  if (begin_norm_axis < 0 || begin_norm_axis >= x->dims)
+    return 1 ;
+  rows = 1 ;
+  cols = 1 ;
+  for (int i = 0; i < begin_norm_axis; ++i) rows *= x->dim_size[i] ;
+  for (int i = begin_norm_axis; i < x->dims; ++i) cols *= x->dim_size[i] ;
+  return cols == 0 ? 1 : 0 ;
+}
+
+//
+// LayerNorm
+//
+// Tensor x, gamma, beta, y, mean, rstd, double epsilon, int64 begin_norm_axis
+//
+
+int op_layer_norm(const VEOpArgs& args)
+{
+  if (args.nVariables() != 8)
+    return 1;
+
+  const Tensor* x     = args.arg<Tensor>(0);
+  const Tensor* gamma = args.arg<Tensor>(1);
+  const Tensor* beta  = args.arg<Tensor>(2);
+  const Tensor* y     = args.arg<Tensor>(3);
+  const Tensor* mean  = args.arg<Tensor>(4);
+  const Tensor* rstd  = args.arg<Tensor>(5);
+  const double epsilon          = *args.arg<double>(6) ;
+  const int64_t begin_norm_axis = *args.arg<int64_t>(7) ;
+
+  LOG(3) << __FUNCTION__ << ": x=" << x->to_s()
+    << " epsilon=" << epsilon << " begin_norm_axis=" << begin_norm_axis;
+
+  int64_t rows, cols ;
+  if (get_layer_norm_shape(x, begin_norm_axis, rows, cols))
+    return 1 ;
+  if (y->dtype != x->dtype || y->nelems != x->nelems)
+    return 1 ;
+  if (gamma->nelems != cols || beta->nelems != cols
+      || mean->nelems != rows || rstd->nelems != rows)
+    return 1 ;
+
+  int ret = 1 ;
+#define LAYER_NORM(T) \
+  ret = layer_norm<T>(reinterpret_cast<const T*>(x->addr), \
+                      reinterpret_cast<const T*>(gamma->addr), \
+                      reinterpret_cast<const T*>(beta->addr), \
+                      reinterpret_cast<T*>(y->addr), \
+                      reinterpret_cast<T*>(mean->addr), \
+                      reinterpret_cast<T*>(rstd->addr), \
+                      rows, cols, T(epsilon))
+
+  if (x->dtype == DT_FLOAT) {
+    LAYER_NORM(float) ;
+  } else if (x->dtype == DT_DOUBLE) {
+    LAYER_NORM(double) ;
+  }
+#undef LAYER_NORM
+
+  return ret ;
+}
+
+//
+// LayerNormGrad
+//
+// Tensor dy, x, gamma, mean, rstd, dx, dgamma, dbeta, int64 begin_norm_axis
+//
+
+int op_layer_norm_grad(const VEOpArgs& args)
+{
+  if (args.nVariables() != 9)
+    return 1;
+
+  const Tensor* dy     = args.arg<Tensor>(0);
+  const Tensor* x      = args.arg<Tensor>(1);
+  const Tensor* gamma  = args.arg<Tensor>(2);
+  const Tensor* mean   = args.arg<Tensor>(3);
+  const Tensor* rstd   = args.arg<Tensor>(4);
+  const Tensor* dx     = args.arg<Tensor>(5);
+  const Tensor* dgamma = args.arg<Tensor>(6);
+  const Tensor* dbeta  = args.arg<Tensor>(7);
+  const int64_t begin_norm_axis = *args.arg<int64_t>(8) ;
+
+  LOG(3) << __FUNCTION__ << ": x=" << x->to_s()
+    << " begin_norm_axis=" << begin_norm_axis;
+
+  int64_t rows, cols ;
+  if (get_layer_norm_shape(x, begin_norm_axis, rows, cols))
+    return 1 ;
+  if (dy->dtype != x->dtype || dx->dtype != x->dtype
+      || dy->nelems != x->nelems || dx->nelems != x->nelems)
+    return 1 ;
+  if (gamma->nelems != cols || dgamma->nelems != cols || dbeta->nelems != cols
+      || mean->nelems != rows || rstd->nelems != rows)
+    return 1 ;
+
+  int ret = 1 ;
+#define LAYER_NORM_GRAD(T) \
+  ret = layer_norm_grad<T>(reinterpret_cast<const T*>(dy->addr), \
+                           reinterpret_cast<const T*>(x->addr), \
+                           reinterpret_cast<const T*>(gamma->addr), \
+                           reinterpret_cast<const T*>(mean->addr), \
+                           reinterpret_cast<const T*>(rstd->addr), \
+                           reinterpret_cast<T*>(dx->addr), \
+                           reinterpret_cast<T*>(dgamma->addr), \
+                           reinterpret_cast<T*>(dbeta->addr), \
+                           rows, cols)
+
+  if (x->dtype == DT_FLOAT) {
+    LAYER_NORM_GRAD(float) ;
+  } else if (x->dtype == DT_DOUBLE) {
+    LAYER_NORM_GRAD(double) ;
+  }
+#undef LAYER_NORM_GRAD
+
+  return ret ;
+}
+
+} // namespace
+
+DEFINE_KERNEL(FusedBatchNorm, op_fused_batch_norm);
+DEFINE_KERNEL(FusedBatchNormGrad, op_fused_batch_norm_grad);
+DEFINE_KERNEL(LayerNorm, op_layer_norm);
+DEFINE_KERNEL(LayerNormGrad, op_layer_norm_grad);
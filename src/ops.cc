@@ -3,13 +3,20 @@
 #include <cstdint>
 #include <cassert>
 #include <algorithm>
+#include <cstddef>
 #include "kernel.h"
 #include "types.h"
 #include "log.h"
 
 #include <omp.h>
+#include <vector>
 
 #include "vednn.h"
+#include "strided_copy.h"
+#include "fill_functor.h"
+#include "float16.h"
+#include "softmax_functor.h"
+#include "vmath.h"
 
 
 #define LIBVETF_INTRINSIC
@@ -47,15 +54,19 @@ REGISTER_KERNEL("BiasAdd", "op_BiasAdd");
 REGISTER_KERNEL("BiasAddGrad", "op_BiasAddGrad");
 REGISTER_KERNEL("Relu", "op_Relu");
 REGISTER_KERNEL("ReluGrad", "op_ReluGrad");
+REGISTER_KERNEL("ReluBiasAddGrad", "op_ReluBiasAddGrad");
 REGISTER_KERNEL("Snapshot", "op_Snapshot")
 REGISTER_KERNEL("Transpose", "op_Transpose");
 REGISTER_KERNEL("MatMul", "op_MatMul");
 REGISTER_KERNEL("Softmax", "op_Softmax");
+REGISTER_KERNEL("SoftmaxGrad", "op_SoftmaxGrad");
+REGISTER_KERNEL("LogSoftmaxGrad", "op_LogSoftmaxGrad");
 REGISTER_KERNEL("Pack", "op_Pack");
 REGISTER_KERNEL("Slice", "op_Slice");
 
 // Unary
 REGISTER_KERNEL("Neg", "op_Neg");
+REGISTER_KERNEL("LogicalNot", "op_LogicalNot");
 REGISTER_KERNEL("Sqrt", "op_Sqrt");
 REGISTER_KERNEL("Rsqrt", "op_Rsqrt");
 REGISTER_KERNEL("Square", "op_Square");
@@ -80,12 +91,16 @@ extern "C" {
   int op_BiasAddGrad(const void* arg, size_t len);
   int op_Relu(const void* arg, size_t len);
   int op_ReluGrad(const void* arg, size_t len);
+  int op_ReluBiasAddGrad(const void* arg, size_t len);
   int op_Snapshot(const void* arg, size_t len);
   int op_Neg(const void* arg, size_t len);
+  int op_LogicalNot(const void* arg, size_t len);
   int op_Floor(const void* arg, size_t len);
   int op_Transpose(const void* arg, size_t len);
   int op_MatMul(const void* arg, size_t len);
   int op_Softmax(const void* arg, size_t len);
+  int op_SoftmaxGrad(const void* arg, size_t len);
+  int op_LogSoftmaxGrad(const void* arg, size_t len);
   int op_Sqrt(const void* arg, size_t len);
   int op_Rsqrt(const void* arg, size_t len);
   int op_Square(const void* arg, size_t len);
@@ -101,171 +116,169 @@ extern "C" {
 //
 // Fill
 //
-
-namespace {
-template <typename T>
-  int fill(const void* args, size_t len)
-  {
-    LOG(2) << __PRETTY_FUNCTION__;
-    struct Args {
-      int data_type;
-      uint64_t in;
-      uint64_t out;
-      size_t num_elems;
-    } const* p;
-
-    if (len != sizeof(*p)) {
-      fprintf(stderr, "%s: illegal argument lenght: %ld expected but %ld\n",
-              sizeof(*p), len);
-      return 1;
-    }
-
-    p = reinterpret_cast<const Args*>(args);
-#if 0
-    LOG(2, "%s: data_type=%d out=%016lx num_elems=%lu\n",
-          __FUNCTION__, p->data_type, p->out, p->num_elems);
-#endif
-
-    const T* in = (T*)p->in;
-    T* out = (T*)p->out;
-
-    LOG(2) << __FUNCTION__ << ": value=" << *in;
-
-    for (size_t i = 0; i < p->num_elems; ++i)
-      out[i] = *in;
-
-    LOG(2) << __PRETTY_FUNCTION__ << ": done";
-    return 0;
-  }
-}
-
-#define DATA_TYPE(p) *(int*)(p)
+// Fill and ZerosLike only depend on the element size, so they support every
+// dtype with a fixed size.
+//
 
 int op_fill(const void* args, size_t len)
 {
   LOG(1) << __FUNCTION__;
-  int dtype = DATA_TYPE(args);
-  LOG(2) << __FUNCTION__ << ": dtype=" << dtype;
+  struct Args {
+    int data_type;
+    uint64_t in;
+    uint64_t out;
+    size_t num_elems;
+  } const* p;
 
-  if (dtype == DT_FLOAT) {
-    return fill<float>(args, len);
-  }
-  else if (dtype == DT_DOUBLE) {
-    return fill<double>(args, len);
-  }
-  else if (dtype == DT_INT64) {
-    return fill<int64_t>(args, len);
-  }
-  else {
+  if (len != sizeof(*p)) {
+    fprintf(stderr, "%s: illegal argument lenght: %ld expected but %ld\n",
+            __FUNCTION__, sizeof(*p), len);
     return 1;
   }
-}
-
-//
-// ZerosLike
-//
 
-namespace {
-template <typename T>
-  int zeroslike(const void* args, size_t len)
-  {
-    LOG(2) << __PRETTY_FUNCTION__;
-    struct Args {
-      int data_type;
-      uint64_t out;
-      size_t num_elems;
-    } const* p;
-
-    if (len != sizeof(*p)) {
-      fprintf(stderr, "%s: illegal argument lenght: %ld expected but %ld\n",
-              sizeof(*p), len);
-      return 1;
-    }
-
-    p = reinterpret_cast<const Args*>(args);
-
-    T* out = (T*)p->out;
-
-    LOG(2) << __FUNCTION__ ;
+  p = reinterpret_cast<const Args*>(args);
+  LOG(2) << __FUNCTION__ << ": dtype=" << p->data_type << " num_elems=" << p->num_elems;
 
-    for (size_t i = 0; i < p->num_elems; ++i)
-      out[i] = T(0.);
+  const int elem_size = DataTypeSize(p->data_type);
+  if (elem_size == 0)
+    return 1;
 
-    LOG(2) << __PRETTY_FUNCTION__ << ": done";
-    return 0;
-  }
+  return fill_bytes(reinterpret_cast<void*>(p->out), p->num_elems,
+                    reinterpret_cast<const void*>(p->in), elem_size);
 }
 
-#define DATA_TYPE(p) *(int*)(p)
+//
+// ZerosLike
+//
 
 int op_ZerosLike(const void* args, size_t len)
 {
   LOG(1) << __FUNCTION__;
-  int dtype = DATA_TYPE(args);
-  LOG(2) << __FUNCTION__ << ": dtype=" << dtype;
+  struct Args {
+    int data_type;
+    uint64_t out;
+    size_t num_elems;
+  } const* p;
 
-  if (dtype == DT_FLOAT) {
-    return zeroslike<float>(args, len);
-  } else {
+  if (len != sizeof(*p)) {
+    fprintf(stderr, "%s: illegal argument lenght: %ld expected but %ld\n",
+            __FUNCTION__, sizeof(*p), len);
     return 1;
   }
+
+  p = reinterpret_cast<const Args*>(args);
+  LOG(2) << __FUNCTION__ << ": dtype=" << p->data_type << " num_elems=" << p->num_elems;
+
+  const int elem_size = DataTypeSize(p->data_type);
+  if (elem_size == 0)
+    return 1;
+
+  fill_zero(reinterpret_cast<void*>(p->out), p->num_elems * elem_size);
+  return 0;
 }
 
+//
+// AddN
+//
+// out is computed block by block: every input is added into a block of out
+// while it stays in cache, so out is written to memory once instead of once
+// per input. Blocks are distributed among threads.
+//
+
+// block size in bytes
+#define ADDN_BLOCK_SIZE (16*1024)
+
 namespace {
 template <typename T>
-void AddNOp(T* out, T** in, size_t num_elems, size_t num_inputs)
+void AddNOp(T* out, const uint64_t* in_ptrs, size_t num_elems, size_t num_inputs)
 {
-  switch( num_inputs ) {
-  case 0 :
-     memset(out, 0, sizeof(T) * num_elems);
-     break ;
-  case 1 :
-     for (size_t i = 0; i < num_elems; ++i) {
-       out[i] = in[0][i];
-     }
-     break ;
-  case 2 :
-     for (size_t i = 0; i < num_elems; ++i) {
-       out[i] = in[0][i] + in[1][i] ;
-     }
-     break ;
-  default :
-     for (size_t i = 0; i < num_elems; ++i) {
-       out[i] = in[0][i];
-     }
-     for (size_t j = 1; j < num_inputs; ++j) {
-       for (size_t i = 0; i < num_elems; ++i) {
-         out[i] += in[j][i];
-       }
-     }
-     break ;
+  std::vector<const T*> in(num_inputs);
+  for (size_t j = 0; j < num_inputs; ++j)
+    in[j] = reinterpret_cast<const T*>(in_ptrs[j]);
+
+  // out may share its buffer with an input. Move that input to the front,
+  // so that the first pass reads it before out is written.
+  for (size_t j = 1; j < num_inputs; ++j) {
+    if (in[j] == out) {
+      std::swap(in[0], in[j]);
+      break;
+    }
+  }
+
+  const size_t block = ADDN_BLOCK_SIZE / sizeof(T);
+  const size_t nblocks = (num_elems + block - 1) / block;
+
+#pragma omp parallel for
+  for (size_t b = 0; b < nblocks; ++b) {
+    const size_t i0 = b * block;
+    const size_t n = std::min(block, num_elems - i0);
+    T* o = out + i0;
+
+    switch( num_inputs ) {
+    case 0 :
+       for (size_t i = 0; i < n; ++i) o[i] = T(0);
+       break ;
+    case 1 :
+       for (size_t i = 0; i < n; ++i) o[i] = in[0][i0+i];
+       break ;
+    default :
+       for (size_t i = 0; i < n; ++i) o[i] = in[0][i0+i] + in[1][i0+i];
+       break ;
+    }
+
+    // two inputs per pass over the block
+    size_t j = 2;
+#pragma _NEC novector
+    for (; j + 1 < num_inputs; j += 2) {
+      const T* a = in[j] + i0;
+      const T* c = in[j+1] + i0;
+      for (size_t i = 0; i < n; ++i) o[i] += a[i] + c[i];
+    }
+    if (j < num_inputs) {
+      const T* a = in[j] + i0;
+      for (size_t i = 0; i < n; ++i) o[i] += a[i];
+    }
   }
 }
 };
 
+// Args is followed by num_inputs input pointers. Hosts that send a fixed
+// in[32] array are accepted as well.
 int op_AddN(const void* args, size_t len)
 {
   LOG(1) << __FUNCTION__;
-#define MAX_INPUTS 32
   struct Args {
     int output_type;
     uint64_t out;
     size_t num_elems;
     size_t num_inputs;
-    uint64_t in[MAX_INPUTS];
+    uint64_t in[1];
   } const* p;
 
-  if (len != sizeof(*p)) {
-      fprintf(stderr, "%s: illegal argument lenght: %ld expected but %ld\n", sizeof(*p), len);
+  const size_t header = offsetof(Args, in);
+  if (len < header) {
+      fprintf(stderr, "%s: illegal argument length: %ld\n", __FUNCTION__, len);
       return 1;
   }
 
   p = reinterpret_cast<const Args*>(args);
 
+  if (len < header + sizeof(uint64_t) * p->num_inputs) {
+      fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n",
+              __FUNCTION__, header + sizeof(uint64_t) * p->num_inputs, len);
+      return 1;
+  }
+
   LOG(2) << __FUNCTION__ << "num_elems=" << p->num_elems << " num_inputs=" << p->num_inputs;
 
   if (p->output_type == DT_FLOAT) {
-    AddNOp<float>((float*)p-> out, (float**)p->in, p->num_elems, p->num_inputs);
+    AddNOp<float>((float*)p->out, p->in, p->num_elems, p->num_inputs);
+  } else if (p->output_type == DT_DOUBLE) {
+    AddNOp<double>((double*)p->out, p->in, p->num_elems, p->num_inputs);
+  } else if (p->output_type == DT_INT32) {
+    AddNOp<int32_t>((int32_t*)p->out, p->in, p->num_elems, p->num_inputs);
+  } else if (p->output_type == DT_INT64) {
+    AddNOp<int64_t>((int64_t*)p->out, p->in, p->num_elems, p->num_inputs);
   } else {
     return 1;
   }
@@ -273,6 +286,225 @@ int op_AddN(const void* args, size_t len)
   return 0;
 }
 
+//
+// BiasAdd and BiasAddGrad
+//
+// A tensor of any rank is viewed as [outer, channel, inner]. For the
+// channel-last format (NHWC, and any rank with the channel as the last dim)
+// inner is 1; for the channel-first format (NCHW, NCDHW) outer is the batch
+// and inner the product of the spatial dims. Rank-2 inputs have their
+// channel last in both formats.
+//
+// bias_add runs the rows (channel last) or planes (channel first) in a
+// parallel loop with a vectorized inner loop.
+//
+// bias_backprop[c] is the sum of the gradient over all dims but the channel.
+// Each thread sums its share of the rows or planes into its own
+// part[threadid * channel + c], then the parts are added up in parallel
+// over blocks of channels.
+//
+// With Relu, the gradient is masked by features > 0 on the fly and the
+// masked gradient is stored to backprop, which is ReluGrad fused into the
+// same pass.
+//
+
+// Below this many elements bias ops run on a single thread.
+#define BIAS_PARALLEL_MIN (16*1024)
+
+namespace {
+
+struct BiasShape {
+  int64_t outer;
+  int64_t channel;
+  int64_t inner;
+};
+
+int get_bias_shape(int data_format, int32_t dims, const int64_t* dim_size,
+                   BiasShape& s)
+{
+  if (dims < 2 || dims > 8)
+    return 1 ;
+  if (data_format != FORMAT_NHWC && data_format != FORMAT_NCHW)
+    return 1 ;
+  const int c = (data_format == FORMAT_NCHW) ? 1 : dims - 1 ;
+  s.outer = 1 ;
+  s.channel = dim_size[c] ;
+  s.inner = 1 ;
+  for (int d = 0; d < c; ++d) s.outer *= dim_size[d] ;
+  for (int d = c + 1; d < dims; ++d) s.inner *= dim_size[d] ;
+  return 0 ;
+}
+
+// bfloat16 is added and summed in float
+template<typename T> struct BiasValue {
+  typedef T acc_t ;
+  static T load(T v) { return v ; }
+  static T store(T v) { return v ; }
+};
+
+template<> struct BiasValue<bfloat16_t> {
+  typedef float acc_t ;
+  static float load(bfloat16_t v) { return bf16_to_float(v.v) ; }
+  static bfloat16_t store(float v) { bfloat16_t r ; r.v = float_to_bf16(v) ; return r ; }
+};
+
+template<typename T>
+void bias_add(const T* in, const T* bias, T* out, const BiasShape& s)
+{
+  typedef BiasValue<T> V ;
+  const int64_t channel = s.channel ;
+  const int64_t inner = s.inner ;
+  const bool parallel = s.outer * channel * inner >= BIAS_PARALLEL_MIN ;
+
+  if (inner == 1) {
+#pragma omp parallel for if (parallel)
+    for (int64_t r = 0; r < s.outer; ++r) {
+      const T* ir = in + r * channel ;
+      T* or_ = out + r * channel ;
+      for (int64_t c = 0; c < channel; ++c)
+        or_[c] = V::store(V::load(ir[c]) + V::load(bias[c])) ;
+    }
+  } else {
+#pragma omp parallel for if (parallel)
+    for (int64_t u = 0; u < s.outer * channel; ++u) {
+      const T* iu = in + u * inner ;
+      T* ou = out + u * inner ;
+      const typename V::acc_t b = V::load(bias[u % channel]) ;
+      for (int64_t i = 0; i < inner; ++i)
+        ou[i] = V::store(V::load(iu[i]) + b) ;
+    }
+  }
+}
+
+template<typename T, bool Relu>
+void bias_grad(const T* g, const T* features, T* backprop, T* bias_backprop,
+               const BiasShape& s)
+{
+  typedef BiasValue<T> V ;
+  typedef typename V::acc_t A ;
+  const int64_t outer = s.outer ;
+  const int64_t channel = s.channel ;
+  const int64_t inner = s.inner ;
+  const bool parallel = outer * channel * inner >= BIAS_PARALLEL_MIN ;
+  const int nthreads_max = parallel ? omp_get_max_threads() : 1 ;
+  std::vector<A> part(nthreads_max * channel, A(0.)) ;
+
+#pragma omp parallel if (parallel)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+    A* my = part.data() + threadid * channel ;
+
+    // rows of channel elements (NHWC) or planes of inner elements (NCHW)
+    const int64_t nunits = inner == 1 ? outer : outer * channel ;
+    int64_t chunkSize = nunits / nthreads ;
+    int64_t remain    = nunits % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    if (inner == 1) {
+      for (int64_t r = chunkBegin; r < chunkBegin + myChunk; ++r) {
+        const T* gr = g + r * channel ;
+        if (Relu) {
+          const T* fr = features + r * channel ;
+          T* br = backprop + r * channel ;
+          for (int64_t c = 0; c < channel; ++c) {
+            const A v = V::load(fr[c]) > A(0.) ? V::load(gr[c]) : A(0.) ;
+            br[c] = V::store(v) ;
+            my[c] += v ;
+          }
+        } else {
+          for (int64_t c = 0; c < channel; ++c)
+            my[c] += V::load(gr[c]) ;
+        }
+      }
+    } else {
+      for (int64_t u = chunkBegin; u < chunkBegin + myChunk; ++u) {
+        const T* gu = g + u * inner ;
+        A sum = A(0.) ;
+        if (Relu) {
+          const T* fu = features + u * inner ;
+          T* bu = backprop + u * inner ;
+          for (int64_t i = 0; i < inner; ++i) {
+            const A v = V::load(fu[i]) > A(0.) ? V::load(gu[i]) : A(0.) ;
+            bu[i] = V::store(v) ;
+            sum += v ;
+          }
+        } else {
+          for (int64_t i = 0; i < inner; ++i)
+            sum += V::load(gu[i]) ;
+        }
+        my[u % channel] += sum ;
+      }
+    }
+
+#pragma omp barrier
+
+    int64_t cchunkSize = channel / nthreads ;
+    int64_t cremain    = channel % nthreads ;
+
+    int64_t cchunkBegin = cchunkSize * threadid + ( threadid < cremain ? threadid : cremain ) ;
+    int64_t cmyChunk    = cchunkSize + ( threadid < cremain ? 1 : 0 ) ;
+
+    for (int64_t c = cchunkBegin; c < cchunkBegin + cmyChunk; ++c) {
+      A sum = A(0.) ;
+      for (int64_t t = 0; t < nthreads; ++t)
+        sum += part[t * channel + c] ;
+      bias_backprop[c] = V::store(sum) ;
+    }
+  }
+}
+
+template<typename T>
+int bias_op(bool grad, uint64_t in, uint64_t bias, uint64_t out, const BiasShape& s)
+{
+  if (grad)
+    bias_grad<T, false>(reinterpret_cast<const T*>(in), NULL, NULL,
+                        reinterpret_cast<T*>(out), s) ;
+  else
+    bias_add<T>(reinterpret_cast<const T*>(in), reinterpret_cast<const T*>(bias),
+                reinterpret_cast<T*>(out), s) ;
+  return 0 ;
+}
+
+// BiasAdd (grad = false) or BiasAddGrad (grad = true, in is the output
+// backprop, out the bias backprop) for every supported dtype
+int bias_op(int dtype, bool grad, uint64_t in, uint64_t bias, uint64_t out,
+            const BiasShape& s)
+{
+  if (dtype == DT_FLOAT)
+    return bias_op<float>(grad, in, bias, out, s) ;
+  else if (dtype == DT_DOUBLE)
+    return bias_op<double>(grad, in, bias, out, s) ;
+  else if (dtype == DT_BFLOAT16)
+    return bias_op<bfloat16_t>(grad, in, bias, out, s) ;
+  return 1 ;
+}
+
+// The host sends either (batch, width, height, channel) for a rank-4
+// tensor, or the rank and dims of a tensor of rank 2 to 8.
+struct BiasTensorShape {
+  int32_t dims;
+  int64_t dim_size[8];
+};
+
+BiasShape bias_shape_4d(int data_format, int batch, int width, int height, int channel)
+{
+  BiasShape s ;
+  s.channel = channel ;
+  if (data_format == FORMAT_NCHW) {
+    s.outer = batch ;
+    s.inner = int64_t(height) * width ;
+  } else {
+    s.outer = int64_t(batch) * height * width ;
+    s.inner = 1 ;
+  }
+  return s ;
+}
+
+} // namespace
+
 namespace {
 
 template<typename T>
@@ -345,7 +577,7 @@ inline int BiasAdd_NCHW<float>(uint64_t out, uint64_t in, uint64_t bias, int bat
 
 int op_BiasAdd(const void* args, size_t len)
 {
-  LOG(1) << __FUNCTION__;
+  LOG(2) << __FUNCTION__ << " begin";
   struct Args {
     int dtype;
     int data_format;
@@ -358,10 +590,38 @@ int op_BiasAdd(const void* args, size_t len)
     int channel;
   } const* p;
 
+  struct ArgsNd {
+    int dtype;
+    int data_format;
+    uint64_t in;
+    uint64_t bias;
+    uint64_t out;
+    BiasTensorShape shape;
+  };
+
+  if (len == sizeof(ArgsNd)) {
+    const ArgsNd* q = reinterpret_cast<const ArgsNd*>(args);
+    int ret = 1 ;
+    BiasShape s ;
+    if (get_bias_shape(q->data_format, q->shape.dims, q->shape.dim_size, s) == 0)
+      ret = bias_op(q->dtype, false, q->in, q->bias, q->out, s) ;
+    LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+    return ret ;
+  }
+
   CHECK_ARG_LEN(len, sizeof(Args));
 
   p = reinterpret_cast<const Args*>(args);
 
+  if (p->dtype != DT_FLOAT) {
+    int ret = 1 ;
+    if (p->data_format == FORMAT_NHWC || p->data_format == FORMAT_NCHW)
+      ret = bias_op(p->dtype, false, p->in, p->bias, p->out,
+                    bias_shape_4d(p->data_format, p->batch, p->width, p->height, p->channel)) ;
+    LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+    return ret ;
+  }
+
   int r = 1 ;
 
   if (p->dtype == DT_FLOAT && p->data_format == FORMAT_NHWC) {
@@ -410,37 +670,20 @@ int op_BiasAdd(const void* args, size_t len)
     }
   }
 
+  LOG(2) << __FUNCTION__ << " end. ret=" << r;
   return r;
 }
 
+
 #ifndef LIBVETF_INTRINSIC
 namespace {
 
 template<typename T>
 int BiasAddGrad_NHWC(uint64_t output, uint64_t output_backprop, int batch, int width, int height, int channel)
 {
-  T* pout = reinterpret_cast<T*>(output);
-  const T* pin = reinterpret_cast<const T*>(output_backprop);
-
-  memset(pout, 0, sizeof(T) * channel);
-
-  for (int b = 0; b < batch; ++b) {
-    for (int y = 0; y < height; ++y) {
-      for (int x = 0; x < width; ++x) {
-        for (int c = 0; c < channel; ++c) {
-          int i
-            = b * height * width * channel
-            + y * width * channel
-            + x * channel;
-          pout[c] += pin[i + c];
-        }
-      }
-    }
-  }
-
-#if 0
-  fprintf(stderr, "%s done\n", __PRETTY_FUNCTION__);
-#endif
+  bias_grad<T, false>(reinterpret_cast<const T*>(output_backprop), NULL, NULL,
+                      reinterpret_cast<T*>(output),
+                      bias_shape_4d(FORMAT_NHWC, batch, width, height, channel)) ;
   return 0;
 }
 
@@ -448,22 +691,9 @@ int BiasAddGrad_NHWC(uint64_t output, uint64_t output_backprop, int batch, int w
 template<typename T>
 int BiasAddGrad_NCHW(uint64_t output, uint64_t output_backprop, int batch, int width, int height, int channel)
 {
-  T* pout = reinterpret_cast<T*>(output);
-  const T* pin = reinterpret_cast<const T*>(output_backprop);
-
-  memset(pout, 0, sizeof(T) * channel);
-
-  for (int b = 0; b < batch; ++b) {
-    for (int c = 0; c < channel; ++c) {
-      for (int i = 0; i < width * height; ++i) {
-        pout[c] += pin[b * channel * height * width + c * height * width + i];
-      }
-    }
-  }
-
-#if 0
-  fprintf(stderr, "%s done\n", __PRETTY_FUNCTION__);
-#endif
+  bias_grad<T, false>(reinterpret_cast<const T*>(output_backprop), NULL, NULL,
+                      reinterpret_cast<T*>(output),
+                      bias_shape_4d(FORMAT_NCHW, batch, width, height, channel)) ;
   return 0;
 }
 
@@ -471,7 +701,7 @@ int BiasAddGrad_NCHW(uint64_t output, uint64_t output_backprop, int batch, int w
 #endif
 int op_BiasAddGrad(const void* args, size_t len)
 {
-  LOG(2) << __FUNCTION__;
+  LOG(2) << __FUNCTION__ << " begin";
   struct Args{
     int dtype;
     int data_format;
@@ -483,23 +713,50 @@ int op_BiasAddGrad(const void* args, size_t len)
     int channel;
   } const* p;
 
+  struct ArgsNd {
+    int dtype;
+    int data_format;
+    uint64_t output_backprop;
+    uint64_t output;
+    BiasTensorShape shape;
+  };
+
+  if (len == sizeof(ArgsNd)) {
+    const ArgsNd* q = reinterpret_cast<const ArgsNd*>(args);
+    int ret = 1 ;
+    BiasShape s ;
+    if (get_bias_shape(q->data_format, q->shape.dims, q->shape.dim_size, s) == 0)
+      ret = bias_op(q->dtype, true, q->output_backprop, 0, q->output, s) ;
+    LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+    return ret ;
+  }
+
   CHECK_ARG_LEN(len, sizeof(Args));
 
   p = reinterpret_cast<const Args*>(args);
 
+  if (p->dtype != DT_FLOAT) {
+    int ret = 1 ;
+    if (p->data_format == FORMAT_NHWC || p->data_format == FORMAT_NCHW)
+      ret = bias_op(p->dtype, true, p->output_backprop, 0, p->output,
+                    bias_shape_4d(p->data_format, p->batch, p->width, p->height, p->channel)) ;
+    LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+    return ret ;
+  }
+
 #if 0
   fprintf(stderr, "%s dtype=%d data_format=%d batch=%d width=%d height=%d channel=%d\n", 
           __FUNCTION__, p->dtype, p->data_format, p->batch, p->width, p->height, p->channel);
 #endif
 
+  int r = 1;
 #ifndef LIBVETF_INTRINSIC
   if (p->dtype == DT_FLOAT && p->data_format == FORMAT_NHWC) {
-    return BiasAddGrad_NHWC<float>(p->output, p->output_backprop, p->batch, p->width, p->height, p->channel);
+    r = BiasAddGrad_NHWC<float>(p->output, p->output_backprop, p->batch, p->width, p->height, p->channel);
   } else if (p->dtype == DT_FLOAT && p->data_format == FORMAT_NCHW) {
-    return BiasAddGrad_NCHW<float>(p->output, p->output_backprop, p->batch, p->width, p->height, p->channel);
+    r = BiasAddGrad_NCHW<float>(p->output, p->output_backprop, p->batch, p->width, p->height, p->channel);
   }
 #else
-int r;
   if (p->dtype == DT_FLOAT && p->data_format == FORMAT_NHWC) {
 #ifdef SET_TIMER
   unsigned long long start = __veperf_get_stm();
@@ -519,11 +776,10 @@ int r;
   printf("grad chw, nchw %d %d %d %d:%lfms\n",p->batch,p->channel,p->width, p->height,(end-start)/(800e3));
 #endif
   }
-  return r;
 #endif
 
-  LOG(2) << __FUNCTION__ << " done";
-  return 1;
+  LOG(2) << __FUNCTION__ << " end. ret=" << r;
+  return r;
 }
 
 //
@@ -577,6 +833,63 @@ int op_ReluGrad(const void* args, size_t len)
   return 1;
 }
 
+//
+// ReluBiasAddGrad
+//
+// ReluGrad followed by BiasAddGrad, as in the backward pass of a conv or
+// dense layer with relu:
+//
+//   backprop      = features > 0 ? gradients : 0
+//   bias_backprop = BiasAddGrad(backprop)
+//
+// Both outputs are written in one pass over gradients and features, so
+// backprop is not read back for the bias gradient.
+//
+
+int op_ReluBiasAddGrad(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+  struct Args {
+    int dtype;
+    int data_format;
+    uint64_t gradients;
+    uint64_t features;
+    uint64_t backprop;
+    uint64_t bias_backprop;
+    int batch;
+    int width;
+    int height;
+    int channel;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  if (p->data_format != FORMAT_NHWC && p->data_format != FORMAT_NCHW)
+    return 1 ;
+  const BiasShape s = bias_shape_4d(p->data_format, p->batch, p->width, p->height, p->channel) ;
+
+  int ret = 1 ;
+  if (p->dtype == DT_FLOAT) {
+    bias_grad<float, true>(reinterpret_cast<const float*>(p->gradients),
+                           reinterpret_cast<const float*>(p->features),
+                           reinterpret_cast<float*>(p->backprop),
+                           reinterpret_cast<float*>(p->bias_backprop),
+                           s) ;
+    ret = 0 ;
+  } else if (p->dtype == DT_DOUBLE) {
+    bias_grad<double, true>(reinterpret_cast<const double*>(p->gradients),
+                            reinterpret_cast<const double*>(p->features),
+                            reinterpret_cast<double*>(p->backprop),
+                            reinterpret_cast<double*>(p->bias_backprop),
+                            s) ;
+    ret = 0 ;
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
 
 int op_Snapshot(const void* arg, size_t len)
 {
@@ -662,6 +975,47 @@ int op_Neg(const void* args, size_t len)
   return 0;
 }
 
+//
+// LogicalNot
+//
+
+int op_LogicalNot(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct _Tensor {
+    int dtype;
+    int data_format;
+    uint64_t addr;
+    int32_t dims;
+    int64_t nelems;
+    int64_t dim_size[8];
+  };
+
+  struct Args {
+    _Tensor in;
+    _Tensor out;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  if (p->in.dtype != DT_BOOL || p->out.dtype != DT_BOOL)
+    return 1;
+
+  bool* po = reinterpret_cast<bool*>(p->out.addr);
+  const bool* pi = reinterpret_cast<const bool*>(p->in.addr);
+  const int64_t n = p->in.nelems;
+
+#pragma omp parallel for if (n >= 64 * 1024)
+  for (int64_t i = 0; i < n; ++i) {
+    po[i] = !pi[i];
+  }
+
+  LOG(2) << __FUNCTION__ << " end";
+  return 0;
+}
+
 //
 // Floor
 //
@@ -763,14 +1117,14 @@ int op_Reciprocal(const void* args, size_t len)
 //
 
 namespace {
-template<typename Tin, typename Tout>
+template<typename Tin, typename Tout, typename M>
   void op_log(uint64_t out, uint64_t in, size_t nelems)
   {
     Tout* po = reinterpret_cast<Tout*>(out);
     const Tin* pi = reinterpret_cast<Tin*>(in);
 
     for (int64_t i = 0; i < nelems; ++i) {
-      po[i] = std::log(pi[i]) ;
+      po[i] = M::log(pi[i]) ;
     }
   }
 }
@@ -797,7 +1151,10 @@ int op_Log(const void* args, size_t len)
   p = reinterpret_cast<const Args*>(args);
 
   if (p->in.dtype == DT_FLOAT || p->out.dtype == DT_FLOAT) {
-    op_log<float, float>(p->out.addr, p->in.addr, p->in.nelems);
+    if (vmath_use_fast("Log"))
+      op_log<float, float, VMathFast>(p->out.addr, p->in.addr, p->in.nelems);
+    else
+      op_log<float, float, VMathAccurate>(p->out.addr, p->in.addr, p->in.nelems);
   } else {
     return 1;
   }
@@ -812,14 +1169,14 @@ int op_Log(const void* args, size_t len)
 //
 
 namespace {
-template<typename Tin, typename Tout>
+template<typename Tin, typename Tout, typename M>
   void op_exp(uint64_t out, uint64_t in, size_t nelems)
   {
     Tout* po = reinterpret_cast<Tout*>(out);
     const Tin* pi = reinterpret_cast<Tin*>(in);
 
     for (int64_t i = 0; i < nelems; ++i) {
-      po[i] = std::exp(pi[i]) ;
+      po[i] = M::exp(pi[i]) ;
     }
   }
 }
@@ -846,7 +1203,10 @@ int op_Exp(const void* args, size_t len)
   p = reinterpret_cast<const Args*>(args);
 
   if (p->in.dtype == DT_FLOAT || p->out.dtype == DT_FLOAT) {
-    op_exp<float, float>(p->out.addr, p->in.addr, p->in.nelems);
+    if (vmath_use_fast("Exp"))
+      op_exp<float, float, VMathFast>(p->out.addr, p->in.addr, p->in.nelems);
+    else
+      op_exp<float, float, VMathAccurate>(p->out.addr, p->in.addr, p->in.nelems);
   } else {
     return 1;
   }
@@ -860,15 +1220,14 @@ int op_Exp(const void* args, size_t len)
 // Sigmoid
 //
 namespace {
-  template<typename Tin, typename Tout>
+  template<typename Tin, typename Tout, typename M>
   int op_sigmoid(uint64_t out, uint64_t in, size_t nelems)
   {
     Tout* po = reinterpret_cast<Tout*>(out);
     const Tin* pi = reinterpret_cast<Tin*>(in);
 
     for (int64_t i = 0; i < nelems; ++i) {
-      const Tout One = Tout(1.) ;
-      po[i] = One / (One + std::exp(-pi[i])) ;
+      po[i] = M::sigmoid(pi[i]) ;
     }
     return 0;
   }
@@ -896,7 +1255,10 @@ int op_Sigmoid(const void* args, size_t len)
   p = reinterpret_cast<const Args*>(args);
 
   if (p->in.dtype == DT_FLOAT || p->out.dtype == DT_FLOAT) {
-    op_sigmoid<float, float>(p->out.addr, p->in.addr, p->in.nelems);
+    if (vmath_use_fast("Sigmoid"))
+      op_sigmoid<float, float, VMathFast>(p->out.addr, p->in.addr, p->in.nelems);
+    else
+      op_sigmoid<float, float, VMathAccurate>(p->out.addr, p->in.addr, p->in.nelems);
   } else {
     return 1;
   }
@@ -909,14 +1271,14 @@ int op_Sigmoid(const void* args, size_t len)
 // Tanh
 //
 namespace {
-  template<typename Tin, typename Tout>
+  template<typename Tin, typename Tout, typename M>
   int op_tanh(uint64_t out, uint64_t in, size_t nelems)
   {
     Tout* po = reinterpret_cast<Tout*>(out);
     const Tin* pi = reinterpret_cast<Tin*>(in);
 
     for (int64_t i = 0; i < nelems; ++i) {
-      po[i] = std::tanh(pi[i]) ;
+      po[i] = M::tanh(pi[i]) ;
     }
     return 0;
   }
@@ -944,7 +1306,10 @@ int op_Tanh(const void* args, size_t len)
   p = reinterpret_cast<const Args*>(args);
 
   if (p->in.dtype == DT_FLOAT || p->out.dtype == DT_FLOAT) {
-    op_tanh<float, float>(p->out.addr, p->in.addr, p->in.nelems);
+    if (vmath_use_fast("Tanh"))
+      op_tanh<float, float, VMathFast>(p->out.addr, p->in.addr, p->in.nelems);
+    else
+      op_tanh<float, float, VMathAccurate>(p->out.addr, p->in.addr, p->in.nelems);
   } else {
     return 1;
   }
@@ -1307,6 +1672,9 @@ int op_MatMul(const void* args, size_t len)
 //
 // Softmax
 //
+// Softmax and LogSoftmax along the last axis. The host passes the outer dims
+// collapsed into batch_size, so any rank is handled. See softmax_functor.h.
+//
 
 int op_Softmax(const void* args, size_t len)
 {
@@ -1329,71 +1697,91 @@ int op_Softmax(const void* args, size_t len)
   LOG(2) << __FUNCTION__ << " dim[0]=" << p->batch_size \
 	  << " dim[1]=" << p->num_classes;
 
+  const bool fast = vmath_use_fast(p->bool_log ? "LogSoftmax" : "Softmax") ;
+
   if (p->dtype == DT_FLOAT) {
-    const float* in = reinterpret_cast<const float*>(p->in);
-    float* out = reinterpret_cast<float*>(p->out);
-
-    if( p->bool_log ) {
-#if 1	// use vednn
-      return vednnSoftmaxForward( VEDNN_SOFTMAX_LOG,
-                                 (void *)(p->in), (void*)(p->out),
-                                 p->batch_size, p->num_classes) ;
-#else
-      // LogSoftmax
-      for(uint64_t b=0; b<p->batch_size; b++) {
-        float max = -FLT_MAX ;
-        for(uint64_t i=0; i<p->num_classes; i++) {
-           if( max < in[i] ) max = in[i] ;
-        }
+    ret = fast
+      ? softmax_forward<float, VMathFast>(reinterpret_cast<const float*>(p->in),
+                                          reinterpret_cast<float*>(p->out),
+                                          p->batch_size, p->num_classes, p->bool_log)
+      : softmax_forward<float, VMathAccurate>(reinterpret_cast<const float*>(p->in),
+                                              reinterpret_cast<float*>(p->out),
+                                              p->batch_size, p->num_classes, p->bool_log) ;
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    ret = fast
+      ? softmax_forward<double, VMathFast>(reinterpret_cast<const double*>(p->in),
+                                           reinterpret_cast<double*>(p->out),
+                                           p->batch_size, p->num_classes, p->bool_log)
+      : softmax_forward<double, VMathAccurate>(reinterpret_cast<const double*>(p->in),
+                                               reinterpret_cast<double*>(p->out),
+                                               p->batch_size, p->num_classes, p->bool_log) ;
+  }
+  
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
 
-        float sum = 0.f ;
-        for(uint64_t i=0; i<p->num_classes; i++) {
-          const float shifted_in = in[i] - max ; 
-          sum += std::exp(shifted_in) ;
-          out[i] = shifted_in ;
-        }
+//
+// SoftmaxGrad / LogSoftmaxGrad
+//
+// y is the output of the forward op, dy the incoming gradient.
+//
 
-        float log_sum = logf(sum) ;
-        for(uint64_t i=0; i<p->num_classes; i++) {
-          out[i] -= log_sum ;
-        }
+namespace {
+int softmax_grad_op(const void* args, size_t len, bool log)
+{
+  struct Args {
+    int dtype;
+    uint64_t y;
+    uint64_t dy;
+    uint64_t dx;
+    uint64_t batch_size;
+    uint64_t num_classes;
+  } const* p;
 
-        in  += p->num_classes ; 
-        out += p->num_classes ; 
-      }
-#endif
-    }
-    else {
-#if 1	// use vednn
-      return vednnSoftmaxForward( VEDNN_SOFTMAX_ACCURATE,
-                                 (void *)(p->in), (void*)(p->out),
-                                 p->batch_size, p->num_classes) ;
-#else
-      // Softmax
-      for(uint64_t b=0; b<p->batch_size; b++) {
-        float max = -FLT_MAX ;
-        for(uint64_t i=0; i<p->num_classes; i++) {
-          if( max < in[i] ) max = in[i] ;
-        }
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
 
-        float sum = 0.f ;
-        for(uint64_t i=0; i<p->num_classes; i++) {
-          sum += (out[i] = std::exp(in[i]-max)) ;
-        }
+  LOG(2) << __FUNCTION__ << " dim[0]=" << p->batch_size \
+	  << " dim[1]=" << p->num_classes;
 
-        float inv_sum = 1.f / sum ;
-        for(uint64_t i=0; i<p->num_classes; i++) {
-          out[i] *= inv_sum ;
-        }
+  // only LogSoftmaxGrad evaluates exp
+  const bool fast = log && vmath_use_fast("LogSoftmaxGrad") ;
 
-        in  += p->num_classes ; 
-        out += p->num_classes ; 
-      }
-#endif
-    }
-    ret = 0 ;
+  int ret = 1 ;
+  if (p->dtype == DT_FLOAT) {
+    const float* y = reinterpret_cast<const float*>(p->y) ;
+    const float* dy = reinterpret_cast<const float*>(p->dy) ;
+    float* dx = reinterpret_cast<float*>(p->dx) ;
+    ret = fast
+      ? softmax_grad<float, VMathFast>(y, dy, dx, p->batch_size, p->num_classes, log)
+      : softmax_grad<float, VMathAccurate>(y, dy, dx, p->batch_size, p->num_classes, log) ;
   }
-  
+  else if (p->dtype == DT_DOUBLE) {
+    const double* y = reinterpret_cast<const double*>(p->y) ;
+    const double* dy = reinterpret_cast<const double*>(p->dy) ;
+    double* dx = reinterpret_cast<double*>(p->dx) ;
+    ret = fast
+      ? softmax_grad<double, VMathFast>(y, dy, dx, p->batch_size, p->num_classes, log)
+      : softmax_grad<double, VMathAccurate>(y, dy, dx, p->batch_size, p->num_classes, log) ;
+  }
+  return ret ;
+}
+} // namespace
+
+int op_SoftmaxGrad(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+  int ret = softmax_grad_op(args, len, false) ;
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
+int op_LogSoftmaxGrad(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+  int ret = softmax_grad_op(args, len, true) ;
   LOG(2) << __FUNCTION__ << " end. ret=" << ret;
   return ret;
 }
@@ -1401,22 +1789,8 @@ int op_Softmax(const void* args, size_t len)
 //
 // Pack
 //
-
-template<typename T>
-  int pack(uint64_t n, uint64_t l, uint64_t *in, uint64_t out)
-  {
-    const T** pi = reinterpret_cast<const T**>(in);
-    T* po = reinterpret_cast<T*>(out);
-
-    for(int64_t i=0; i<n; i++) {
-      for(int64_t j=0; j<l; j++) {
-        po[j] = pi[i][j] ;
-      }
-      po += l ;
-    }
-
-    return 0 ;
-  }
+// n inputs of l elements each are stacked into out.
+//
 
 int op_Pack(const void* args, size_t len)
 {
@@ -1434,11 +1808,16 @@ int op_Pack(const void* args, size_t len)
 
   p = reinterpret_cast<const Args*>(args);
 
-  if (p->dtype == DT_FLOAT) {
-    ret = pack<float>(p->n, p->l, (uint64_t*)&p->in[0], p->out) ;
-  }
-  else if (p->dtype == DT_INT32) {
-    ret = pack<int32_t>(p->n, p->l, (uint64_t*)&p->in[0], p->out) ;
+  const int elem_size = DataTypeSize(p->dtype) ;
+  if (elem_size > 0) {
+    std::vector<StridedCopyBlock> blocks(p->n) ;
+    for(int64_t i=0; i<p->n; i++) {
+      blocks[i] = strided_copy_2d(reinterpret_cast<const void*>(p->in[i]),
+                                  reinterpret_cast<char*>(p->out) + i * p->l * elem_size,
+                                  1, p->l, p->l, p->l) ;
+    }
+    strided_copy(blocks.data(), p->n, elem_size) ;
+    ret = 0 ;
   }
 
   LOG(2) << __FUNCTION__ << " end. ret=" << ret;
@@ -1450,121 +1829,8 @@ int op_Pack(const void* args, size_t len)
 //
 // Slice
 //
-template <typename T>
-int slice1(uint64_t input_ptr, uint64_t output_ptr,
-           uint64_t input_size, uint64_t output_size, uint64_t index) 
-{
-  const T* pi = reinterpret_cast<const T*>(input_ptr);
-  T* po = reinterpret_cast<T*>(output_ptr);
-
-  const T* pi_ = pi + index ;
-  for(int i=0; i<output_size; i++) {
-    po[i] = pi_[i] ;
-  }
-
-  return 0 ;
-} 
-
-template <typename T>
-int slice2(uint64_t input_ptr, uint64_t output_ptr,
-           uint64_t *input_size, uint64_t *output_size, uint64_t *index) 
-{
-  const T* pi = reinterpret_cast<const T*>(input_ptr);
-  T* po = reinterpret_cast<T*>(output_ptr);
-
-  for(size_t i0=0; i0<output_size[0]; i0++) {
-    const size_t ii0 = i0+index[0];
-    const size_t io0 = i0 ;
-    for(size_t i1=0; i1<output_size[1]; i1++) {
-      const size_t ii1 = ii0 * input_size[1] + index[1] + i1 ;
-      const size_t io1 = io0 * output_size[1] + i1 ;
-      po[io1] = pi[ii1] ;
-    }
-  }
-
-  return 0 ;
-}
-
-template <typename T>
-int slice3(uint64_t input_ptr, uint64_t output_ptr,
-           uint64_t *input_size, uint64_t *output_size, uint64_t *index)
-{
-  const T* pi = reinterpret_cast<const T*>(input_ptr);
-  T* po = reinterpret_cast<T*>(output_ptr);
-
-  for(size_t i0=0; i0<output_size[0]; i0++) {
-    const size_t ii0 = i0+index[0];
-    const size_t io0 = i0 ;
-    for(size_t i1=0; i1<output_size[1]; i1++) {
-      const size_t ii1 = ii0 * input_size[1] + index[1] + i1 ;
-      const size_t io1 = io0 * output_size[1] + i1 ;
-      for(size_t i2=0; i2<output_size[2]; i2++) {
-        const size_t ii2 = ii1 * input_size[2] + index[2] + i2 ;
-        const size_t io2 = io1 * output_size[2] + i2 ;
-        po[io2] = pi[ii2] ;
-      }
-    }
-  }
-  return 0 ;
-} 
-
-template <typename T>
-int slice4(uint64_t input_ptr, uint64_t output_ptr,
-           uint64_t *input_size, uint64_t *output_size, uint64_t *index)
-{
-  const T* pi = reinterpret_cast<const T*>(input_ptr);
-  T* po = reinterpret_cast<T*>(output_ptr);
-
-  for(size_t i0=0; i0<output_size[0]; i0++) {
-    const size_t ii0 = i0+index[0];
-    const size_t io0 = i0 ;
-    for(size_t i1=0; i1<output_size[1]; i1++) {
-      const size_t ii1 = ii0 * input_size[1] + index[1] + i1 ;
-      const size_t io1 = io0 * output_size[1] + i1 ;
-      for(size_t i2=0; i2<output_size[2]; i2++) {
-        const size_t ii2 = ii1 * input_size[2] + index[2] + i2 ;
-        const size_t io2 = io1 * output_size[2] + i2 ;
-        for(size_t i3=0; i3<output_size[3]; i3++) {
-          const size_t ii3 = ii2 * input_size[3] + index[3] + i3 ;
-          const size_t io3 = io2 * output_size[3] + i3 ;
-          po[io3] = pi[ii3] ;
-        }
-      }
-    }
-  }
-  return 0 ;
-}
-
-template <typename T>
-int slice_handle(uint64_t input_dims, uint64_t input_ptr, uint64_t output_ptr, uint64_t *array) 
-{
-  int ret=1 ;
-  switch( input_dims ) {
-  case 1 :
-    ret = slice1<T>(input_ptr, output_ptr, array[0], array[1], array[2]) ;
-    break ;
-  case 2 :
-    ret = slice2<T>(input_ptr, output_ptr, array, array+2, array+4) ;
-    break ;
-  case 3 :
-    ret = slice3<T>(input_ptr, output_ptr, array, array+3, array+6) ;
-    break ;
-  case 4 :
-    ret = slice4<T>(input_ptr, output_ptr, array, array+4, array+8) ;
-    break ;
-#if 0 // todo : add larger dim
-  case 5 :
-    break ;
-  case 6 :
-    break ;
-  case 7 :
-    break ;
-#endif
-  default :
-    break ;
-  }
-  return ret ;
-}
+// array holds input_size[input_dims], output_size[input_dims] and
+// index[input_dims]. The slice is a single block copy.
 //
 int op_Slice(const void* args, size_t len)
 {
@@ -1582,16 +1848,33 @@ int op_Slice(const void* args, size_t len)
 
   p = reinterpret_cast<const Args*>(args);
 
-  if (p->dtype == DT_FLOAT) {
-    ret = slice_handle<float>(p->input_dims, p->input_ptr, p->output_ptr, (uint64_t*) p->array) ;
-  }
-  else if (p->dtype == DT_INT32) {
-    ret = slice_handle<int32_t>(p->input_dims, p->input_ptr, p->output_ptr, (uint64_t*) p->array) ;
-  }
-  else if (p->dtype == DT_DOUBLE) {
-    ret = slice_handle<double>(p->input_dims, p->input_ptr, p->output_ptr, (uint64_t*) p->array) ;
+  const int elem_size = DataTypeSize(p->dtype) ;
+  const int64_t dims = p->input_dims ;
+
+  if (elem_size > 0 && dims > 0 && dims <= STRIDED_COPY_MAX_DIMS) {
+    const uint64_t* input_size  = p->array ;
+    const uint64_t* output_size = p->array + dims ;
+    const uint64_t* index       = p->array + 2 * dims ;
+
+    StridedCopyBlock blk ;
+    blk.dst = reinterpret_cast<void*>(p->output_ptr) ;
+    blk.ndims = dims ;
+
+    int64_t offset = 0 ;
+    int64_t is = 1, os = 1 ;
+    for (int64_t k = dims - 1; k >= 0; --k) {
+      blk.shape[k] = output_size[k] ;
+      blk.src_stride[k] = is ;
+      blk.dst_stride[k] = os ;
+      offset += index[k] * is ;
+      is *= input_size[k] ;
+      os *= output_size[k] ;
+    }
+    blk.src = reinterpret_cast<const char*>(p->input_ptr) + offset * elem_size ;
+
+    strided_copy(&blk, 1, elem_size) ;
+    ret = 0 ;
   }
-  
 
   LOG(2) << __FUNCTION__ << " end. ret=" << ret;
   return ret ; 
@@ -0,0 +1,96 @@
+#ifndef PHILOX_H_
+#define PHILOX_H_
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "vmath.h"
+
+//
+// Philox4x32-10 counter-based random number generator (Salmon et al.,
+// "Parallel Random Numbers: As Easy as 1, 2, 3"), as used by TensorFlow.
+//
+// A 64-bit key and a 128-bit counter map to 4 random uint32 values with no
+// state in between, so block i of a stream can be computed by any thread
+// and the output does not depend on how the work is split. The key is the
+// op seed. The counter is (offset + block, seed2), where offset is the
+// number of blocks the host has already consumed from this stream.
+//
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+struct PhiloxKey {
+  uint32_t k0, k1;
+};
+
+inline PhiloxKey philox_key(uint64_t seed)
+{
+  PhiloxKey key;
+  key.k0 = static_cast<uint32_t>(seed);
+  key.k1 = static_cast<uint32_t>(seed >> 32);
+  return key;
+}
+
+// block: low 64 bits of the counter, seed2: high 64 bits
+inline void philox4x32_10(PhiloxKey key, uint64_t block, uint64_t seed2,
+                          uint32_t out[4])
+{
+  uint32_t c0 = static_cast<uint32_t>(block);
+  uint32_t c1 = static_cast<uint32_t>(block >> 32);
+  uint32_t c2 = static_cast<uint32_t>(seed2);
+  uint32_t c3 = static_cast<uint32_t>(seed2 >> 32);
+  uint32_t k0 = key.k0;
+  uint32_t k1 = key.k1;
+
+  for (int r = 0; r < 10; ++r) {
+    const uint64_t p0 = static_cast<uint64_t>(PHILOX_M0) * c0;
+    const uint64_t p1 = static_cast<uint64_t>(PHILOX_M1) * c2;
+    const uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+    const uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+    c1 = static_cast<uint32_t>(p1);
+    c3 = static_cast<uint32_t>(p0);
+    c0 = n0;
+    c2 = n2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// uniform in [0, 1) from the 23 (52) low bits
+inline float philox_to_float(uint32_t x)
+{
+  const uint32_t u = (x & 0x7fffffu) | 0x3f800000u;
+  float f;
+  memcpy(&f, &u, 4);
+  return f - 1.0f;
+}
+
+inline double philox_to_double(uint32_t lo, uint32_t hi)
+{
+  const uint64_t u = ((static_cast<uint64_t>(hi) << 32 | lo) & 0xfffffffffffffull)
+                     | 0x3ff0000000000000ull;
+  double d;
+  memcpy(&d, &u, 8);
+  return d - 1.0;
+}
+
+// Box-Muller: two uniforms to two standard normals. log goes through the
+// math tier M of vmath.h.
+template <typename M, typename T>
+inline void philox_box_muller(T u1, T u2, T& z0, T& z1)
+{
+  const T epsilon = T(1.0e-7);
+  if (u1 < epsilon) u1 = epsilon;
+  const T v = T(2.0 * M_PI) * u2;
+  const T r = std::sqrt(T(-2.0) * M::log(u1));
+  z0 = r * std::sin(v);
+  z1 = r * std::cos(v);
+}
+
+#endif // PHILOX_H_
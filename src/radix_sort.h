@@ -0,0 +1,139 @@
+#ifndef RADIX_SORT_H_
+#define RADIX_SORT_H_
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+
+//
+// Parallel LSD radix sort of integer keys with an optional payload.
+//
+// Keys are sorted by RADIX_BITS digits, least significant first. Each pass
+//
+//   1. counts the digits of every thread's chunk of keys,
+//   2. turns the counts into the start of each (digit, thread) bucket,
+//      digit-major, so that every pass is stable,
+//   3. scatters every thread's chunk to its buckets.
+//
+// A pass whose digit is the same for all keys is skipped, which for
+// indices far below the range of the key type is most of them. Signed keys
+// are sorted with their sign bit flipped.
+//
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+// Below this many keys the sort runs on a single thread.
+#define RADIX_PARALLEL_MIN (64*1024)
+
+template <typename Key> struct RadixKey {};
+
+template <> struct RadixKey<int32_t> {
+  typedef uint32_t U ;
+  static U bits(int32_t k) { return static_cast<uint32_t>(k) ^ 0x80000000u ; }
+};
+
+template <> struct RadixKey<uint32_t> {
+  typedef uint32_t U ;
+  static U bits(uint32_t k) { return k ; }
+};
+
+template <> struct RadixKey<int64_t> {
+  typedef uint64_t U ;
+  static U bits(int64_t k) { return static_cast<uint64_t>(k) ^ 0x8000000000000000ull ; }
+};
+
+template <> struct RadixKey<uint64_t> {
+  typedef uint64_t U ;
+  static U bits(uint64_t k) { return k ; }
+};
+
+// Sorts keys[0, n) in ascending order and moves values (if not null) along.
+// key_buf and value_buf are scratch arrays of n elements.
+template <typename Key, typename Value>
+void radix_sort(Key* keys, Value* values, int64_t n, Key* key_buf, Value* value_buf)
+{
+  typedef typename RadixKey<Key>::U U ;
+
+  if (n <= 1)
+    return ;
+
+  const bool parallel = n >= RADIX_PARALLEL_MIN ;
+
+  // bits that differ between keys
+  U all_or = 0, all_and = ~U(0) ;
+#pragma omp parallel for if (parallel) reduction(|:all_or) reduction(&:all_and)
+  for (int64_t i = 0; i < n; ++i) {
+    const U b = RadixKey<Key>::bits(keys[i]) ;
+    all_or |= b ;
+    all_and &= b ;
+  }
+  const U diff = all_or ^ all_and ;
+
+  const int nthreads_max = parallel ? omp_get_max_threads() : 1 ;
+  std::vector<int64_t> count(nthreads_max * RADIX_SIZE) ;
+
+  Key* src_k = keys ;
+  Key* dst_k = key_buf ;
+  Value* src_v = values ;
+  Value* dst_v = value_buf ;
+
+  for (int shift = 0; shift < 8 * (int)sizeof(Key); shift += RADIX_BITS) {
+    if (((diff >> shift) & (RADIX_SIZE - 1)) == 0)
+      continue ;
+
+#pragma omp parallel if (parallel)
+    {
+      int64_t nthreads = omp_get_num_threads() ;
+      int64_t threadid = omp_get_thread_num() ;
+
+      int64_t chunkSize = n / nthreads ;
+      int64_t remain    = n % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      int64_t* c = count.data() + threadid * RADIX_SIZE ;
+      for (int d = 0; d < RADIX_SIZE; ++d)
+        c[d] = 0 ;
+      for (int64_t i = chunkBegin; i < chunkBegin + myChunk; ++i)
+        ++c[(RadixKey<Key>::bits(src_k[i]) >> shift) & (RADIX_SIZE - 1)] ;
+
+#pragma omp barrier
+#pragma omp single
+      {
+        int64_t offset = 0 ;
+        for (int d = 0; d < RADIX_SIZE; ++d) {
+          for (int64_t t = 0; t < nthreads; ++t) {
+            const int64_t tmp = count[t * RADIX_SIZE + d] ;
+            count[t * RADIX_SIZE + d] = offset ;
+            offset += tmp ;
+          }
+        }
+      }
+
+      for (int64_t i = chunkBegin; i < chunkBegin + myChunk; ++i) {
+        const int64_t o = c[(RadixKey<Key>::bits(src_k[i]) >> shift) & (RADIX_SIZE - 1)]++ ;
+        dst_k[o] = src_k[i] ;
+        if (values)
+          dst_v[o] = src_v[i] ;
+      }
+    }
+
+    std::swap(src_k, dst_k) ;
+    std::swap(src_v, dst_v) ;
+  }
+
+  // an odd number of passes leaves the result in the buffers
+  if (src_k != keys) {
+#pragma omp parallel for if (parallel)
+    for (int64_t i = 0; i < n; ++i) {
+      keys[i] = src_k[i] ;
+      if (values)
+        values[i] = src_v[i] ;
+    }
+  }
+}
+
+#endif // RADIX_SORT_H_
@@ -0,0 +1,345 @@
+#include <cstdint>
+#include <algorithm>
+#include "asl.h"
+#include "types.h"
+#include <sstream>
+#include "ve_ops_common.h"
+#include "philox.h"
+
+#include <omp.h>
+
+//
+// RandomUniform, RandomStandardNormal, TruncatedNormal
+//
+// Arguments: Tensor out, uint64 seed, uint64 seed2, uint64 offset.
+//
+// Values are drawn from the Philox stream (seed, seed2) starting at counter
+// block offset. Output group g (4 floats or 2 doubles) is made from block
+// offset + g * blocks_per_group, so the result only depends on
+// (seed, seed2, offset) and not on the number of threads. The host advances
+// offset by ceil(nelems / results_per_group) * blocks_per_group per call.
+//
+// RandomUniform called with only the output tensor keeps using the ASL
+// generator.
+//
+// Normals always use the accurate tier of vmath.h, so a stream does not
+// change with VE_FAST_MATH.
+//
+
+namespace {
+
+// blocks reserved for each group of TruncatedNormal. Normals are rejected
+// with probability 4.6%, so 16 blocks are practically never used up. If
+// they are, drawing continues into the following blocks, which is still
+// deterministic.
+#define TRUNCATED_NORMAL_BLOCKS_PER_GROUP 16
+
+template <typename T> struct UniformDist ;
+
+template <> struct UniformDist<float> {
+  enum { kResults = 4, kBlocks = 1 } ;
+  static void run(PhiloxKey key, uint64_t block, uint64_t seed2, float* r) {
+    uint32_t x[4] ;
+    philox4x32_10(key, block, seed2, x) ;
+    for (int i = 0; i < 4; ++i) r[i] = philox_to_float(x[i]) ;
+  }
+} ;
+
+template <> struct UniformDist<double> {
+  enum { kResults = 2, kBlocks = 1 } ;
+  static void run(PhiloxKey key, uint64_t block, uint64_t seed2, double* r) {
+    uint32_t x[4] ;
+    philox4x32_10(key, block, seed2, x) ;
+    r[0] = philox_to_double(x[0], x[1]) ;
+    r[1] = philox_to_double(x[2], x[3]) ;
+  }
+} ;
+
+template <typename T> struct NormalDist ;
+
+template <> struct NormalDist<float> {
+  enum { kResults = 4, kBlocks = 1 } ;
+  static void run(PhiloxKey key, uint64_t block, uint64_t seed2, float* r) {
+    uint32_t x[4] ;
+    philox4x32_10(key, block, seed2, x) ;
+    philox_box_muller<VMathAccurate>(philox_to_float(x[0]), philox_to_float(x[1]), r[0], r[1]) ;
+    philox_box_muller<VMathAccurate>(philox_to_float(x[2]), philox_to_float(x[3]), r[2], r[3]) ;
+  }
+} ;
+
+template <> struct NormalDist<double> {
+  enum { kResults = 2, kBlocks = 1 } ;
+  static void run(PhiloxKey key, uint64_t block, uint64_t seed2, double* r) {
+    uint32_t x[4] ;
+    philox4x32_10(key, block, seed2, x) ;
+    philox_box_muller<VMathAccurate>(philox_to_double(x[0], x[1]),
+                                     philox_to_double(x[2], x[3]), r[0], r[1]) ;
+  }
+} ;
+
+// standard normal truncated to (-2, 2) by rejection, as in TF
+template <typename T> struct TruncatedNormalDist {
+  enum { kResults = NormalDist<T>::kResults,
+         kBlocks = TRUNCATED_NORMAL_BLOCKS_PER_GROUP } ;
+  static void run(PhiloxKey key, uint64_t block, uint64_t seed2, T* r) {
+    int n = 0 ;
+#pragma _NEC novector
+    while (n < kResults) {
+      T z[kResults] ;
+      NormalDist<T>::run(key, block++, seed2, z) ;
+#pragma _NEC novector
+      for (int i = 0; i < kResults && n < kResults; ++i) {
+        if (std::fabs(z[i]) < T(2.0)) r[n++] = z[i] ;
+      }
+    }
+  }
+} ;
+
+template <typename T, typename Dist>
+void philox_generate(T* out, int64_t n, uint64_t seed, uint64_t seed2, uint64_t offset)
+{
+  const PhiloxKey key = philox_key(seed) ;
+  const int64_t ngroups = (n + Dist::kResults - 1) / Dist::kResults ;
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = ngroups / nthreads ;
+    int64_t remain    = ngroups % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    for (int64_t g = chunkBegin; g < chunkBegin + myChunk; ++g) {
+      T r[Dist::kResults] ;
+      Dist::run(key, offset + g * Dist::kBlocks, seed2, r) ;
+      const int64_t i0 = g * Dist::kResults ;
+      const int64_t m = std::min<int64_t>(Dist::kResults, n - i0) ;
+      for (int64_t j = 0; j < m; ++j) out[i0 + j] = r[j] ;
+    }
+  }
+}
+
+template <template <typename> class Dist>
+int op_philox(const VEOpArgs& args, const char* name)
+{
+  if (args.nVariables() != 4)
+    return 1;
+
+  const Tensor* t = args.arg<Tensor>(0);
+  const uint64_t seed   = *args.arg<uint64_t>(1) ;
+  const uint64_t seed2  = *args.arg<uint64_t>(2) ;
+  const uint64_t offset = *args.arg<uint64_t>(3) ;
+
+  LOG(3) << name << ": nelems=" << t->nelems << " seed=" << seed
+         << " seed2=" << seed2 << " offset=" << offset;
+
+  if (t->dtype == DT_FLOAT) {
+    philox_generate<float, Dist<float> >(reinterpret_cast<float*>(t->addr),
+                                         t->nelems, seed, seed2, offset) ;
+  }
+  else if (t->dtype == DT_DOUBLE) {
+    philox_generate<double, Dist<double> >(reinterpret_cast<double*>(t->addr),
+                                           t->nelems, seed, seed2, offset) ;
+  }
+  else {
+    return 1 ;
+  }
+
+  return 0;
+}
+
+int op_randomUniform(const VEOpArgs& args)
+{
+  if (args.nVariables() == 1) {
+    const Tensor* t = args.arg<Tensor>(0);
+
+    LOG(3) << "op_RandomUniform: nelems=" << t->nelems;
+
+    if (t->dtype != DT_FLOAT)
+      return 1;
+
+    float* p = reinterpret_cast<float*>(t->addr);
+    ASL::getRandom(t->nelems, p) ;
+    return 0;
+  }
+
+  return op_philox<UniformDist>(args, __FUNCTION__) ;
+}
+
+int op_randomStandardNormal(const VEOpArgs& args)
+{
+  return op_philox<NormalDist>(args, __FUNCTION__) ;
+}
+
+int op_truncatedNormal(const VEOpArgs& args)
+{
+  return op_philox<TruncatedNormalDist>(args, __FUNCTION__) ;
+}
+
+} // namespace
+
+DEFINE_KERNEL(RandomUniform, op_randomUniform);
+DEFINE_KERNEL(RandomStandardNormal, op_randomStandardNormal);
+DEFINE_KERNEL(TruncatedNormal, op_truncatedNormal);
+
+
+//
+// Dropout, DropoutGrad
+//
+// Dropout: Tensor x, Tensor y, Tensor mask, double rate,
+//          uint64 seed, uint64 seed2, uint64 offset
+// DropoutGrad: Tensor dy, Tensor mask, Tensor dx, double rate
+//
+// Element i is kept when the i-th value of the Philox uniform stream (the
+// same one RandomUniform<float> produces) is >= rate, and kept values are
+// scaled by 1 / (1 - rate). The keep decisions are stored as a bit mask,
+// bit i%32 of 32-bit word i/32, instead of a float mask. The host advances
+// offset by ceil(nelems / 32) * 8 blocks per call.
+//
+// Each thread handles whole mask words, so no word is shared between
+// threads and the result does not depend on the number of threads.
+//
+
+namespace {
+
+#define DROPOUT_BLOCKS_PER_WORD 8   // 8 Philox blocks = 32 uniforms
+
+// 1 / (1 - rate), computed in double from the rate the kernels checked.
+// Rounding a rate just below 1 to float first would give 1 / 0.
+template <typename T>
+inline T dropout_scale(double rate)
+{
+  return static_cast<T>(1. / (1. - rate)) ;
+}
+
+template <typename T>
+void dropout(const T* x, T* y, uint32_t* mask, int64_t n, double rate,
+             uint64_t seed, uint64_t seed2, uint64_t offset)
+{
+  const PhiloxKey key = philox_key(seed) ;
+  const int64_t nwords = (n + 31) / 32 ;
+  const T scale = dropout_scale<T>(rate) ;
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = nwords / nthreads ;
+    int64_t remain    = nwords % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    for (int64_t w = chunkBegin; w < chunkBegin + myChunk; ++w) {
+      uint32_t bits = 0 ;
+      for (int b = 0; b < DROPOUT_BLOCKS_PER_WORD; ++b) {
+        uint32_t r[4] ;
+        philox4x32_10(key, offset + w * DROPOUT_BLOCKS_PER_WORD + b, seed2, r) ;
+        for (int l = 0; l < 4; ++l)
+          bits |= (philox_to_float(r[l]) >= rate ? 1u : 0u) << (4 * b + l) ;
+      }
+      mask[w] = bits ;
+
+      const int64_t i0 = w * 32 ;
+      const int64_t m = std::min<int64_t>(32, n - i0) ;
+      for (int64_t j = 0; j < m; ++j)
+        y[i0 + j] = ((bits >> j) & 1) ? x[i0 + j] * scale : T(0) ;
+    }
+  }
+}
+
+template <typename T>
+void dropout_grad(const T* dy, const uint32_t* mask, T* dx, int64_t n, double rate)
+{
+  const T scale = dropout_scale<T>(rate) ;
+
+#pragma omp parallel for
+  for (int64_t i = 0; i < n; ++i)
+    dx[i] = ((mask[i >> 5] >> (i & 31)) & 1) ? dy[i] * scale : T(0) ;
+}
+
+int op_dropout(const VEOpArgs& args)
+{
+  if (args.nVariables() != 7)
+    return 1;
+
+  const Tensor* x    = args.arg<Tensor>(0);
+  const Tensor* y    = args.arg<Tensor>(1);
+  const Tensor* mask = args.arg<Tensor>(2);
+  const double rate     = *args.arg<double>(3) ;
+  const uint64_t seed   = *args.arg<uint64_t>(4) ;
+  const uint64_t seed2  = *args.arg<uint64_t>(5) ;
+  const uint64_t offset = *args.arg<uint64_t>(6) ;
+
+  LOG(3) << __FUNCTION__ << ": x=" << x->to_s() << " rate=" << rate;
+
+  if (x->dtype != y->dtype || x->nelems != y->nelems)
+    return 1 ;
+  if (mask->nelems * DataTypeSize(mask->dtype) < (x->nelems + 31) / 32 * 4)
+    return 1 ;
+  if (!(rate >= 0.0 && rate < 1.0))
+    return 1 ;
+
+  uint32_t* pm = reinterpret_cast<uint32_t*>(mask->addr) ;
+
+  if (x->dtype == DT_FLOAT) {
+    dropout<float>(reinterpret_cast<const float*>(x->addr),
+                   reinterpret_cast<float*>(y->addr), pm, x->nelems,
+                   rate, seed, seed2, offset) ;
+  }
+  else if (x->dtype == DT_DOUBLE) {
+    dropout<double>(reinterpret_cast<const double*>(x->addr),
+                    reinterpret_cast<double*>(y->addr), pm, x->nelems,
+                    rate, seed, seed2, offset) ;
+  }
+  else {
+    return 1 ;
+  }
+
+  return 0;
+}
+
+int op_dropoutGrad(const VEOpArgs& args)
+{
+  if (args.nVariables() != 4)
+    return 1;
+
+  const Tensor* dy   = args.arg<Tensor>(0);
+  const Tensor* mask = args.arg<Tensor>(1);
+  const Tensor* dx   = args.arg<Tensor>(2);
+  const double rate  = *args.arg<double>(3) ;
+
+  LOG(3) << __FUNCTION__ << ": dy=" << dy->to_s() << " rate=" << rate;
+
+  if (dy->dtype != dx->dtype || dy->nelems != dx->nelems)
+    return 1 ;
+  if (mask->nelems * DataTypeSize(mask->dtype) < (dy->nelems + 31) / 32 * 4)
+    return 1 ;
+  if (!(rate >= 0.0 && rate < 1.0))
+    return 1 ;
+
+  const uint32_t* pm = reinterpret_cast<const uint32_t*>(mask->addr) ;
+
+  if (dy->dtype == DT_FLOAT) {
+    dropout_grad<float>(reinterpret_cast<const float*>(dy->addr), pm,
+                        reinterpret_cast<float*>(dx->addr), dy->nelems, rate) ;
+  }
+  else if (dy->dtype == DT_DOUBLE) {
+    dropout_grad<double>(reinterpret_cast<const double*>(dy->addr), pm,
+                         reinterpret_cast<double*>(dx->addr), dy->nelems, rate) ;
+  }
+  else {
+    return 1 ;
+  }
+
+  return 0;
+}
+
+} // namespace
+
+DEFINE_KERNEL(Dropout, op_dropout);
+DEFINE_KERNEL(DropoutGrad, op_dropoutGrad);
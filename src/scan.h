@@ -0,0 +1,211 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+
+//
+// Building blocks of the scan kernels (Cumsum, Cumprod, Where, BooleanMask)
+// and of the kernels that need an offset per element (Unique).
+//
+// A scan over a long axis is blocked at two levels:
+//
+//   - across threads: every thread reduces its block of the axis (up-sweep),
+//     the block totals are scanned by one thread, and every thread scans its
+//     block again starting from the total of the blocks before it
+//     (down-sweep).
+//   - within a thread: the positions that are scanned independently (inner
+//     positions, rows, or SCAN_LANES lanes of one row) form the inner loop,
+//     so that the loop over the axis carries one value per position and the
+//     inner loop vectorizes.
+//
+// The reversed direction is a negative step from the last element.
+//
+
+#define SCAN_LANES 256
+
+// Below this many elements a scan runs on a single thread.
+#define SCAN_PARALLEL_MIN (64*1024)
+
+struct ScanSum {
+  template <typename T> static T identity() { return T(0) ; }
+  template <typename T> static T apply(T a, T b) { return a + b ; }
+};
+
+struct ScanProd {
+  template <typename T> static T identity() { return T(1) ; }
+  template <typename T> static T apply(T a, T b) { return a * b ; }
+};
+
+// m independent scans of n elements, element a of scan k at
+// in[a * step + k * stride]. carry[k] is the value before the first element
+// on entry and the total on exit.
+template <typename Op, typename T>
+void scan_strip(const T* in, T* out, int64_t n, int64_t step, int64_t stride,
+                int64_t m, T* carry, bool exclusive)
+{
+  for (int64_t a = 0; a < n; ++a) {
+    const T* ia = in + a * step ;
+    T* oa = out + a * step ;
+#pragma _NEC ivdep
+    for (int64_t k = 0; k < m; ++k) {
+      const T c = carry[k] ;
+      const T s = Op::apply(c, ia[k * stride]) ;
+      oa[k * stride] = exclusive ? c : s ;
+      carry[k] = s ;
+    }
+  }
+}
+
+// acc[k] = acc[k] op (the n elements of scan k), same layout as scan_strip
+template <typename Op, typename T>
+void reduce_strip(const T* in, int64_t n, int64_t step, int64_t stride,
+                  int64_t m, T* acc)
+{
+  for (int64_t a = 0; a < n; ++a) {
+    const T* ia = in + a * step ;
+#pragma _NEC ivdep
+    for (int64_t k = 0; k < m; ++k)
+      acc[k] = Op::apply(acc[k], ia[k * stride]) ;
+  }
+}
+
+// Scans the n elements in[0], in[dir], in[2 dir], ... of one row starting
+// from c and returns the total. A long row is cut into SCAN_LANES lanes of
+// equal length: the lane totals are reduced, scanned, and the lanes are
+// scanned side by side from their offsets. The rest of the row is scanned
+// after the last lane.
+template <typename Op, typename T>
+T scan_row(const T* in, T* out, int64_t n, int64_t dir, T c, bool exclusive)
+{
+  const int64_t len = n / SCAN_LANES ;
+
+  if (len >= 8) {
+    T carry[SCAN_LANES] ;
+    for (int64_t l = 0; l < SCAN_LANES; ++l)
+      carry[l] = Op::template identity<T>() ;
+    reduce_strip<Op>(in, len, dir, len * dir, SCAN_LANES, carry) ;
+    for (int64_t l = 0; l < SCAN_LANES; ++l) {
+      const T t = carry[l] ;
+      carry[l] = c ;
+      c = Op::apply(c, t) ;
+    }
+    scan_strip<Op>(in, out, len, dir, len * dir, SCAN_LANES, carry, exclusive) ;
+
+    const int64_t done = len * SCAN_LANES ;
+    in += done * dir ;
+    out += done * dir ;
+    n -= done ;
+  }
+
+  scan_strip<Op>(in, out, n, dir, 0, 1, &c, exclusive) ;
+  return c ;
+}
+
+// Total of the n elements in[0], in[dir], ... of one row, op'ed onto c.
+template <typename Op, typename T>
+T reduce_row(const T* in, int64_t n, int64_t dir, T c)
+{
+  const int64_t len = n / SCAN_LANES ;
+
+  if (len >= 8) {
+    T acc[SCAN_LANES] ;
+    for (int64_t l = 0; l < SCAN_LANES; ++l)
+      acc[l] = Op::template identity<T>() ;
+    reduce_strip<Op>(in, len, SCAN_LANES * dir, dir, SCAN_LANES, acc) ;
+    for (int64_t l = 0; l < SCAN_LANES; ++l)
+      c = Op::apply(c, acc[l]) ;
+
+    const int64_t done = len * SCAN_LANES ;
+    in += done * dir ;
+    n -= done ;
+  }
+
+  reduce_strip<Op>(in, n, dir, 0, 1, &c) ;
+  return c ;
+}
+
+// a[i] = a[0] + ... + a[i-1], returns the total
+template <typename T>
+T exclusive_sum(T* a, int64_t n)
+{
+  const bool parallel = n >= SCAN_PARALLEL_MIN ;
+  const int nthreads_max = parallel ? omp_get_max_threads() : 1 ;
+  std::vector<T> part(nthreads_max + 1, T(0)) ;
+  T total = T(0) ;
+
+#pragma omp parallel if (parallel)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = n / nthreads ;
+    int64_t remain    = n % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    part[threadid + 1] = reduce_row<ScanSum>(a + chunkBegin, myChunk, 1, T(0)) ;
+
+#pragma omp barrier
+#pragma omp single
+    {
+      for (int64_t t = 0; t < nthreads; ++t)
+        part[t + 1] += part[t] ;
+      total = part[nthreads] ;
+    }
+
+    scan_row<ScanSum>(a + chunkBegin, a + chunkBegin, myChunk, 1, part[threadid], true) ;
+  }
+
+  return total ;
+}
+
+// Stream compaction: calls emit(i, j) for every i in [0, n) with keep(i),
+// where j is the number of kept positions before i, and returns the number
+// of kept positions. Every thread counts its chunk, the counts are scanned,
+// and every thread emits its chunk from its offset.
+template <typename Keep, typename Emit>
+int64_t compact(int64_t n, Keep keep, Emit emit)
+{
+  const bool parallel = n >= SCAN_PARALLEL_MIN ;
+  const int nthreads_max = parallel ? omp_get_max_threads() : 1 ;
+  std::vector<int64_t> part(nthreads_max + 1, 0) ;
+  int64_t total = 0 ;
+
+#pragma omp parallel if (parallel)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = n / nthreads ;
+    int64_t remain    = n % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    int64_t cnt = 0 ;
+    for (int64_t i = chunkBegin; i < chunkBegin + myChunk; ++i)
+      cnt += keep(i) ? 1 : 0 ;
+    part[threadid + 1] = cnt ;
+
+#pragma omp barrier
+#pragma omp single
+    {
+      for (int64_t t = 0; t < nthreads; ++t)
+        part[t + 1] += part[t] ;
+      total = part[nthreads] ;
+    }
+
+    int64_t j = part[threadid] ;
+    for (int64_t i = chunkBegin; i < chunkBegin + myChunk; ++i) {
+      if (keep(i))
+        emit(i, j++) ;
+    }
+  }
+
+  return total ;
+}
+
+#endif // SCAN_H_
@@ -0,0 +1,426 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "kernel.h"
+#include "types.h"
+#include "log.h"
+#include "scan.h"
+
+#include <omp.h>
+
+REGISTER_KERNEL("Cumsum", "op_Cumsum");
+REGISTER_KERNEL("Cumprod", "op_Cumprod");
+REGISTER_KERNEL("Where", "op_Where");
+REGISTER_KERNEL("BooleanMask", "op_BooleanMask");
+
+#define CHECK_ARG_LEN(l0, l1) \
+  if ((l0) != (l1)) { \
+      fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n", (l1), (l0)); \
+      return 1; \
+  }
+
+extern "C" {
+  int op_Cumsum(const void* arg, size_t len);
+  int op_Cumprod(const void* arg, size_t len);
+  int op_Where(const void* arg, size_t len);
+  int op_BooleanMask(const void* arg, size_t len);
+}
+
+#define VE_SCAN_MAX_HANDLE_DIM 8
+
+//
+// Cumsum / Cumprod
+//
+// The input is viewed as [outer, axis, inner] and scanned along axis,
+// inclusive or exclusive, forward or reverse (see scan.h).
+//
+//  - inner > 1: strips of SCAN_LANES inner positions are scanned side by
+//    side. When there are fewer strips than threads the axis is split among
+//    threads instead.
+//  - inner == 1: long rows are scanned by scan_row, short rows a strip of
+//    rows at a time. When there are fewer rows than threads each row is
+//    split among threads.
+//
+// The blocked order of the operations gives results that can differ from a
+// sequential scan in the last bits for float types.
+//
+
+namespace {
+
+template <typename Op, typename T>
+int cumulative(uint64_t in_ptr, uint64_t out_ptr, int64_t outer, int64_t n,
+               int64_t inner, bool exclusive, bool reverse)
+{
+  const T* in = reinterpret_cast<const T*>(in_ptr) ;
+  T* out = reinterpret_cast<T*>(out_ptr) ;
+
+  if (outer * n * inner == 0)
+    return 0 ;
+
+  const bool parallel = outer * n * inner >= SCAN_PARALLEL_MIN ;
+  const int nthreads_max = parallel ? omp_get_max_threads() : 1 ;
+
+  // the scans start at element first of the axis and go in direction dir
+  const int64_t first = reverse ? n - 1 : 0 ;
+  const int64_t dir = reverse ? -1 : 1 ;
+
+  if (inner > 1) {
+    const int64_t nstrip = (inner + SCAN_LANES - 1) / SCAN_LANES ;
+
+    if (outer * nstrip >= nthreads_max) {
+#pragma omp parallel for if (parallel)
+      for (int64_t u = 0; u < outer * nstrip; ++u) {
+        const int64_t o = u / nstrip ;
+        const int64_t k0 = (u % nstrip) * SCAN_LANES ;
+        const int64_t m = std::min<int64_t>(SCAN_LANES, inner - k0) ;
+        const int64_t offset = (o * n + first) * inner + k0 ;
+
+        T carry[SCAN_LANES] ;
+        for (int64_t k = 0; k < m; ++k)
+          carry[k] = Op::template identity<T>() ;
+        scan_strip<Op>(in + offset, out + offset, n, dir * inner, 1, m, carry, exclusive) ;
+      }
+    } else {
+      const int64_t w = outer * inner ;
+      std::vector<T> part((nthreads_max + 1) * w) ;
+
+#pragma omp parallel
+      {
+        int64_t nthreads = omp_get_num_threads() ;
+        int64_t threadid = omp_get_thread_num() ;
+
+        int64_t chunkSize = n / nthreads ;
+        int64_t remain    = n % nthreads ;
+
+        int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+        int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+        // up-sweep
+        T* mine = part.data() + (threadid + 1) * w ;
+        for (int64_t k = 0; k < w; ++k)
+          mine[k] = Op::template identity<T>() ;
+        for (int64_t o = 0; o < outer; ++o) {
+          const int64_t offset = (o * n + first + dir * chunkBegin) * inner ;
+          reduce_strip<Op>(in + offset, myChunk, dir * inner, 1, inner, mine + o * inner) ;
+        }
+
+#pragma omp barrier
+#pragma omp single
+        {
+          for (int64_t k = 0; k < w; ++k)
+            part[k] = Op::template identity<T>() ;
+          for (int64_t t = 0; t < nthreads; ++t) {
+            const T* prev = part.data() + t * w ;
+            T* cur = part.data() + (t + 1) * w ;
+            for (int64_t k = 0; k < w; ++k)
+              cur[k] = Op::apply(prev[k], cur[k]) ;
+          }
+        }
+
+        // down-sweep
+        T* carry = part.data() + threadid * w ;
+        for (int64_t o = 0; o < outer; ++o) {
+          const int64_t offset = (o * n + first + dir * chunkBegin) * inner ;
+          scan_strip<Op>(in + offset, out + offset, myChunk, dir * inner, 1, inner,
+                         carry + o * inner, exclusive) ;
+        }
+      }
+    }
+  } else if (outer >= nthreads_max) {
+    if (n >= 8 * SCAN_LANES) {
+#pragma omp parallel for if (parallel)
+      for (int64_t o = 0; o < outer; ++o) {
+        scan_row<Op>(in + o * n + first, out + o * n + first, n, dir,
+                     Op::template identity<T>(), exclusive) ;
+      }
+    } else {
+      const int64_t nstrip = (outer + SCAN_LANES - 1) / SCAN_LANES ;
+#pragma omp parallel for if (parallel)
+      for (int64_t u = 0; u < nstrip; ++u) {
+        const int64_t o0 = u * SCAN_LANES ;
+        const int64_t m = std::min<int64_t>(SCAN_LANES, outer - o0) ;
+
+        T carry[SCAN_LANES] ;
+        for (int64_t k = 0; k < m; ++k)
+          carry[k] = Op::template identity<T>() ;
+        scan_strip<Op>(in + o0 * n + first, out + o0 * n + first, n, dir, n, m,
+                       carry, exclusive) ;
+      }
+    }
+  } else {
+    std::vector<T> part((nthreads_max + 1) * outer) ;
+
+#pragma omp parallel
+    {
+      int64_t nthreads = omp_get_num_threads() ;
+      int64_t threadid = omp_get_thread_num() ;
+
+      int64_t chunkSize = n / nthreads ;
+      int64_t remain    = n % nthreads ;
+
+      int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+      int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+      // up-sweep
+      for (int64_t o = 0; o < outer; ++o) {
+        part[(threadid + 1) * outer + o]
+          = reduce_row<Op>(in + o * n + first + dir * chunkBegin, myChunk, dir,
+                           Op::template identity<T>()) ;
+      }
+
+#pragma omp barrier
+#pragma omp single
+      {
+        for (int64_t o = 0; o < outer; ++o)
+          part[o] = Op::template identity<T>() ;
+        for (int64_t t = 0; t < nthreads; ++t) {
+          for (int64_t o = 0; o < outer; ++o)
+            part[(t + 1) * outer + o] = Op::apply(part[t * outer + o], part[(t + 1) * outer + o]) ;
+        }
+      }
+
+      // down-sweep
+      for (int64_t o = 0; o < outer; ++o) {
+        const int64_t offset = o * n + first + dir * chunkBegin ;
+        scan_row<Op>(in + offset, out + offset, myChunk, dir,
+                     part[threadid * outer + o], exclusive) ;
+      }
+    }
+  }
+
+  return 0 ;
+}
+
+template <typename Op>
+int cumulative_kernel(const void* args, size_t len)
+{
+  struct Args {
+    int dtype ;
+    int exclusive ;
+    int reverse ;
+    int64_t axis ;
+    uint64_t in_ptr, out_ptr ;
+    int64_t input_dims ;
+    int64_t dim_size[VE_SCAN_MAX_HANDLE_DIM] ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  const int64_t dims = p->input_dims ;
+  int64_t axis = p->axis ;
+  if (dims < 1 || dims > VE_SCAN_MAX_HANDLE_DIM)
+    return 1 ;
+  if (axis < 0)
+    axis += dims ;
+  if (axis < 0 || axis >= dims)
+    return 1 ;
+
+  int64_t outer = 1, inner = 1 ;
+  for (int64_t d = 0; d < axis; ++d) outer *= p->dim_size[d] ;
+  for (int64_t d = axis + 1; d < dims; ++d) inner *= p->dim_size[d] ;
+  const int64_t n = p->dim_size[axis] ;
+
+  LOG(3) << "cumulative: outer=" << outer << " n=" << n << " inner=" << inner
+         << " exclusive=" << p->exclusive << " reverse=" << p->reverse ;
+
+  int ret = 1;
+
+  if (p->dtype == DT_FLOAT) {
+    ret = cumulative<Op, float>(p->in_ptr, p->out_ptr, outer, n, inner,
+                                p->exclusive, p->reverse) ;
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    ret = cumulative<Op, double>(p->in_ptr, p->out_ptr, outer, n, inner,
+                                 p->exclusive, p->reverse) ;
+  }
+  else if (p->dtype == DT_INT32) {
+    ret = cumulative<Op, int32_t>(p->in_ptr, p->out_ptr, outer, n, inner,
+                                  p->exclusive, p->reverse) ;
+  }
+  else if (p->dtype == DT_INT64) {
+    ret = cumulative<Op, int64_t>(p->in_ptr, p->out_ptr, outer, n, inner,
+                                  p->exclusive, p->reverse) ;
+  }
+
+  return ret;
+}
+
+} // namespace
+
+int op_Cumsum(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+  int ret = cumulative_kernel<ScanSum>(args, len) ;
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
+int op_Cumprod(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+  int ret = cumulative_kernel<ScanProd>(args, len) ;
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
+//
+// Where
+//
+// Writes the coordinates of the nonzero (true) elements of the input in row
+// major order to out[num_true, input_dims] (int64) and num_true to
+// *num_true. out is allocated by the host for all elements.
+//
+// Integer and bool elements are true when any bit is set. half and bfloat16
+// are read as uint16 and ignore the sign bit, so that -0.0 is false like
+// 0.0.
+//
+
+namespace {
+
+struct NonZero {
+  template <typename T> bool operator()(T v) const { return v != T(0) ; }
+} ;
+
+template <typename T, typename IsTrue>
+int where(uint64_t in_ptr, uint64_t out_ptr, uint64_t num_true_ptr,
+          int64_t dims, const int64_t* dim_size, IsTrue is_true)
+{
+  const T* in = reinterpret_cast<const T*>(in_ptr) ;
+  int64_t* out = reinterpret_cast<int64_t*>(out_ptr) ;
+
+  int64_t n = 1 ;
+  for (int64_t d = 0; d < dims; ++d) n *= dim_size[d] ;
+
+  *reinterpret_cast<int64_t*>(num_true_ptr) = compact(
+    n,
+    [in, is_true](int64_t i) { return is_true(in[i]) ; },
+    [out, dims, dim_size](int64_t i, int64_t j) {
+      int64_t* o = out + j * dims ;
+      for (int64_t d = dims - 1; d >= 0; --d) {
+        o[d] = i % dim_size[d] ;
+        i /= dim_size[d] ;
+      }
+    }) ;
+
+  return 0 ;
+}
+
+} // namespace
+
+int op_Where(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype ;
+    uint64_t in_ptr, out_ptr ;
+    uint64_t num_true_ptr ;
+    int64_t input_dims ;
+    int64_t dim_size[VE_SCAN_MAX_HANDLE_DIM] ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  if (p->input_dims < 0 || p->input_dims > VE_SCAN_MAX_HANDLE_DIM)
+    return 1 ;
+
+  int ret = 1;
+
+  const NonZero nonzero ;
+
+  if (p->dtype == DT_FLOAT) {
+    ret = where<float>(p->in_ptr, p->out_ptr, p->num_true_ptr, p->input_dims, p->dim_size, nonzero) ;
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    ret = where<double>(p->in_ptr, p->out_ptr, p->num_true_ptr, p->input_dims, p->dim_size, nonzero) ;
+  }
+  else if (p->dtype == DT_HALF || p->dtype == DT_BFLOAT16) {
+    ret = where<uint16_t>(p->in_ptr, p->out_ptr, p->num_true_ptr, p->input_dims, p->dim_size,
+                          [](uint16_t v) { return (v & 0x7fff) != 0 ; }) ;
+  }
+  else {
+    switch (DataTypeSize(p->dtype)) {
+      case 1: ret = where<uint8_t> (p->in_ptr, p->out_ptr, p->num_true_ptr, p->input_dims, p->dim_size, nonzero) ; break ;
+      case 2: ret = where<uint16_t>(p->in_ptr, p->out_ptr, p->num_true_ptr, p->input_dims, p->dim_size, nonzero) ; break ;
+      case 4: ret = where<uint32_t>(p->in_ptr, p->out_ptr, p->num_true_ptr, p->input_dims, p->dim_size, nonzero) ; break ;
+      case 8: ret = where<uint64_t>(p->in_ptr, p->out_ptr, p->num_true_ptr, p->input_dims, p->dim_size, nonzero) ; break ;
+    }
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
+//
+// BooleanMask
+//
+// The input is viewed as [outer, inner] with a bool mask[outer]. The rows
+// with a true mask are copied to out in order and their number is written
+// to *count. out is allocated by the host for all rows.
+//
+
+namespace {
+
+template <typename T>
+int boolean_mask(uint64_t in_ptr, uint64_t mask_ptr, uint64_t out_ptr,
+                 uint64_t count_ptr, int64_t outer, int64_t inner)
+{
+  const T* in = reinterpret_cast<const T*>(in_ptr) ;
+  const bool* mask = reinterpret_cast<const bool*>(mask_ptr) ;
+  T* out = reinterpret_cast<T*>(out_ptr) ;
+  int64_t* count = reinterpret_cast<int64_t*>(count_ptr) ;
+
+  if (inner == 1) {
+    *count = compact(outer,
+                     [mask](int64_t i) { return mask[i] ; },
+                     [in, out](int64_t i, int64_t j) { out[j] = in[i] ; }) ;
+  } else {
+    *count = compact(outer,
+                     [mask](int64_t i) { return mask[i] ; },
+                     [in, out, inner](int64_t i, int64_t j) {
+                       for (int64_t k = 0; k < inner; ++k)
+                         out[j * inner + k] = in[i * inner + k] ;
+                     }) ;
+  }
+
+  return 0 ;
+}
+
+} // namespace
+
+int op_BooleanMask(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype ;
+    int64_t outer ;
+    int64_t inner ;
+    uint64_t in_ptr ;
+    uint64_t mask_ptr ;
+    uint64_t out_ptr ;
+    uint64_t count_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  LOG(3) << __FUNCTION__ << " outer=" << p->outer << " inner=" << p->inner ;
+
+  int ret = 1;
+
+  // rows are moved as plain elements of the dtype's size
+  switch (DataTypeSize(p->dtype)) {
+    case 1: ret = boolean_mask<uint8_t> (p->in_ptr, p->mask_ptr, p->out_ptr, p->count_ptr, p->outer, p->inner) ; break ;
+    case 2: ret = boolean_mask<uint16_t>(p->in_ptr, p->mask_ptr, p->out_ptr, p->count_ptr, p->outer, p->inner) ; break ;
+    case 4: ret = boolean_mask<uint32_t>(p->in_ptr, p->mask_ptr, p->out_ptr, p->count_ptr, p->outer, p->inner) ; break ;
+    case 8: ret = boolean_mask<uint64_t>(p->in_ptr, p->mask_ptr, p->out_ptr, p->count_ptr, p->outer, p->inner) ; break ;
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include "kernel.h"
+#include "types.h"
+#include "log.h"
+
+#include <omp.h>
+
+#include "scatter_functor.h"
+
+REGISTER_KERNEL("ScatterUpdate", "op_ScatterUpdate");
+REGISTER_KERNEL("ScatterAdd", "op_ScatterAdd");
+REGISTER_KERNEL("ScatterSub", "op_ScatterSub");
+
+#define CHECK_ARG_LEN(l0, l1) \
+  if ((l0) != (l1)) { \
+      fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n", (l1), (l0)); \
+      return 1; \
+  }
+
+extern "C" {
+  int op_ScatterUpdate(const void* arg, size_t len);
+  int op_ScatterAdd(const void* arg, size_t len);
+  int op_ScatterSub(const void* arg, size_t len);
+}
+
+//
+// ScatterUpdate, ScatterAdd, ScatterSub
+//
+// ref[idx[j], :] (=, +=, -=) updates[j, :]
+//
+
+namespace {
+
+enum ScatterOp {
+  SCATTER_UPDATE,
+  SCATTER_ADD,
+  SCATTER_SUB,
+} ;
+
+template <typename T, typename Index>
+int scatter(ScatterOp op, int64_t first_dim_size, int64_t inner_size,
+            int64_t nindex, uint64_t ref_ptr, uint64_t idx_ptr,
+            uint64_t updates_ptr)
+{
+  T* ref = reinterpret_cast<T*>(ref_ptr);
+  const Index* idx = reinterpret_cast<const Index*>(idx_ptr);
+  const T* updates = reinterpret_cast<const T*>(updates_ptr);
+
+  return scatter_rows_parallel(idx, nindex, first_dim_size, inner_size,
+      [=](int64_t row, int64_t j) {
+        T* d = ref + row * inner_size ;
+        const T* s = updates + j * inner_size ;
+        if (op == SCATTER_UPDATE) {
+          for (int64_t k = 0; k < inner_size; k++) d[k] = s[k] ;
+        }
+        else if (op == SCATTER_ADD) {
+          for (int64_t k = 0; k < inner_size; k++) d[k] += s[k] ;
+        }
+        else {
+          for (int64_t k = 0; k < inner_size; k++) d[k] -= s[k] ;
+        }
+      }) ;
+}
+
+template <typename T>
+int scatter_handle(ScatterOp op, int idxtype, int64_t first_dim_size,
+                   int64_t inner_size, int64_t nindex, uint64_t ref_ptr,
+                   uint64_t idx_ptr, uint64_t updates_ptr)
+{
+  if (idxtype == DT_INT32) {
+    return scatter<T, int32_t>(op, first_dim_size, inner_size, nindex,
+                               ref_ptr, idx_ptr, updates_ptr) ;
+  }
+  else if (idxtype == DT_INT64) {
+    return scatter<T, int64_t>(op, first_dim_size, inner_size, nindex,
+                               ref_ptr, idx_ptr, updates_ptr) ;
+  }
+  return 1 ;
+}
+
+int op_Scatter(const void* args, size_t len, ScatterOp op, const char* name)
+{
+  LOG(2) << name << " begin";
+
+  struct Args {
+    int dtype, idxtype;
+    int64_t first_dim_size, inner_size, nindex ;
+    uint64_t ref_ptr, idx_ptr, updates_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  int ret = 1;
+
+  switch (p->dtype) {
+    case DT_FLOAT:
+      ret = scatter_handle<float>(op, p->idxtype, p->first_dim_size, p->inner_size,
+                                  p->nindex, p->ref_ptr, p->idx_ptr, p->updates_ptr) ;
+      break ;
+    case DT_DOUBLE:
+      ret = scatter_handle<double>(op, p->idxtype, p->first_dim_size, p->inner_size,
+                                   p->nindex, p->ref_ptr, p->idx_ptr, p->updates_ptr) ;
+      break ;
+    case DT_INT32:
+      ret = scatter_handle<int32_t>(op, p->idxtype, p->first_dim_size, p->inner_size,
+                                    p->nindex, p->ref_ptr, p->idx_ptr, p->updates_ptr) ;
+      break ;
+    case DT_INT64:
+      ret = scatter_handle<int64_t>(op, p->idxtype, p->first_dim_size, p->inner_size,
+                                    p->nindex, p->ref_ptr, p->idx_ptr, p->updates_ptr) ;
+      break ;
+    default:
+      break ;
+  }
+
+  LOG(2) << name << " end. ret=" << ret;
+  return ret;
+}
+}
+
+int op_ScatterUpdate(const void* args, size_t len)
+{
+  return op_Scatter(args, len, SCATTER_UPDATE, __FUNCTION__) ;
+}
+
+int op_ScatterAdd(const void* args, size_t len)
+{
+  return op_Scatter(args, len, SCATTER_ADD, __FUNCTION__) ;
+}
+
+int op_ScatterSub(const void* args, size_t len)
+{
+  return op_Scatter(args, len, SCATTER_SUB, __FUNCTION__) ;
+}
@@ -0,0 +1,89 @@
+#ifndef SCATTER_FUNCTOR_H_
+#define SCATTER_FUNCTOR_H_
+
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+
+#include "radix_sort.h"
+
+//
+// Row scatter shared by the Scatter*, SparseApply* and UnsortedSegmentSum
+// kernels.
+//
+// They use the same layout as Gather: the variable is [first_dim_size,
+// inner_size], indices are [nindex] and updates (or gradients) are
+// [nindex, inner_size]. func(dst_row, src_row) is called once for every
+// index, where dst_row = idx[src_row].
+//
+// The (index, position) pairs are sorted by index with the stable radix
+// sort, which keeps the updates of one row in index order. The sorted list
+// is split evenly among threads and each boundary is moved to the end of
+// its run of equal indices, so every row is updated by exactly one thread.
+// Duplicate indices need no atomics, the result does not depend on the
+// number of threads, and the work follows the indices rather than the
+// table rows, so indices crowded into a few hot rows of a large table still
+// spread over all threads.
+//
+// Below SCATTER_PARALLEL_MIN elements (nindex * inner_size) the rows are
+// updated by the calling thread in index order.
+//
+
+#define SCATTER_PARALLEL_MIN (64*1024)
+
+// func is called for every index, including those out of range.
+template <typename Index, typename F>
+void scatter_rows(const Index* idx, int64_t nindex, int64_t inner_size, F func)
+{
+  if (nindex * inner_size < SCATTER_PARALLEL_MIN || omp_get_max_threads() == 1) {
+    for (int64_t j = 0; j < nindex; j++)
+      func(static_cast<int64_t>(idx[j]), j) ;
+    return ;
+  }
+
+  std::vector<Index> keys(idx, idx + nindex), key_buf(nindex) ;
+  std::vector<int64_t> pos(nindex), pos_buf(nindex) ;
+  for (int64_t j = 0; j < nindex; j++)
+    pos[j] = j ;
+  radix_sort(keys.data(), pos.data(), nindex, key_buf.data(), pos_buf.data()) ;
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = nindex / nthreads ;
+    int64_t remain    = nindex % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t chunkEnd   = chunkBegin + chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    // move both ends to run boundaries
+    while (chunkBegin > 0 && chunkBegin < nindex && keys[chunkBegin] == keys[chunkBegin - 1])
+      ++chunkBegin ;
+    while (chunkEnd > 0 && chunkEnd < nindex && keys[chunkEnd] == keys[chunkEnd - 1])
+      ++chunkEnd ;
+
+    for (int64_t j = chunkBegin; j < chunkEnd; j++)
+      func(static_cast<int64_t>(keys[j]), pos[j]) ;
+  }
+}
+
+// Returns 1 without touching the variable if an index is out of range.
+template <typename Index, typename F>
+int scatter_rows_parallel(const Index* idx, int64_t nindex,
+                          int64_t first_dim_size, int64_t inner_size, F func)
+{
+  int bad = 0 ;
+#pragma omp parallel for reduction(|:bad) if (nindex >= SCATTER_PARALLEL_MIN)
+  for (int64_t j = 0; j < nindex; j++) {
+    bad |= (idx[j] < 0 || idx[j] >= first_dim_size) ? 1 : 0 ;
+  }
+  if (bad)
+    return 1 ;
+
+  scatter_rows(idx, nindex, inner_size, func) ;
+  return 0 ;
+}
+
+#endif // SCATTER_FUNCTOR_H_
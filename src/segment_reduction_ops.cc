@@ -3,13 +3,26 @@
 #include <cstdint>
 #include <cassert>
 #include <algorithm>
+#include <limits>
+#include <cmath>
 #include "kernel.h"
 #include "types.h"
 #include "log.h"
 
 #include <omp.h>
 
+#include "fill_functor.h"
+#include "scatter_functor.h"
+
 REGISTER_KERNEL("UnsortedSegmentSum", "op_UnsortedSegmentSum");
+REGISTER_KERNEL("SegmentSum", "op_SegmentSum");
+REGISTER_KERNEL("SegmentMean", "op_SegmentMean");
+REGISTER_KERNEL("SegmentMax", "op_SegmentMax");
+REGISTER_KERNEL("SegmentMin", "op_SegmentMin");
+REGISTER_KERNEL("SparseSegmentSum", "op_SparseSegmentSum");
+REGISTER_KERNEL("SparseSegmentMean", "op_SparseSegmentMean");
+REGISTER_KERNEL("SparseSegmentSqrtN", "op_SparseSegmentSqrtN");
+REGISTER_KERNEL("EmbeddingLookupSparse", "op_EmbeddingLookupSparse");
 
 #define CHECK_ARG_LEN(l0, l1) \
   if ((l0) != (l1)) { \
@@ -19,12 +32,26 @@ REGISTER_KERNEL("UnsortedSegmentSum", "op_UnsortedSegmentSum");
 
 extern "C" {
   int op_UnsortedSegmentSum(const void* arg, size_t len);
+  int op_SegmentSum(const void* arg, size_t len);
+  int op_SegmentMean(const void* arg, size_t len);
+  int op_SegmentMax(const void* arg, size_t len);
+  int op_SegmentMin(const void* arg, size_t len);
+  int op_SparseSegmentSum(const void* arg, size_t len);
+  int op_SparseSegmentMean(const void* arg, size_t len);
+  int op_SparseSegmentSqrtN(const void* arg, size_t len);
+  int op_EmbeddingLookupSparse(const void* arg, size_t len);
 }
 
 
 //
 // UnsortedSegmentSum
 //
+// The rows are added with scatter_rows (scatter_functor.h), so a large
+// input is split among threads by segment id and no output row is written
+// by two threads. The rows of a segment are added in input order, so the
+// sums do not depend on the number of threads. Rows with an id out of
+// [0, num_segments) are dropped.
+//
 
 namespace {
 
@@ -37,18 +64,15 @@ int unsorted_segment_sum(int64_t num_idx, int64_t num_segments, int64_t segment_
   const Index* idx = reinterpret_cast<const Index*>(idx_ptr);
   T* dst = reinterpret_cast<T*>(dst_ptr);
 
-#pragma omp parallel for
-  for(int64_t i=0; i < num_segments * segment_size; i++) {
-    dst[i] = initial_value ;
-  }
+  fill_parallel<T>(dst, num_segments * segment_size, initial_value) ;
 
-  // TODO : use openmp
-  for(int64_t i=0; i<num_idx; i++) {
-    const int64_t k = idx[i] ;
-    for(int64_t j=0; j<segment_size; j++) {
-      dst[k*segment_size+j] += src[i*segment_size+j] ;
-    }
-  }
+  scatter_rows(idx, num_idx, segment_size,
+      [=](int64_t k, int64_t i) {
+        if (k < 0 || k >= num_segments) return ;
+        T* d = dst + k * segment_size ;
+        const T* s = src + i * segment_size ;
+        for (int64_t j = 0; j < segment_size; j++) d[j] += s[j] ;
+      }) ;
 
   return 0 ;
 }
@@ -99,3 +123,457 @@ int op_UnsortedSegmentSum(const void* args, size_t len)
   return ret;
 }
 
+
+
+//
+// SegmentSum, SegmentMean, SegmentMax, SegmentMin
+// SparseSegmentSum, SparseSegmentMean, SparseSegmentSqrtN
+//
+// Segment ids are sorted, so every segment is a contiguous run of input rows.
+// The rows are split among threads at segment boundaries, and each thread
+// reduces its runs straight into the output rows. No output row is written
+// by two threads, and rows of empty segments are filled with 0 as in TF.
+//
+// The sparse variants read input row indices[j] instead of row j.
+//
+
+namespace {
+
+template <typename T>
+struct SegmentSumReducer {
+  static T init() { return T(0) ; }
+  static T reduce(T a, T b) { return a + b ; }
+  static T finalize(T a, int64_t n) { return a ; }
+} ;
+
+template <typename T>
+struct SegmentMeanReducer {
+  static T init() { return T(0) ; }
+  static T reduce(T a, T b) { return a + b ; }
+  static T finalize(T a, int64_t n) { return a / T(n) ; }
+} ;
+
+template <typename T>
+struct SegmentSqrtNReducer {
+  static T init() { return T(0) ; }
+  static T reduce(T a, T b) { return a + b ; }
+  static T finalize(T a, int64_t n) { return a / std::sqrt(T(n)) ; }
+} ;
+
+template <typename T>
+struct SegmentMaxReducer {
+  static T init() { return std::numeric_limits<T>::lowest() ; }
+  static T reduce(T a, T b) { return a > b ? a : b ; }
+  static T finalize(T a, int64_t n) { return a ; }
+} ;
+
+template <typename T>
+struct SegmentMinReducer {
+  static T init() { return std::numeric_limits<T>::max() ; }
+  static T reduce(T a, T b) { return a < b ? a : b ; }
+  static T finalize(T a, int64_t n) { return a ; }
+} ;
+
+// Move pos forward to the first row of the segment that contains it.
+template <typename SegIndex>
+inline int64_t segment_boundary(const SegIndex* ids, int64_t num_idx, int64_t pos)
+{
+  while (pos > 0 && pos < num_idx && ids[pos] == ids[pos-1]) pos++ ;
+  return pos ;
+}
+
+// Output rows of empty segments [from, to) are 0.
+template <typename T>
+inline void zero_segments(T* dst, int64_t from, int64_t to, int64_t segment_size)
+{
+  for (int64_t i = from * segment_size; i < to * segment_size; i++) dst[i] = T(0) ;
+}
+
+template <typename T, typename Index, typename SegIndex, typename Reducer>
+void segment_reduction_rows(const T* src, const Index* indices, const SegIndex* ids,
+                            T* dst, int64_t num_idx, int64_t num_segments,
+                            int64_t segment_size, int64_t rowBegin, int64_t rowEnd)
+{
+  int64_t prev = rowBegin > 0 ? ids[rowBegin-1] : -1 ;
+
+  int64_t j0 = rowBegin ;
+  while (j0 < rowEnd) {
+    const int64_t id = ids[j0] ;
+    int64_t j1 = j0 + 1 ;
+    while (j1 < rowEnd && ids[j1] == id) j1++ ;
+
+    zero_segments(dst, prev + 1, id, segment_size) ;
+
+    T* d = dst + id * segment_size ;
+    for (int64_t k = 0; k < segment_size; k++) d[k] = Reducer::init() ;
+#pragma _NEC novector
+    for (int64_t j = j0; j < j1; j++) {
+      const int64_t row = indices ? indices[j] : j ;
+      const T* s = src + row * segment_size ;
+      for (int64_t k = 0; k < segment_size; k++) d[k] = Reducer::reduce(d[k], s[k]) ;
+    }
+    for (int64_t k = 0; k < segment_size; k++) d[k] = Reducer::finalize(d[k], j1 - j0) ;
+
+    prev = id ;
+    j0 = j1 ;
+  }
+
+  if (rowEnd == num_idx)
+    zero_segments(dst, prev + 1, num_segments, segment_size) ;
+}
+
+// indices_ptr is 0 for the dense (non-sparse) kernels.
+template <typename T, typename Index, typename SegIndex, typename Reducer>
+int segment_reduction(int64_t num_idx, int64_t num_segments, int64_t segment_size,
+                      int64_t num_rows,
+                      uint64_t src_ptr, uint64_t indices_ptr, uint64_t ids_ptr,
+                      uint64_t dst_ptr)
+{
+  const T* src = reinterpret_cast<const T*>(src_ptr);
+  const Index* indices = reinterpret_cast<const Index*>(indices_ptr);
+  const SegIndex* ids = reinterpret_cast<const SegIndex*>(ids_ptr);
+  T* dst = reinterpret_cast<T*>(dst_ptr);
+
+  int bad = 0 ;
+#pragma omp parallel for reduction(|:bad)
+  for (int64_t j = 0; j < num_idx; j++) {
+    bad |= (ids[j] < 0 || ids[j] >= num_segments
+            || (j > 0 && ids[j] < ids[j-1])) ? 1 : 0 ;
+    if (indices)
+      bad |= (indices[j] < 0 || indices[j] >= num_rows) ? 1 : 0 ;
+  }
+  if (bad) {
+    LOG(2) << __FUNCTION__ << ": segment ids not sorted or index out of range";
+    return 1 ;
+  }
+
+  if (num_idx == 0) {
+    fill_parallel<T>(dst, num_segments * segment_size, T(0)) ;
+    return 0 ;
+  }
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = num_idx / nthreads ;
+    int64_t remain    = num_idx % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t chunkEnd   = chunkBegin + chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    chunkBegin = segment_boundary(ids, num_idx, chunkBegin) ;
+    chunkEnd   = threadid == nthreads - 1 ? num_idx
+                                          : segment_boundary(ids, num_idx, chunkEnd) ;
+
+    if( chunkBegin < chunkEnd ) {
+      segment_reduction_rows<T, Index, SegIndex, Reducer>(
+          src, indices, ids, dst, num_idx, num_segments, segment_size,
+          chunkBegin, chunkEnd) ;
+    }
+  }
+
+  return 0 ;
+}
+
+template <template <typename> class Reducer>
+int op_SegmentReduction(const void* args, size_t len, const char* name)
+{
+  LOG(2) << name << " begin";
+
+  struct Args {
+    int dtype, idxtype;
+    int64_t num_idx, num_segments, segment_size ;
+    uint64_t src_ptr, idx_ptr, dst_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  int ret = 1;
+
+  if (p->dtype == DT_FLOAT) {
+    if ( p->idxtype == DT_INT32 ) {
+      ret = segment_reduction<float, int32_t, int32_t, Reducer<float> >
+              (p->num_idx, p->num_segments, p->segment_size, p->num_idx,
+               p->src_ptr, 0, p->idx_ptr, p->dst_ptr) ;
+    }
+    else if ( p->idxtype == DT_INT64 ) {
+      ret = segment_reduction<float, int64_t, int64_t, Reducer<float> >
+              (p->num_idx, p->num_segments, p->segment_size, p->num_idx,
+               p->src_ptr, 0, p->idx_ptr, p->dst_ptr) ;
+    }
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    if ( p->idxtype == DT_INT32 ) {
+      ret = segment_reduction<double, int32_t, int32_t, Reducer<double> >
+              (p->num_idx, p->num_segments, p->segment_size, p->num_idx,
+               p->src_ptr, 0, p->idx_ptr, p->dst_ptr) ;
+    }
+    else if ( p->idxtype == DT_INT64 ) {
+      ret = segment_reduction<double, int64_t, int64_t, Reducer<double> >
+              (p->num_idx, p->num_segments, p->segment_size, p->num_idx,
+               p->src_ptr, 0, p->idx_ptr, p->dst_ptr) ;
+    }
+  }
+
+  LOG(2) << name << " end. ret=" << ret;
+  return ret;
+}
+
+// segment_ids of the SparseSegment ops are int32. idxtype is the type of
+// indices.
+template <template <typename> class Reducer>
+int op_SparseSegmentReduction(const void* args, size_t len, const char* name)
+{
+  LOG(2) << name << " begin";
+
+  struct Args {
+    int dtype, idxtype;
+    int64_t num_idx, num_segments, segment_size ;
+    int64_t num_rows ;
+    uint64_t src_ptr, indices_ptr, segment_ids_ptr, dst_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  int ret = 1;
+
+  if (p->dtype == DT_FLOAT) {
+    if ( p->idxtype == DT_INT32 ) {
+      ret = segment_reduction<float, int32_t, int32_t, Reducer<float> >
+              (p->num_idx, p->num_segments, p->segment_size, p->num_rows,
+               p->src_ptr, p->indices_ptr, p->segment_ids_ptr, p->dst_ptr) ;
+    }
+    else if ( p->idxtype == DT_INT64 ) {
+      ret = segment_reduction<float, int64_t, int32_t, Reducer<float> >
+              (p->num_idx, p->num_segments, p->segment_size, p->num_rows,
+               p->src_ptr, p->indices_ptr, p->segment_ids_ptr, p->dst_ptr) ;
+    }
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    if ( p->idxtype == DT_INT32 ) {
+      ret = segment_reduction<double, int32_t, int32_t, Reducer<double> >
+              (p->num_idx, p->num_segments, p->segment_size, p->num_rows,
+               p->src_ptr, p->indices_ptr, p->segment_ids_ptr, p->dst_ptr) ;
+    }
+    else if ( p->idxtype == DT_INT64 ) {
+      ret = segment_reduction<double, int64_t, int32_t, Reducer<double> >
+              (p->num_idx, p->num_segments, p->segment_size, p->num_rows,
+               p->src_ptr, p->indices_ptr, p->segment_ids_ptr, p->dst_ptr) ;
+    }
+  }
+
+  LOG(2) << name << " end. ret=" << ret;
+  return ret;
+}
+}
+
+int op_SegmentSum(const void* args, size_t len)
+{
+  return op_SegmentReduction<SegmentSumReducer>(args, len, __FUNCTION__) ;
+}
+
+int op_SegmentMean(const void* args, size_t len)
+{
+  return op_SegmentReduction<SegmentMeanReducer>(args, len, __FUNCTION__) ;
+}
+
+int op_SegmentMax(const void* args, size_t len)
+{
+  return op_SegmentReduction<SegmentMaxReducer>(args, len, __FUNCTION__) ;
+}
+
+int op_SegmentMin(const void* args, size_t len)
+{
+  return op_SegmentReduction<SegmentMinReducer>(args, len, __FUNCTION__) ;
+}
+
+int op_SparseSegmentSum(const void* args, size_t len)
+{
+  return op_SparseSegmentReduction<SegmentSumReducer>(args, len, __FUNCTION__) ;
+}
+
+int op_SparseSegmentMean(const void* args, size_t len)
+{
+  return op_SparseSegmentReduction<SegmentMeanReducer>(args, len, __FUNCTION__) ;
+}
+
+int op_SparseSegmentSqrtN(const void* args, size_t len)
+{
+  return op_SparseSegmentReduction<SegmentSqrtNReducer>(args, len, __FUNCTION__) ;
+}
+
+
+//
+// EmbeddingLookupSparse
+//
+// Fused form of embedding_lookup_sparse: gathers params[ids[j]], scales it
+// by weights[j] and accumulates it into output row segment_ids[j], without
+// materializing the [nnz, dim] gathered tensor. segment_ids must be sorted
+// (as they are when they come from a SparseTensor), which lets the rows be
+// split among threads at segment boundaries like the SparseSegment ops.
+//
+// combiner: 0 = sum, 1 = mean, 2 = sqrtn. Mean divides by the sum of the
+// weights and sqrtn by the square root of the sum of squared weights.
+// weights_ptr is 0 when there are no weights, i.e. all weights are 1.
+//
+
+namespace {
+
+enum {
+  EMBEDDING_COMBINER_SUM = 0,
+  EMBEDDING_COMBINER_MEAN = 1,
+  EMBEDDING_COMBINER_SQRTN = 2,
+} ;
+
+template <typename T, typename Index>
+void embedding_lookup_rows(const T* params, const Index* ids, const int32_t* segment_ids,
+                           const T* weights, T* dst, int combiner,
+                           int64_t num_idx, int64_t num_segments, int64_t dim,
+                           int64_t rowBegin, int64_t rowEnd)
+{
+  int64_t prev = rowBegin > 0 ? segment_ids[rowBegin-1] : -1 ;
+
+  int64_t j0 = rowBegin ;
+  while (j0 < rowEnd) {
+    const int64_t id = segment_ids[j0] ;
+    int64_t j1 = j0 + 1 ;
+    while (j1 < rowEnd && segment_ids[j1] == id) j1++ ;
+
+    zero_segments(dst, prev + 1, id, dim) ;
+
+    T* d = dst + id * dim ;
+    for (int64_t k = 0; k < dim; k++) d[k] = T(0) ;
+
+    T wsum = T(0) ;
+#pragma _NEC novector
+    for (int64_t j = j0; j < j1; j++) {
+      const T w = weights ? weights[j] : T(1) ;
+      const T* s = params + ids[j] * dim ;
+      for (int64_t k = 0; k < dim; k++) d[k] += w * s[k] ;
+      wsum += combiner == EMBEDDING_COMBINER_SQRTN ? w * w : w ;
+    }
+
+    if (combiner != EMBEDDING_COMBINER_SUM) {
+      T scale = combiner == EMBEDDING_COMBINER_SQRTN ? std::sqrt(wsum) : wsum ;
+      scale = scale != T(0) ? T(1) / scale : T(0) ;
+      for (int64_t k = 0; k < dim; k++) d[k] *= scale ;
+    }
+
+    prev = id ;
+    j0 = j1 ;
+  }
+
+  if (rowEnd == num_idx)
+    zero_segments(dst, prev + 1, num_segments, dim) ;
+}
+
+template <typename T, typename Index>
+int embedding_lookup_sparse(int combiner, int64_t num_idx, int64_t num_segments,
+                            int64_t dim, int64_t num_rows,
+                            uint64_t params_ptr, uint64_t ids_ptr,
+                            uint64_t segment_ids_ptr, uint64_t weights_ptr,
+                            uint64_t dst_ptr)
+{
+  const T* params = reinterpret_cast<const T*>(params_ptr);
+  const Index* ids = reinterpret_cast<const Index*>(ids_ptr);
+  const int32_t* segment_ids = reinterpret_cast<const int32_t*>(segment_ids_ptr);
+  const T* weights = reinterpret_cast<const T*>(weights_ptr);
+  T* dst = reinterpret_cast<T*>(dst_ptr);
+
+  if (combiner != EMBEDDING_COMBINER_SUM
+      && combiner != EMBEDDING_COMBINER_MEAN
+      && combiner != EMBEDDING_COMBINER_SQRTN)
+    return 1 ;
+
+  int bad = 0 ;
+#pragma omp parallel for reduction(|:bad)
+  for (int64_t j = 0; j < num_idx; j++) {
+    bad |= (segment_ids[j] < 0 || segment_ids[j] >= num_segments
+            || (j > 0 && segment_ids[j] < segment_ids[j-1])
+            || ids[j] < 0 || ids[j] >= num_rows) ? 1 : 0 ;
+  }
+  if (bad) {
+    LOG(2) << __FUNCTION__ << ": segment ids not sorted or index out of range";
+    return 1 ;
+  }
+
+  if (num_idx == 0) {
+    fill_parallel<T>(dst, num_segments * dim, T(0)) ;
+    return 0 ;
+  }
+
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = num_idx / nthreads ;
+    int64_t remain    = num_idx % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t chunkEnd   = chunkBegin + chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    chunkBegin = segment_boundary(segment_ids, num_idx, chunkBegin) ;
+    chunkEnd   = threadid == nthreads - 1 ? num_idx
+                                          : segment_boundary(segment_ids, num_idx, chunkEnd) ;
+
+    if( chunkBegin < chunkEnd ) {
+      embedding_lookup_rows<T, Index>(params, ids, segment_ids, weights, dst,
+                                      combiner, num_idx, num_segments, dim,
+                                      chunkBegin, chunkEnd) ;
+    }
+  }
+
+  return 0 ;
+}
+}
+
+int op_EmbeddingLookupSparse(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype, idxtype;
+    int combiner ;
+    int64_t num_idx, num_segments, dim ;
+    int64_t num_rows ;
+    uint64_t params_ptr, ids_ptr, segment_ids_ptr, weights_ptr, dst_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  int ret = 1;
+
+  if (p->dtype == DT_FLOAT) {
+    if ( p->idxtype == DT_INT32 ) {
+      ret = embedding_lookup_sparse<float, int32_t>
+              (p->combiner, p->num_idx, p->num_segments, p->dim, p->num_rows,
+               p->params_ptr, p->ids_ptr, p->segment_ids_ptr, p->weights_ptr, p->dst_ptr) ;
+    }
+    else if ( p->idxtype == DT_INT64 ) {
+      ret = embedding_lookup_sparse<float, int64_t>
+              (p->combiner, p->num_idx, p->num_segments, p->dim, p->num_rows,
+               p->params_ptr, p->ids_ptr, p->segment_ids_ptr, p->weights_ptr, p->dst_ptr) ;
+    }
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    if ( p->idxtype == DT_INT32 ) {
+      ret = embedding_lookup_sparse<double, int32_t>
+              (p->combiner, p->num_idx, p->num_segments, p->dim, p->num_rows,
+               p->params_ptr, p->ids_ptr, p->segment_ids_ptr, p->weights_ptr, p->dst_ptr) ;
+    }
+    else if ( p->idxtype == DT_INT64 ) {
+      ret = embedding_lookup_sparse<double, int64_t>
+              (p->combiner, p->num_idx, p->num_segments, p->dim, p->num_rows,
+               p->params_ptr, p->ids_ptr, p->segment_ids_ptr, p->weights_ptr, p->dst_ptr) ;
+    }
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
@@ -0,0 +1,320 @@
+#ifndef SOFTMAX_FUNCTOR_H_
+#define SOFTMAX_FUNCTOR_H_
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+
+#include "vmath.h"
+
+//
+// Last-axis softmax kernels: Softmax, LogSoftmax, their gradients and the
+// softmax cross entropy ops. The input is viewed as [batch_size,
+// num_classes], where batch_size is the product of all outer dims.
+//
+// Each row is cut into blocks of SOFTMAX_BLOCK classes and the (row, block)
+// pairs are split among OpenMP threads, so a small batch with many classes
+// keeps all threads busy as well as a large batch does. softmax_row_blocks
+// runs
+//
+//   pass1(u, i, j0, j1)   for every block u = (row i, classes [j0, j1))
+//   reduce(i)             for every row, combining the results of its blocks
+//   pass2(u, i, j0, j1)   for every block
+//   finish(i)             for every row
+//
+// inside one parallel region. The softmax itself uses a blocked online
+// max/sum: pass 1 finds the block max m_b and s_b = sum(exp(x - m_b)), and
+// reduce gets M = max(m_b), S = sum(s_b * exp(m_b - M)).
+//
+// The kernels take the math tier (VMathAccurate or VMathFast, see vmath.h)
+// as a template parameter.
+//
+
+#define SOFTMAX_BLOCK 1024
+
+// Below this many logits the kernel runs on a single thread.
+#define SOFTMAX_PARALLEL_MIN (16*1024)
+
+template <typename P1, typename R, typename P2, typename F>
+void softmax_row_blocks(int64_t batch_size, int64_t num_classes,
+                        P1 pass1, R reduce, P2 pass2, F finish)
+{
+  const int64_t nblk = (num_classes + SOFTMAX_BLOCK - 1) / SOFTMAX_BLOCK ;
+  const int64_t nunits = batch_size * nblk ;
+
+#pragma omp parallel if (batch_size * num_classes >= SOFTMAX_PARALLEL_MIN)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = nunits / nthreads ;
+    int64_t remain    = nunits % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    int64_t rchunkSize = batch_size / nthreads ;
+    int64_t rremain    = batch_size % nthreads ;
+
+    int64_t rchunkBegin = rchunkSize * threadid + ( threadid < rremain ? threadid : rremain ) ;
+    int64_t rmyChunk    = rchunkSize + ( threadid < rremain ? 1 : 0 ) ;
+
+    for (int64_t u = chunkBegin; u < chunkBegin + myChunk; ++u) {
+      const int64_t j0 = (u % nblk) * SOFTMAX_BLOCK ;
+      pass1(u, u / nblk, j0, std::min<int64_t>(j0 + SOFTMAX_BLOCK, num_classes)) ;
+    }
+
+#pragma omp barrier
+
+    for (int64_t i = rchunkBegin; i < rchunkBegin + rmyChunk; ++i)
+      reduce(i) ;
+
+#pragma omp barrier
+
+    for (int64_t u = chunkBegin; u < chunkBegin + myChunk; ++u) {
+      const int64_t j0 = (u % nblk) * SOFTMAX_BLOCK ;
+      pass2(u, u / nblk, j0, std::min<int64_t>(j0 + SOFTMAX_BLOCK, num_classes)) ;
+    }
+
+#pragma omp barrier
+
+    for (int64_t i = rchunkBegin; i < rchunkBegin + rmyChunk; ++i)
+      finish(i) ;
+  }
+}
+
+// Block max and sum(exp(x - max)) of x[j0, j1). If e is not null, the
+// exponentials are stored to e[j0, j1).
+template <typename M, typename T>
+inline void softmax_block_max_sum(const T* x, T* e, int64_t j0, int64_t j1,
+                                  T& max, T& sum)
+{
+  T m = -std::numeric_limits<T>::infinity() ;
+  for (int64_t j = j0; j < j1; ++j)
+    m = x[j] > m ? x[j] : m ;
+
+  // a block of -inf only contributes exp(-inf) = 0, not nan
+  const T shift = m == -std::numeric_limits<T>::infinity() ? T(0.) : m ;
+
+  T s = T(0.) ;
+  if (e) {
+    for (int64_t j = j0; j < j1; ++j) {
+      const T v = M::exp(x[j] - shift) ;
+      e[j] = v ;
+      s += v ;
+    }
+  } else {
+    for (int64_t j = j0; j < j1; ++j)
+      s += M::exp(x[j] - shift) ;
+  }
+  max = m ;
+  sum = s ;
+}
+
+// log(S) + M of a row from the max and sum of its nblk blocks
+template <typename M, typename T>
+inline T softmax_combine_lse(const T* bmax, const T* bsum, int64_t nblk)
+{
+  T m = bmax[0] ;
+  for (int64_t k = 1; k < nblk; ++k)
+    m = bmax[k] > m ? bmax[k] : m ;
+  T s = T(0.) ;
+  for (int64_t k = 0; k < nblk; ++k)
+    s += bsum[k] * M::exp(bmax[k] - m) ;
+  return M::log(s) + m ;
+}
+
+//
+// Softmax / LogSoftmax
+//
+// Softmax stores exp(x - m_b) in pass 1 and rescales it by exp(m_b - lse)
+// in pass 2, so exp is evaluated once per element. LogSoftmax writes
+// x - lse in pass 2 and leaves out untouched in pass 1, so out may alias in.
+//
+
+template <typename T, typename M>
+int softmax_forward(const T* in, T* out, int64_t batch_size,
+                    int64_t num_classes, bool log)
+{
+  if (batch_size <= 0 || num_classes <= 0)
+    return 0 ;
+
+  const int64_t nblk = (num_classes + SOFTMAX_BLOCK - 1) / SOFTMAX_BLOCK ;
+  std::vector<T> bmax(batch_size * nblk), bsum(batch_size * nblk) ;
+  std::vector<T> rlse(batch_size) ;
+
+  softmax_row_blocks(batch_size, num_classes,
+    [&](int64_t u, int64_t i, int64_t j0, int64_t j1) {
+      softmax_block_max_sum<M>(in + i * num_classes,
+                            log ? static_cast<T*>(0) : out + i * num_classes,
+                            j0, j1, bmax[u], bsum[u]) ;
+    },
+    [&](int64_t i) {
+      rlse[i] = softmax_combine_lse<M>(&bmax[i * nblk], &bsum[i * nblk], nblk) ;
+    },
+    [&](int64_t u, int64_t i, int64_t j0, int64_t j1) {
+      const T* x = in + i * num_classes ;
+      T* y = out + i * num_classes ;
+      const T lse = rlse[i] ;
+      if (log) {
+        for (int64_t j = j0; j < j1; ++j)
+          y[j] = x[j] - lse ;
+      } else {
+        const T scale = M::exp(bmax[u] - lse) ;
+        for (int64_t j = j0; j < j1; ++j)
+          y[j] *= scale ;
+      }
+    },
+    [](int64_t i) {}) ;
+
+  return 0 ;
+}
+
+//
+// SoftmaxGrad:    dx = (dy - sum(dy * y)) * y,   y = softmax(x)
+// LogSoftmaxGrad: dx = dy - exp(y) * sum(dy),    y = log_softmax(x)
+//
+// pass 1 computes the partial sums of each block, pass 2 writes dx.
+//
+
+template <typename T, typename M>
+int softmax_grad(const T* y, const T* dy, T* dx, int64_t batch_size,
+                 int64_t num_classes, bool log)
+{
+  if (batch_size <= 0 || num_classes <= 0)
+    return 0 ;
+
+  const int64_t nblk = (num_classes + SOFTMAX_BLOCK - 1) / SOFTMAX_BLOCK ;
+  std::vector<T> bsum(batch_size * nblk), rsum(batch_size) ;
+
+  softmax_row_blocks(batch_size, num_classes,
+    [&](int64_t u, int64_t i, int64_t j0, int64_t j1) {
+      const T* yi = y + i * num_classes ;
+      const T* dyi = dy + i * num_classes ;
+      T s = T(0.) ;
+      if (log) {
+        for (int64_t j = j0; j < j1; ++j)
+          s += dyi[j] ;
+      } else {
+        for (int64_t j = j0; j < j1; ++j)
+          s += dyi[j] * yi[j] ;
+      }
+      bsum[u] = s ;
+    },
+    [&](int64_t i) {
+      T s = T(0.) ;
+      for (int64_t k = 0; k < nblk; ++k)
+        s += bsum[i * nblk + k] ;
+      rsum[i] = s ;
+    },
+    [&](int64_t u, int64_t i, int64_t j0, int64_t j1) {
+      const T* yi = y + i * num_classes ;
+      const T* dyi = dy + i * num_classes ;
+      T* dxi = dx + i * num_classes ;
+      const T s = rsum[i] ;
+      if (log) {
+        for (int64_t j = j0; j < j1; ++j)
+          dxi[j] = dyi[j] - M::exp(yi[j]) * s ;
+      } else {
+        for (int64_t j = j0; j < j1; ++j)
+          dxi[j] = (dyi[j] - s) * yi[j] ;
+      }
+    },
+    [](int64_t i) {}) ;
+
+  return 0 ;
+}
+
+//
+// Softmax cross entropy
+//
+// pass 1 stores exp(x - m_b) to back, pass 2 turns it into
+// back = exp(x - lse) - label. The label policy writes the "- label" part and
+// computes the loss, lse - x for every labelled class.
+//
+
+// labels: [batch_size, num_classes] probabilities
+template <typename T>
+struct SoftmaxDenseLabels {
+  const T* labels;
+  int64_t num_classes;
+
+  // finishes back for classes [j0, j1) of row i and returns their loss
+  T backprop(int64_t i, int64_t j0, int64_t j1, const T* x, T* back,
+             T scale, T lse) const {
+    const T* lab = labels + i * num_classes;
+    T l = T(0.) ;
+    for (int64_t j = j0; j < j1; ++j) {
+      back[j] = back[j] * scale - lab[j] ;
+      l += lab[j] * (lse - x[j]) ;
+    }
+    return l ;
+  }
+
+  T row_loss(int64_t i, const T* x, T lse) const { return T(0.) ; }
+};
+
+// labels: [batch_size] class indices, already checked to be in range
+template <typename T, typename Index>
+struct SoftmaxSparseLabels {
+  const Index* labels;
+
+  T backprop(int64_t i, int64_t j0, int64_t j1, const T* x, T* back,
+             T scale, T lse) const {
+    for (int64_t j = j0; j < j1; ++j)
+      back[j] = back[j] * scale ;
+    const int64_t label = labels[i] ;
+    if (label >= j0 && label < j1)
+      back[label] -= T(1.) ;
+    return T(0.) ;
+  }
+
+  T row_loss(int64_t i, const T* x, T lse) const { return lse - x[labels[i]] ; }
+};
+
+template <typename T, typename M, typename Labels>
+int softmax_xent(const T* logits, const Labels& labels, T* loss, T* back,
+                 int64_t batch_size, int64_t num_classes)
+{
+  if (batch_size <= 0)
+    return 0 ;
+  if (num_classes <= 0) {
+    for (int64_t i = 0; i < batch_size; ++i) loss[i] = T(0.) ;
+    return 0 ;
+  }
+
+  const int64_t nblk = (num_classes + SOFTMAX_BLOCK - 1) / SOFTMAX_BLOCK ;
+
+  // per (row, block): max, sum of exp, loss. Per row: log(S) + M.
+  std::vector<T> bmax(batch_size * nblk), bsum(batch_size * nblk) ;
+  std::vector<T> bloss(batch_size * nblk), rlse(batch_size) ;
+
+  softmax_row_blocks(batch_size, num_classes,
+    [&](int64_t u, int64_t i, int64_t j0, int64_t j1) {
+      softmax_block_max_sum<M>(logits + i * num_classes, back + i * num_classes,
+                            j0, j1, bmax[u], bsum[u]) ;
+    },
+    [&](int64_t i) {
+      rlse[i] = softmax_combine_lse<M>(&bmax[i * nblk], &bsum[i * nblk], nblk) ;
+    },
+    [&](int64_t u, int64_t i, int64_t j0, int64_t j1) {
+      const T lse = rlse[i] ;
+      // exp(m_b - M) / S == exp(m_b - lse)
+      const T scale = M::exp(bmax[u] - lse) ;
+      bloss[u] = labels.backprop(i, j0, j1, logits + i * num_classes,
+                                 back + i * num_classes, scale, lse) ;
+    },
+    [&](int64_t i) {
+      T l = labels.row_loss(i, logits + i * num_classes, rlse[i]) ;
+      for (int64_t k = 0; k < nblk; ++k)
+        l += bloss[i * nblk + k] ;
+      loss[i] = l ;
+    }) ;
+
+  return 0 ;
+}
+
+#endif // SOFTMAX_FUNCTOR_H_
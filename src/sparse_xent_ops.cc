@@ -6,6 +6,7 @@
 #include "kernel.h"
 #include "types.h"
 #include "log.h"
+#include "softmax_functor.h"
 
 #include <omp.h>
 
@@ -28,20 +29,28 @@ extern "C" {
 
 namespace {
 
-template <typename T, typename Index>
-int SparseSoftmaxXentWithLogits(int64_t batch_size, int64_t num_classes, 
-                                uint64_t logits_ptr, uint64_t labels_ptr,
-                                uint64_t scratch_ptr, uint64_t loss_ptr, uint64_t backprop_ptr) 
+template <typename T, typename Index, typename M>
+int sparse_softmax_xent(int64_t batch_size, int64_t num_classes,
+                        uint64_t logits_ptr, uint64_t labels_ptr,
+                        uint64_t loss_ptr, uint64_t backprop_ptr)
 {
   const T* logits = reinterpret_cast<const T*>(logits_ptr);
   const Index* labels = reinterpret_cast<const Index*>(labels_ptr);
-  T* scratch = reinterpret_cast<T*>(scratch_ptr);
   T* loss = reinterpret_cast<T*>(loss_ptr);
   T* backprop = reinterpret_cast<T*>(backprop_ptr);
 
-#if 1
+  // out of range labels are reported by the host kernel
+  int bad = 0 ;
+#pragma omp parallel for reduction(|:bad)
+  for(int64_t i=0; i<batch_size; i++) {
+    bad |= ( labels[i] < 0 || labels[i] >= num_classes ) ? 1 : 0 ;
+  }
+  if( bad )
+    return 1 ;
+
   if( num_classes == 2 ) {
     // vectorize  batch_loop
+#pragma omp parallel for if (batch_size * 2 >= SOFTMAX_PARALLEL_MIN)
     for(int64_t i=0; i<batch_size; i++) {
       const T logits0 = logits[2*i+0] ; 
       const T logits1 = logits[2*i+1] ; 
@@ -51,12 +60,12 @@ int SparseSoftmaxXentWithLogits(int64_t batch_size, int64_t num_classes,
       const T backprop0 = logits0 - max_logits ;
       const T backprop1 = logits1 - max_logits ;
 
-      const T exp_backprop0 = std::exp(backprop0) ;
-      const T exp_backprop1 = std::exp(backprop1) ;
+      const T exp_backprop0 = M::exp(backprop0) ;
+      const T exp_backprop1 = M::exp(backprop1) ;
 
       const T sum_exp_logits = exp_backprop0 + exp_backprop1 ;
 
-      const T log_sum_exp_logits = std::log(sum_exp_logits) ;
+      const T log_sum_exp_logits = M::log(sum_exp_logits) ;
 
       const Index label = labels[i] ;
 
@@ -66,100 +75,24 @@ int SparseSoftmaxXentWithLogits(int64_t batch_size, int64_t num_classes,
       backprop[2*i+1] = exp_backprop1 / sum_exp_logits - ( 1 == label ? T(1.) : T(0.) ) ;
       
     }
-  }
-  else {
-    // omp-parallelize batch loop
-#pragma omp parallel for
-    for(int64_t i=0; i<batch_size; i++) {
-      T max_logits = T(0.) ;
-      for(int64_t j=0; j<num_classes; j++) {
-        if( max_logits < logits[i*num_classes+j]) {
-          max_logits = logits[i*num_classes+j] ;
-        }
-      }
-      for(int64_t j=0; j<num_classes; j++) {
-        backprop[i*num_classes+j] = logits[i*num_classes+j] - max_logits ;
-      }
-   
-      T sum_exp_logits = T(0.) ;
-      for(int64_t j=0; j<num_classes; j++) {
-        sum_exp_logits += std::exp(backprop[i*num_classes+j]) ;
-      }
-
-      const T log_sum_exp_logits = std::log(sum_exp_logits) ;
-      const Index label = labels[i] ;
-      T sum = T(0.) ; 
-      for(int64_t j=0; j<num_classes; j++) {
-        sum += ( j == label ? 
-                     log_sum_exp_logits - backprop[i*num_classes+j] :
-                     T(0.) 
-               ) ;  
-        backprop[i*num_classes+j] = 
-          std::exp(backprop[i*num_classes+j]) / sum_exp_logits
-            - ( j == label ? T(1.) : T(0.) ) ;
-      }
-      loss[i] = sum ;
-    }
-  }
-#else // original
-  // scratch = max_logits along classes.
-  for(int64_t i=0; i<batch_size; i++) {
-    T max = T(0.) ;
-    for(int64_t j=0; j<num_classes; j++) {
-      if( max < logits[i*num_classes+j]) {
-        max = logits[i*num_classes+j] ;
-      }
-    }
-    scratch[i] = max ;
-  }
-
-  // backprop = logits - max_logits.
-  for(int64_t i=0; i<batch_size; i++) {
-    const T max = scratch[i] ;
-    for(int64_t j=0; j<num_classes; j++) {
-      backprop[i*num_classes+j] = logits[i*num_classes+j] - max ;
-    }
+    return 0 ;
   }
 
-  // scratch = sum(exp(logits - max_logits)) along classes.
-  for(int64_t i=0; i<batch_size; i++) {
-    T sum_exp_logits = T(0.) ;
-    for(int64_t j=0; j<num_classes; j++) {
-      sum_exp_logits += std::exp(backprop[i*num_classes+j]) ;
-    }
-    scratch[i] = sum_exp_logits ;
-  }
-
-  //  sum(-labels *
-  //     ((logits - max_logits) - log(sum(exp(logits - max_logits)))))
-  //  along classes
-  for(int64_t i=0; i<batch_size; i++) {
-    const T log_sum_exp_logits = std::log(scratch[i]) ;
-    const Index label = labels[i] ;
-    T sum = T(0.) ; 
-    for(int64_t j=0; j<num_classes; j++) {
-      sum += ( j == label ? 
-                     log_sum_exp_logits - backprop[i*num_classes+j] :
-                     T(0.) 
-                 ) ;  
-    }
-    loss[i] = sum ;
-  }
-
-  // backprop: prob - labels, where
-  //   prob = exp(logits - max_logits) / sum(exp(logits - max_logits))
-  for(int64_t i=0; i<batch_size; i++) {
-    const T sum_exp_logits = scratch[i] ;
-    const Index label = labels[i] ;
-    for(int64_t j=0; j<num_classes; j++) {
-      backprop[i*num_classes+j] = 
-        std::exp(backprop[i*num_classes+j]) / sum_exp_logits
-          - ( j == label ? T(1.) : T(0.) ) ;
-    }
-  }
-#endif
+  SoftmaxSparseLabels<T, Index> l = { labels } ;
+  return softmax_xent<T, M>(logits, l, loss, backprop, batch_size, num_classes) ;
+}
 
-  return 0 ;
+template <typename T, typename Index>
+int SparseSoftmaxXentWithLogits(int64_t batch_size, int64_t num_classes, 
+                                uint64_t logits_ptr, uint64_t labels_ptr,
+                                uint64_t scratch_ptr, uint64_t loss_ptr, uint64_t backprop_ptr) 
+{
+  if (vmath_use_fast("SparseSoftmaxXentWithLogits"))
+    return sparse_softmax_xent<T, Index, VMathFast>(batch_size, num_classes,
+                                                     logits_ptr, labels_ptr, loss_ptr, backprop_ptr) ;
+  else
+    return sparse_softmax_xent<T, Index, VMathAccurate>(batch_size, num_classes,
+                                                         logits_ptr, labels_ptr, loss_ptr, backprop_ptr) ;
 }
 }
 
@@ -0,0 +1,236 @@
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include <omp.h>
+
+#include "strided_copy.h"
+
+// Contiguous rows of at least this many bytes are copied with memcpy.
+// Shorter or strided rows use a vectorized element loop.
+#define STRIDED_COPY_MEMCPY_MIN 1024
+
+// Copies smaller than this run on a single thread.
+#define STRIDED_COPY_PARALLEL_MIN (64*1024)
+
+namespace {
+
+// A block after dims are collapsed. The innermost dim is kept apart as the
+// row, the remaining ones are the outer dims iterated row by row. A row may
+// be cut into nsplit pieces when there are too few rows to keep all
+// threads busy.
+struct CopyPlan {
+  const char* src;
+  char* dst;
+  int nouter;
+  int64_t shape[STRIDED_COPY_MAX_DIMS];
+  int64_t src_stride[STRIDED_COPY_MAX_DIMS];   // bytes
+  int64_t dst_stride[STRIDED_COPY_MAX_DIMS];   // bytes
+  int64_t row_len;                             // elements
+  int64_t row_src_stride, row_dst_stride;      // elements
+  int64_t nsplit, piece_len;
+  int64_t nrows;                               // outer rows * nsplit
+};
+
+void make_plan(const StridedCopyBlock& b, size_t elem_size, CopyPlan& p)
+{
+  int64_t shape[STRIDED_COPY_MAX_DIMS];
+  int64_t sst[STRIDED_COPY_MAX_DIMS];
+  int64_t dst[STRIDED_COPY_MAX_DIMS];
+  int n = 0;
+
+  p.src = reinterpret_cast<const char*>(b.src);
+  p.dst = reinterpret_cast<char*>(b.dst);
+  p.nouter = 0;
+  p.row_len = 0;
+  p.row_src_stride = p.row_dst_stride = 1;
+  p.nsplit = 1;
+  p.piece_len = 0;
+  p.nrows = 0;
+
+  for (int k = 0; k < b.ndims; ++k) {
+    if (b.shape[k] == 0)
+      return;
+    if (b.shape[k] == 1)
+      continue;
+    // merge with the previous (outer) dim if it steps over exactly this one
+    if (n > 0
+        && sst[n-1] == b.shape[k] * b.src_stride[k]
+        && dst[n-1] == b.shape[k] * b.dst_stride[k]) {
+      shape[n-1] *= b.shape[k];
+      sst[n-1] = b.src_stride[k];
+      dst[n-1] = b.dst_stride[k];
+      continue;
+    }
+    shape[n] = b.shape[k];
+    sst[n] = b.src_stride[k];
+    dst[n] = b.dst_stride[k];
+    ++n;
+  }
+
+  if (n == 0) {  // single element
+    shape[0] = 1; sst[0] = 1; dst[0] = 1; n = 1;
+  }
+
+  p.nouter = n - 1;
+  int64_t nouter_rows = 1;
+  for (int k = 0; k < n - 1; ++k) {
+    p.shape[k] = shape[k];
+    p.src_stride[k] = sst[k] * elem_size;
+    p.dst_stride[k] = dst[k] * elem_size;
+    nouter_rows *= shape[k];
+  }
+  p.row_len = shape[n-1];
+  p.row_src_stride = sst[n-1];
+  p.row_dst_stride = dst[n-1];
+  p.nsplit = 1;
+  p.piece_len = p.row_len;
+  p.nrows = nouter_rows;
+}
+
+template <typename T>
+inline void copy_row_t(char* dst, const char* src, int64_t len,
+                       int64_t sst, int64_t dst_stride)
+{
+  T* d = reinterpret_cast<T*>(dst);
+  const T* s = reinterpret_cast<const T*>(src);
+  if (sst == 1 && dst_stride == 1) {
+    for (int64_t i = 0; i < len; ++i) d[i] = s[i];
+  }
+  else {
+    for (int64_t i = 0; i < len; ++i) d[i * dst_stride] = s[i * sst];
+  }
+}
+
+inline void copy_row(char* dst, const char* src, int64_t len,
+                     int64_t sst, int64_t dst_stride, size_t elem_size)
+{
+  if (sst == 1 && dst_stride == 1 && len * elem_size >= STRIDED_COPY_MEMCPY_MIN) {
+    memcpy(dst, src, len * elem_size);
+    return;
+  }
+
+  switch (elem_size) {
+    case 1: copy_row_t<uint8_t> (dst, src, len, sst, dst_stride); break;
+    case 2: copy_row_t<uint16_t>(dst, src, len, sst, dst_stride); break;
+    case 4: copy_row_t<uint32_t>(dst, src, len, sst, dst_stride); break;
+    case 8: copy_row_t<uint64_t>(dst, src, len, sst, dst_stride); break;
+    default:
+#pragma _NEC novector
+      for (int64_t i = 0; i < len; ++i)
+        memcpy(dst + i * dst_stride * elem_size, src + i * sst * elem_size, elem_size);
+      break;
+  }
+}
+
+// Copies rows [rowBegin, rowEnd) of one plan.
+void copy_rows(const CopyPlan& p, size_t elem_size, int64_t rowBegin, int64_t rowEnd)
+{
+  int64_t idx[STRIDED_COPY_MAX_DIMS];
+
+  int64_t outer = rowBegin / p.nsplit;
+  int64_t piece = rowBegin % p.nsplit;
+
+  const char* s = p.src;
+  char* d = p.dst;
+  for (int k = p.nouter - 1; k >= 0; --k) {
+    idx[k] = outer % p.shape[k];
+    outer /= p.shape[k];
+    s += idx[k] * p.src_stride[k];
+    d += idx[k] * p.dst_stride[k];
+  }
+
+#pragma _NEC novector
+  for (int64_t r = rowBegin; r < rowEnd; ++r) {
+    const int64_t off = piece * p.piece_len;
+    const int64_t len = std::min(p.piece_len, p.row_len - off);
+    copy_row(d + off * p.row_dst_stride * elem_size,
+             s + off * p.row_src_stride * elem_size,
+             len, p.row_src_stride, p.row_dst_stride, elem_size);
+
+    if (++piece < p.nsplit)
+      continue;
+    piece = 0;
+
+    // next outer row
+    for (int k = p.nouter - 1; k >= 0; --k) {
+      s += p.src_stride[k];
+      d += p.dst_stride[k];
+      if (++idx[k] < p.shape[k])
+        break;
+      s -= idx[k] * p.src_stride[k];
+      d -= idx[k] * p.dst_stride[k];
+      idx[k] = 0;
+    }
+  }
+}
+
+} // namespace
+
+void strided_copy(const StridedCopyBlock* blocks, int64_t nblocks,
+                  size_t elem_size)
+{
+  std::vector<CopyPlan> plans(nblocks);
+
+  int64_t total_rows = 0;
+  int64_t total_bytes = 0;
+  for (int64_t b = 0; b < nblocks; ++b) {
+    make_plan(blocks[b], elem_size, plans[b]);
+    total_rows += plans[b].nrows;
+    total_bytes += plans[b].nrows * plans[b].row_len * elem_size;
+  }
+
+  const bool parallel = total_bytes >= STRIDED_COPY_PARALLEL_MIN;
+
+  // Too few rows for the threads: cut long rows into pieces.
+  const int64_t want_rows = 4 * omp_get_max_threads();
+  if (parallel && total_rows < want_rows) {
+    total_rows = 0;
+    for (int64_t b = 0; b < nblocks; ++b) {
+      CopyPlan& p = plans[b];
+      if (p.nrows == 0)   // empty block
+        continue;
+      const int64_t nsplit =
+          std::max<int64_t>(1, std::min<int64_t>((want_rows + p.nrows - 1) / std::max<int64_t>(p.nrows, 1),
+                                                 p.row_len * elem_size / STRIDED_COPY_MEMCPY_MIN));
+      p.nsplit = nsplit;
+      p.piece_len = (p.row_len + nsplit - 1) / nsplit;
+      p.nsplit = (p.row_len + p.piece_len - 1) / p.piece_len;
+      p.nrows *= p.nsplit;
+      total_rows += p.nrows;
+    }
+  }
+
+  // first global row of each plan
+  std::vector<int64_t> row_begin(nblocks + 1);
+  row_begin[0] = 0;
+  for (int64_t b = 0; b < nblocks; ++b)
+    row_begin[b+1] = row_begin[b] + plans[b].nrows;
+
+#pragma omp parallel if (parallel)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = total_rows / nthreads ;
+    int64_t remain    = total_rows % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    if( myChunk > 0 ) {
+      const int64_t chunkEnd = chunkBegin + myChunk ;
+      int64_t b = std::upper_bound(row_begin.begin(), row_begin.end(), chunkBegin)
+                  - row_begin.begin() - 1 ;
+      int64_t r = chunkBegin ;
+      while (r < chunkEnd) {
+        const int64_t e = std::min(chunkEnd, row_begin[b+1]) ;
+        if (e > r)
+          copy_rows(plans[b], elem_size, r - row_begin[b], e - row_begin[b]) ;
+        r = e ;
+        ++b ;
+      }
+    }
+  }
+}
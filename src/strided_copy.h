@@ -0,0 +1,50 @@
+#ifndef STRIDED_COPY_H_
+#define STRIDED_COPY_H_
+
+#include <cstdint>
+#include <cstddef>
+
+//
+// N-D strided copy engine used by the data movement ops (Concat, Split,
+// SplitV, Pack, Slice, Tile).
+//
+// An op is described as a list of blocks. Each block copies
+//
+//   dst[sum_k i_k * dst_stride[k]] = src[sum_k i_k * src_stride[k]]
+//
+// for all 0 <= i_k < shape[k]. Strides are in elements and may be 0 on the
+// source side (broadcast). Contiguous dims are collapsed, and the innermost
+// rows of all blocks are then split among OpenMP threads. Long contiguous
+// rows are copied with memcpy.
+//
+
+#define STRIDED_COPY_MAX_DIMS 16
+
+struct StridedCopyBlock {
+  const void* src;
+  void* dst;
+  int ndims;
+  int64_t shape[STRIDED_COPY_MAX_DIMS];
+  int64_t src_stride[STRIDED_COPY_MAX_DIMS];
+  int64_t dst_stride[STRIDED_COPY_MAX_DIMS];
+};
+
+// Block copying a [rows, cols] matrix whose rows are src_ld and dst_ld
+// elements apart. This is all Concat, Split and Pack need.
+inline StridedCopyBlock strided_copy_2d(const void* src, void* dst,
+                                        int64_t rows, int64_t cols,
+                                        int64_t src_ld, int64_t dst_ld)
+{
+  StridedCopyBlock b;
+  b.src = src;
+  b.dst = dst;
+  b.ndims = 2;
+  b.shape[0] = rows; b.src_stride[0] = src_ld; b.dst_stride[0] = dst_ld;
+  b.shape[1] = cols; b.src_stride[1] = 1;      b.dst_stride[1] = 1;
+  return b;
+}
+
+void strided_copy(const StridedCopyBlock* blocks, int64_t nblocks,
+                  size_t elem_size);
+
+#endif // STRIDED_COPY_H_
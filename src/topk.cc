@@ -0,0 +1,176 @@
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include "kernel.h"
+#include "types.h"
+#include "log.h"
+
+#include <omp.h>
+
+REGISTER_KERNEL("TopKV2", "op_TopKV2");
+
+#define CHECK_ARG_LEN(l0, l1) \
+  if ((l0) != (l1)) { \
+      fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n", (l1), (l0)); \
+      return 1; \
+  }
+
+extern "C" {
+  int op_TopKV2(const void* arg, size_t len);
+}
+
+//
+// TopKV2
+//
+// The input is viewed as [rows, cols] and the k largest entries of each row
+// are written to values[rows, k] and indices[rows, k] in descending order.
+// Equal values are ordered by index, lower first, as in TensorFlow. The
+// output is always sorted, which is also a valid result for sorted=false.
+//
+// Each row keeps a heap of its best k entries with the worst one on top. An
+// entry that does not beat the top is dropped with a single compare, so most
+// of a long row is a plain scan. When k is a large part of the row, a partial
+// sort of the row's indices is cheaper and is used instead. Rows are split
+// among threads.
+//
+
+// Below this many elements the op runs on a single thread.
+#define TOPK_PARALLEL_MIN (16*1024)
+
+namespace {
+
+template <typename T>
+struct TopKEntry {
+  T value ;
+  int32_t index ;
+};
+
+// a comes before b in the output
+template <typename T>
+inline bool topk_before(const TopKEntry<T>& a, const TopKEntry<T>& b)
+{
+  return a.value > b.value || (a.value == b.value && a.index < b.index) ;
+}
+
+template <typename T>
+void topk_heap(const T* x, int64_t cols, int64_t k, TopKEntry<T>* heap)
+{
+  bool (*cmp)(const TopKEntry<T>&, const TopKEntry<T>&) = topk_before<T> ;
+
+  for (int64_t j = 0; j < k; ++j) {
+    heap[j].value = x[j] ;
+    heap[j].index = j ;
+  }
+  std::make_heap(heap, heap + k, cmp) ;     // worst entry on top
+
+  for (int64_t j = k; j < cols; ++j) {
+    // index j is larger than every index in the heap, so only a strictly
+    // larger value gets in
+    if (x[j] > heap[0].value) {
+      std::pop_heap(heap, heap + k, cmp) ;
+      heap[k - 1].value = x[j] ;
+      heap[k - 1].index = j ;
+      std::push_heap(heap, heap + k, cmp) ;
+    }
+  }
+  std::sort_heap(heap, heap + k, cmp) ;     // best first
+}
+
+template <typename T>
+void topk_partial_sort(const T* x, int64_t cols, int64_t k, TopKEntry<T>* buf)
+{
+  for (int64_t j = 0; j < cols; ++j) {
+    buf[j].value = x[j] ;
+    buf[j].index = j ;
+  }
+  std::partial_sort(buf, buf + k, buf + cols, topk_before<T>) ;
+}
+
+template <typename T>
+int topk(uint64_t in_ptr, uint64_t values_ptr, uint64_t indices_ptr,
+         int64_t rows, int64_t cols, int64_t k)
+{
+  const T* in = reinterpret_cast<const T*>(in_ptr) ;
+  T* values = reinterpret_cast<T*>(values_ptr) ;
+  int32_t* indices = reinterpret_cast<int32_t*>(indices_ptr) ;
+
+  if (k < 0 || k > cols)
+    return 1 ;
+  if (rows == 0 || k == 0)
+    return 0 ;
+
+  // with k small against cols most entries fail the first compare
+  const bool use_heap = k * 16 <= cols ;
+
+#pragma omp parallel if (rows * cols >= TOPK_PARALLEL_MIN)
+  {
+    std::vector<TopKEntry<T> > buf(use_heap ? k : cols) ;
+
+#pragma omp for
+    for (int64_t i = 0; i < rows; ++i) {
+      if (use_heap)
+        topk_heap(in + i * cols, cols, k, buf.data()) ;
+      else
+        topk_partial_sort(in + i * cols, cols, k, buf.data()) ;
+
+      T* vi = values + i * k ;
+      int32_t* ii = indices + i * k ;
+      for (int64_t j = 0; j < k; ++j) {
+        vi[j] = buf[j].value ;
+        ii[j] = buf[j].index ;
+      }
+    }
+  }
+
+  return 0 ;
+}
+}
+
+int op_TopKV2(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype ;
+    int sorted ;
+    int64_t rows ;
+    int64_t cols ;
+    int64_t k ;
+    uint64_t in_ptr ;
+    uint64_t values_ptr ;
+    uint64_t indices_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  LOG(3) << __FUNCTION__ << " rows=" << p->rows << " cols=" << p->cols
+         << " k=" << p->k << " sorted=" << p->sorted ;
+
+  int ret = 1;
+
+  // indices are int32
+  if (p->cols > INT32_MAX)
+    return 1 ;
+
+  if (p->dtype == DT_FLOAT) {
+    ret = topk<float>(p->in_ptr, p->values_ptr, p->indices_ptr,
+                      p->rows, p->cols, p->k) ;
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    ret = topk<double>(p->in_ptr, p->values_ptr, p->indices_ptr,
+                       p->rows, p->cols, p->k) ;
+  }
+  else if (p->dtype == DT_INT32) {
+    ret = topk<int32_t>(p->in_ptr, p->values_ptr, p->indices_ptr,
+                        p->rows, p->cols, p->k) ;
+  }
+  else if (p->dtype == DT_INT64) {
+    ret = topk<int64_t>(p->in_ptr, p->values_ptr, p->indices_ptr,
+                        p->rows, p->cols, p->k) ;
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
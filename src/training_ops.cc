@@ -10,9 +10,12 @@
 #include <omp.h>
 
 #include "libvetfkernel.h"
+#include "scatter_functor.h"
 
 REGISTER_KERNEL("ApplyGradientDescent", "op_ApplyGradientDescent");
 REGISTER_KERNEL("ApplyAdam", "op_ApplyAdam");
+REGISTER_KERNEL("SparseApplyGradientDescent", "op_SparseApplyGradientDescent");
+REGISTER_KERNEL("SparseApplyAdam", "op_SparseApplyAdam");
 
 #define CHECK_ARG_LEN(l0, l1) \
   if ((l0) != (l1)) { \
@@ -23,6 +26,8 @@ REGISTER_KERNEL("ApplyAdam", "op_ApplyAdam");
 extern "C" {
   int op_ApplyGradientDescent(const void *arg, size_t len) ;
   int op_ApplyAdam(const void* arg, size_t len);
+  int op_SparseApplyGradientDescent(const void* arg, size_t len);
+  int op_SparseApplyAdam(const void* arg, size_t len);
 }
 
 //
@@ -257,3 +262,234 @@ int op_ApplyAdam(const void* args, size_t len)
   return ret;
 }
 
+
+//
+// SparseApplyGradientDescent
+//
+// var[idx[j], :] -= alpha * grad[j, :]
+//
+// var is [first_dim_size, inner_size] and grad is [nindex, inner_size], the
+// same layout as Gather. Only the indexed rows are read and written.
+//
+
+namespace {
+
+template <typename T, typename Index>
+int sparse_apply_gradient_descent(int64_t first_dim_size, int64_t inner_size,
+                                  int64_t nindex,
+                                  uint64_t var_ptr, uint64_t alpha_ptr,
+                                  uint64_t grad_ptr, uint64_t idx_ptr)
+{
+  T* var = reinterpret_cast<T*>(var_ptr);
+  const T alpha = *reinterpret_cast<const T*>(alpha_ptr);
+  const T* grad = reinterpret_cast<const T*>(grad_ptr);
+  const Index* idx = reinterpret_cast<const Index*>(idx_ptr);
+
+  return scatter_rows_parallel(idx, nindex, first_dim_size, inner_size,
+      [=](int64_t row, int64_t j) {
+        T* w = var + row * inner_size ;
+        const T* g = grad + j * inner_size ;
+        for (int64_t k = 0; k < inner_size; k++) w[k] -= alpha * g[k] ;
+      }) ;
+}
+
+}
+
+int op_SparseApplyGradientDescent(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype, idxtype;
+    int64_t first_dim_size, inner_size, nindex ;
+    uint64_t var_ptr, alpha_ptr ;
+    uint64_t grad_ptr, idx_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  int ret = 1;
+
+  if (p->dtype == DT_FLOAT) {
+    if (p->idxtype == DT_INT32) {
+      ret = sparse_apply_gradient_descent<float, int32_t>
+              (p->first_dim_size, p->inner_size, p->nindex,
+               p->var_ptr, p->alpha_ptr, p->grad_ptr, p->idx_ptr) ;
+    }
+    else if (p->idxtype == DT_INT64) {
+      ret = sparse_apply_gradient_descent<float, int64_t>
+              (p->first_dim_size, p->inner_size, p->nindex,
+               p->var_ptr, p->alpha_ptr, p->grad_ptr, p->idx_ptr) ;
+    }
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    if (p->idxtype == DT_INT32) {
+      ret = sparse_apply_gradient_descent<double, int32_t>
+              (p->first_dim_size, p->inner_size, p->nindex,
+               p->var_ptr, p->alpha_ptr, p->grad_ptr, p->idx_ptr) ;
+    }
+    else if (p->idxtype == DT_INT64) {
+      ret = sparse_apply_gradient_descent<double, int64_t>
+              (p->first_dim_size, p->inner_size, p->nindex,
+               p->var_ptr, p->alpha_ptr, p->grad_ptr, p->idx_ptr) ;
+    }
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
+
+//
+// SparseApplyAdam
+//
+// Lazy Adam: m, v and var are updated only in the rows named by idx, with
+// the same step as ApplyAdam. Duplicate indices are applied one after the
+// other in index order, as in TF's SparseApply* kernels.
+//
+
+namespace {
+
+template <typename T>
+inline void apply_adam_row(bool use_nesterov, T* var, T* m, T* v, const T* grd,
+                           T beta1, T beta2, T epsilon, T k, int64_t n)
+{
+  const T one = T(1.) ;
+  if( use_nesterov ) {
+    for(int64_t i=0; i<n; i++) {
+      m[i] = m[i] + (one - beta1) * (grd[i] - m[i]) ;
+      v[i] = v[i] + (one - beta2) * (grd[i]*grd[i] - v[i]) ;
+      var[i] -= k * ( m[i] * beta1 + (one-beta1) * grd[i] ) / ( epsilon + std::sqrt(v[i])) ;
+    }
+  }
+  else {
+    for(int64_t i=0; i<n; i++) {
+      m[i] = m[i] + (one - beta1) * (grd[i] - m[i]) ;
+      v[i] = v[i] + (one - beta2) * (grd[i]*grd[i] - v[i]) ;
+      var[i] -= k * m[i] / (epsilon + std::sqrt(v[i])) ;
+    }
+  }
+}
+
+template <>
+inline void apply_adam_row<float>(bool use_nesterov, float* var, float* m, float* v,
+                                  const float* grd, float beta1, float beta2,
+                                  float epsilon, float k, int64_t n)
+{
+  const float one = 1.f ;
+  if( use_nesterov ) {
+    for(int64_t i=0; i<n; i++) {
+      m[i] = m[i] + (one - beta1) * (grd[i] - m[i]) ;
+      v[i] = v[i] + (one - beta2) * (grd[i]*grd[i] - v[i]) ;
+      var[i] -= k * ( m[i] * beta1 + (one-beta1) * grd[i] ) / ( epsilon + std::sqrt(v[i])) ;
+    }
+  }
+  else {
+    _apply_adam_f32(var, m, v, beta1, beta2, epsilon, k, n, grd) ;
+  }
+}
+
+template <typename T, typename Index>
+int sparse_apply_adam(bool use_nesterov,
+                      int64_t first_dim_size, int64_t inner_size, int64_t nindex,
+                      uint64_t var_ptr, uint64_t m_ptr, uint64_t v_ptr,
+                      uint64_t beta1_power_ptr, uint64_t beta2_power_ptr,
+                      uint64_t lr_ptr,
+                      uint64_t beta1_ptr, uint64_t beta2_ptr, uint64_t epsilon_ptr,
+                      uint64_t grd_ptr, uint64_t idx_ptr)
+{
+  T* var = reinterpret_cast<T*>(var_ptr);
+  T* m   = reinterpret_cast<T*>(m_ptr);
+  T* v   = reinterpret_cast<T*>(v_ptr);
+
+  const T* grd = reinterpret_cast<const T*>(grd_ptr);
+  const Index* idx = reinterpret_cast<const Index*>(idx_ptr);
+
+  const T beta1_power = reinterpret_cast<const T*>(beta1_power_ptr)[0];
+  const T beta2_power = reinterpret_cast<const T*>(beta2_power_ptr)[0];
+  const T lr = reinterpret_cast<const T*>(lr_ptr)[0];
+  const T beta1 = reinterpret_cast<const T*>(beta1_ptr)[0];
+  const T beta2 = reinterpret_cast<const T*>(beta2_ptr)[0];
+  const T epsilon = reinterpret_cast<const T*>(epsilon_ptr)[0];
+
+  const T one = T(1.) ;
+  const T k = (lr * std::sqrt( one - beta2_power) / ( one - beta1_power)) ;
+
+  return scatter_rows_parallel(idx, nindex, first_dim_size, inner_size,
+      [=](int64_t row, int64_t j) {
+        const int64_t o = row * inner_size ;
+        apply_adam_row<T>(use_nesterov, var + o, m + o, v + o,
+                          grd + j * inner_size, beta1, beta2, epsilon, k,
+                          inner_size) ;
+      }) ;
+}
+
+template <typename T>
+int sparse_apply_adam_handle(int idxtype, bool use_nesterov,
+                             int64_t first_dim_size, int64_t inner_size, int64_t nindex,
+                             uint64_t var_ptr, uint64_t m_ptr, uint64_t v_ptr,
+                             uint64_t beta1_power_ptr, uint64_t beta2_power_ptr,
+                             uint64_t lr_ptr,
+                             uint64_t beta1_ptr, uint64_t beta2_ptr, uint64_t epsilon_ptr,
+                             uint64_t grd_ptr, uint64_t idx_ptr)
+{
+  if (idxtype == DT_INT32) {
+    return sparse_apply_adam<T, int32_t>(use_nesterov, first_dim_size, inner_size, nindex,
+                                         var_ptr, m_ptr, v_ptr,
+                                         beta1_power_ptr, beta2_power_ptr, lr_ptr,
+                                         beta1_ptr, beta2_ptr, epsilon_ptr,
+                                         grd_ptr, idx_ptr) ;
+  }
+  else if (idxtype == DT_INT64) {
+    return sparse_apply_adam<T, int64_t>(use_nesterov, first_dim_size, inner_size, nindex,
+                                         var_ptr, m_ptr, v_ptr,
+                                         beta1_power_ptr, beta2_power_ptr, lr_ptr,
+                                         beta1_ptr, beta2_ptr, epsilon_ptr,
+                                         grd_ptr, idx_ptr) ;
+  }
+  return 1 ;
+}
+
+}
+
+int op_SparseApplyAdam(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int dtype, idxtype;
+    bool use_nesterov_ ;
+    int64_t first_dim_size, inner_size, nindex ;
+    uint64_t var_ptr, m_ptr, v_ptr ;
+    uint64_t beta1_power_ptr, beta2_power_ptr ;
+    uint64_t lr ;
+    uint64_t beta1_ptr, beta2_ptr, epsilon_ptr ;
+    uint64_t grad_ptr, idx_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  int ret = 1;
+
+  if (p->dtype == DT_FLOAT) {
+    ret = sparse_apply_adam_handle<float> (p->idxtype, p->use_nesterov_,
+                                           p->first_dim_size, p->inner_size, p->nindex,
+                                           p->var_ptr, p->m_ptr, p->v_ptr,
+                                           p->beta1_power_ptr, p->beta2_power_ptr, p->lr,
+                                           p->beta1_ptr, p->beta2_ptr, p->epsilon_ptr,
+                                           p->grad_ptr, p->idx_ptr) ;
+  }
+  else if (p->dtype == DT_DOUBLE) {
+    ret = sparse_apply_adam_handle<double>(p->idxtype, p->use_nesterov_,
+                                           p->first_dim_size, p->inner_size, p->nindex,
+                                           p->var_ptr, p->m_ptr, p->v_ptr,
+                                           p->beta1_power_ptr, p->beta2_power_ptr, p->lr,
+                                           p->beta1_ptr, p->beta2_ptr, p->epsilon_ptr,
+                                           p->grad_ptr, p->idx_ptr) ;
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
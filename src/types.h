@@ -70,4 +70,32 @@ enum TensorFormat {
   FORMAT_HWCN = 5,
 };
 
+// from tensorflow/core/framework/types.h
+// Size in bytes of one element, or 0 for types that are not plain values.
+inline int DataTypeSize(int dtype) {
+  switch (dtype) {
+    case DT_FLOAT:      return 4;
+    case DT_DOUBLE:     return 8;
+    case DT_INT32:      return 4;
+    case DT_UINT8:      return 1;
+    case DT_INT16:      return 2;
+    case DT_INT8:       return 1;
+    case DT_COMPLEX64:  return 8;
+    case DT_INT64:      return 8;
+    case DT_BOOL:       return 1;
+    case DT_QINT8:      return 1;
+    case DT_QUINT8:     return 1;
+    case DT_QINT32:     return 4;
+    case DT_BFLOAT16:   return 2;
+    case DT_QINT16:     return 2;
+    case DT_QUINT16:    return 2;
+    case DT_UINT16:     return 2;
+    case DT_COMPLEX128: return 16;
+    case DT_HALF:       return 2;
+    case DT_UINT32:     return 4;
+    case DT_UINT64:     return 8;
+    default:            return 0;
+  }
+}
+
 #endif
@@ -0,0 +1,241 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "kernel.h"
+#include "types.h"
+#include "log.h"
+#include "radix_sort.h"
+#include "scan.h"
+
+#include <omp.h>
+
+REGISTER_KERNEL("Sort", "op_Sort");
+REGISTER_KERNEL("Unique", "op_Unique");
+REGISTER_KERNEL("UniqueWithCounts", "op_UniqueWithCounts");
+
+#define CHECK_ARG_LEN(l0, l1) \
+  if ((l0) != (l1)) { \
+      fprintf(stderr, "%s: illegal argument length: %ld expected but %ld\n", (l1), (l0)); \
+      return 1; \
+  }
+
+extern "C" {
+  int op_Sort(const void* arg, size_t len);
+  int op_Unique(const void* arg, size_t len);
+  int op_UniqueWithCounts(const void* arg, size_t len);
+}
+
+//
+// Sort
+//
+// Sorts n integer keys in ascending order with an optional payload of
+// 4- or 8-byte values (value_type DT_INVALID for none). The sort is stable.
+//
+
+namespace {
+
+template <typename Key, typename Value>
+int sort_kv(uint64_t keys_in, uint64_t values_in, uint64_t keys_out,
+            uint64_t values_out, int64_t n)
+{
+  Key* keys = reinterpret_cast<Key*>(keys_out) ;
+  Value* values = reinterpret_cast<Value*>(values_out) ;
+
+  if (keys_out != keys_in)
+    memcpy(keys, reinterpret_cast<const Key*>(keys_in), n * sizeof(Key)) ;
+  if (values && values_out != values_in)
+    memcpy(values, reinterpret_cast<const Value*>(values_in), n * sizeof(Value)) ;
+
+  std::vector<Key> key_buf(n) ;
+  std::vector<Value> value_buf(values ? n : 0) ;
+  radix_sort(keys, values, n, key_buf.data(), values ? value_buf.data() : NULL) ;
+  return 0 ;
+}
+
+template <typename Key>
+int sort_keys(int value_type, uint64_t keys_in, uint64_t values_in,
+              uint64_t keys_out, uint64_t values_out, int64_t n)
+{
+  if (value_type == DT_INVALID)
+    return sort_kv<Key, uint32_t>(keys_in, 0, keys_out, 0, n) ;
+
+  switch (DataTypeSize(value_type)) {
+    case 4: return sort_kv<Key, uint32_t>(keys_in, values_in, keys_out, values_out, n) ;
+    case 8: return sort_kv<Key, uint64_t>(keys_in, values_in, keys_out, values_out, n) ;
+  }
+  return 1 ;
+}
+
+} // namespace
+
+int op_Sort(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+
+  struct Args {
+    int key_type ;
+    int value_type ;
+    int64_t n ;
+    uint64_t keys_in ;
+    uint64_t values_in ;
+    uint64_t keys_out ;
+    uint64_t values_out ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  int ret = 1;
+
+  if (p->key_type == DT_INT32) {
+    ret = sort_keys<int32_t>(p->value_type, p->keys_in, p->values_in,
+                             p->keys_out, p->values_out, p->n) ;
+  }
+  else if (p->key_type == DT_INT64) {
+    ret = sort_keys<int64_t>(p->value_type, p->keys_in, p->values_in,
+                             p->keys_out, p->values_out, p->n) ;
+  }
+
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
+//
+// Unique / UniqueWithCounts
+//
+// y is the unique values of x in order of first occurrence, idx[i] the
+// position of x[i] in y and count[j] the number of occurrences of y[j]. y
+// and count are allocated by the host with n elements, the number of unique
+// values is written to *num_unique.
+//
+// (x[i], i) is radix sorted, so each value is a run of the sorted keys and
+// the first position of a run is its first occurrence. The first
+// occurrences are flagged in position order and an exclusive sum over the
+// flags gives the slot of each value in y.
+//
+
+namespace {
+
+template <typename T, typename Index>
+int unique(const T* x, T* y, Index* idx, Index* count, int64_t* num_unique,
+           int64_t n)
+{
+  if (n == 0) {
+    *num_unique = 0 ;
+    return 0 ;
+  }
+
+  const bool parallel = n >= SCAN_PARALLEL_MIN ;
+
+  std::vector<T> keys(n), key_buf(n) ;
+  std::vector<int64_t> pos(n), pos_buf(n) ;
+#pragma omp parallel for if (parallel)
+  for (int64_t i = 0; i < n; ++i) {
+    keys[i] = x[i] ;
+    pos[i] = i ;
+  }
+  radix_sort(keys.data(), pos.data(), n, key_buf.data(), pos_buf.data()) ;
+
+  // run of each sorted key: the number of run starts up to j, minus one.
+  // pos_buf is free after the sort.
+  std::vector<int64_t>& run = pos_buf ;
+#pragma omp parallel for if (parallel)
+  for (int64_t j = 0; j < n; ++j)
+    run[j] = (j == 0 || keys[j] != keys[j - 1]) ? 1 : 0 ;
+  const int64_t nruns = exclusive_sum(run.data(), n) ;
+#pragma omp parallel for if (parallel)
+  for (int64_t j = 0; j < n; ++j)
+    run[j] += (j == 0 || keys[j] != keys[j - 1]) ? 0 : -1 ;
+
+  // start of each run in the sorted keys, and first occurrence flags
+  std::vector<int64_t> start(nruns + 1), slot(n, 0) ;
+  start[nruns] = n ;
+#pragma omp parallel for if (parallel)
+  for (int64_t j = 0; j < n; ++j) {
+    if (j == 0 || keys[j] != keys[j - 1]) {
+      start[run[j]] = j ;
+      slot[pos[j]] = 1 ;
+    }
+  }
+  exclusive_sum(slot.data(), n) ;
+
+#pragma omp parallel for if (parallel)
+  for (int64_t j = 0; j < n; ++j) {
+    const int64_t r = run[j] ;
+    const int64_t s = slot[pos[start[r]]] ;
+    idx[pos[j]] = s ;
+    if (j == start[r]) {
+      y[s] = keys[j] ;
+      if (count)
+        count[s] = start[r + 1] - j ;
+    }
+  }
+
+  *num_unique = nruns ;
+  return 0 ;
+}
+
+template <typename T>
+int unique_idx(int idxtype, uint64_t x, uint64_t y, uint64_t idx,
+               uint64_t count, uint64_t num_unique, int64_t n)
+{
+  if (idxtype == DT_INT32) {
+    return unique<T, int32_t>(reinterpret_cast<const T*>(x), reinterpret_cast<T*>(y),
+                              reinterpret_cast<int32_t*>(idx), reinterpret_cast<int32_t*>(count),
+                              reinterpret_cast<int64_t*>(num_unique), n) ;
+  }
+  else if (idxtype == DT_INT64) {
+    return unique<T, int64_t>(reinterpret_cast<const T*>(x), reinterpret_cast<T*>(y),
+                              reinterpret_cast<int64_t*>(idx), reinterpret_cast<int64_t*>(count),
+                              reinterpret_cast<int64_t*>(num_unique), n) ;
+  }
+  return 1 ;
+}
+
+int unique_op(const void* args, size_t len, bool with_counts)
+{
+  struct Args {
+    int dtype, idxtype ;
+    int64_t n ;
+    uint64_t x_ptr ;
+    uint64_t y_ptr ;
+    uint64_t idx_ptr ;
+    uint64_t count_ptr ;
+    uint64_t num_unique_ptr ;
+  } const* p;
+
+  CHECK_ARG_LEN(len, sizeof(Args));
+  p = reinterpret_cast<const Args*>(args);
+
+  const uint64_t count = with_counts ? p->count_ptr : 0 ;
+
+  int ret = 1 ;
+  if (p->dtype == DT_INT32) {
+    ret = unique_idx<int32_t>(p->idxtype, p->x_ptr, p->y_ptr, p->idx_ptr,
+                              count, p->num_unique_ptr, p->n) ;
+  }
+  else if (p->dtype == DT_INT64) {
+    ret = unique_idx<int64_t>(p->idxtype, p->x_ptr, p->y_ptr, p->idx_ptr,
+                              count, p->num_unique_ptr, p->n) ;
+  }
+  return ret ;
+}
+
+} // namespace
+
+int op_Unique(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+  int ret = unique_op(args, len, false) ;
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
+
+int op_UniqueWithCounts(const void* args, size_t len)
+{
+  LOG(2) << __FUNCTION__ << " begin";
+  int ret = unique_op(args, len, true) ;
+  LOG(2) << __FUNCTION__ << " end. ret=" << ret;
+  return ret;
+}
@@ -1,32 +1,60 @@
 #include <cstdint>
-#include "asl.h"
 #include "types.h"
 #include <sstream>
 #include "ve_ops_common.h"
+#include "float16.h"
+#include "strided_copy.h"
+#include "broadcast.h"
+#include "softmax_functor.h"
+#include <vector>
+
+#include <omp.h>
+
+//
+// Select / SelectV2
+//
+// out = cond ? then : else. SelectV2 broadcasts the three inputs to the
+// output shape. Select takes then and else of the output shape and a cond of
+// the same shape, or a vector cond that picks whole rows; the vector is
+// broadcast as [n, 1, ..., 1]. Elements are moved as plain values of the
+// dtype's size, so every dtype is supported.
+//
 
 namespace {
 
 template <typename T>
-int op_select_nn(uint64_t out,
-                 uint64_t cond,
-                 uint64_t then,
-                 uint64_t else_,
-                 size_t n)
+int select(const Broadcast& b, uint64_t out, uint64_t cond, uint64_t then,
+           uint64_t else_)
 {
   T* po = reinterpret_cast<T*>(out);
   const bool* pc = reinterpret_cast<const bool*>(cond);
   const T* pt = reinterpret_cast<const T*>(then);
   const T* pe = reinterpret_cast<const T*>(else_);
 
-  for (size_t i = 0; i < n; ++i) {
-    po[i] = pc[i] ? pt[i] : pe[i];
-  }
+  const int e = b.ndims - 1 ;
+  const int64_t sc = b.stride[0][e] ;
+  const int64_t st = b.stride[1][e] ;
+  const int64_t se = b.stride[2][e] ;
+
+  broadcast_for_each(b, [=](int64_t o, const int64_t* off, int64_t n) {
+    T* po0 = po + o ;
+    const bool* pc0 = pc + off[0] ;
+    const T* pt0 = pt + off[1] ;
+    const T* pe0 = pe + off[2] ;
+    if (sc && st && se) {
+      for (int64_t i = 0; i < n; ++i)
+        po0[i] = pc0[i] ? pt0[i] : pe0[i] ;
+    } else {
+      for (int64_t i = 0; i < n; ++i)
+        po0[i] = pc0[i * sc] ? pt0[i * st] : pe0[i * se] ;
+    }
+  }) ;
+
   return 0;
 }
 
-int op_select(const VEOpArgs& args)
+int op_select_common(const VEOpArgs& args, bool v2)
 {
-  //fprintf(stderr, "%s: ninputs=%d noutputs=%d\n", __FUNCTION__, args.ninputs(), args.noutputs());
   if (args.nVariables() != 4)
     return 1;
 
@@ -35,111 +63,251 @@ int op_select(const VEOpArgs& args)
   const Tensor *t2 = args.arg<Tensor>(2) ;
   const Tensor *t3 = args.arg<Tensor>(3) ;
 
-#if 0
-  fprintf(stderr, "%s: input(0).dtype=%d\n", __FUNCTION__, t0->dtype);
-  fprintf(stderr, "%s: input(1).dtype=%d\n", __FUNCTION__, t1->dtype);
-  fprintf(stderr, "%s: input(2).dtype=%d\n", __FUNCTION__, t2->dtype);
-  fprintf(stderr, "%s: output(0).dtype=%d\n", __FUNCTION__, t3->dtype);
-#endif
-
-  if (t0->dtype == DT_BOOL
-      && t1->dtype == DT_FLOAT
-      && t2->dtype == DT_FLOAT
-      && t3->dtype == DT_FLOAT) {
-    if (t0->nelems == t1->nelems
-        && t0->nelems == t2->nelems) {
-      return op_select_nn<float>(t3->addr,
-                                 t0->addr,
-                                 t1->addr,
-                                 t2->addr,
-                                 t0->nelems);
-    }
+  if (t0->dtype != DT_BOOL
+      || t1->dtype != t3->dtype
+      || t2->dtype != t3->dtype)
+    return 1;
+  if (t0->dims > BROADCAST_MAX_DIMS || t1->dims > BROADCAST_MAX_DIMS
+      || t2->dims > BROADCAST_MAX_DIMS || t3->dims > BROADCAST_MAX_DIMS)
+    return 1;
+
+  int dims[3] = { t0->dims, t1->dims, t2->dims } ;
+  int64_t dim_size[4][BROADCAST_MAX_DIMS] ;
+  for (int i = 0; i < t0->dims; ++i) dim_size[0][i] = t0->dim_size[i] ;
+  for (int i = 0; i < t1->dims; ++i) dim_size[1][i] = t1->dim_size[i] ;
+  for (int i = 0; i < t2->dims; ++i) dim_size[2][i] = t2->dim_size[i] ;
+  for (int i = 0; i < t3->dims; ++i) dim_size[3][i] = t3->dim_size[i] ;
+
+  if (!v2 && t0->dims == 1 && t3->dims > 1) {
+    for (int i = 1; i < t3->dims; ++i)
+      dim_size[0][i] = 1 ;
+    dims[0] = t3->dims ;
   }
 
-#if 0
-  fprintf(stderr, "%s: return 1\n", __FUNCTION__);
-#endif
+  const int64_t* in_size[3] = { dim_size[0], dim_size[1], dim_size[2] } ;
+  Broadcast b ;
+  if (!broadcast_init(b, t3->dims, dim_size[3], 3, dims, in_size))
+    return 1;
+
+  switch (DataTypeSize(t3->dtype)) {
+    case 1: return select<uint8_t> (b, t3->addr, t0->addr, t1->addr, t2->addr) ;
+    case 2: return select<uint16_t>(b, t3->addr, t0->addr, t1->addr, t2->addr) ;
+    case 4: return select<uint32_t>(b, t3->addr, t0->addr, t1->addr, t2->addr) ;
+    case 8: return select<uint64_t>(b, t3->addr, t0->addr, t1->addr, t2->addr) ;
+  }
   return 1;
 }
 
-int op_randomUniform(const VEOpArgs& args)
+int op_select(const VEOpArgs& args)
 {
-  if (args.nVariables() != 1)
-    return 1;
-
-  const Tensor* t = args.arg<Tensor>(0);
-
-  LOG(3) << "op_RandomUniform: nelems=" << t->nelems;
-
-  if (t->dtype == DT_FLOAT) {
-    float* p = reinterpret_cast<float*>(t->addr);
-    ASL::getRandom(t->nelems, p) ;
-  }
+  return op_select_common(args, false) ;
+}
 
-  return 0;
+int op_selectv2(const VEOpArgs& args)
+{
+  return op_select_common(args, true) ;
 }
 
 } // namespace
 
 DEFINE_KERNEL(Select, op_select);
-DEFINE_KERNEL(RandomUniform, op_randomUniform);
+DEFINE_KERNEL(SelectV2, op_selectv2);
 
 //
 // Cast
 //
+// Every pair of the numeric types below (plus bool, bfloat16 and half) is
+// supported. op_cast picks the loop for (from, to) with a two level type
+// dispatch and runs it in parallel over element chunks.
+//
 
 namespace {
 
 template <typename TO, typename TI>
-  void cast(const Tensor* to, const Tensor* ti) {
-    TO* po = reinterpret_cast<TO*>(to->addr);
-    const TI* pi = reinterpret_cast<const TI*>(ti->addr);
+struct CastValue {
+  static TO apply(TI x) { return static_cast<TO>(x); }
+};
+
+template <typename TI>
+struct CastValue<bool, TI> {
+  static bool apply(TI x) { return x != TI(0); }
+};
 
-    for (size_t i = 0; i < ti->nelems; ++i)
-      po[i] = pi[i];
+template <typename TO>
+struct CastValue<TO, bfloat16_t> {
+  static TO apply(bfloat16_t x) { return CastValue<TO, float>::apply(bf16_to_float(x.v)); }
+};
+
+template <typename TI>
+struct CastValue<bfloat16_t, TI> {
+  static bfloat16_t apply(TI x) {
+    bfloat16_t y; y.v = float_to_bf16(CastValue<float, TI>::apply(x)); return y;
   }
+};
 
 template <typename TO>
-  void cast2bool(const Tensor* to, const Tensor* ti) {
-    TO* po = reinterpret_cast<TO*>(to->addr);
-    const bool* pi = reinterpret_cast<const bool*>(ti->addr);
+struct CastValue<TO, half_t> {
+  static TO apply(half_t x) { return CastValue<TO, float>::apply(half_to_float(x.v)); }
+};
+
+template <typename TI>
+struct CastValue<half_t, TI> {
+  static half_t apply(TI x) {
+    half_t y; y.v = float_to_half(CastValue<float, TI>::apply(x)); return y;
+  }
+};
+
+// pairs matched by two of the partial specializations above
+template <>
+struct CastValue<bool, bfloat16_t> {
+  static bool apply(bfloat16_t x) { return (x.v & 0x7fff) != 0; }
+};
+
+template <>
+struct CastValue<bool, half_t> {
+  static bool apply(half_t x) { return (x.v & 0x7fff) != 0; }
+};
+
+template <>
+struct CastValue<bfloat16_t, bfloat16_t> {
+  static bfloat16_t apply(bfloat16_t x) { return x; }
+};
+
+template <>
+struct CastValue<half_t, half_t> {
+  static half_t apply(half_t x) { return x; }
+};
 
-#if 0 // original ( partially vectorized ) 
-    for (size_t i = 0; i < ti->nelems; ++i)
-      po[i] = pi[i];
-#else
-  const size_t n = ti->nelems ;
+template <>
+struct CastValue<bfloat16_t, half_t> {
+  static bfloat16_t apply(half_t x) {
+    bfloat16_t y; y.v = float_to_bf16(half_to_float(x.v)); return y;
+  }
+};
+
+template <>
+struct CastValue<half_t, bfloat16_t> {
+  static half_t apply(bfloat16_t x) {
+    half_t y; y.v = float_to_half(bf16_to_float(x.v)); return y;
+  }
+};
+
+template <typename TO, typename TI>
+void cast(TO* po, const TI* pi, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    po[i] = CastValue<TO, TI>::apply(pi[i]);
+}
 
-  const size_t vloop_begin =  (to->addr) & 0x3 ;
-  const size_t vloop_end   =  n   & 0xFFFFFFFFFFFFFFFC ;
+// bool input is read 4 bytes at a time so that the loop vectorizes.
+template <typename TO>
+void cast2bool(TO* po, const bool* pi, size_t n)
+{
+  size_t vloop_begin = (4 - (reinterpret_cast<uint64_t>(pi) & 0x3)) & 0x3 ;
+  if (vloop_begin > n) vloop_begin = n ;
+  const size_t vloop_end = vloop_begin + ((n - vloop_begin) & ~size_t(0x3)) ;
 
 #pragma novector
   for(size_t i=0; i < vloop_begin ; i++) {
     po[i] = pi[i] ;
   }
-  
-  const int*  pi_i = reinterpret_cast<const int*>(&pi[vloop_begin]);
+
+  const int32_t* pi_i = reinterpret_cast<const int32_t*>(&pi[vloop_begin]);
+  TO* po_v = po + vloop_begin ;
   for(size_t j=0; j < (vloop_end - vloop_begin)>>2 ; j++) {
     const int32_t b  = pi_i[j] ;
 
-    const int32_t b0 =   b        & 0xFF ; 
+    const int32_t b0 =   b        & 0xFF ;
     const int32_t b1 = ( b >>  8) & 0xFF ;
     const int32_t b2 = ( b >> 16) & 0xFF ;
-    const int32_t b3 = ( b >> 24)        ;
+    const int32_t b3 = ( b >> 24) & 0xFF ;
 
-    po[vloop_begin+4*j+0] = b0 ;
-    po[vloop_begin+4*j+1] = b1 ;
-    po[vloop_begin+4*j+2] = b2 ;
-    po[vloop_begin+4*j+3] = b3 ;
+    po_v[4*j+0] = b0 ;
+    po_v[4*j+1] = b1 ;
+    po_v[4*j+2] = b2 ;
+    po_v[4*j+3] = b3 ;
   }
 
-
 #pragma novector
   for(size_t i=vloop_end; i < n ; i++) {
     po[i] = pi[i] ;
   }
-#endif
+}
+
+template <> void cast<float, bool>(float* po, const bool* pi, size_t n) { cast2bool<float>(po, pi, n); }
+template <> void cast<double, bool>(double* po, const bool* pi, size_t n) { cast2bool<double>(po, pi, n); }
+template <> void cast<int32_t, bool>(int32_t* po, const bool* pi, size_t n) { cast2bool<int32_t>(po, pi, n); }
+template <> void cast<int64_t, bool>(int64_t* po, const bool* pi, size_t n) { cast2bool<int64_t>(po, pi, n); }
+
+typedef void (*CastFunc)(uint64_t out, uint64_t in, size_t n);
+
+// Below this many elements the cast runs on a single thread. Most casts in
+// input pipelines are of small or scalar tensors.
+#define CAST_PARALLEL_MIN 8192
+
+template <typename TO, typename TI>
+void cast_loop(uint64_t out, uint64_t in, size_t n)
+{
+  TO* po = reinterpret_cast<TO*>(out);
+  const TI* pi = reinterpret_cast<const TI*>(in);
+
+#pragma omp parallel if (n >= CAST_PARALLEL_MIN)
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
+
+    int64_t chunkSize = n / nthreads ;
+    int64_t remain    = n % nthreads ;
+
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
+
+    if( myChunk > 0 ) {
+      cast<TO, TI>(po + chunkBegin, pi + chunkBegin, myChunk) ;
+    }
   }
+}
+
+template <typename TO>
+CastFunc cast_func_from(int from)
+{
+  switch (from) {
+    case DT_FLOAT:    return cast_loop<TO, float>;
+    case DT_DOUBLE:   return cast_loop<TO, double>;
+    case DT_INT8:     return cast_loop<TO, int8_t>;
+    case DT_INT16:    return cast_loop<TO, int16_t>;
+    case DT_INT32:    return cast_loop<TO, int32_t>;
+    case DT_INT64:    return cast_loop<TO, int64_t>;
+    case DT_UINT8:    return cast_loop<TO, uint8_t>;
+    case DT_UINT16:   return cast_loop<TO, uint16_t>;
+    case DT_UINT32:   return cast_loop<TO, uint32_t>;
+    case DT_UINT64:   return cast_loop<TO, uint64_t>;
+    case DT_BOOL:     return cast_loop<TO, bool>;
+    case DT_BFLOAT16: return cast_loop<TO, bfloat16_t>;
+    case DT_HALF:     return cast_loop<TO, half_t>;
+    default:          return NULL;
+  }
+}
+
+CastFunc cast_func(int to, int from)
+{
+  switch (to) {
+    case DT_FLOAT:    return cast_func_from<float>(from);
+    case DT_DOUBLE:   return cast_func_from<double>(from);
+    case DT_INT8:     return cast_func_from<int8_t>(from);
+    case DT_INT16:    return cast_func_from<int16_t>(from);
+    case DT_INT32:    return cast_func_from<int32_t>(from);
+    case DT_INT64:    return cast_func_from<int64_t>(from);
+    case DT_UINT8:    return cast_func_from<uint8_t>(from);
+    case DT_UINT16:   return cast_func_from<uint16_t>(from);
+    case DT_UINT32:   return cast_func_from<uint32_t>(from);
+    case DT_UINT64:   return cast_func_from<uint64_t>(from);
+    case DT_BOOL:     return cast_func_from<bool>(from);
+    case DT_BFLOAT16: return cast_func_from<bfloat16_t>(from);
+    case DT_HALF:     return cast_func_from<half_t>(from);
+    default:          return NULL;
+  }
+}
 
 int op_cast(const VEOpArgs& args)
 {
@@ -158,19 +326,11 @@ int op_cast(const VEOpArgs& args)
   if (ti->nelems != to->nelems)
     return 1;
 
-  if (ti->dtype == DT_BOOL && to->dtype == DT_FLOAT) {
-    cast2bool<float>(to, ti);
-  } else if (ti->dtype == DT_INT32 && to->dtype == DT_FLOAT) {
-    cast<float, int32_t>(to, ti);
-  } else if (ti->dtype == DT_BOOL && to->dtype == DT_INT32) {
-    cast2bool<int32_t>(to, ti);
-  } else if (ti->dtype == DT_UINT16 && to->dtype == DT_INT32) {
-    cast<int32_t, uint16_t>(to, ti);
-  } else if (ti->dtype == DT_INT8 && to->dtype == DT_BOOL) {
-    cast<bool, int8_t>(to, ti);
-  } else {
+  CastFunc func = cast_func(to->dtype, ti->dtype);
+  if (!func)
     return 1;
-  }
+
+  func(to->addr, ti->addr, ti->nelems);
 
   return 0;
 }
@@ -182,170 +342,13 @@ DEFINE_KERNEL(Cast, op_cast);
 //
 // Tile
 //
+// X = TILE(Y), X = [m0*e0, m1*e1, ...], Y = [e0, e1, ...]
+// is copied as one block of shape [m0, e0, m1, e1, ...] whose m dims have
+// source stride 0.
+//
 
 namespace {
 
-template<typename T>
-int tile_dim3(Tensor const& X, Tensor const& Y)
-{
-  LOG(3) << __FUNCTION__;
-  T* px = reinterpret_cast<T*>(X.addr);
-  T const* py = reinterpret_cast<T*>(Y.addr);
-
-  int64_t const* sx = X.dim_size;
-  int64_t const* sy = Y.dim_size;
-
-  for (size_t i0 = 0; i0 < sx[0]; ++i0) {
-    const size_t ix0 = i0 ;
-    const size_t iy0 = i0 % sy[0] ;
-    for (size_t i1 = 0; i1 < sx[1]; ++i1) {
-      const size_t ix1 = ix0 * sx[1] + i1 ;
-      const size_t iy1 = iy0 * sy[1] + (i1 % sy[1]) ;
-      for (size_t i2 = 0; i2 < sx[2]; ++i2) {
-	const size_t ix2 = ix1 * sx[2] + i2 ;
-	const size_t iy2 = iy1 * sy[2] + (i2 % sy[2]) ;
-	px[ix2] = py[iy2] ;
-      }
-    }
-  }
-
-  return 0;
-}
-
-// X = TILE(Y)
-// X = [d0, d1, d2, d3]
-// Y = [e0, e1, 1, 1]
-template<typename T>
-int tile_dim4_11(Tensor const& X, Tensor const& Y)
-{
-  LOG(3) << __FUNCTION__;
-  T* px = reinterpret_cast<T*>(X.addr);
-  T const* py = reinterpret_cast<T*>(Y.addr);
-
-  int64_t const* sx = X.dim_size;
-  int64_t const* sy = Y.dim_size;
-
-#pragma _NEC novector
-  for (size_t i0 = 0; i0 < sx[0]; ++i0) {
-    const size_t ix0 = i0 ;
-    const size_t iy0 = i0 % sy[0] ;
-#pragma _NEC novector
-    for (size_t i1 = 0; i1 < sx[1]; ++i1) {
-      const size_t ix1 = ix0 * sx[1] + i1 ;
-      const size_t iy1 = iy0 * sy[1] + (i1 % sy[1]) ;
-      for (size_t i23 = 0; i23 < sx[2] * sx[3] ; ++i23) {
-	const size_t ix23 = ix1 * sx[2] * sx[3] + i23 ;
-	px[ix23] = py[iy1] ;
-      }
-    }
-  }
-
-  return 0;
-}
-
-template<typename T>
-int tile_dim4(Tensor const& X, Tensor const& Y)
-{
-  LOG(3) << __FUNCTION__;
-  T* px = reinterpret_cast<T*>(X.addr);
-  T const* py = reinterpret_cast<T*>(Y.addr);
-
-  int64_t const* sx = X.dim_size;
-  int64_t const* sy = Y.dim_size;
-
-  for (size_t i0 = 0; i0 < sx[0]; ++i0) {
-    const size_t ix0 = i0 ;
-    const size_t iy0 = i0 % sy[0] ;
-    for (size_t i1 = 0; i1 < sx[1]; ++i1) {
-      const size_t ix1 = ix0 * sx[1] + i1 ;
-      const size_t iy1 = iy0 * sy[1] + (i1 % sy[1]) ;
-      for (size_t i2 = 0; i2 < sx[2]; ++i2) {
-	const size_t ix2 = ix1 * sx[2] + i2 ;
-	const size_t iy2 = iy1 * sy[2] + (i2 % sy[2]) ;
-	for (size_t i3 = 0; i3 < sx[3]; ++i3) {
-	  const size_t ix3 = ix2 * sx[3] + i3 ;
-	  const size_t iy3 = iy2 * sy[3] + (i3 % sy[3]) ;
-	  px[ix3] = py[iy3] ;
-	}
-      }
-    }
-  }
-
-  return 0;
-}
-
-// X = TILE(Y)
-// X = [d0, d1, d2, d3, d4]
-// Y = [e0, e1, e2, 1, 1]
-template<typename T>
-int tile_dim5_11(Tensor const& X, Tensor const& Y)
-{
-  LOG(3) << __FUNCTION__;
-  T* px = reinterpret_cast<T*>(X.addr);
-  T const* py = reinterpret_cast<T*>(Y.addr);
-
-  int64_t const* sx = X.dim_size;
-  int64_t const* sy = Y.dim_size;
-
-#pragma _NEC novector
-  for (size_t i0 = 0; i0 < sx[0]; ++i0) {
-    const size_t ix0 = i0 ;
-    const size_t iy0 = i0 % sy[0] ;
-#pragma _NEC novector
-    for (size_t i1 = 0; i1 < sx[1]; ++i1) {
-      const size_t ix1 = ix0 * sx[1] + i1 ;
-      const size_t iy1 = iy0 * sy[1] + (i1 % sy[1]) ;
-#pragma _NEC novector
-      for (size_t i2 = 0; i2 < sx[2]; ++i2) {
-	const size_t ix2 = ix1 * sx[2] + i2 ;
-	const size_t iy2 = iy1 * sy[2] + (i2 % sy[2]) ;
-	for (size_t i34 = 0; i34 < sx[3] * sx[4] ; ++i34) {
-	  const size_t ix34 = ix2 * sx[3] * sx[4] + i34 ;
-	  px[ix34] = py[iy2] ;
-	}
-      }
-    }
-  }
-
-  return 0;
-}
-
-template<typename T>
-int tile_dim5(Tensor const& X, Tensor const& Y)
-{
-  LOG(3) << __FUNCTION__;
-  T* px = reinterpret_cast<T*>(X.addr);
-  T const* py = reinterpret_cast<T*>(Y.addr);
-
-  int64_t const* sx = X.dim_size;
-  int64_t const* sy = Y.dim_size;
-
-  for (size_t i0 = 0; i0 < sx[0]; ++i0) {
-    const size_t ix0 = i0 ;
-    const size_t iy0 = i0 % sy[0] ;
-    for (size_t i1 = 0; i1 < sx[1]; ++i1) {
-      const size_t ix1 = ix0 * sx[1] + i1 ;
-      const size_t iy1 = iy0 * sy[1] + (i1 % sy[1]) ;
-      for (size_t i2 = 0; i2 < sx[2]; ++i2) {
-	const size_t ix2 = ix1 * sx[2] + i2 ;
-	const size_t iy2 = iy1 * sy[2] + (i2 % sy[2]) ;
-	for (size_t i3 = 0; i3 < sx[3]; ++i3) {
-	  const size_t ix3 = ix2 * sx[3] + i3 ;
-	  const size_t iy3 = iy2 * sy[3] + (i3 % sy[3]) ;
-	  for (size_t i4 = 0; i4 < sx[4]; ++i4) {
-	    const size_t ix4 = ix3 * sx[4] + i4 ;
-	    const size_t iy4 = iy3 * sy[4] + (i4 % sy[4]) ;
-	    px[ix4] = py[iy4] ;
-	  }
-	}
-      }
-    }
-  }
-
-  return 0;
-}
-
-
 int op_tile(const VEOpArgs& args)
 {
   if (args.nVariables() != 2)
@@ -357,60 +360,34 @@ int op_tile(const VEOpArgs& args)
     << " ti=" << ti->to_s()
     << " to=" << to->to_s();
 
-  int rc = 1 ;
+  const int elem_size = DataTypeSize(ti->dtype) ;
+  if (ti->dtype != to->dtype || elem_size == 0)
+    return 1 ;
+  if (ti->dims != to->dims || 2 * ti->dims > STRIDED_COPY_MAX_DIMS)
+    return 1 ;
 
-//  printf("ti->dims = %ld\n", ti->dims) ;
-//  for(int i=0; i<ti->dims ; i++ ) printf(" [%d] = %ld\n", i, ti->dim_size[i]) ;
-//  printf("to->dims = %ld\n", to->dims) ;
-//  for(int i=0; i<to->dims ; i++ ) printf(" [%d] = %ld\n", i, to->dim_size[i]) ;
-//  fflush(stdout) ;
+  StridedCopyBlock blk ;
+  blk.src = reinterpret_cast<const void*>(ti->addr) ;
+  blk.dst = reinterpret_cast<void*>(to->addr) ;
+  blk.ndims = 2 * ti->dims ;
 
-  if (ti->dtype == DT_FLOAT && to->dtype == DT_FLOAT) {
-    const float* pi = reinterpret_cast<const float*>(ti->addr);
-    float* po = reinterpret_cast<float*>(to->addr);
-    if (ti->dims == 1 && to->dims == 1 && ti->nelems == 1) {
-      for (size_t i = 0; i < to->nelems; ++i) {
-        po[i] = pi[0];
-      }
-      rc = 0 ;
-    } else if (ti->dims == 2 && to->dims == 2
-               && ti->dim_size[0] == to->dim_size[0]
-               && ti->dim_size[1] == 1) {
-      for (size_t i = 0; i < ti->dim_size[0]; ++i) {
-        for (size_t j = 0; j < to->dim_size[1]; ++j) {
-          po[i * to->dim_size[1] + j] = pi[i];
-        }
-      }
-      rc = 0 ;
-    } else if (ti->dims == 2 && to->dims == 2
-               && ti->dim_size[1] == to->dim_size[1]
-               && ti->dim_size[0] == 1) {
-      for (size_t i = 0; i < to->dim_size[0]; ++i) {
-        for (size_t j = 0; j < to->dim_size[1]; ++j) {
-          po[i * to->dim_size[1] + j] = pi[j];
-        }
-      }
-      rc = 0 ;
-    } else if ( ti->dims == to->dims && ti->dims == 3 ) {
-      rc = tile_dim3<float>(*to, *ti) ;
-    } else if ( ti->dims == to->dims && ti->dims == 4 ) {
-      if( ti->dim_size[2]==1 && ti->dim_size[3]==1 ) {
-	rc = tile_dim4_11<float>(*to, *ti) ;
-      }
-      else {
-	rc = tile_dim4<float>(*to, *ti) ;
-      }
-    } else if ( ti->dims == to->dims && ti->dims == 5 ) {
-      if( ti->dim_size[3]==1 && ti->dim_size[4]==1 ) {
-	rc = tile_dim5_11<float>(*to, *ti) ;
-      }
-      else {
-	rc = tile_dim5<float>(*to, *ti) ;
-      }
-    }
+  int64_t xs = 1, ys = 1 ;
+  for (int k = ti->dims - 1; k >= 0; --k) {
+    const int64_t e = ti->dim_size[k] ;
+    const int64_t d = to->dim_size[k] ;
+    if (e == 0 ? d != 0 : d % e != 0)
+      return 1 ;
+    const int64_t m = e == 0 ? 0 : d / e ;
+
+    blk.shape[2*k]   = m ; blk.src_stride[2*k]   = 0  ; blk.dst_stride[2*k]   = e * xs ;
+    blk.shape[2*k+1] = e ; blk.src_stride[2*k+1] = ys ; blk.dst_stride[2*k+1] = xs ;
+    xs *= d ;
+    ys *= e ;
   }
 
-  return rc;
+  strided_copy(&blk, 1, elem_size) ;
+
+  return 0;
 }
 } // namespace
 
@@ -425,100 +402,28 @@ template<typename T>
 int softmax_xent_with_logits_same_shape(
   int64_t logits_addr,
   int64_t labels_addr,
-  int64_t scratch_addr,
   int64_t loss_addr,
   int64_t back_addr,
   size_t batch_size,
   size_t num_classes )
 {
-  T* logits  = reinterpret_cast<T*>(logits_addr);
-  T* labels  = reinterpret_cast<T*>(labels_addr);
-  T* scratch = reinterpret_cast<T*>(scratch_addr);
-  T* loss    = reinterpret_cast<T*>(loss_addr);
-  T* back    = reinterpret_cast<T*>(back_addr);
-
-#if 1 /* optimized version */
-  for(int64_t i=0; i<batch_size; i++) {
-    T max_logits = T(0.) ;
-    for(int64_t j=0; j<num_classes; j++) {
-      if(max_logits < logits[i*num_classes+j]) max_logits = logits[i*num_classes+j] ;
-    }
-
-    T sum_exp_logits = T(0.) ;
-    for(int64_t j=0; j<num_classes; j++) {
-      const T logit = logits[i*num_classes+j] - max_logits;
-      sum_exp_logits += std::exp(logit) ;
-      back[i*num_classes+j] = logit ;
-    }
-
-    T l = T(0.) ;
-    for(int64_t j=0; j<num_classes; j++) {
-      const T logit = back[i*num_classes+j] ;
-      const T label = labels[i*num_classes+j] ;
-
-      l += label * (std::log(sum_exp_logits) - logit);
-      back[i*num_classes+j] = std::exp(logit) / sum_exp_logits - label ;
-    }
-    loss[i] = l ;
-  }
-#else /* original version */
-  // max_logits along classes.
-  for(int64_t i=0; i<batch_size; i++) {
-    T max_logits = T(0.) ;
-    for(int64_t j=0; j<num_classes; j++) {
-      if(max_logits < logits[i*num_classes+j]) max_logits = logits[i*num_classes+j] ;
-    }
-    scratch[i] = max_logits ;
-  }
-
-  // logits - max_logits.
-  for(int64_t i=0; i<batch_size; i++) {
-    const T max_logits = scratch[i] ;
-    for(int64_t j=0; j<num_classes; j++) {
-      back[i*num_classes+j] = logits[i*num_classes+j] - max_logits;
-    }
-  }
-
-  // sum(exp(logits - max_logits)) along classes.
-  for(int64_t i=0; i<batch_size; i++) {
-    T sum_exp_logits = T(0.) ;
-    for(int64_t j=0; j<num_classes; j++) {
-      sum_exp_logits += std::exp(back[i*num_classes+j]) ;
-    }
-    scratch[i] = sum_exp_logits ;
-  }
-
-
-  //  sum(-labels *
-  //     ((logits - max_logits) - log(sum(exp(logits - max_logits)))))
-  //  along classes
-  for(int64_t i=0; i<batch_size; i++) {
-    const T sum_exp_logits = scratch[i] ;
-    T l = T(0.) ;
-    for(int64_t j=0; j<num_classes; j++) {
-      l += labels[i*num_classes+j] * (std::log(sum_exp_logits) - back[i*num_classes+j]);
-    }
-    loss[i] = l ;
-  }
-
-  // backprop: prob - labels, where
-  //   prob = exp(logits - max_logits) / sum(exp(logits - max_logits))
-  for(int64_t i=0; i<batch_size; i++) {
-    const T sum_exp_logits = scratch[i] ;
-    for(int64_t j=0; j<num_classes; j++) {
-      back[i*num_classes+j] = std::exp(back[i*num_classes+j]) / sum_exp_logits - labels[i*num_classes+j] ;
-    }
-  }
-#endif
-
-  return 0 ;
+  const T* logits = reinterpret_cast<const T*>(logits_addr);
+  const T* labels = reinterpret_cast<const T*>(labels_addr);
+  T* loss         = reinterpret_cast<T*>(loss_addr);
+  T* back         = reinterpret_cast<T*>(back_addr);
+
+  SoftmaxDenseLabels<T> l = { labels, static_cast<int64_t>(num_classes) } ;
+  if (vmath_use_fast("SoftmaxXentWithLogits"))
+    return softmax_xent<T, VMathFast>(logits, l, loss, back, batch_size, num_classes) ;
+  else
+    return softmax_xent<T, VMathAccurate>(logits, l, loss, back, batch_size, num_classes) ;
 }
 
 namespace {
 int op_softmax_xent_with_logits(const VEOpArgs& args)
 {
   if (args.nVariables() != 5)
-    return 5;
+    return 1;
 
   const Tensor* logits_in = args.arg<Tensor>(0);
   const Tensor* labels_in = args.arg<Tensor>(1);
@@ -533,27 +438,28 @@ int op_softmax_xent_with_logits(const VEOpArgs& args)
     << " loss_out="  << loss_out->to_s()
     << " back_out="  << back_out->to_s() ;
 
-  if ( logits_in->dtype == DT_FLOAT
-      && labels_in->dtype == DT_FLOAT
-      && scratch->dtype == DT_FLOAT
-      && loss_out->dtype == DT_FLOAT
-      && back_out->dtype == DT_FLOAT ) {
-
-    int r=1;
-
-    // TODO : add other patterns (ex:n1,1n)
-    if (logits_in->dims == 2 && labels_in->dims == 2
-	&& logits_in->dim_size[0] == labels_in->dim_size[0]
-        && logits_in->dim_size[1] == labels_in->dim_size[1] ) {
-      r = softmax_xent_with_logits_same_shape<float>(
-   	    logits_in->addr, labels_in->addr,
-	    scratch->addr, loss_out->addr, back_out->addr,
-	    logits_in->dim_size[0], labels_in->dim_size[1] ) ;
-    }
+  const int dtype = logits_in->dtype ;
+  if (labels_in->dtype != dtype || loss_out->dtype != dtype || back_out->dtype != dtype)
+    return 1;
 
-    return r;
+  // TODO : add other patterns (ex:n1,1n)
+  if (logits_in->dims != 2 || labels_in->dims != 2
+      || logits_in->dim_size[0] != labels_in->dim_size[0]
+      || logits_in->dim_size[1] != labels_in->dim_size[1] )
+    return 1;
+
+  int r = 1;
+  if (dtype == DT_FLOAT) {
+    r = softmax_xent_with_logits_same_shape<float>(
+          logits_in->addr, labels_in->addr, loss_out->addr, back_out->addr,
+          logits_in->dim_size[0], logits_in->dim_size[1] ) ;
+  } else if (dtype == DT_DOUBLE) {
+    r = softmax_xent_with_logits_same_shape<double>(
+          logits_in->addr, labels_in->addr, loss_out->addr, back_out->addr,
+          logits_in->dim_size[0], logits_in->dim_size[1] ) ;
   }
-  return 1;
+
+  return r;
 }
 } // namespace
 
@@ -563,27 +469,29 @@ DEFINE_KERNEL(SoftmaxXentWithLogits, op_softmax_xent_with_logits);
 //
 // Concat
 //
-template<typename T>
-  int concat(uint64_t n, uint64_t dim0, uint64_t dim1, uint64_t out,
-             uint64_t *ins, uint64_t *dim1s )
-  {
-    const T** pi = reinterpret_cast<const T**>(ins);
-    const uint64_t* in_dim1s = reinterpret_cast<const uint64_t*>(dim1s);
-    T* po = reinterpret_cast<T*>(out);
-
-    for(int64_t i=0; i<dim0; i++) {
-      for(int64_t j=0; j<n; j++) {
-        int64_t idim1 = idim1 = in_dim1s[j] ;
-        for(int64_t k=0; k<idim1; k++) {
-          po[k] = pi[j][i*idim1+k] ;
-        }
-        po+=idim1 ;
-      }
-    }
-    return 0 ;
+// Inputs are viewed as [dim0, dim1s[j]] and the output as [dim0, dim1].
+// Each input is one block copy into its column range of the output.
+//
+namespace {
+int concat(size_t elem_size, uint64_t n, uint64_t dim0, uint64_t dim1,
+           uint64_t out, const uint64_t *ins, const uint64_t *dim1s)
+{
+  std::vector<StridedCopyBlock> blocks(n) ;
+
+  uint64_t offset = 0 ;
+  for(int64_t j=0; j<n; j++) {
+    blocks[j] = strided_copy_2d(reinterpret_cast<const void*>(ins[j]),
+                                reinterpret_cast<char*>(out) + offset * elem_size,
+                                dim0, dim1s[j], dim1s[j], dim1) ;
+    offset += dim1s[j] ;
   }
+  if (offset != dim1)
+    return 1 ;
+
+  strided_copy(blocks.data(), n, elem_size) ;
+  return 0 ;
+}
 
-namespace {
 int op_Concat(const VEOpArgs& args)
 {
   LOG(2) << __FUNCTION__ << " begin";
@@ -598,21 +506,17 @@ int op_Concat(const VEOpArgs& args)
   const uint64_t output_ptr        = *args.arg<uint64_t>(narg++) ;
 
 
-  uint64_t ins[n_input] ;
-  uint64_t dim1s[n_input] ;
+  std::vector<uint64_t> ins(n_input) ;
+  std::vector<uint64_t> dim1s(n_input) ;
   for(int64_t i=0; i<n_input; i++) {
     ins[i]   = *args.arg<uint64_t>(narg++) ;
     dim1s[i] = *args.arg<uint64_t>(narg++) ;
   }
 
-  if (dtype == DT_FLOAT) {
-    ret = concat<float>(n_input, outputs_flat_dim0, outputs_flat_dim1, output_ptr, ins, dim1s ) ;
-  }
-  else if (dtype == DT_INT32) {
-    ret = concat<int32_t>(n_input, outputs_flat_dim0, outputs_flat_dim1, output_ptr, ins, dim1s ) ;
-  }
-  else if (dtype == DT_DOUBLE) {
-    ret = concat<double>(n_input, outputs_flat_dim0, outputs_flat_dim1, output_ptr, ins, dim1s ) ;
+  const int elem_size = DataTypeSize(dtype) ;
+  if (elem_size > 0) {
+    ret = concat(elem_size, n_input, outputs_flat_dim0, outputs_flat_dim1,
+                 output_ptr, ins.data(), dim1s.data()) ;
   }
 
   LOG(2) << __FUNCTION__ << " end. ret=" << ret;
@@ -625,33 +529,41 @@ DEFINE_KERNEL(Concat, op_Concat);
 
 
 //
-// Split
+// Split, SplitV
 //
-template<typename T>
-  int split(const int64_t  num_split,
+// The input is viewed as [prefix_dim_size, split_dim_size, suffix_dim_size].
+// Output n takes split_sizes[n] entries of the split dim, and is one block
+// copy of a [prefix_dim_size, split_sizes[n] * suffix_dim_size] matrix.
+//
+namespace {
+int split_v(size_t elem_size,
+            const int64_t  num_split,
             const int64_t  prefix_dim_size,
-	    const int64_t  split_dim_size,
-	    const int64_t  suffix_dim_size,
-	    const uint64_t input_addr,
-	    uint64_t       *output_addrs)
-  {
-    const T* pi = reinterpret_cast<const T*>(input_addr);
-    T** po = reinterpret_cast<T**>(output_addrs);
-
-    const int64_t split_dim_output_size = split_dim_size / num_split ;
+            const int64_t  split_dim_size,
+            const int64_t  suffix_dim_size,
+            const int64_t  *split_sizes,
+            const uint64_t input_addr,
+            const uint64_t *output_addrs)
+{
+  std::vector<StridedCopyBlock> blocks(num_split) ;
+
+  int64_t offset = 0 ;
+  for(int64_t n=0; n<num_split; n++) {
+    const int64_t cols = split_sizes[n] * suffix_dim_size ;
+    blocks[n] = strided_copy_2d(reinterpret_cast<const char*>(input_addr)
+                                  + offset * suffix_dim_size * elem_size,
+                                reinterpret_cast<void*>(output_addrs[n]),
+                                prefix_dim_size, cols,
+                                split_dim_size * suffix_dim_size, cols) ;
+    offset += split_sizes[n] ;
+  }
+  if (offset != split_dim_size)
+    return 1 ;
 
-    for(int64_t i=0; i<prefix_dim_size; i++) {
-      for(int64_t n=0; n<num_split; n++) {
-	for(int64_t j=0; j<split_dim_output_size*suffix_dim_size; j++) {
-	  po[n][(i*split_dim_output_size)*suffix_dim_size+j]
-		= pi[(i*split_dim_size+(n*split_dim_output_size))*suffix_dim_size+j] ;
-	}
-      }
-    }
-    return 0 ;
-  }
+  strided_copy(blocks.data(), num_split, elem_size) ;
+  return 0 ;
+}
 
-namespace {
 int op_Split(const VEOpArgs& args)
 {
   LOG(2) << __FUNCTION__ << " begin";
@@ -667,63 +579,24 @@ int op_Split(const VEOpArgs& args)
   const Tensor *input_tensor = args.arg<Tensor>(narg++) ;
   const uint64_t input_addr  = input_tensor->addr ;
 
-  uint64_t output_addrs[num_split] ;
+  std::vector<uint64_t> output_addrs(num_split) ;
+  std::vector<int64_t>  split_sizes(num_split, split_dim_size / num_split) ;
   for(int64_t i=0; i<num_split; i++) {
     const Tensor *result = args.arg<Tensor>(narg++) ;
     output_addrs[i] = result->addr ;
   }
 
-  const int dtype = input_tensor->dtype ;
-
-  if (dtype == DT_FLOAT) {
-    ret = split<float>(num_split, prefix_dim_size, split_dim_size, suffix_dim_size,
-                       input_addr, output_addrs) ;
-  }
-  else if (dtype == DT_DOUBLE) {
-    ret = split<double>(num_split, prefix_dim_size, split_dim_size, suffix_dim_size,
-                       input_addr, output_addrs) ;
+  const int elem_size = DataTypeSize(input_tensor->dtype) ;
+  if (elem_size > 0) {
+    ret = split_v(elem_size, num_split, prefix_dim_size, split_dim_size, suffix_dim_size,
+                  split_sizes.data(), input_addr, output_addrs.data()) ;
   }
 
   LOG(2) << __FUNCTION__ << " end. ret=" << ret;
 
   return ret;
 }
-}
-
-DEFINE_KERNEL(Split, op_Split);
-
-
-//
-// SplitV
-//
-template<typename T>
-  int split_v(const int64_t  num_split,
-              const int64_t  prefix_dim_size,
-	      const int64_t  split_dim_size,
-	      const int64_t  suffix_dim_size,
-	      const int64_t  *split_sizes,
-	      const uint64_t input_addr,
-	      uint64_t       *output_addrs)
-  {
-    const T* pi = reinterpret_cast<const T*>(input_addr);
-    T** po = reinterpret_cast<T**>(output_addrs);
-
-
-    for(int64_t i=0; i<prefix_dim_size; i++) {
-      int64_t offset = 0 ;
-      for(int64_t n=0; n<num_split; n++) {
-	const int64_t split_size = split_sizes[n] ;
- 	for(int64_t j=0; j<split_size*suffix_dim_size; j++) {
-	  po[n][i*split_size*suffix_dim_size+j]
-		= pi[(i*split_dim_size+offset)*suffix_dim_size+j] ;
-	}
- 	offset += split_size ;
-      }
-    }
-    return 0 ;
-  }
 
-namespace {
 int op_SplitV(const VEOpArgs& args)
 {
   LOG(2) << __FUNCTION__ << " begin";
@@ -739,23 +612,18 @@ int op_SplitV(const VEOpArgs& args)
   const Tensor *input_tensor = args.arg<Tensor>(narg++) ;
   const uint64_t input_addr  = input_tensor->addr ;
 
-  uint64_t output_addrs[num_split] ;
-  int64_t  split_sizes[num_split] ;
+  std::vector<uint64_t> output_addrs(num_split) ;
+  std::vector<int64_t>  split_sizes(num_split) ;
   for(int64_t i=0; i<num_split; i++) {
     const Tensor *result = args.arg<Tensor>(narg++) ;
     output_addrs[i] = result->addr ;
     split_sizes[i] = *args.arg<int64_t>(narg++) ;
   }
 
-  const int dtype = input_tensor->dtype ;
-
-  if (dtype == DT_FLOAT) {
-    ret = split_v<float>(num_split, prefix_dim_size, split_dim_size, suffix_dim_size,
-	                 split_sizes, input_addr, output_addrs) ;
-  }
-  else if (dtype == DT_DOUBLE) {
-    ret = split_v<double>(num_split, prefix_dim_size, split_dim_size, suffix_dim_size,
-                          split_sizes, input_addr, output_addrs) ;
+  const int elem_size = DataTypeSize(input_tensor->dtype) ;
+  if (elem_size > 0) {
+    ret = split_v(elem_size, num_split, prefix_dim_size, split_dim_size, suffix_dim_size,
+                  split_sizes.data(), input_addr, output_addrs.data()) ;
   }
 
   LOG(2) << __FUNCTION__ << " end. ret=" << ret;
@@ -764,82 +632,50 @@ int op_SplitV(const VEOpArgs& args)
 }
 }
 
+DEFINE_KERNEL(Split, op_Split);
 DEFINE_KERNEL(SplitV, op_SplitV);
 
 
 //
-// StridedSlice
+// StridedSlice, StridedSliceGrad
 //
-#define STRIDED_SLICE_MAX_HANDLE_DIM 3
-
-template<typename T>
-int strided_slice1(const int64_t* begin_di,
-                   const int64_t* end_di,
-		   const int64_t* stride_di,
-		   const Tensor*  input_tensor,
-                   Tensor* result_tensor)
-{
-  const T* pi = reinterpret_cast<const T*>(input_tensor->addr);
-  T* po = reinterpret_cast<T*>(result_tensor->addr);
-
-  const int64_t d0 = input_tensor->dim_size[0] ;
-
-  for(int64_t i0=begin_di[0]; i0<end_di[0] ; i0+=stride_di[0] ) {
-    *po = pi[i0] ; po++ ;
-  }
-
-  return 0 ;
-}
+// The host resolves begin/end masks, ellipsis, new-axis and shrink-axis
+// masks (ValidateStridedSliceOp), so the kernels get a canonical begin, end
+// and stride for each input dim. A shrunk dim is a range of length 1, and
+// new axes do not appear. Strides may be negative.
+//
+#define STRIDED_SLICE_MAX_HANDLE_DIM 8
 
+namespace {
 
-template<typename T>
-int strided_slice2(const int64_t* begin_di,
-                   const int64_t* end_di,
-		   const int64_t* stride_di,
-		   const Tensor*  input_tensor,
-                   Tensor* result_tensor)
+inline int64_t strided_slice_extent(int64_t begin, int64_t end, int64_t stride)
 {
-  const T* pi = reinterpret_cast<const T*>(input_tensor->addr);
-  T* po = reinterpret_cast<T*>(result_tensor->addr);
-
-  const int64_t d0 = input_tensor->dim_size[0] ;
-  const int64_t d1 = input_tensor->dim_size[1] ;
-
-  for(int64_t i0=begin_di[0]; i0<end_di[0] ; i0+=stride_di[0] ) {
-    for(int64_t i1=begin_di[1]; i1<end_di[1] ; i1+=stride_di[1] ) {
-      *po = pi[i0*d1+i1] ; po++ ;
-    }
-  }
-
-  return 0 ;
+  if (stride > 0)
+    return end > begin ? (end - begin + stride - 1) / stride : 0 ;
+  else
+    return begin > end ? (begin - end - stride - 1) / (-stride) : 0 ;
 }
 
-template<typename T>
-int strided_slice3(const int64_t* begin_di,
-                   const int64_t* end_di,
-		   const int64_t* stride_di,
-		   const Tensor*  input_tensor,
-                   Tensor* result_tensor)
+int read_strided_slice_args(const VEOpArgs& args, int& narg, int64_t dims,
+                            int64_t* begin_di, int64_t* end_di, int64_t* stride_di)
 {
-  const T* pi = reinterpret_cast<const T*>(input_tensor->addr);
-  T* po = reinterpret_cast<T*>(result_tensor->addr);
-
-  const int64_t d0 = input_tensor->dim_size[0] ;
-  const int64_t d1 = input_tensor->dim_size[1] ;
-  const int64_t d2 = input_tensor->dim_size[2] ;
+  if (dims < 1 || dims > STRIDED_SLICE_MAX_HANDLE_DIM)
+    return 1 ;
 
-  for(int64_t i0=begin_di[0]; i0<end_di[0] ; i0+=stride_di[0] ) {
-    for(int64_t i1=begin_di[1]; i1<end_di[1] ; i1+=stride_di[1] ) {
-      for(int64_t i2=begin_di[2]; i2<end_di[2] ; i2+=stride_di[2] ) {
-	*po = pi[(i0*d1+i1)*d2+i2] ; po++ ;
-      }
-    }
+  for(int64_t i=0; i<dims; i++) {
+    begin_di[i] = *args.arg<int64_t>(narg++) ;
+  }
+  for(int64_t i=0; i<dims; i++) {
+    end_di[i] = *args.arg<int64_t>(narg++) ;
+  }
+  for(int64_t i=0; i<dims; i++) {
+    stride_di[i] = *args.arg<int64_t>(narg++) ;
+    if (stride_di[i] == 0)
+      return 1 ;
   }
-
   return 0 ;
 }
 
-namespace {
 int op_StridedSlice(const VEOpArgs& args)
 {
   LOG(2) << __FUNCTION__ << " begin";
@@ -856,46 +692,32 @@ int op_StridedSlice(const VEOpArgs& args)
   int64_t end_di[STRIDED_SLICE_MAX_HANDLE_DIM] ;
   int64_t stride_di[STRIDED_SLICE_MAX_HANDLE_DIM] ;
 
-  for(int64_t i=0; i<processing_dims; i++) {
-    begin_di[i] = *args.arg<int64_t>(narg++) ;
-  }
-  for(int64_t i=0; i<processing_dims; i++) {
-    end_di[i] = *args.arg<int64_t>(narg++) ;
-  }
-  for(int64_t i=0; i<processing_dims; i++) {
-    stride_di[i] = *args.arg<int64_t>(narg++) ;
-  }
-
-  const int dtype = input_tensor->dtype ;
-
-  if (dtype == DT_FLOAT) {
-    switch(processing_dims) {
-    case 1:
-      ret = strided_slice1<float>(begin_di, end_di, stride_di, input_tensor, (Tensor*)result_tensor) ;
-      break ;
-    case 2:
-      ret = strided_slice2<float>(begin_di, end_di, stride_di, input_tensor, (Tensor*)result_tensor) ;
-      break ;
-    case 3 :
-      ret = strided_slice3<float>(begin_di, end_di, stride_di, input_tensor, (Tensor*)result_tensor) ;
-      break ;
-    default :
-      break ;
+  const int elem_size = DataTypeSize(input_tensor->dtype) ;
+
+  if (elem_size > 0
+      && input_tensor->dims == processing_dims
+      && read_strided_slice_args(args, narg, processing_dims,
+                                 begin_di, end_di, stride_di) == 0) {
+    StridedCopyBlock blk ;
+    blk.dst = reinterpret_cast<void*>(result_tensor->addr) ;
+    blk.ndims = processing_dims ;
+
+    int64_t offset = 0 ;
+    int64_t is = 1, os = 1 ;
+    for (int64_t k = processing_dims - 1; k >= 0; --k) {
+      const int64_t n = strided_slice_extent(begin_di[k], end_di[k], stride_di[k]) ;
+      blk.shape[k] = n ;
+      blk.src_stride[k] = stride_di[k] * is ;
+      blk.dst_stride[k] = os ;
+      offset += begin_di[k] * is ;
+      is *= input_tensor->dim_size[k] ;
+      os *= n ;
     }
-  }
-  else if (dtype == DT_DOUBLE) {
-    switch(processing_dims) {
-    case 1:
-      ret = strided_slice1<double>(begin_di, end_di, stride_di, input_tensor, (Tensor*)result_tensor) ;
-      break ;
-    case 2:
-      ret = strided_slice2<double>(begin_di, end_di, stride_di, input_tensor, (Tensor*)result_tensor) ;
-      break ;
-    case 3 :
-      ret = strided_slice3<double>(begin_di, end_di, stride_di, input_tensor, (Tensor*)result_tensor) ;
-      break ;
-    default :
-      break ;
+    blk.src = reinterpret_cast<const char*>(input_tensor->addr) + offset * elem_size ;
+
+    if (os == result_tensor->nelems) {
+      strided_copy(&blk, 1, elem_size) ;
+      ret = 0 ;
     }
   }
 
@@ -903,91 +725,70 @@ int op_StridedSlice(const VEOpArgs& args)
 
   return ret;
 }
-}
-#undef STRIDED_SLICE_MAX_HANDLE_DIM
-
-DEFINE_KERNEL(StridedSlice, op_StridedSlice);
-
-
-//
-// StridedSliceGrad
-//
-#define STRIDED_SLICE_GRAD_MAX_HANDLE_DIM 3
 
+// dx is written row by row (rows along the last dim). A row is zeroed and
+// the dy values that land in it are stored while the row is in cache, so
+// dx is written in a single pass.
 template<typename T>
-int strided_slice_grad1(const int64_t* begin_di,
-                        const int64_t* end_di,
-		        const int64_t* stride_di,
-		        const Tensor*  dy_tensor,
-                        Tensor* result_tensor)
+void strided_slice_grad(int64_t dims,
+                        const int64_t* dx_size,
+                        const int64_t* begin_di,
+                        const int64_t* stride_di,
+                        const int64_t* n_di,
+                        const T* dy, T* dx)
 {
-  const T* pi = reinterpret_cast<const T*>(dy_tensor->addr);
-  T* po = reinterpret_cast<T*>(result_tensor->addr);
+  const int64_t inner = dx_size[dims-1] ;
+  int64_t nrows = 1 ;
+  for (int64_t k = 0; k < dims - 1; ++k) nrows *= dx_size[k] ;
 
-  const int64_t d0 = result_tensor->dim_size[0] ;
+  int64_t dy_stride[STRIDED_SLICE_MAX_HANDLE_DIM] ;
+  dy_stride[dims-1] = 1 ;
+  for (int64_t k = dims - 2; k >= 0; --k) dy_stride[k] = dy_stride[k+1] * n_di[k+1] ;
 
-  for(int64_t i=0; i<d0; i++) po[i] = T(0.) ;
+  const int64_t b_last = begin_di[dims-1] ;
+  const int64_t s_last = stride_di[dims-1] ;
+  const int64_t n_last = n_di[dims-1] ;
 
-  for(int64_t i0=begin_di[0]; i0<end_di[0] ; i0+=stride_di[0] ) {
-    po[i0] = *pi ; pi++ ;
-  }
-
-  return 0 ;
-}
-
-
-template<typename T>
-int strided_slice_grad2(const int64_t* begin_di,
-                        const int64_t* end_di,
-		        const int64_t* stride_di,
-		        const Tensor*  dy_tensor,
-                        Tensor* result_tensor)
-{
-  const T* pi = reinterpret_cast<const T*>(dy_tensor->addr);
-  T* po = reinterpret_cast<T*>(result_tensor->addr);
-
-  const int64_t d0 = result_tensor->dim_size[0] ;
-  const int64_t d1 = result_tensor->dim_size[1] ;
-
-  for(int64_t i=0; i<d0*d1; i++) po[i] = T(0.) ;
-
-  for(int64_t i0=begin_di[0]; i0<end_di[0] ; i0+=stride_di[0] ) {
-    for(int64_t i1=begin_di[1]; i1<end_di[1] ; i1+=stride_di[1] ) {
-      po[i0*d1+i1] = *pi ; pi++ ;
-    }
-  }
-
-  return 0 ;
-}
+#pragma omp parallel
+  {
+    int64_t nthreads = omp_get_num_threads() ;
+    int64_t threadid = omp_get_thread_num() ;
 
-template<typename T>
-int strided_slice_grad3(const int64_t* begin_di,
-                        const int64_t* end_di,
-		        const int64_t* stride_di,
-		        const Tensor*  dy_tensor,
-                        Tensor* result_tensor)
-{
-  const T* pi = reinterpret_cast<const T*>(dy_tensor->addr);
-  T* po = reinterpret_cast<T*>(result_tensor->addr);
+    int64_t chunkSize = nrows / nthreads ;
+    int64_t remain    = nrows % nthreads ;
 
-  const int64_t d0 = result_tensor->dim_size[0] ;
-  const int64_t d1 = result_tensor->dim_size[1] ;
-  const int64_t d2 = result_tensor->dim_size[2] ;
+    int64_t chunkBegin = chunkSize * threadid + ( threadid < remain ? threadid : remain ) ;
+    int64_t myChunk    = chunkSize + ( threadid < remain ? 1 : 0 ) ;
 
-  for(int64_t i=0; i<d0*d1*d2; i++) po[i] = T(0.) ;
+#pragma _NEC novector
+    for (int64_t r = chunkBegin; r < chunkBegin + myChunk; ++r) {
+      T* o = dx + r * inner ;
+      for (int64_t i = 0; i < inner; ++i) o[i] = T(0) ;
+
+      // is this row on the slice lattice, and which dy row is it?
+      bool hit = n_last > 0 ;
+      int64_t off = 0 ;
+      int64_t rem = r ;
+      for (int64_t k = dims - 2; k >= 0 && hit; --k) {
+        const int64_t c = rem % dx_size[k] ;
+        rem /= dx_size[k] ;
+        const int64_t t  = stride_di[k] > 0 ? c - begin_di[k] : begin_di[k] - c ;
+        const int64_t as = stride_di[k] > 0 ? stride_di[k] : -stride_di[k] ;
+        if (t < 0 || t % as != 0 || t / as >= n_di[k])
+          hit = false ;
+        else
+          off += (t / as) * dy_stride[k] ;
+      }
 
-  for(int64_t i0=begin_di[0]; i0<end_di[0] ; i0+=stride_di[0] ) {
-    for(int64_t i1=begin_di[1]; i1<end_di[1] ; i1+=stride_di[1] ) {
-      for(int64_t i2=begin_di[2]; i2<end_di[2] ; i2+=stride_di[2] ) {
-	po[(i0*d1+i1)*d2+i2] = *pi ; pi++ ;
+      if (hit) {
+        const T* pi = dy + off ;
+        for (int64_t j = 0; j < n_last; ++j)
+          o[b_last + j * s_last] = pi[j] ;
       }
     }
   }
-
-  return 0 ;
 }
 
-namespace {
 int op_StridedSliceGrad(const VEOpArgs& args)
 {
   LOG(2) << __FUNCTION__ << " begin";
@@ -1000,50 +801,49 @@ int op_StridedSliceGrad(const VEOpArgs& args)
   const Tensor *dy_tensor     = args.arg<Tensor>(narg++) ;
   const Tensor *result_tensor = args.arg<Tensor>(narg++) ;
 
-  int64_t begin_di[STRIDED_SLICE_GRAD_MAX_HANDLE_DIM] ;
-  int64_t end_di[STRIDED_SLICE_GRAD_MAX_HANDLE_DIM] ;
-  int64_t stride_di[STRIDED_SLICE_GRAD_MAX_HANDLE_DIM] ;
-
-  for(int64_t i=0; i<processing_dims; i++) {
-    begin_di[i] = *args.arg<int64_t>(narg++) ;
-  }
-  for(int64_t i=0; i<processing_dims; i++) {
-    end_di[i] = *args.arg<int64_t>(narg++) ;
-  }
-  for(int64_t i=0; i<processing_dims; i++) {
-    stride_di[i] = *args.arg<int64_t>(narg++) ;
-  }
-
-  const int dtype = dy_tensor->dtype ;
-
-  if (dtype == DT_FLOAT) {
-    switch(processing_dims) {
-    case 1:
-      ret = strided_slice_grad1<float>(begin_di, end_di, stride_di, dy_tensor, (Tensor*)result_tensor) ;
-      break ;
-    case 2:
-      ret = strided_slice_grad2<float>(begin_di, end_di, stride_di, dy_tensor, (Tensor*)result_tensor) ;
-      break ;
-    case 3 :
-      ret = strided_slice_grad3<float>(begin_di, end_di, stride_di, dy_tensor, (Tensor*)result_tensor) ;
-      break ;
-    default :
-      break ;
+  int64_t begin_di[STRIDED_SLICE_MAX_HANDLE_DIM] ;
+  int64_t end_di[STRIDED_SLICE_MAX_HANDLE_DIM] ;
+  int64_t stride_di[STRIDED_SLICE_MAX_HANDLE_DIM] ;
+  int64_t n_di[STRIDED_SLICE_MAX_HANDLE_DIM] ;
+
+  const int elem_size = DataTypeSize(dy_tensor->dtype) ;
+
+  if (elem_size > 0
+      && result_tensor->dims == processing_dims
+      && read_strided_slice_args(args, narg, processing_dims,
+                                 begin_di, end_di, stride_di) == 0) {
+    int64_t n = 1 ;
+    for (int64_t k = 0; k < processing_dims; ++k) {
+      n_di[k] = strided_slice_extent(begin_di[k], end_di[k], stride_di[k]) ;
+      n *= n_di[k] ;
     }
-  }
-  else if (dtype == DT_DOUBLE) {
-    switch(processing_dims) {
-    case 1:
-      ret = strided_slice_grad1<double>(begin_di, end_di, stride_di, dy_tensor, (Tensor*)result_tensor) ;
-      break ;
-    case 2:
-      ret = strided_slice_grad2<double>(begin_di, end_di, stride_di, dy_tensor, (Tensor*)result_tensor) ;
-      break ;
-    case 3 :
-      ret = strided_slice_grad3<double>(begin_di, end_di, stride_di, dy_tensor, (Tensor*)result_tensor) ;
-      break ;
-    default :
-      break ;
+
+    if (n == dy_tensor->nelems) {
+      const int64_t* dx_size = result_tensor->dim_size ;
+      const void* dy = reinterpret_cast<const void*>(dy_tensor->addr) ;
+      void* dx = reinterpret_cast<void*>(result_tensor->addr) ;
+      ret = 0 ;
+      switch (elem_size) {
+      case 1 :
+        strided_slice_grad<uint8_t>(processing_dims, dx_size, begin_di, stride_di, n_di,
+                                    (const uint8_t*)dy, (uint8_t*)dx) ;
+        break ;
+      case 2 :
+        strided_slice_grad<uint16_t>(processing_dims, dx_size, begin_di, stride_di, n_di,
+                                     (const uint16_t*)dy, (uint16_t*)dx) ;
+        break ;
+      case 4 :
+        strided_slice_grad<uint32_t>(processing_dims, dx_size, begin_di, stride_di, n_di,
+                                     (const uint32_t*)dy, (uint32_t*)dx) ;
+        break ;
+      case 8 :
+        strided_slice_grad<uint64_t>(processing_dims, dx_size, begin_di, stride_di, n_di,
+                                     (const uint64_t*)dy, (uint64_t*)dx) ;
+        break ;
+      default :
+        ret = 1 ;
+        break ;
+      }
     }
   }
 
@@ -1052,8 +852,9 @@ int op_StridedSliceGrad(const VEOpArgs& args)
   return ret;
 }
 }
-#undef STRIDED_SLICE_GRAD_MAX_HANDLE_DIM
+#undef STRIDED_SLICE_MAX_HANDLE_DIM
 
+DEFINE_KERNEL(StridedSlice, op_StridedSlice);
 DEFINE_KERNEL(StridedSliceGrad, op_StridedSliceGrad);
 
 
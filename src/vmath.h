@@ -0,0 +1,310 @@
+#ifndef VMATH_H_
+#define VMATH_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <string>
+
+//
+// Math layer for the transcendental functions of the kernels (Exp, Log,
+// Sigmoid, Tanh, softmax, xent, the activations of activation_ops.cc and
+// FusedAttention). Functions without a fast version here, such as erf and
+// log1p, are called from libm in both tiers.
+//
+// There are two tiers with the same interface:
+//
+//   VMathAccurate  the libm functions
+//   VMathFast      inline polynomial versions, within 4 ulp
+//
+// VMathAccurate evaluates float tanh and sigmoid in double, so they are
+// within 1 ulp like exp and log. Double tanh is libm's, within 2 ulp with
+// glibc, and double sigmoid adds the rounding of its formula to exp, within
+// 3 ulp. A correctly rounded double version would need double-double
+// arithmetic in the element loop.
+//
+// The fast versions are plain arithmetic and bit operations with no calls
+// and no branches, so the compiler inlines and vectorizes them into the
+// element loop of the kernel. Both handle inf, nan, zero and subnormal
+// inputs and outputs like libm. They are checked against libm on the host
+// by test/vmath_test.cc.
+//
+// A kernel templates its loop on the tier and picks one per call with
+// vmath_use_fast(name). The default is VMathAccurate. The environment
+// variable VE_FAST_MATH selects the fast tier: "1" or "all" for every
+// kernel, or a comma separated list of kernel names, e.g.
+// VE_FAST_MATH=Softmax,SoftmaxXentWithLogits,Gelu,FusedAttention.
+//
+
+inline bool vmath_use_fast(const char* kernel)
+{
+  static const std::string list = [] {
+    const char* tmp = getenv("VE_FAST_MATH") ;
+    return std::string(tmp ? tmp : "") ;
+  }() ;
+
+  if (list.empty() || list == "0")
+    return false ;
+  if (list == "1" || list == "all")
+    return true ;
+
+  const std::string name(kernel) ;
+  size_t pos = 0 ;
+  while (pos <= list.size()) {
+    size_t end = list.find(',', pos) ;
+    if (end == std::string::npos)
+      end = list.size() ;
+    if (list.compare(pos, end - pos, name) == 0)
+      return true ;
+    pos = end + 1 ;
+  }
+  return false ;
+}
+
+namespace vmath {
+
+inline uint32_t as_uint(float f)    { uint32_t u; memcpy(&u, &f, 4); return u; }
+inline float    as_float(uint32_t u) { float f; memcpy(&f, &u, 4); return f; }
+inline uint64_t as_uint(double d)   { uint64_t u; memcpy(&u, &d, 8); return u; }
+inline double   as_double(uint64_t u) { double d; memcpy(&d, &u, 8); return d; }
+
+//
+// exp: x = k ln2 + r with |r| <= ln2/2, exp(x) = 2^k exp(r). exp(r) is a
+// Taylor polynomial (degree 7 for float, 13 for double, truncation error
+// below 0.1 ulp). 2^k is applied in two steps so that subnormal results
+// come out right.
+//
+
+inline float exp_fast(float x)
+{
+  const bool nan = x != x ;
+  const bool over = x > 88.72283935546875f ;
+  const bool under = x < -103.97208404541015625f ;
+  const float xc = (nan || over || under) ? 0.f : x ;
+
+  const float k = std::floor(xc * 1.44269502162933349609375f + 0.5f) ;
+  const float r = (xc - k * 0.693145751953125f) - k * 1.428606765330187045e-06f ;
+
+  float p = 1.f / 5040.f ;
+  p = p * r + 1.f / 720.f ;
+  p = p * r + 1.f / 120.f ;
+  p = p * r + 1.f / 24.f ;
+  p = p * r + 1.f / 6.f ;
+  p = p * r + 0.5f ;
+  p = p * r + 1.f ;
+  p = p * r + 1.f ;
+
+  const int32_t ki = static_cast<int32_t>(k) ;
+  const int32_t k1 = ki / 2 ;
+  const int32_t k2 = ki - k1 ;
+  const float y = p * as_float(static_cast<uint32_t>(k1 + 127) << 23)
+                    * as_float(static_cast<uint32_t>(k2 + 127) << 23) ;
+
+  return nan ? x : over ? HUGE_VALF : under ? 0.f : y ;
+}
+
+inline double exp_fast(double x)
+{
+  const bool nan = x != x ;
+  const bool over = x > 709.782712893383973096 ;
+  const bool under = x < -745.1332191019411 ;
+  const double xc = (nan || over || under) ? 0. : x ;
+
+  const double k = std::floor(xc * 1.44269504088896338700 + 0.5) ;
+  const double r = (xc - k * 6.93147180369123816490e-01) - k * 1.90821492927058770002e-10 ;
+
+  double p = 1. / 6227020800. ;
+  p = p * r + 1. / 479001600. ;
+  p = p * r + 1. / 39916800. ;
+  p = p * r + 1. / 3628800. ;
+  p = p * r + 1. / 362880. ;
+  p = p * r + 1. / 40320. ;
+  p = p * r + 1. / 5040. ;
+  p = p * r + 1. / 720. ;
+  p = p * r + 1. / 120. ;
+  p = p * r + 1. / 24. ;
+  p = p * r + 1. / 6. ;
+  p = p * r + 0.5 ;
+  p = p * r + 1. ;
+  p = p * r + 1. ;
+
+  const int64_t ki = static_cast<int64_t>(k) ;
+  const int64_t k1 = ki / 2 ;
+  const int64_t k2 = ki - k1 ;
+  const double y = p * as_double(static_cast<uint64_t>(k1 + 1023) << 52)
+                     * as_double(static_cast<uint64_t>(k2 + 1023) << 52) ;
+
+  return nan ? x : over ? HUGE_VAL : under ? 0. : y ;
+}
+
+//
+// log: x = 2^k m with sqrt(2)/2 <= m < sqrt(2), f = m - 1 and
+// log(1 + f) = f - f^2/2 + s (f^2/2 + R(s^2)), s = f / (2 + f),
+// with the minimax polynomial R and the argument reduction of fdlibm.
+//
+
+inline float log_fast(float x)
+{
+  uint32_t ix = as_uint(x) ;
+  const bool sub = ix < 0x00800000u ;             // subnormal, zero or negative zero
+  ix = sub ? as_uint(x * 33554432.f) : ix ;       // * 2^25
+  int32_t k = sub ? -25 : 0 ;
+
+  ix += 0x3f800000u - 0x3f3504f3u ;
+  k += static_cast<int32_t>(ix >> 23) - 0x7f ;
+  ix = (ix & 0x007fffffu) + 0x3f3504f3u ;
+  const float f = as_float(ix) - 1.f ;
+
+  const float s = f / (2.f + f) ;
+  const float z = s * s ;
+  const float w = z * z ;
+  const float t1 = w * (0.40000972152f + w * 0.24279078841f) ;
+  const float t2 = z * (0.66666662693f + w * 0.28498786688f) ;
+  const float R = t2 + t1 ;
+  const float hfsq = 0.5f * f * f ;
+  const float dk = static_cast<float>(k) ;
+  const float y = s * (hfsq + R) + dk * 9.0580006145e-06f - hfsq + f + dk * 6.9313812256e-01f ;
+
+  return x != x ? x
+       : x < 0.f ? std::numeric_limits<float>::quiet_NaN()
+       : x == 0.f ? -HUGE_VALF
+       : x == HUGE_VALF ? x
+       : y ;
+}
+
+inline double log_fast(double x)
+{
+  uint64_t ix = as_uint(x) ;
+  const bool sub = ix < 0x0010000000000000ull ;
+  ix = sub ? as_uint(x * 18014398509481984.) : ix ;   // * 2^54
+  int64_t k = sub ? -54 : 0 ;
+
+  uint32_t hx = static_cast<uint32_t>(ix >> 32) ;
+  hx += 0x3ff00000u - 0x3fe6a09eu ;
+  k += static_cast<int64_t>(hx >> 20) - 0x3ff ;
+  hx = (hx & 0x000fffffu) + 0x3fe6a09eu ;
+  ix = static_cast<uint64_t>(hx) << 32 | (ix & 0xffffffffull) ;
+  const double f = as_double(ix) - 1. ;
+
+  const double s = f / (2. + f) ;
+  const double z = s * s ;
+  const double w = z * z ;
+  const double t1 = w * (3.999999999940941908e-01 + w * (2.222219843214978396e-01
+                    + w * 1.531383769920937332e-01)) ;
+  const double t2 = z * (6.666666666666735130e-01 + w * (2.857142874366239149e-01
+                    + w * (1.818357216161805012e-01 + w * 1.479819860511658591e-01))) ;
+  const double R = t2 + t1 ;
+  const double hfsq = 0.5 * f * f ;
+  const double dk = static_cast<double>(k) ;
+  const double y = s * (hfsq + R) + dk * 1.90821492927058770002e-10 - hfsq + f
+                   + dk * 6.93147180369123816490e-01 ;
+
+  return x != x ? x
+       : x < 0. ? std::numeric_limits<double>::quiet_NaN()
+       : x == 0. ? -HUGE_VAL
+       : x == HUGE_VAL ? x
+       : y ;
+}
+
+//
+// tanh(|x|) = t / (t + 2) with t = expm1(2 |x|). expm1 uses the exp
+// reduction, keeping the leading 1 out of the polynomial so that small
+// arguments stay accurate. Beyond 9 (float) or 19.1 (double) tanh rounds
+// to 1.
+//
+
+inline float tanh_fast(float x)
+{
+  const float a = std::fabs(x) ;
+  const float a2 = (a < 9.f ? a : 9.f) * 2.f ;
+
+  const float k = std::floor(a2 * 1.44269502162933349609375f + 0.5f) ;
+  const float r = (a2 - k * 0.693145751953125f) - k * 1.428606765330187045e-06f ;
+
+  float q = 1.f / 5040.f ;
+  q = q * r + 1.f / 720.f ;
+  q = q * r + 1.f / 120.f ;
+  q = q * r + 1.f / 24.f ;
+  q = q * r + 1.f / 6.f ;
+  q = q * r + 0.5f ;
+  q = q * r + 1.f ;
+  q = q * r ;                                      // expm1(r)
+
+  const float two_k = as_float(static_cast<uint32_t>(static_cast<int32_t>(k) + 127) << 23) ;
+  const float t = two_k * q + (two_k - 1.f) ;      // expm1(2a)
+  const float y = a < 9.f ? t / (t + 2.f) : 1.f ;
+
+  return x != x ? x : std::copysign(y, x) ;
+}
+
+inline double tanh_fast(double x)
+{
+  const double a = std::fabs(x) ;
+  const double a2 = (a < 19.1 ? a : 19.1) * 2. ;
+
+  const double k = std::floor(a2 * 1.44269504088896338700 + 0.5) ;
+  const double r = (a2 - k * 6.93147180369123816490e-01) - k * 1.90821492927058770002e-10 ;
+
+  double q = 1. / 6227020800. ;
+  q = q * r + 1. / 479001600. ;
+  q = q * r + 1. / 39916800. ;
+  q = q * r + 1. / 3628800. ;
+  q = q * r + 1. / 362880. ;
+  q = q * r + 1. / 40320. ;
+  q = q * r + 1. / 5040. ;
+  q = q * r + 1. / 720. ;
+  q = q * r + 1. / 120. ;
+  q = q * r + 1. / 24. ;
+  q = q * r + 1. / 6. ;
+  q = q * r + 0.5 ;
+  q = q * r + 1. ;
+  q = q * r ;
+
+  const double two_k = as_double(static_cast<uint64_t>(static_cast<int64_t>(k) + 1023) << 52) ;
+  const double t = two_k * q + (two_k - 1.) ;
+  const double y = a < 19.1 ? t / (t + 2.) : 1. ;
+
+  return x != x ? x : std::copysign(y, x) ;
+}
+
+// 1 / (1 + exp(-x)), written as exp(x) / (1 + exp(x)) for x < 0 so that
+// exp does not overflow and small results keep their precision
+template <typename M, typename T>
+inline T sigmoid(T x)
+{
+  const T e = M::exp(-std::fabs(x)) ;
+  const T s = T(1.) / (T(1.) + e) ;
+  return x < T(0.) ? e * s : s ;
+}
+
+} // namespace vmath
+
+namespace vmath {
+// the type VMathAccurate evaluates tanh and sigmoid in
+template <typename T> struct accurate_type { typedef T type ; } ;
+template <> struct accurate_type<float> { typedef double type ; } ;
+} // namespace vmath
+
+struct VMathAccurate {
+  template <typename T> static T exp(T x)  { return std::exp(x) ; }
+  template <typename T> static T log(T x)  { return std::log(x) ; }
+  template <typename T> static T tanh(T x) {
+    typedef typename vmath::accurate_type<T>::type U ;
+    return static_cast<T>(std::tanh(static_cast<U>(x))) ;
+  }
+  template <typename T> static T sigmoid(T x) {
+    typedef typename vmath::accurate_type<T>::type U ;
+    return static_cast<T>(vmath::sigmoid<VMathAccurate>(static_cast<U>(x))) ;
+  }
+};
+
+struct VMathFast {
+  template <typename T> static T exp(T x)  { return vmath::exp_fast(x) ; }
+  template <typename T> static T log(T x)  { return vmath::log_fast(x) ; }
+  template <typename T> static T tanh(T x) { return vmath::tanh_fast(x) ; }
+  template <typename T> static T sigmoid(T x) { return vmath::sigmoid<VMathFast>(x) ; }
+};
+
+#endif // VMATH_H_
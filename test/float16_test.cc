@@ -0,0 +1,186 @@
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include "../src/float16.h"
+
+// Checks the half and bfloat16 conversions of src/float16.h. Every 16-bit
+// value is converted to float and back, and float_to_half/float_to_bf16
+// are checked at every rounding boundary: the midpoint between two
+// adjacent 16-bit values (ties to even) and the floats just below and
+// above it. Builds on the host as well:
+//   g++ -O2 test/float16_test.cc
+
+struct TestParam
+{
+    int verbose;
+};
+
+static bool same_bits(float a, float b) { return float_as_bits(a) == float_as_bits(b); }
+
+static void report(TestParam const& param, const char* name, uint16_t h,
+                   float f, uint16_t got, uint16_t exp)
+{
+    if (param.verbose > 0)
+        fprintf(stderr, "%s: h=0x%04x f=%.9g (0x%08x) got 0x%04x expected 0x%04x\n",
+                name, h, f, float_as_bits(f), got, exp);
+}
+
+// value of half h computed with ldexp
+static float ref_half(uint16_t h)
+{
+    const int exp = (h >> 10) & 0x1f;
+    const int mant = h & 0x3ff;
+    const double s = (h & 0x8000) ? -1. : 1.;
+    if (exp == 0)
+        return static_cast<float>(s * ldexp(mant, -24));
+    return static_cast<float>(s * ldexp(1024 + mant, exp - 25));
+}
+
+bool test_half_to_float(TestParam const& param)
+{
+    int nerr = 0;
+    for (uint32_t i = 0; i < 0x10000; ++i) {
+        const uint16_t h = static_cast<uint16_t>(i);
+        const float f = half_to_float(h);
+        bool ok;
+        if (((h >> 10) & 0x1f) == 0x1f) {
+            // inf and NaN keep the sign and the payload
+            const uint32_t bits = (static_cast<uint32_t>(h & 0x8000) << 16)
+                                  | 0x7f800000 | (static_cast<uint32_t>(h & 0x3ff) << 13);
+            ok = float_as_bits(f) == bits;
+        } else {
+            ok = same_bits(f, ref_half(h));
+        }
+        if (!ok) {
+            if (nerr++ < 10)
+                report(param, "half_to_float", h, f, 0, 0);
+        }
+    }
+    return nerr == 0;
+}
+
+bool test_float_to_half(TestParam const& param)
+{
+    int nerr = 0;
+    auto check = [&](uint16_t h, float f, uint16_t exp) {
+        const uint16_t got = float_to_half(f);
+        if (got != exp && nerr++ < 10)
+            report(param, "float_to_half", h, f, got, exp);
+    };
+
+    for (uint32_t s = 0; s < 2; ++s) {
+        const uint16_t sign = s ? 0x8000 : 0;
+        for (uint16_t a = 0; a < 0x7c00; ++a) {
+            const uint16_t h = sign | a;
+            const float fa = half_to_float(h);
+            check(h, fa, h);
+
+            // a and the next larger magnitude a + 1 (inf after 65504)
+            const int exp = (a >> 10) & 0x1f;
+            const float ulp = static_cast<float>(ldexp(1., (exp == 0 ? 1 : exp) - 25));
+            const float m = s ? fa - ulp / 2 : fa + ulp / 2;
+            const uint16_t b = h + 1;
+            check(h, m, (a & 1) ? b : h);
+            check(h, nextafterf(m, 0.f), h);
+            check(h, nextafterf(m, s ? -INFINITY : INFINITY), b);
+        }
+        check(sign, s ? -1.e10f : 1.e10f, sign | 0x7c00);
+        check(sign, s ? -INFINITY : INFINITY, sign | 0x7c00);
+        check(sign, s ? -1.e-10f : 1.e-10f, sign);
+    }
+
+    const uint16_t nan = float_to_half(NAN);
+    if ((nan & 0x7c00) != 0x7c00 || (nan & 0x3ff) == 0) {
+        ++nerr;
+        report(param, "float_to_half", 0, NAN, nan, 0x7e00);
+    }
+
+    return nerr == 0;
+}
+
+bool test_bf16_to_float(TestParam const& param)
+{
+    int nerr = 0;
+    for (uint32_t i = 0; i < 0x10000; ++i) {
+        const uint16_t h = static_cast<uint16_t>(i);
+        const float f = bf16_to_float(h);
+        if (float_as_bits(f) != i << 16 && nerr++ < 10)
+            report(param, "bf16_to_float", h, f, 0, 0);
+    }
+    return nerr == 0;
+}
+
+bool test_float_to_bf16(TestParam const& param)
+{
+    int nerr = 0;
+    auto check = [&](uint16_t h, float f, uint16_t exp) {
+        const uint16_t got = float_to_bf16(f);
+        if (got != exp && nerr++ < 10)
+            report(param, "float_to_bf16", h, f, got, exp);
+    };
+
+    for (uint32_t s = 0; s < 2; ++s) {
+        const uint16_t sign = s ? 0x8000 : 0;
+        for (uint16_t a = 0; a < 0x7f80; ++a) {
+            const uint16_t h = sign | a;
+            const uint32_t u = static_cast<uint32_t>(h) << 16;
+            const uint16_t b = h + 1;
+            check(h, bits_as_float(u), h);
+            check(h, bits_as_float(u | 0x8000), (a & 1) ? b : h);
+            check(h, bits_as_float(u | 0x7fff), h);
+            check(h, bits_as_float(u | 0x8001), b);
+        }
+    }
+
+    // NaN stays NaN, also when rounding would carry into the exponent
+    const uint32_t nans[] = { 0x7fc00000, 0x7f800001, 0x7fffffff, 0xffffffff };
+    for (size_t i = 0; i < sizeof(nans) / sizeof(nans[0]); ++i) {
+        const uint16_t got = float_to_bf16(bits_as_float(nans[i]));
+        if ((got & 0x7f80) != 0x7f80 || (got & 0x7f) == 0) {
+            ++nerr;
+            report(param, "float_to_bf16", 0, bits_as_float(nans[i]), got, 0x7fc0);
+        }
+    }
+
+    return nerr == 0;
+}
+
+struct Test
+{
+    std::string name;
+    bool (*func)(TestParam const&);
+};
+
+int main(int argc, char* argv[])
+{
+    Test tests[] = {
+        "half_to_float", test_half_to_float,
+        "float_to_half", test_float_to_half,
+        "bf16_to_float", test_bf16_to_float,
+        "float_to_bf16", test_float_to_bf16,
+    };
+
+    TestParam param;
+    param.verbose = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-v") == 0) {
+            ++param.verbose;
+        }
+    }
+
+    int ntests = sizeof(tests) / sizeof(Test);
+    int ok = 0;
+    for (size_t i = 0; i < ntests; ++i) {
+        bool flag = tests[i].func(param);
+        fprintf(stderr, "%-20s %s\n", tests[i].name.c_str(), flag ? "OK" : "NG");
+        if (flag)
+            ++ok;
+    }
+    fprintf(stderr, "%d tests failed\n", ntests - ok);
+    return ntests - ok;
+}
@@ -0,0 +1,207 @@
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "../src/grouped_conv2d.h"
+
+// Checks the direct grouped convolution of src/grouped_conv2d.cc, forward
+// and both backprops, against a naive reference. Depthwise convolutions are
+// the cases with one input channel per group. Builds on the host as well:
+//   g++ -O2 -fopenmp -Isrc test/grouped_conv_test.cc src/grouped_conv2d.cc
+
+struct TestParam
+{
+    int verbose;
+};
+
+struct TensorParam {
+    int w,h,c,n ;
+};
+
+struct ConvCase {
+    int batch, in_c, in_h, in_w ;
+    int kh, kw ;
+    int in_c_per_group, out_c ;
+    int stride, dilation ;
+    bool same ;                         // SAME or VALID padding
+    int data_format ;
+};
+
+template <typename T> struct dtype_s {};
+template <> struct dtype_s<float> { static const int type = DT_FLOAT; };
+template <> struct dtype_s<double> { static const int type = DT_DOUBLE; };
+
+template <typename T>
+bool test_conv(TestParam const& param, ConvCase const& k)
+{
+    const int ekh = (k.kh - 1) * k.dilation + 1 ;
+    const int ekw = (k.kw - 1) * k.dilation + 1 ;
+    int out_h, out_w, pad_h = 0, pad_w = 0 ;
+    if (k.same) {
+        out_h = (k.in_h + k.stride - 1) / k.stride ;
+        out_w = (k.in_w + k.stride - 1) / k.stride ;
+        pad_h = std::max((out_h - 1) * k.stride + ekh - k.in_h, 0) ;
+        pad_w = std::max((out_w - 1) * k.stride + ekw - k.in_w, 0) ;
+    } else {
+        out_h = (k.in_h - ekh) / k.stride + 1 ;
+        out_w = (k.in_w - ekw) / k.stride + 1 ;
+    }
+
+    const bool nchw = k.data_format == FORMAT_NCHW ;
+    const int C = k.in_c, O = k.out_c, cpg = k.in_c_per_group ;
+    const int opg = O / (C / cpg) ;
+
+    auto in_at = [&](int n, int c, int h, int w) -> size_t {
+        return nchw ? ((size_t(n) * C + c) * k.in_h + h) * k.in_w + w
+                    : ((size_t(n) * k.in_h + h) * k.in_w + w) * C + c ;
+    };
+    auto out_at = [&](int n, int o, int h, int w) -> size_t {
+        return nchw ? ((size_t(n) * O + o) * out_h + h) * out_w + w
+                    : ((size_t(n) * out_h + h) * out_w + w) * O + o ;
+    };
+    auto filter_at = [&](int y, int x, int ci, int o) -> size_t {
+        return ((size_t(y) * k.kw + x) * cpg + ci) * O + o ;
+    };
+
+    const size_t nin = size_t(k.batch) * C * k.in_h * k.in_w ;
+    const size_t nout = size_t(k.batch) * O * out_h * out_w ;
+    const size_t nfilter = size_t(k.kh) * k.kw * cpg * O ;
+
+    std::vector<T> in(nin), filter(nfilter), out(nout), out_bp(nout) ;
+    std::vector<T> in_bp(nin), filter_bp(nfilter) ;
+    std::vector<T> ref_out(nout, T(0)), ref_in_bp(nin, T(0)), ref_filter_bp(nfilter, T(0)) ;
+
+    for (size_t i = 0; i < nin; ++i) in[i] = T(lrand48() % 17 - 8) / 8 ;
+    for (size_t i = 0; i < nfilter; ++i) filter[i] = T(lrand48() % 17 - 8) / 8 ;
+    for (size_t i = 0; i < nout; ++i) out_bp[i] = T(lrand48() % 17 - 8) / 8 ;
+
+    for (int n = 0; n < k.batch; ++n)
+    for (int o = 0; o < O; ++o)
+    for (int oh = 0; oh < out_h; ++oh)
+    for (int ow = 0; ow < out_w; ++ow)
+    for (int ci = 0; ci < cpg; ++ci)
+    for (int y = 0; y < k.kh; ++y)
+    for (int x = 0; x < k.kw; ++x) {
+        const int c = (o / opg) * cpg + ci ;
+        const int h = oh * k.stride + y * k.dilation - pad_h / 2 ;
+        const int w = ow * k.stride + x * k.dilation - pad_w / 2 ;
+        if (h < 0 || h >= k.in_h || w < 0 || w >= k.in_w)
+            continue ;
+        const size_t ii = in_at(n, c, h, w), oi = out_at(n, o, oh, ow) ;
+        const size_t fi = filter_at(y, x, ci, o) ;
+        ref_out[oi] += in[ii] * filter[fi] ;
+        ref_in_bp[ii] += out_bp[oi] * filter[fi] ;
+        ref_filter_bp[fi] += out_bp[oi] * in[ii] ;
+    }
+
+    TensorParam tin = { k.in_w, k.in_h, C, k.batch } ;
+    TensorParam tfilter = { k.kw, k.kh, cpg, O } ;
+    TensorParam tout = { out_w, out_h, O, k.batch } ;
+
+    GroupedConv g ;
+    bool flag = grouped_conv_param(g, tin, tfilter, tout, k.stride, k.stride,
+                                   k.dilation, k.dilation, pad_h, pad_w,
+                                   k.data_format) ;
+    if (flag) {
+        const int dtype = dtype_s<T>::type ;
+        int ret = grouped_conv2d(g, dtype, reinterpret_cast<uint64_t>(in.data()),
+                                 reinterpret_cast<uint64_t>(filter.data()),
+                                 reinterpret_cast<uint64_t>(out.data())) ;
+        ret |= grouped_conv2d_backprop_input(g, dtype, reinterpret_cast<uint64_t>(out_bp.data()),
+                                             reinterpret_cast<uint64_t>(filter.data()),
+                                             reinterpret_cast<uint64_t>(in_bp.data())) ;
+        ret |= grouped_conv2d_backprop_filter(g, dtype, reinterpret_cast<uint64_t>(in.data()),
+                                              reinterpret_cast<uint64_t>(out_bp.data()),
+                                              reinterpret_cast<uint64_t>(filter_bp.data())) ;
+        flag = ret == 0 ;
+    }
+
+    // inputs are multiples of 1/8, so every sum is exact
+    flag = flag && out == ref_out && in_bp == ref_in_bp && filter_bp == ref_filter_bp ;
+
+    if (param.verbose > 1 || (!flag && param.verbose > 0))
+        fprintf(stderr, "%s N=%d C=%d H=%d W=%d k=%dx%d cpg=%d O=%d s=%d d=%d %s\n",
+                nchw ? "NCHW" : "NHWC", k.batch, C, k.in_h, k.in_w, k.kh, k.kw,
+                cpg, O, k.stride, k.dilation, k.same ? "SAME" : "VALID") ;
+
+    return flag ;
+}
+
+template <typename T>
+bool test_cases(TestParam const& param, ConvCase const* cases, size_t n)
+{
+    bool flag = true ;
+    for (int f = 0; f < 2; ++f) {
+        for (size_t i = 0; i < n; ++i) {
+            ConvCase k = cases[i] ;
+            k.data_format = f == 0 ? FORMAT_NCHW : FORMAT_NHWC ;
+            flag &= test_conv<T>(param, k) ;
+        }
+    }
+    return flag ;
+}
+
+// batch, in_c, in_h, in_w, kh, kw, in_c_per_group, out_c, stride, dilation, same
+static const ConvCase depthwise_cases[] = {
+    { 2,  3,  9, 11, 3, 3, 1,  3, 1, 1, true  },
+    { 2,  4, 10,  9, 3, 3, 1,  8, 2, 1, true  },   // multiplier 2
+    { 1,  5, 12, 13, 3, 2, 1, 10, 1, 2, false },   // dilation
+    { 3,  6, 16, 16, 5, 5, 1,  6, 2, 1, false },
+    { 2, 32, 40, 40, 3, 3, 1, 64, 1, 1, true  },   // parallel
+    { 1,  3,  7,  7, 1, 1, 1,  6, 1, 1, false },
+};
+
+static const ConvCase grouped_cases[] = {
+    { 2,  8,  9, 10, 3, 3, 2,  4, 1, 1, true  },
+    { 2,  8, 12, 12, 3, 3, 4,  8, 2, 1, true  },
+    { 1,  6, 20, 20, 3, 3, 3, 12, 1, 2, false },
+    { 2, 16, 40, 40, 3, 3, 4, 32, 1, 1, true  },
+};
+
+#define NCASES(a) (sizeof(a) / sizeof(a[0]))
+
+bool test_depthwise_f32(TestParam const& param) { return test_cases<float>(param, depthwise_cases, NCASES(depthwise_cases)); }
+bool test_depthwise_f64(TestParam const& param) { return test_cases<double>(param, depthwise_cases, NCASES(depthwise_cases)); }
+bool test_grouped_f32(TestParam const& param) { return test_cases<float>(param, grouped_cases, NCASES(grouped_cases)); }
+bool test_grouped_f64(TestParam const& param) { return test_cases<double>(param, grouped_cases, NCASES(grouped_cases)); }
+
+struct Test
+{
+    std::string name;
+    bool (*func)(TestParam const&);
+};
+
+int main(int argc, char* argv[])
+{
+    Test tests[] = {
+        "depthwise_conv_f32", test_depthwise_f32,
+        "depthwise_conv_f64", test_depthwise_f64,
+        "grouped_conv_f32", test_grouped_f32,
+        "grouped_conv_f64", test_grouped_f64,
+    };
+
+    TestParam param;
+    param.verbose = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-v") == 0) {
+            ++param.verbose;
+        }
+    }
+
+    int ntests = sizeof(tests) / sizeof(Test);
+    int ok = 0;
+    for (size_t i = 0; i < ntests; ++i) {
+        bool flag = tests[i].func(param);
+        fprintf(stderr, "%-20s %s\n", tests[i].name.c_str(), flag ? "OK" : "NG");
+        if (flag)
+            ++ok;
+    }
+    fprintf(stderr, "%d tests failed\n", ntests - ok);
+    return ntests - ok;
+}
@@ -0,0 +1,108 @@
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include "../src/philox.h"
+
+// Checks src/philox.h against the philox4x32-10 known-answer vectors of
+// Random123 (kat_vectors), and the conversions of the random bits to
+// uniform floats. Builds on the host as well:
+//   g++ -O2 test/philox_test.cc
+
+struct TestParam
+{
+    int verbose;
+};
+
+struct Kat {
+    uint32_t ctr[4];
+    uint32_t key[2];
+    uint32_t expected[4];
+};
+
+static const Kat kats[] = {
+    { { 0x00000000, 0x00000000, 0x00000000, 0x00000000 },
+      { 0x00000000, 0x00000000 },
+      { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } },
+    { { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff },
+      { 0xffffffff, 0xffffffff },
+      { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } },
+    { { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 },
+      { 0xa4093822, 0x299f31d0 },
+      { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } },
+};
+
+bool test_philox4x32_10(TestParam const& param)
+{
+    bool flag = true;
+    for (size_t i = 0; i < sizeof(kats) / sizeof(kats[0]); ++i) {
+        const Kat& k = kats[i];
+        // the key is the seed, and the counter is (block, seed2)
+        const PhiloxKey key = philox_key(static_cast<uint64_t>(k.key[1]) << 32 | k.key[0]);
+        const uint64_t block = static_cast<uint64_t>(k.ctr[1]) << 32 | k.ctr[0];
+        const uint64_t seed2 = static_cast<uint64_t>(k.ctr[3]) << 32 | k.ctr[2];
+
+        uint32_t out[4];
+        philox4x32_10(key, block, seed2, out);
+
+        const bool ok = memcmp(out, k.expected, sizeof(out)) == 0;
+        if (param.verbose > 1 || (!ok && param.verbose > 0))
+            fprintf(stderr, "kat %lu: %08x %08x %08x %08x expected %08x %08x %08x %08x\n",
+                    i, out[0], out[1], out[2], out[3],
+                    k.expected[0], k.expected[1], k.expected[2], k.expected[3]);
+        flag &= ok;
+    }
+    return flag;
+}
+
+bool test_philox_to_float(TestParam const& param)
+{
+    const float f0 = philox_to_float(0);
+    const float f1 = philox_to_float(0xffffffffu);
+    const double d0 = philox_to_double(0, 0);
+    const double d1 = philox_to_double(0xffffffffu, 0xffffffffu);
+
+    bool flag = f0 == 0.f && f1 == 1.f - std::ldexp(1.f, -23)
+             && d0 == 0. && d1 == 1. - std::ldexp(1., -52);
+
+    if (param.verbose > 1 || (!flag && param.verbose > 0))
+        fprintf(stderr, "float [%.9g, %.9g] double [%.17g, %.17g]\n", f0, f1, d0, d1);
+    return flag;
+}
+
+struct Test
+{
+    std::string name;
+    bool (*func)(TestParam const&);
+};
+
+int main(int argc, char* argv[])
+{
+    Test tests[] = {
+        "philox4x32_10", test_philox4x32_10,
+        "philox_to_float", test_philox_to_float,
+    };
+
+    TestParam param;
+    param.verbose = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-v") == 0) {
+            ++param.verbose;
+        }
+    }
+
+    int ntests = sizeof(tests) / sizeof(Test);
+    int ok = 0;
+    for (size_t i = 0; i < ntests; ++i) {
+        bool flag = tests[i].func(param);
+        fprintf(stderr, "%-20s %s\n", tests[i].name.c_str(), flag ? "OK" : "NG");
+        if (flag)
+            ++ok;
+    }
+    fprintf(stderr, "%d tests failed\n", ntests - ok);
+    return ntests - ok;
+}
@@ -4,6 +4,8 @@
 #include <cstdio>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
 
 // copy from src/binary_ops.cc
 struct _Tensor {
@@ -35,6 +37,14 @@ struct BinaryOpArgs {
 
 template<typename T> struct dypte_s {};
 template<> struct dypte_s<float> { static const int type = 1; };
+template<> struct dypte_s<double> { static const int type = 2; };
+template<> struct dypte_s<int32_t> { static const int type = 3; };
+template<> struct dypte_s<int64_t> { static const int type = 9; };
+template<> struct dypte_s<bool> { static const int type = 10; };
+template<> struct dypte_s<uint16_t> { static const int type = 17; };
+
+#define DT_BFLOAT16 14
+#define DT_HALF     19
 
 template <typename T>
 _Tensor makeTensor(size_t dims, std::vector<size_t> const& dim_size)
@@ -140,8 +150,43 @@ extern "C" {
     int op_Sub(const void* args, size_t len);
     int op_Mul(const void* args, size_t len);
     int op_SquaredDifference(const void* args, size_t len);
+    int op_Equal(const void* args, size_t len);
+    int op_NotEqual(const void* args, size_t len);
+    int op_Less(const void* args, size_t len);
+    int op_LessEqual(const void* args, size_t len);
+    int op_Greater(const void* args, size_t len);
+    int op_GreaterEqual(const void* args, size_t len);
+    int op_LogicalAnd(const void* args, size_t len);
+    int op_LogicalOr(const void* args, size_t len);
+    int op_FloorDiv(const void* args, size_t len);
+    int op_FloorMod(const void* args, size_t len);
+    int op_BitwiseAnd(const void* args, size_t len);
+    int op_RightShift(const void* args, size_t len);
+    int op_Concat(const void* args, size_t len);
+    int op_LogicalNot(const void* args, size_t len);
+    int op_Select(const void* args, size_t len);
+    int op_SelectV2(const void* args, size_t len);
 }
 
+// arguments of the VEOpArgs kernels: the number of variables, then the size
+// and bytes of each
+class OpArgs {
+    public:
+        OpArgs() : buf_(sizeof(int64_t), 0) {}
+        template<typename T> void add(T const& v) {
+            size_t off = buf_.size();
+            buf_.resize(off + sizeof(size_t) + sizeof(T));
+            size_t size = sizeof(T);
+            memcpy(&buf_[off], &size, sizeof(size_t));
+            memcpy(&buf_[off + sizeof(size_t)], &v, sizeof(T));
+            ++*reinterpret_cast<int64_t*>(&buf_[0]);
+        }
+        const void* data() const { return buf_.data(); }
+        size_t size() const { return buf_.size(); }
+    private:
+        std::vector<char> buf_;
+};
+
 template<typename T>
 bool test_BinaryOp(TestParam const& param,
                    Tensor<T>& out, Tensor<T> const& in0, Tensor<T> const& in1, Tensor<T> const& exp,
@@ -171,9 +216,9 @@ bool test_BinaryOp(TestParam const& param,
     return flag;
 }
 
-template <typename T, typename F>
-int ref_Binop(Tensor<T>& X, Tensor<T> const& Y, Tensor<T> const& Z, F op,
-        T* pX, T const* pY, T const* pZ, int dim)
+template <typename Tout, typename T, typename F>
+int ref_Binop(Tensor<Tout>& X, Tensor<T> const& Y, Tensor<T> const& Z, F op,
+        Tout* pX, T const* pY, T const* pZ, int dim)
 {
   //fprintf(stderr, "%s: dim=%d X.stride[%d]=%d\n", __FUNCTION__, dim, dim, X.stride(dim));
   if (dim + 1 == X.dims()) {
@@ -189,7 +234,7 @@ int ref_Binop(Tensor<T>& X, Tensor<T> const& Y, Tensor<T> const& Z, F op,
       fprintf(stderr, "%s: dim=%d X.dim_size[%d]=%d i=%d %d %d\n",
               __FUNCTION__, dim, dim, X.dim_size(dim), i, Y.dim_size(dim), Y.stride(dim));
 #endif
-      T* pX0 = pX + i * X.stride(dim);
+      Tout* pX0 = pX + i * X.stride(dim);
       T const* pY0 = pY + (i % Y.dim_size(dim)) * Y.stride(dim);
       T const* pZ0 = pZ + (i % Z.dim_size(dim)) * Z.stride(dim);
       ref_Binop(X, Y, Z, op, pX0, pY0, pZ0, dim + 1);
@@ -198,8 +243,8 @@ int ref_Binop(Tensor<T>& X, Tensor<T> const& Y, Tensor<T> const& Z, F op,
   return 0;
 }
 
-template <typename T, typename F>
-int ref_Binop(Tensor<T>& X, Tensor<T> const& Y, Tensor<T> const& Z, F op)
+template <typename Tout, typename T, typename F>
+int ref_Binop(Tensor<Tout>& X, Tensor<T> const& Y, Tensor<T> const& Z, F op)
 {
   return ref_Binop(X, Y, Z, op, X.data(), Y.data(), Z.data(), 0);
 }
@@ -593,6 +638,404 @@ bool test_SquaredDifference_05(TestParam const& param)
 }
 
 
+// binary ops with broadcasting: in0 and in1 are filled by gen0 and gen1,
+// out of type Tout is checked against ref_Binop with op
+template<typename Tout, typename T, typename G0, typename G1, typename F>
+bool test_ElementwiseOp(TestParam const& param,
+                        std::vector<size_t> const& s0,
+                        std::vector<size_t> const& s1,
+                        std::vector<size_t> const& so,
+                        G0 gen0, G1 gen1, F op,
+                        int (*kernel)(const void* args, size_t len),
+                        int in_dtype = 0)
+{
+    Tensor<T> in0(s0);
+    Tensor<T> in1(s1);
+    Tensor<Tout> out(so);
+    Tensor<Tout> exp(so);
+
+    for (size_t i = 0; i < in0.nelems(); ++i)
+      in0.data()[i] = gen0();
+    for (size_t i = 0; i < in1.nelems(); ++i)
+      in1.data()[i] = gen1();
+    for (size_t i = 0; i < out.nelems(); ++i)
+      out.data()[i] = Tout();
+
+    ref_Binop(exp, in0, in1, op);
+
+    BinaryOpArgs args;
+    args.out = out.tensor();
+    args.in0 = in0.tensor();
+    args.in1 = in1.tensor();
+    if (in_dtype != 0)          // T only holds the bits
+      args.in0.dtype = args.in1.dtype = in_dtype;
+    int ret = kernel(&args, sizeof(args));
+
+    bool flag = ret == 0 && checkTensor(out, exp);
+
+    if (param.verbose > 1 || (!flag && param.verbose > 0)) {
+      size_t nerr = 0;
+      for (size_t i = 0; i < out.nelems(); ++i)
+        nerr += out.data()[i] != exp.data()[i];
+      fprintf(stderr, "ret=%d %lu of %lu elements differ\n", ret, nerr, out.nelems());
+    }
+
+    return flag;
+}
+
+// comparison and logical ops: T inputs, bool output. Few distinct values,
+// so that equal elements are common.
+template<typename T, typename F>
+bool test_CompareOp(TestParam const& param,
+                    std::vector<size_t> const& s0,
+                    std::vector<size_t> const& s1,
+                    std::vector<size_t> const& so,
+                    F op, int (*kernel)(const void* args, size_t len))
+{
+    auto gen = []() { return (T)(lrand48() % 3); };
+    return test_ElementwiseOp<bool, T>(param, s0, s1, so, gen, gen,
+            [op](T y, T z) -> bool { return op(y, z); }, kernel);
+}
+
+bool test_Equal_01(TestParam const& param)
+{
+  return test_CompareOp<float>(param, {8, 16, 32}, {8, 1, 32}, {8, 16, 32},
+          [](float a, float b) { return a == b; }, op_Equal);
+}
+
+bool test_NotEqual_01(TestParam const& param)
+{
+  return test_CompareOp<int32_t>(param, {1, 1, 1}, {4, 5, 6}, {4, 5, 6},
+          [](int32_t a, int32_t b) { return a != b; }, op_NotEqual);
+}
+
+bool test_Less_01(TestParam const& param)
+{
+  return test_CompareOp<float>(param, {4, 1, 6}, {1, 5, 6}, {4, 5, 6},
+          [](float a, float b) { return a < b; }, op_Less);
+}
+
+bool test_LessEqual_01(TestParam const& param)
+{
+  return test_CompareOp<int64_t>(param, {64, 128}, {64, 128}, {64, 128},
+          [](int64_t a, int64_t b) { return a <= b; }, op_LessEqual);
+}
+
+bool test_Greater_01(TestParam const& param)
+{
+  return test_CompareOp<double>(param, {16, 1, 8, 1}, {1, 32, 1, 4}, {16, 32, 8, 4},
+          [](double a, double b) { return a > b; }, op_Greater);
+}
+
+bool test_GreaterEqual_01(TestParam const& param)
+{
+  return test_CompareOp<float>(param, {8, 16, 32}, {1, 1, 1}, {8, 16, 32},
+          [](float a, float b) { return a >= b; }, op_GreaterEqual);
+}
+
+bool test_GreaterEqual_02(TestParam const& param)
+{
+  return test_CompareOp<float>(param, {8, 16, 32}, {8, 16, 1}, {8, 16, 32},
+          [](float a, float b) { return a >= b; }, op_GreaterEqual);
+}
+
+bool test_LogicalAnd_01(TestParam const& param)
+{
+  return test_CompareOp<bool>(param, {32, 64}, {1, 64}, {32, 64},
+          [](bool a, bool b) { return a && b; }, op_LogicalAnd);
+}
+
+bool test_LogicalOr_01(TestParam const& param)
+{
+  return test_CompareOp<bool>(param, {32, 1}, {32, 64}, {32, 64},
+          [](bool a, bool b) { return a || b; }, op_LogicalOr);
+}
+
+// half and bfloat16 are compared as float. bits[i] holds value[i]: zeros of
+// both signs, +-1, 1.5, the smallest subnormal, inf and NaN.
+template<typename F>
+bool test_Compare16(TestParam const& param, int dtype, F op,
+                    int (*kernel)(const void* args, size_t len))
+{
+  static const uint16_t half_bits[] = {
+    0x0000, 0x8000, 0x3c00, 0xbc00, 0x3e00, 0x0001, 0x7c00, 0x7e00 };
+  static const float half_value[] = {
+    0.f, -0.f, 1.f, -1.f, 1.5f, 5.9604644775390625e-8f, INFINITY, NAN };
+  static const uint16_t bf16_bits[] = {
+    0x0000, 0x8000, 0x3f80, 0xbf80, 0x3fc0, 0x0001, 0x7f80, 0x7fc0 };
+  static const float bf16_value[] = {
+    0.f, -0.f, 1.f, -1.f, 1.5f, 9.18354961579912e-41f, INFINITY, NAN };
+
+  const uint16_t* bits = dtype == DT_HALF ? half_bits : bf16_bits;
+  const float* value = dtype == DT_HALF ? half_value : bf16_value;
+  auto to_float = [bits, value](uint16_t v) {
+    int i = 0;
+    while (bits[i] != v) ++i;
+    return value[i];
+  };
+
+  auto gen = [bits]() { return bits[lrand48() % 8]; };
+  return test_ElementwiseOp<bool, uint16_t>(param, {16, 8}, {1, 8}, {16, 8}, gen, gen,
+          [op, to_float](uint16_t a, uint16_t b) -> bool {
+            return op(to_float(a), to_float(b)); },
+          kernel, dtype);
+}
+
+bool test_Equal_02(TestParam const& param)
+{
+  return test_Compare16(param, DT_HALF,
+          [](float a, float b) { return a == b; }, op_Equal);
+}
+
+bool test_Less_02(TestParam const& param)
+{
+  return test_Compare16(param, DT_BFLOAT16,
+          [](float a, float b) { return a < b; }, op_Less);
+}
+
+// LogicalNot
+bool test_LogicalNot_01(TestParam const& param)
+{
+  struct Args {
+    _Tensor in;
+    _Tensor out;
+  } args;
+
+  Tensor<bool> in({64, 1000});
+  Tensor<bool> out({64, 1000});
+  Tensor<bool> exp({64, 1000});
+
+  for (size_t i = 0; i < in.nelems(); ++i) {
+    in.data()[i] = lrand48() % 2;
+    out.data()[i] = false;
+    exp.data()[i] = !in.data()[i];
+  }
+
+  args.in = in.tensor();
+  args.out = out.tensor();
+  int ret = op_LogicalNot(&args, sizeof(args));
+
+  bool flag = ret == 0 && checkTensor(out, exp);
+  if (param.verbose > 1 || (!flag && param.verbose > 0))
+    fprintf(stderr, "ret=%d\n", ret);
+
+  return flag;
+}
+
+// Select and SelectV2: out = cond ? then : else. SelectV2 broadcasts all
+// three inputs. Select takes a cond of the same shape as then and else, or
+// a vector that selects whole rows.
+
+// the Tensor of the VEOpArgs kernels (ve_ops_common.h)
+struct VETensor {
+    int32_t dtype;
+    uint64_t addr;
+    int32_t dims;
+    int64_t nelems;
+    int64_t dim_size[8];
+} __attribute__((__packed__));
+
+template<typename T>
+VETensor makeVETensor(Tensor<T> const& t)
+{
+    _Tensor s = t.tensor();
+    VETensor v;
+    v.dtype = s.dtype;
+    v.addr = s.addr;
+    v.dims = s.dims;
+    v.nelems = s.nelems;
+    for (int i = 0; i < 8; ++i)
+      v.dim_size[i] = i < s.dims ? s.dim_size[i] : 0;
+    return v;
+}
+
+template<typename T>
+bool test_Select(TestParam const& param,
+                 std::vector<size_t> const& sc,
+                 std::vector<size_t> const& st,
+                 std::vector<size_t> const& se,
+                 std::vector<size_t> const& so,
+                 int (*kernel)(const void* args, size_t len))
+{
+    Tensor<bool> cond(sc);
+    Tensor<T> then_(st);
+    Tensor<T> else_(se);
+    Tensor<T> out(so);
+    Tensor<T> exp(so);
+
+    for (size_t i = 0; i < cond.nelems(); ++i)
+      cond.data()[i] = lrand48() % 2;
+    for (size_t i = 0; i < then_.nelems(); ++i)
+      then_.data()[i] = (T)(lrand48() % 1000);
+    for (size_t i = 0; i < else_.nelems(); ++i)
+      else_.data()[i] = (T)(-(lrand48() % 1000));
+    for (size_t i = 0; i < out.nelems(); ++i)
+      out.data()[i] = T(0);
+
+    // coordinates of element i of out, broadcast to each input by the
+    // trailing dims (a Select vector cond by the leading dim)
+    const size_t dims = so.size();
+    std::vector<size_t> c(dims);
+    auto at = [&c, dims](std::vector<size_t> const& s, bool leading) {
+      if (leading)
+        return c[0];
+      size_t off = 0;
+      for (size_t d = 0; d < s.size(); ++d) {
+        size_t k = c[dims - s.size() + d];
+        off = off * s[d] + (s[d] == 1 ? 0 : k);
+      }
+      return off;
+    };
+    const bool row_cond = kernel == op_Select && sc.size() == 1 && dims > 1;
+    for (size_t i = 0; i < out.nelems(); ++i) {
+      size_t k = i;
+      for (size_t d = dims; d-- > 0; ) {
+        c[d] = k % so[d];
+        k /= so[d];
+      }
+      exp.data()[i] = cond.data()[at(sc, row_cond)] ? then_.data()[at(st, false)]
+                                                    : else_.data()[at(se, false)];
+    }
+
+    OpArgs args;
+    args.add(makeVETensor(cond));
+    args.add(makeVETensor(then_));
+    args.add(makeVETensor(else_));
+    args.add(makeVETensor(out));
+    int ret = kernel(args.data(), args.size());
+
+    bool flag = ret == 0 && checkTensor(out, exp);
+    if (param.verbose > 1 || (!flag && param.verbose > 0))
+        fprintf(stderr, "ret=%d\n", ret);
+
+    return flag;
+}
+
+bool test_Select_01(TestParam const& param)
+{
+  return test_Select<double>(param, {48}, {48, 100}, {48, 100}, {48, 100}, op_Select);
+}
+
+bool test_Select_02(TestParam const& param)
+{
+  return test_Select<float>(param, {8, 16, 32}, {8, 16, 32}, {8, 16, 32}, {8, 16, 32}, op_Select);
+}
+
+bool test_SelectV2_01(TestParam const& param)
+{
+  return test_Select<float>(param, {4, 1, 8}, {1, 5, 8}, {4, 5, 1}, {4, 5, 8}, op_SelectV2);
+}
+
+bool test_SelectV2_02(TestParam const& param)
+{
+  return test_Select<int32_t>(param, {1}, {64, 300}, {300}, {64, 300}, op_SelectV2);
+}
+
+
+// integer ops: in1 is kept nonzero for the division ops
+template<typename T, typename F>
+bool test_IntegerOp(TestParam const& param,
+                    std::vector<size_t> const& s0,
+                    std::vector<size_t> const& s1,
+                    std::vector<size_t> const& so,
+                    F op, int (*kernel)(const void* args, size_t len))
+{
+    return test_ElementwiseOp<T, T>(param, s0, s1, so,
+            []() { return (T)(lrand48() % 2001 - 1000); },
+            []() { return (T)(lrand48() % 2 ? lrand48() % 30 + 1 : -(lrand48() % 30 + 1)); },
+            op, kernel);
+}
+
+bool test_FloorDiv_01(TestParam const& param)
+{
+  return test_IntegerOp<int32_t>(param, {16, 64}, {1, 64}, {16, 64},
+          [](int32_t a, int32_t b) -> int32_t {
+            int32_t q = a / b;
+            return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q; },
+          op_FloorDiv);
+}
+
+bool test_FloorMod_01(TestParam const& param)
+{
+  return test_IntegerOp<int64_t>(param, {8, 32, 4}, {8, 1, 4}, {8, 32, 4},
+          [](int64_t a, int64_t b) -> int64_t {
+            int64_t r = a % b;
+            return (r != 0 && ((r < 0) != (b < 0))) ? r + b : r; },
+          op_FloorMod);
+}
+
+bool test_BitwiseAnd_01(TestParam const& param)
+{
+  return test_IntegerOp<int64_t>(param, {32, 64}, {32, 64}, {32, 64},
+          [](int64_t a, int64_t b) -> int64_t { return a & b; }, op_BitwiseAnd);
+}
+
+bool test_RightShift_01(TestParam const& param)
+{
+  // shift amounts from -8 to 63: negative ones are clamped to 0, and 31
+  // or more to 31
+  return test_ElementwiseOp<int32_t, int32_t>(param, {64, 16}, {1, 16}, {64, 16},
+          []() { return (int32_t)(lrand48() % 2001 - 1000) * 1000003; },
+          []() { return (int32_t)(lrand48() % 72 - 8); },
+          [](int32_t a, int32_t b) -> int32_t {
+            return a >> (b < 0 ? 0 : b > 31 ? 31 : b); },
+          op_RightShift);
+}
+
+
+// Concat of [dim0, dim1s[j]] inputs, empty ones included
+bool test_Concat(TestParam const& param, size_t dim0,
+                 std::vector<size_t> const& dim1s)
+{
+    size_t dim1 = 0;
+    for (size_t j = 0; j < dim1s.size(); ++j)
+        dim1 += dim1s[j];
+
+    std::vector<std::vector<float> > ins(dim1s.size());
+    std::vector<float> out(dim0 * dim1, -1.0f);
+    std::vector<float> exp(dim0 * dim1);
+
+    OpArgs args;
+    args.add<int64_t>(dypte_s<float>::type);
+    args.add<uint64_t>(dim1s.size());
+    args.add<uint64_t>(dim0);
+    args.add<uint64_t>(dim1);
+    args.add<uint64_t>(reinterpret_cast<uint64_t>(out.data()));
+
+    size_t offset = 0;
+    for (size_t j = 0; j < dim1s.size(); ++j) {
+        ins[j].resize(dim0 * dim1s[j] + 1);   // not empty for data()
+        for (size_t i = 0; i < dim0; ++i) {
+            for (size_t k = 0; k < dim1s[j]; ++k) {
+                ins[j][i * dim1s[j] + k] = (float)(j * 1000 + i * 7 + k);
+                exp[i * dim1 + offset + k] = ins[j][i * dim1s[j] + k];
+            }
+        }
+        offset += dim1s[j];
+        args.add<uint64_t>(reinterpret_cast<uint64_t>(ins[j].data()));
+        args.add<uint64_t>(dim1s[j]);
+    }
+
+    int ret = op_Concat(args.data(), args.size());
+
+    bool flag = ret == 0 && out == exp;
+    if (param.verbose > 1 || (!flag && param.verbose > 0))
+        fprintf(stderr, "ret=%d\n", ret);
+
+    return flag;
+}
+
+bool test_Concat_01(TestParam const& param)
+{
+  return test_Concat(param, 1, {100000, 0});
+}
+
+bool test_Concat_02(TestParam const& param)
+{
+  return test_Concat(param, 4, {0, 30000, 0, 17, 50000});
+}
+
+
 struct Test
 {
     std::string name;
@@ -629,6 +1072,31 @@ int main(int argc, char* argv[])
         "op_Mul_12", test_Mul_12,
 
         "op_SquaredDifference_05", test_SquaredDifference_05,
+
+        "op_Equal_01", test_Equal_01,
+        "op_NotEqual_01", test_NotEqual_01,
+        "op_Less_01", test_Less_01,
+        "op_LessEqual_01", test_LessEqual_01,
+        "op_Greater_01", test_Greater_01,
+        "op_GreaterEqual_01", test_GreaterEqual_01,
+        "op_GreaterEqual_02", test_GreaterEqual_02,
+        "op_LogicalAnd_01", test_LogicalAnd_01,
+        "op_LogicalOr_01", test_LogicalOr_01,
+        "op_Equal_02", test_Equal_02,
+        "op_Less_02", test_Less_02,
+        "op_LogicalNot_01", test_LogicalNot_01,
+        "op_Select_01", test_Select_01,
+        "op_Select_02", test_Select_02,
+        "op_SelectV2_01", test_SelectV2_01,
+        "op_SelectV2_02", test_SelectV2_02,
+
+        "op_FloorDiv_01", test_FloorDiv_01,
+        "op_FloorMod_01", test_FloorMod_01,
+        "op_BitwiseAnd_01", test_BitwiseAnd_01,
+        "op_RightShift_01", test_RightShift_01,
+
+        "op_Concat_01", test_Concat_01,
+        "op_Concat_02", test_Concat_02,
     };
 
     TestParam param;
@@ -0,0 +1,176 @@
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "../src/vmath.h"
+
+// Checks src/vmath.h against libm. The error is measured in ulps of the
+// result against a long double reference. Builds on the host as well:
+//   g++ -O2 test/vmath_test.cc
+
+struct TestParam
+{
+    int verbose;
+};
+
+template <typename T> struct Ulp {};
+template <> struct Ulp<float> {
+    static long double ulp(long double y) {
+        int e;
+        frexpl(y, &e);
+        return ldexpl(1.0L, std::max(e, -125) - 24);
+    }
+};
+template <> struct Ulp<double> {
+    static long double ulp(long double y) {
+        int e;
+        frexpl(y, &e);
+        return ldexpl(1.0L, std::max(e, -1021) - 53);
+    }
+};
+
+// error of y in ulps of ref. Special values must match exactly.
+template <typename T>
+long double ulp_error(T y, long double ref)
+{
+    if (std::isnan(ref))
+        return std::isnan(y) ? 0 : 1e30;
+    if (std::isinf(static_cast<T>(ref)) || std::isinf(y))
+        return y == static_cast<T>(ref) ? 0 : 1e30;
+    if (ref == 0)
+        return y == 0 ? 0 : std::fabs(y) / Ulp<T>::ulp(std::numeric_limits<T>::denorm_min());
+    return fabsl(y - ref) / Ulp<T>::ulp(ref);
+}
+
+template <typename T>
+T from_bits(uint64_t u)
+{
+    T v;
+    if (sizeof(T) == 4) {
+        uint32_t u32 = static_cast<uint32_t>(u);
+        memcpy(&v, &u32, 4);
+    } else {
+        memcpy(&v, &u, 8);
+    }
+    return v;
+}
+
+// inputs: a sweep over [lo, hi], random bit patterns and special values
+template <typename T, typename F, typename R>
+bool check(TestParam const& param, const char* name,
+           F func, R ref, T lo, T hi, long double max_ulp)
+{
+    const int n = 1000000;
+    long double worst = 0;
+    T worst_x = 0;
+
+    srand(1);
+    for (int i = 0; i < 2 * n + 16; ++i) {
+        T x;
+        if (i < n) {
+            x = lo + (hi - lo) * static_cast<T>(i) / n;
+        } else if (i < 2 * n) {
+            uint64_t u = (static_cast<uint64_t>(rand()) << 33)
+                ^ (static_cast<uint64_t>(rand()) << 11) ^ rand();
+            if (sizeof(T) == 4) u >>= 32;
+            x = from_bits<T>(u);
+        } else {
+            const T special[] = {
+                T(0.), -T(0.), T(1.), -T(1.),
+                std::numeric_limits<T>::infinity(),
+                -std::numeric_limits<T>::infinity(),
+                std::numeric_limits<T>::quiet_NaN(),
+                std::numeric_limits<T>::min(),
+                std::numeric_limits<T>::denorm_min(),
+                -std::numeric_limits<T>::denorm_min(),
+                std::numeric_limits<T>::max(),
+                -std::numeric_limits<T>::max(),
+                std::numeric_limits<T>::min() / T(3.),
+                T(1e-8), T(-1e-8), T(0.5),
+            };
+            x = special[i - 2 * n];
+        }
+        long double e = ulp_error(func(x), ref(static_cast<long double>(x)));
+        if (e > worst) {
+            worst = e;
+            worst_x = x;
+        }
+    }
+
+    if (param.verbose)
+        fprintf(stderr, "%-24s max %.3Lf ulp at %.9g\n", name, worst,
+                static_cast<double>(worst_x));
+    return worst <= max_ulp;
+}
+
+static long double ref_exp(long double x) { return expl(x); }
+static long double ref_log(long double x) { return logl(x); }
+static long double ref_tanh(long double x) { return tanhl(x); }
+static long double ref_sigmoid(long double x) { return 1.0L / (1.0L + expl(-x)); }
+
+template <typename T, typename M>
+bool test_tier(TestParam const& param, const char* tier, long double max_ulp)
+{
+    std::string p = std::string(tier) + (sizeof(T) == 4 ? " f32 " : " f64 ");
+    const T emax = sizeof(T) == 4 ? T(89.) : T(710.);
+    const T emin = sizeof(T) == 4 ? T(-104.) : T(-746.);
+
+    bool flag = true;
+    flag &= check<T>(param, (p + "exp").c_str(), M::template exp<T>, ref_exp,
+                     emin, emax, max_ulp);
+    flag &= check<T>(param, (p + "log").c_str(), M::template log<T>, ref_log,
+                     T(0.), T(10.), max_ulp);
+    flag &= check<T>(param, (p + "tanh").c_str(), M::template tanh<T>, ref_tanh,
+                     T(-20.), T(20.), max_ulp);
+    flag &= check<T>(param, (p + "sigmoid").c_str(), M::template sigmoid<T>,
+                     ref_sigmoid, T(-30.), T(30.), max_ulp);
+    return flag;
+}
+
+// The accurate tier is within 1 ulp for float. Double tanh is libm's
+// (glibc is within 2 ulp) and double sigmoid adds the rounding of its
+// formula, see src/vmath.h.
+bool test_accurate_f32(TestParam const& param) { return test_tier<float, VMathAccurate>(param, "accurate", 1); }
+bool test_accurate_f64(TestParam const& param) { return test_tier<double, VMathAccurate>(param, "accurate", 3); }
+bool test_fast_f32(TestParam const& param) { return test_tier<float, VMathFast>(param, "fast", 4); }
+bool test_fast_f64(TestParam const& param) { return test_tier<double, VMathFast>(param, "fast", 4); }
+
+struct Test
+{
+    std::string name;
+    bool (*func)(TestParam const&);
+};
+
+int main(int argc, char* argv[])
+{
+    Test tests[] = {
+        "vmath_accurate_f32", test_accurate_f32,
+        "vmath_accurate_f64", test_accurate_f64,
+        "vmath_fast_f32", test_fast_f32,
+        "vmath_fast_f64", test_fast_f64,
+    };
+
+    TestParam param;
+    param.verbose = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-v") == 0) {
+            ++param.verbose;
+        }
+    }
+
+    int ntests = sizeof(tests) / sizeof(Test);
+    int ok = 0;
+    for (size_t i = 0; i < ntests; ++i) {
+        bool flag = tests[i].func(param);
+        fprintf(stderr, "%-20s %s\n", tests[i].name.c_str(), flag ? "OK" : "NG");
+        if (flag)
+            ++ok;
+    }
+    fprintf(stderr, "%d tests failed\n", ntests - ok);
+    return ntests - ok;
+}